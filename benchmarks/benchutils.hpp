@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file benchutils.hpp
+ * @author Evan Stoddard
+ * @brief Helpers shared by benchmarks
+ */
+
+#ifndef BENCHUTILS_H_
+#define BENCHUTILS_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+namespace ThreadUtilsBench
+{
+	/// @brief Clock used to time tasks
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * @brief Register thread counts 1, 2, 4 ... up to hardware concurrency (min 4)
+	 *
+	 * @param b Benchmark to register arguments for
+	 */
+	inline void threadCounts(benchmark::internal::Benchmark *b)
+	{
+		unsigned int maxThreads = std::max(4u, std::thread::hardware_concurrency());
+		for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			b->Arg(threads);
+		}
+	}
+
+	/**
+	 * @brief Busy wait for duration, standing in for a CPU bound task
+	 *
+	 * @param duration Time to spin for
+	 */
+	inline void spinFor(std::chrono::nanoseconds duration)
+	{
+		Clock::time_point end = Clock::now() + duration;
+		while (Clock::now() < end)
+		{
+		}
+	}
+
+	/**
+	 * @brief Counts down completed tasks so benchmark thread can wait for a batch
+	 *
+	 */
+	class CompletionCounter
+	{
+	public:
+		CompletionCounter() : _remaining(0) {}
+
+		/**
+		 * @brief Expect count more completions
+		 *
+		 */
+		void reset(int64_t count) { _remaining.store(count, std::memory_order_relaxed); }
+
+		/**
+		 * @brief Record a completion
+		 *
+		 */
+		void done() { _remaining.fetch_sub(1, std::memory_order_release); }
+
+		/**
+		 * @brief Wait for all expected completions
+		 *
+		 */
+		void wait()
+		{
+			while (_remaining.load(std::memory_order_acquire) > 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+
+	private:
+		/// @brief Completions still expected
+		std::atomic<int64_t> _remaining;
+	};
+
+	/**
+	 * @brief Report latency percentiles (in microseconds) as benchmark counters
+	 *
+	 * @param state Benchmark state
+	 * @param latencies Latency samples in nanoseconds (sorted in place)
+	 */
+	inline void reportPercentiles(benchmark::State &state, std::vector<int64_t> &latencies)
+	{
+		if (latencies.empty())
+		{
+			return;
+		}
+
+		std::sort(latencies.begin(), latencies.end());
+
+		auto percentile = [&latencies](double p) {
+			size_t index = (size_t)(p * (latencies.size() - 1));
+			return latencies[index] / 1000.0;
+		};
+
+		state.counters["p50_us"] = percentile(0.50);
+		state.counters["p90_us"] = percentile(0.90);
+		state.counters["p99_us"] = percentile(0.99);
+		state.counters["p999_us"] = percentile(0.999);
+		state.counters["max_us"] = latencies.back() / 1000.0;
+	}
+};
+
+#endif /* BENCHUTILS_H_ */
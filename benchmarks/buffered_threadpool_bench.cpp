@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file buffered_threadpool_bench.cpp
+ * @author Evan Stoddard
+ * @brief BufferedThreadpool benchmarks
+ */
+
+#include "benchutils.hpp"
+#include "bufferedthreadpool.hpp"
+
+using namespace ThreadUtilsBench;
+using ThreadUtils::BufferedThreadpool;
+
+/// @brief Tasks fed per iteration
+static const int64_t BatchSize = 10000;
+
+/**
+ * @brief Throughput of tasks that only push their index to the output buffer
+ *
+ * @param state Benchmark state (thread count)
+ */
+static void BM_BufferedThreadpool_EmptyTasks(benchmark::State &state)
+{
+	BufferedThreadpool<int64_t> pool((uint32_t)state.range(0));
+	pool.start();
+
+	for (auto _ : state)
+	{
+		for (int64_t i = 0; i < BatchSize; i++)
+		{
+			pool.feedQueue([&pool, i]() { pool.feedOutputQueue(i); });
+		}
+
+		int64_t sum = 0;
+		for (int64_t i = 0; i < BatchSize; i++)
+		{
+			sum += pool.fetchFromBuffer();
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * BatchSize);
+}
+BENCHMARK(BM_BufferedThreadpool_EmptyTasks)->Apply(threadCounts)->UseRealTime();
+
+/**
+ * @brief Register thread counts with deque (0) and ring output buffers
+ *
+ */
+static void pipelineArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"threads", "ring"});
+
+	unsigned int maxThreads = std::max(4u, std::thread::hardware_concurrency());
+	for (int64_t ring : {0, 4096})
+	{
+		for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			b->Args({(int64_t)threads, ring});
+		}
+	}
+}
+
+/**
+ * @brief Producer/consumer pipeline throughput
+ *
+ * A producer thread feeds tasks, workers push a result each and the
+ * benchmark thread consumes them.
+ *
+ * @param state Benchmark state (thread count, output ring capacity)
+ */
+static void BM_BufferedThreadpool_Pipeline(benchmark::State &state)
+{
+	BufferedThreadpool<int64_t> pool((uint32_t)state.range(0), (size_t)state.range(1));
+	pool.start();
+
+	for (auto _ : state)
+	{
+		std::thread producer([&pool]() {
+			for (int64_t i = 0; i < BatchSize; i++)
+			{
+				pool.feedQueue([&pool, i]() { pool.feedOutputQueue(i); });
+			}
+		});
+
+		int64_t sum = 0;
+		for (int64_t i = 0; i < BatchSize; i++)
+		{
+			sum += pool.fetchFromBuffer();
+		}
+		benchmark::DoNotOptimize(sum);
+
+		producer.join();
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * BatchSize);
+}
+BENCHMARK(BM_BufferedThreadpool_Pipeline)->Apply(pipelineArgs)->UseRealTime();
+
+/**
+ * @brief Feed to fetch latency percentiles of single items through an idle pool
+ *
+ * @param state Benchmark state (thread count)
+ */
+static void BM_BufferedThreadpool_Latency(benchmark::State &state)
+{
+	BufferedThreadpool<Clock::time_point> pool((uint32_t)state.range(0));
+	pool.start();
+
+	std::vector<int64_t> latencies;
+
+	for (auto _ : state)
+	{
+		Clock::time_point fed = Clock::now();
+		pool.feedQueue([&pool, fed]() { pool.feedOutputQueue(fed); });
+
+		Clock::time_point out = pool.fetchFromBuffer();
+		latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - out).count());
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations());
+	reportPercentiles(state, latencies);
+}
+BENCHMARK(BM_BufferedThreadpool_Latency)->Apply(threadCounts)->UseRealTime();
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file ordered_buffered_threadpool_bench.cpp
+ * @author Evan Stoddard
+ * @brief OrderedBufferedThreadpool benchmarks
+ */
+
+#include "benchutils.hpp"
+#include "orderedbufferedthreadpool.hpp"
+
+using namespace ThreadUtilsBench;
+using ThreadUtils::OrderedBufferedThreadpool;
+
+/// @brief Tasks fed per iteration
+static const int64_t BatchSize = 10000;
+
+/**
+ * @brief Ordered output throughput of tasks that do no work
+ *
+ * @param state Benchmark state (thread count)
+ */
+static void BM_OrderedBufferedThreadpool_EmptyTasks(benchmark::State &state)
+{
+	OrderedBufferedThreadpool<int64_t, int64_t> pool((uint32_t)state.range(0));
+	pool.start();
+
+	for (auto _ : state)
+	{
+		for (int64_t i = 0; i < BatchSize; i++)
+		{
+			pool.feedQueue([&pool, i]() { pool.feedOutputQueue(i, i); }, i);
+		}
+
+		int64_t sum = 0;
+		for (int64_t i = 0; i < BatchSize; i++)
+		{
+			sum += pool.fetchFromBuffer();
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * BatchSize);
+}
+BENCHMARK(BM_OrderedBufferedThreadpool_EmptyTasks)->Apply(threadCounts)->UseRealTime();
+
+/**
+ * @brief Ordered output throughput of tasks that do no work, completed by ticket
+ *
+ * @param state Benchmark state (thread count)
+ */
+static void BM_OrderedBufferedThreadpool_EmptyTicketedTasks(benchmark::State &state)
+{
+	typedef OrderedBufferedThreadpool<int64_t, int64_t> Pool;
+	Pool pool((uint32_t)state.range(0));
+	pool.start();
+
+	for (auto _ : state)
+	{
+		for (int64_t i = 0; i < BatchSize; i++)
+		{
+			pool.feedQueueWithTicket([&pool, i](Pool::Ticket ticket) { pool.feedOutputQueue(i, ticket); });
+		}
+
+		int64_t sum = 0;
+		for (int64_t i = 0; i < BatchSize; i++)
+		{
+			sum += pool.fetchFromBuffer();
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * BatchSize);
+}
+BENCHMARK(BM_OrderedBufferedThreadpool_EmptyTicketedTasks)->Apply(threadCounts)->UseRealTime();
+
+/**
+ * @brief Register thread counts with default (0) and wide reorder windows
+ *
+ */
+static void skewedArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"threads", "window"});
+
+	unsigned int maxThreads = std::max(4u, std::thread::hardware_concurrency());
+	for (int64_t window : {0, 256})
+	{
+		for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			b->Args({(int64_t)threads, window});
+		}
+	}
+}
+
+/**
+ * @brief Ordered output throughput with skewed task durations
+ *
+ * Every 16th task runs 100x longer than the rest, so later items finish
+ * first and have to be held back in the reorder window.
+ *
+ * @param state Benchmark state (thread count, reorder window)
+ */
+static void BM_OrderedBufferedThreadpool_Skewed(benchmark::State &state)
+{
+	static const int64_t SkewedBatchSize = 2000;
+
+	OrderedBufferedThreadpool<int64_t, int64_t> pool((uint32_t)state.range(0), (size_t)state.range(1));
+	pool.start();
+
+	for (auto _ : state)
+	{
+		for (int64_t i = 0; i < SkewedBatchSize; i++)
+		{
+			pool.feedQueue([&pool, i]() {
+				spinFor(std::chrono::microseconds(i % 16 == 0 ? 200 : 2));
+				pool.feedOutputQueue(i, i);
+			}, i);
+		}
+
+		int64_t sum = 0;
+		for (int64_t i = 0; i < SkewedBatchSize; i++)
+		{
+			sum += pool.fetchFromBuffer();
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+
+	ThreadUtils::ReorderStats stats = pool.reorderStats();
+	pool.stop();
+
+	state.SetItemsProcessed(state.iterations() * SkewedBatchSize);
+	state.counters["max_held_back"] = (double)stats.maxHeldBack;
+	state.counters["hol_blocks"] = (double)stats.headOfLineBlocks;
+}
+BENCHMARK(BM_OrderedBufferedThreadpool_Skewed)->Apply(skewedArgs)->UseRealTime();
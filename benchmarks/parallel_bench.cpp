@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file parallel_bench.cpp
+ * @author Evan Stoddard
+ * @brief Parallel algorithm benchmarks
+ */
+
+#include <vector>
+#include "benchutils.hpp"
+#include "parallel.hpp"
+
+using namespace ThreadUtilsBench;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Threadpool;
+
+/// @brief Elements per iteration
+static const int64_t NumElements = 1 << 20;
+
+/**
+ * @brief Per element enqueue_new and a manual join, the pattern parallel_for replaces
+ *
+ * @param state Benchmark state (thread count)
+ */
+static void BM_Parallel_PerElementTasks(benchmark::State &state)
+{
+	Threadpool pool((uint32_t)state.range(0));
+	pool.start();
+
+	std::vector<double> values((size_t)NumElements, 1.0);
+	CompletionCounter counter;
+
+	for (auto _ : state)
+	{
+		counter.reset(NumElements);
+		for (int64_t i = 0; i < NumElements; i++)
+		{
+			pool.enqueue_new([&values, &counter](int64_t index) {
+				values[(size_t)index] *= 1.000001;
+				counter.done();
+			}, i);
+		}
+		counter.wait();
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * NumElements);
+}
+BENCHMARK(BM_Parallel_PerElementTasks)->Apply(threadCounts)->UseRealTime();
+
+/**
+ * @brief parallel_for with automatic grain
+ *
+ * @param state Benchmark state (thread count)
+ * @param mode Scheduling mode
+ */
+static void BM_Parallel_For(benchmark::State &state, SchedulingMode mode)
+{
+	Threadpool pool((uint32_t)state.range(0), mode);
+	pool.start();
+
+	std::vector<double> values((size_t)NumElements, 1.0);
+
+	for (auto _ : state)
+	{
+		ThreadUtils::parallel_for(pool, (int64_t)0, NumElements, [&values](int64_t index) {
+			values[(size_t)index] *= 1.000001;
+		});
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * NumElements);
+}
+BENCHMARK_CAPTURE(BM_Parallel_For, shared_queue, SchedulingMode::SharedQueue)
+	->Apply(threadCounts)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Parallel_For, work_stealing, SchedulingMode::WorkStealing)
+	->Apply(threadCounts)->UseRealTime();
+
+/**
+ * @brief parallel_reduce sum
+ *
+ * @param state Benchmark state (thread count)
+ */
+static void BM_Parallel_Reduce(benchmark::State &state)
+{
+	Threadpool pool((uint32_t)state.range(0), SchedulingMode::WorkStealing);
+	pool.start();
+
+	std::vector<double> values((size_t)NumElements, 1.0);
+
+	for (auto _ : state)
+	{
+		double sum = ThreadUtils::parallel_reduce(pool, values.begin(), values.end(), 0.0,
+			[](double a, double b) { return a + b; });
+		benchmark::DoNotOptimize(sum);
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * NumElements);
+}
+BENCHMARK(BM_Parallel_Reduce)->Apply(threadCounts)->UseRealTime();
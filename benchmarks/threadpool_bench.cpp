@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file threadpool_bench.cpp
+ * @author Evan Stoddard
+ * @brief Threadpool benchmarks
+ */
+
+#include <functional>
+#include "benchutils.hpp"
+#include "threadpool.hpp"
+
+using namespace ThreadUtilsBench;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Threadpool;
+
+/// @brief Tasks enqueued per iteration of throughput benchmarks
+static const int64_t BatchSize = 10000;
+
+/**
+ * @brief Throughput of empty tasks enqueued one at a time from outside the pool
+ *
+ * @param state Benchmark state (thread count)
+ * @param mode Scheduling mode
+ */
+static void BM_Threadpool_EmptyTasks(benchmark::State &state, SchedulingMode mode)
+{
+	Threadpool pool((uint32_t)state.range(0), mode);
+	pool.start();
+
+	CompletionCounter counter;
+
+	for (auto _ : state)
+	{
+		counter.reset(BatchSize);
+		for (int64_t i = 0; i < BatchSize; i++)
+		{
+			pool.enqueue([&counter]() { counter.done(); });
+		}
+		counter.wait();
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * BatchSize);
+}
+BENCHMARK_CAPTURE(BM_Threadpool_EmptyTasks, shared_queue, SchedulingMode::SharedQueue)
+	->Apply(threadCounts)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Threadpool_EmptyTasks, work_stealing, SchedulingMode::WorkStealing)
+	->Apply(threadCounts)->UseRealTime();
+
+/**
+ * @brief Throughput of empty tasks spawned from inside the pool
+ *
+ * Each task fans out to two children until the batch is used up, which is
+ * the case work stealing keeps off the shared queue.
+ *
+ * @param state Benchmark state (thread count)
+ * @param mode Scheduling mode
+ */
+static void BM_Threadpool_NestedTasks(benchmark::State &state, SchedulingMode mode)
+{
+	Threadpool pool((uint32_t)state.range(0), mode);
+	pool.start();
+
+	CompletionCounter counter;
+
+	// Task index i spawns 2i+1 and 2i+2, giving a binary tree of BatchSize tasks
+	std::function<void(int64_t)> spawn = [&](int64_t index) {
+		for (int64_t child = 2 * index + 1; child <= 2 * index + 2 && child < BatchSize; child++)
+		{
+			pool.enqueue([&spawn, child]() { spawn(child); });
+		}
+		counter.done();
+	};
+
+	for (auto _ : state)
+	{
+		counter.reset(BatchSize);
+		pool.enqueue([&spawn]() { spawn(0); });
+		counter.wait();
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * BatchSize);
+}
+BENCHMARK_CAPTURE(BM_Threadpool_NestedTasks, shared_queue, SchedulingMode::SharedQueue)
+	->Apply(threadCounts)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Threadpool_NestedTasks, work_stealing, SchedulingMode::WorkStealing)
+	->Apply(threadCounts)->UseRealTime();
+
+/**
+ * @brief Register thread counts with a single task and a burst of tasks
+ *
+ */
+static void latencyArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({"threads", "burst"});
+
+	unsigned int maxThreads = std::max(4u, std::thread::hardware_concurrency());
+	for (int64_t burst : {1, 256})
+	{
+		for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			b->Args({(int64_t)threads, burst});
+		}
+	}
+}
+
+/**
+ * @brief Enqueue to execute latency percentiles
+ *
+ * A burst of 1 measures waking an idle pool, larger bursts include time
+ * spent queued behind other tasks.
+ *
+ * @param state Benchmark state (thread count, burst size)
+ */
+static void BM_Threadpool_Latency(benchmark::State &state)
+{
+	Threadpool pool((uint32_t)state.range(0));
+	pool.start();
+
+	int64_t burst = state.range(1);
+	CompletionCounter counter;
+
+	std::vector<int64_t> latencies;
+	std::vector<int64_t> burstLatencies((size_t)burst);
+
+	for (auto _ : state)
+	{
+		counter.reset(burst);
+		for (int64_t i = 0; i < burst; i++)
+		{
+			Clock::time_point enqueued = Clock::now();
+			int64_t *latency = &burstLatencies[(size_t)i];
+
+			pool.enqueue([&counter, enqueued, latency]() {
+				*latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - enqueued).count();
+				counter.done();
+			});
+		}
+		counter.wait();
+
+		latencies.insert(latencies.end(), burstLatencies.begin(), burstLatencies.end());
+	}
+
+	pool.stop();
+	state.SetItemsProcessed(state.iterations() * burst);
+	reportPercentiles(state, latencies);
+}
+BENCHMARK(BM_Threadpool_Latency)->Apply(latencyArgs)->UseRealTime();
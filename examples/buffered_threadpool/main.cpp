@@ -18,6 +18,8 @@
 
 ThreadUtils::BufferedThreadpool<int64_t> *threadpool;
 
+void SecondStage(int64_t i);
+
 void FirstStage(int64_t i)
 {
 	// Print stage and wait 1 second
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file backoff.hpp
+ * @author Evan Stoddard
+ * @brief Adaptive spin/yield backoff used before parking threads
+ */
+
+#ifndef BACKOFF_H_
+#define BACKOFF_H_
+
+#include <stdint.h>
+#include <thread>
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Hint to the CPU that we're busy waiting
+	 *
+	 */
+	inline void cpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+
+	/**
+	 * @brief Spins, then yields, waiting for a condition before a thread parks.
+	 *
+	 * The spin budget adapts: it doubles whenever spinning found work and
+	 * halves whenever it didn't, so threads that are rarely rescued by
+	 * spinning quickly stop burning CPU.  Spinning is disabled on single CPU
+	 * machines where it can only delay the thread we're waiting on.
+	 *
+	 */
+	class AdaptiveSpin
+	{
+	public:
+		/// @brief Smallest spin budget
+		static constexpr uint32_t MinSpins = 16;
+
+		/// @brief Largest spin budget
+		static constexpr uint32_t MaxSpins = 4096;
+
+		/// @brief Yields after spin budget is used up
+		static constexpr uint32_t Yields = 4;
+
+		/**
+		 * @brief Construct a new Adaptive Spin object
+		 *
+		 */
+		AdaptiveSpin() :
+			_spins(std::thread::hardware_concurrency() > 1 ? MinSpins * 8 : 0)
+		{
+		}
+
+		/**
+		 * @brief Spin and yield until condition holds or budget runs out
+		 *
+		 * @param condition Condition to wait for
+		 * @return true Condition became true
+		 * @return false Budget exhausted, caller should park
+		 */
+		template <typename Condition>
+		bool spinUntil(Condition condition)
+		{
+			if (_spins == 0)
+			{
+				return condition();
+			}
+
+			for (uint32_t i = 0; i < _spins; i++)
+			{
+				if (condition())
+				{
+					grow();
+					return true;
+				}
+
+				cpuRelax();
+			}
+
+			for (uint32_t i = 0; i < Yields; i++)
+			{
+				std::this_thread::yield();
+
+				if (condition())
+				{
+					return true;
+				}
+			}
+
+			shrink();
+			return condition();
+		}
+
+	private:
+		void grow() { _spins = _spins * 2 > MaxSpins ? MaxSpins : _spins * 2; }
+		void shrink() { _spins = _spins / 2 < MinSpins ? MinSpins : _spins / 2; }
+
+	private:
+		/// @brief Current spin budget (0 disables spinning)
+		uint32_t _spins;
+	};
+};
+
+#endif /* BACKOFF_H_ */
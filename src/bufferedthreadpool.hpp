@@ -12,67 +12,270 @@
 #define BUFFEREDTHREADPOOL_H_
 
 #include "threadpool.hpp"
+#include "mpmcringbuffer.hpp"
+#include "optional.hpp"
 
 namespace ThreadUtils
 {
 	template<typename T>
 	class BufferedThreadpool: public Threadpool
 	{
+	protected:
+		/**
+		 * @brief Coroutine suspended in fetchAsync(), waiting for output
+		 *
+		 * Kept free of coroutine types, so the pool's layout doesn't depend on
+		 * whether coroutines are enabled.  It still depends on the language
+		 * version through Optional<T> (std::optional from C++17, our own class
+		 * before), so every translation unit sharing a pool must be built in
+		 * the same language mode.
+		 *
+		 */
+		struct FetchWaiter
+		{
+			/// @brief Output handed over
+			Optional<T> value;
+
+			/// @brief Address of suspended coroutine
+			void *coroutine;
+
+			/// @brief Resumes coroutine
+			void (*resume)(void *coroutine);
+		};
+
 	public:
+#ifdef THREADUTILS_HAS_COROUTINES
+		/**
+		 * @brief Awaitable returned by fetchAsync()
+		 *
+		 */
+		class FetchAwaiter
+		{
+		public:
+			explicit FetchAwaiter(BufferedThreadpool *pool) :
+				_pool(pool)
+			{
+				_waiter.coroutine = nullptr;
+				_waiter.resume = &resume;
+			}
+
+			FetchAwaiter(const FetchAwaiter &) = delete;
+			FetchAwaiter &operator=(const FetchAwaiter &) = delete;
+
+			bool await_ready()
+			{
+				_waiter.value = _pool->tryFetch();
+				return _waiter.value || !_pool->poolRunning();
+			}
+
+			bool await_suspend(std::coroutine_handle<> handle)
+			{
+				_waiter.coroutine = handle.address();
+				return _pool->suspendFetch(&_waiter);
+			}
+
+			Optional<T> await_resume() { return std::move(_waiter.value); }
+
+		private:
+			static void resume(void *coroutine)
+			{
+				std::coroutine_handle<>::from_address(coroutine).resume();
+			}
+
+			/// @brief Pool fetched from
+			BufferedThreadpool *_pool;
+
+			/// @brief Registration while suspended
+			FetchWaiter _waiter;
+		};
+#endif
+
+		/// @brief Times fetch polls an empty ring before yielding
+		static constexpr uint32_t FetchSpinCount = 64;
+
+		/// @brief Times fetch yields on an empty ring before parking
+		static constexpr uint32_t FetchYieldCount = 16;
 
 		/**
 		 * @brief Construct a new Buffered Threadpool object
 		 *
+		 * Workers feeding a full ring wait for consumers to make room, unless
+		 * the pool is stopping or draining: then output spills over into an
+		 * unbounded buffer fetched after the ring.
+		 *
 		 * @param numThreads Number of worker threads to spin up
+		 * @param outputCapacity Capacity of lock-free output ring (0 for unbounded locked deque)
 		 */
-		explicit BufferedThreadpool(uint32_t numThreads) :
+		explicit BufferedThreadpool(uint32_t numThreads, size_t outputCapacity = 0) :
 			Threadpool(numThreads),
-			_activeProcesses(0)
+			_activeProcesses(0),
+			_outputRing(outputCapacity > 0 ? new MpmcRingBuffer<T>(outputCapacity) : nullptr),
+			_parkedConsumers(0),
+			_suspendedFetchCount(0),
+			_parkedProducers(0),
+			_overflowCount(0)
+		{
+
+		}
+
+		/**
+		 * @brief Destroy the Buffered Threadpool object
+		 *
+		 * Shuts down here rather than in ~Threadpool, while the input queue
+		 * and output buffers are still around.
+		 *
+		 */
+		virtual ~BufferedThreadpool()
 		{
+			shutdown();
+		}
 
+		/**
+		 * @brief Feed input worker queue
+		 *
+		 * @param runnable Runnable object, deleted after it has run (or if rejected)
+		 * @return true Runnable fed
+		 * @return false Input queue full, see setBackpressure
+		 */
+		bool feedQueue(AbstractRunnable *runnable)
+		{
+			return feedQueue(Task(runnable));
 		}
 
 		/**
 		 * @brief Feed input worker queue
 		 *
+		 * @param task Task to run, cancelled if rejected
+		 * @return true Task fed
+		 * @return false Input queue full (see setBackpressure) or pool shutting down
 		 */
-		void feedQueue(AbstractRunnable *runnable)
+		bool feedQueue(Task task)
 		{
+			task.setEnqueueTime(metricsNow());
+
+			// Dropped tasks are cancelled after lock is released
+			std::vector<Task> dropped;
+
 			// Take input mutex
-			std::unique_lock<std::mutex> l(_queueMutex);
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+
+			// Wait for room
+			if (!waitForRoom(l, _inputQueue, enqueueDeadline(), DropFromQueue{_inputQueue, dropped, nullptr}))
+			{
+				l.unlock();
+				task.cancel();
+				return false;
+			}
 
-			// Push runnable
-			_inputQueue.emplace_back(runnable);
+			// Push task
+			_inputQueue.emplace_back(std::move(task));
+			THREADUTILS_PLOT("Input queue depth", _inputQueue.size());
 
 			// Release mutex and signal
 			l.unlock();
-			_inputCV.notify_all();
+			cancelTasks(dropped);
+			enqueuerMetrics().addEnqueued(1);
+			wakeWorkers(1);
+
+			return true;
+		}
+
+		/**
+		 * @brief Feed input worker queue with range of tasks under one lock
+		 *
+		 * Stops at the first task rejected by the overflow policy.
+		 *
+		 * @tparam Iterator Iterator over Task or AbstractRunnable*, tasks are moved from
+		 * @param begin First element
+		 * @param end One past last element
+		 * @return size_t Number of tasks fed
+		 */
+		template <typename Iterator>
+		size_t feedQueueBulk(Iterator begin, Iterator end)
+		{
+			// Dropped tasks are cancelled after lock is released
+			std::vector<Task> dropped;
+
+			// Take input mutex
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+
+			// Push tasks there's room for
+			std::chrono::steady_clock::time_point deadline = enqueueDeadline();
+			uint64_t now = metricsNow();
+			size_t count = 0;
+			for (Iterator it = begin; it != end; ++it, count++)
+			{
+				if (!waitForRoom(l, _inputQueue, deadline, DropFromQueue{_inputQueue, dropped, nullptr}))
+				{
+					break;
+				}
+
+				_inputQueue.emplace_back(std::move(*it));
+				_inputQueue.back().setEnqueueTime(now);
+			}
+			THREADUTILS_PLOT("Input queue depth", _inputQueue.size());
+
+			// Release mutex and wake one worker per task
+			l.unlock();
+			cancelTasks(dropped);
+			enqueuerMetrics().addEnqueued(count);
+			wakeWorkers(count);
+
+			return count;
 		}
 
 		/**
 		 * @brief Blocking call to fetch output of type T from output buffer
 		 *
-		 * @return T Return from back of buffer
+		 * Requires T to be default constructible, see fetch().
+		 *
+		 * @return T Return from front of buffer, T() once pool stopped and buffer empty
 		 */
 		T fetchFromBuffer()
 		{
+			Optional<T> out = fetch();
+
+			// If pool killed return empty type
+			if (!out)
+			{
+				return T();
+			}
+
+			return std::move(*out);
+		}
+
+		/**
+		 * @brief Blocking call to fetch output of type T from output buffer
+		 *
+		 * Output is moved out of the buffer, so T may be move only and need
+		 * not be default constructible.
+		 *
+		 * @return Optional<T> Output from front of buffer, empty once pool stopped and buffer empty
+		 */
+		Optional<T> fetch()
+		{
+			if (_outputRing)
+			{
+				return fetchFromRing();
+			}
+
 			// Take lock
-			std::unique_lock<std::mutex> l(_outputMutex);
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
 
 			// Wait on condition variable
-			_outputSignal.wait(l, [&]() {
-				return !_poolRunning || !_outputBuffer.empty();
-			});
+			waitForOutput(l);
 
-			// If pool killed return empty type
-			if (!_poolRunning)
+			// Output to return
+			Optional<T> out;
+
+			// If pool stopped with nothing left buffered return nothing
+			if (_outputBuffer.empty())
 			{
-				l.unlock();
-				return T();
+				return out;
 			}
 
 			// Get output from buffer
-			T out = _outputBuffer.front();
+			out.emplace(std::move(_outputBuffer.front()));
 			_outputBuffer.pop_front();
 
 			// Release lock
@@ -83,34 +286,692 @@ namespace ThreadUtils
 		}
 
 		/**
-		 * @brief Feed output queue
+		 * @brief Blocking call to fetch up to n outputs from output buffer
+		 *
+		 * Waits for at least one output, then drains up to n under a single
+		 * lock acquisition.
+		 *
+		 * @tparam OutputIterator Iterator accepting T
+		 * @param n Maximum number of outputs to fetch
+		 * @param out Iterator outputs are written to
+		 * @return size_t Number of outputs fetched (0 once pool stopped and buffer empty)
+		 */
+		template <typename OutputIterator>
+		size_t fetchFromBuffer(size_t n, OutputIterator out)
+		{
+			if (n == 0)
+			{
+				return 0;
+			}
+
+			if (_outputRing)
+			{
+				return fetchBulkFromRing(n, out);
+			}
+
+			// Take lock
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
+
+			// Wait on condition variable
+			waitForOutput(l);
+
+			// If pool stopped with nothing left buffered return nothing
+			if (_outputBuffer.empty())
+			{
+				return 0;
+			}
+
+			// Drain as much as asked for
+			size_t count = 0;
+			while (count < n && !_outputBuffer.empty())
+			{
+				*out = std::move(_outputBuffer.front());
+				++out;
+				_outputBuffer.pop_front();
+				count++;
+			}
+
+			return count;
+		}
+
+		/**
+		 * @brief Non-blocking fetch of output from buffer
+		 *
+		 * @param out Output taken from front of buffer
+		 * @return true Output fetched
+		 * @return false Buffer empty
+		 */
+		bool tryFetch(T &out)
+		{
+			if (_outputRing)
+			{
+				Optional<T> value = popRing();
+				if (!value)
+				{
+					return false;
+				}
+
+				out = std::move(*value);
+				return true;
+			}
+
+			// Take lock
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
+
+			if (_outputBuffer.empty())
+			{
+				return false;
+			}
+
+			out = std::move(_outputBuffer.front());
+			_outputBuffer.pop_front();
+
+			return true;
+		}
+
+		/**
+		 * @brief Non-blocking fetch of output from buffer
+		 *
+		 * @return Optional<T> Output from front of buffer, empty if buffer empty
+		 */
+		Optional<T> tryFetch()
+		{
+			if (_outputRing)
+			{
+				return popRing();
+			}
+
+			// Take lock
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
+
+			Optional<T> out;
+			if (!_outputBuffer.empty())
+			{
+				out.emplace(std::move(_outputBuffer.front()));
+				_outputBuffer.pop_front();
+			}
+
+			return out;
+		}
+
+#ifdef THREADUTILS_HAS_COROUTINES
+		/**
+		 * @brief Awaitable fetch of output from buffer
+		 *
+		 * Awaiting suspends the coroutine instead of blocking its thread.  The
+		 * next output is handed straight to it and it's resumed on the thread
+		 * that fed the output (usually a worker), rather than queued behind
+		 * work that may be waiting for room in the output buffer.
+		 *
+		 * @code
+		 * while (auto output = co_await pool.fetchAsync())
+		 *     consume(std::move(*output));
+		 * @endcode
+		 *
+		 * @return FetchAwaiter Awaitable producing Optional<T>, empty once pool stopped and buffer empty
+		 */
+		FetchAwaiter fetchAsync()
+		{
+			return FetchAwaiter(this);
+		}
+#endif
+
+		/**
+		 * @brief Feed output queue with copy of value
+		 *
+		 * @param value Value to feed queue
+		 */
+		void feedOutputQueue(const T &value)
+		{
+			pushOutput(value);
+		}
+
+		/**
+		 * @brief Feed output queue, moving value into buffer
 		 *
 		 * @param value Value to feed queue
 		 */
-		void feedOutputQueue(T value)
+		void feedOutputQueue(T &&value)
+		{
+			pushOutput(std::move(value));
+		}
+
+		/**
+		 * @brief Aggregate metrics, adding input queue and output buffer depths
+		 *
+		 * @return MetricsSnapshot Snapshot of pool metrics
+		 */
+		virtual MetricsSnapshot snapshot() override
+		{
+			MetricsSnapshot snapshot = Threadpool::snapshot();
+
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			snapshot.inputQueueDepth = _inputQueue.size();
+			l.unlock();
+
+			if (_outputRing)
+			{
+				snapshot.outputBufferDepth = _outputRing->size() + _overflowCount;
+			}
+			else
+			{
+				std::unique_lock<ProfiledMutex> ol(_outputMutex);
+				snapshot.outputBufferDepth = _outputBuffer.size();
+			}
+
+			snapshot.activeProcesses = _activeProcesses;
+
+			return snapshot;
+		}
+
+	protected:
+		/**
+		 * @brief Push copy of value to output buffer and wake a consumer
+		 *
+		 * @param value Value to push
+		 */
+		void pushOutput(const T &value)
+		{
+			if (_outputRing)
+			{
+				// Ring takes values by move only
+				T copy(value);
+				feedOutputRing(std::move(copy));
+				return;
+			}
+
+			pushBuffer(value);
+		}
+
+		/**
+		 * @brief Move value to output buffer and wake a consumer
+		 *
+		 * @param value Value to push
+		 */
+		void pushOutput(T &&value)
+		{
+			if (_outputRing)
+			{
+				feedOutputRing(std::move(value));
+				return;
+			}
+
+			pushBuffer(std::move(value));
+		}
+
+		/**
+		 * @brief Push value to locked deque buffer and wake a consumer
+		 *
+		 * @param value Value to push (copied or moved)
+		 */
+		template <typename V>
+		void pushBuffer(V &&value)
 		{
 			// Take lock
-			std::unique_lock<std::mutex> l(_outputMutex);
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
 
 			// Push to buffer and decrement active processing counters
-			_outputBuffer.emplace_back(value);
+			_outputBuffer.emplace_back(std::forward<V>(value));
 			_activeProcesses--;
+			THREADUTILS_PLOT("Active processes", _activeProcesses.load());
+			THREADUTILS_PLOT("Output buffer depth", _outputBuffer.size());
 
 			// Release lock
 			l.unlock();
 
 			// Notify output buffer
-			_outputSignal.notify_one();
+			wakeConsumers(1);
+			signalCapacity();
+		}
+
+		/**
+		 * @brief Wait for output in locked output buffer
+		 *
+		 * @param l Lock on output mutex
+		 */
+		void waitForOutput(std::unique_lock<ProfiledMutex> &l)
+		{
+			THREADUTILS_ZONE("Wait for output");
+
+			_parkedConsumers++;
+			_outputSignal.wait(l, [&]() {
+				return !_poolRunning || !_outputBuffer.empty();
+			});
+			_parkedConsumers--;
+		}
+
+		/**
+		 * @brief Wake at most one parked consumer per output pushed
+		 *
+		 * Must be called after pushing (and releasing output mutex).
+		 *
+		 * @param count Number of outputs pushed
+		 */
+		void wakeConsumers(size_t count)
+		{
+			if (count > 0 && _suspendedFetchCount > 0)
+			{
+				resumeSuspendedFetches();
+			}
+
+			uint32_t parked = _parkedConsumers;
+			if (parked == 0 || count == 0)
+			{
+				return;
+			}
+
+			if (count >= parked)
+			{
+				_outputSignal.notify_all();
+				return;
+			}
+
+			for (size_t i = 0; i < count; i++)
+			{
+				_outputSignal.notify_one();
+			}
+		}
+
+		/**
+		 * @brief Blocking fetch from lock-free ring.  Spins, yields, then parks.
+		 *
+		 * @return Optional<T> Output, empty once pool stopped and ring empty
+		 */
+		Optional<T> fetchFromRing()
+		{
+			Optional<T> out;
+
+			// Spin then yield before paying for a park
+			for (uint32_t i = 0; i < FetchSpinCount + FetchYieldCount; i++)
+			{
+				out = popRing();
+				if (out)
+				{
+					return out;
+				}
+
+				if (i >= FetchSpinCount)
+				{
+					std::this_thread::yield();
+				}
+			}
+
+			while (true)
+			{
+				out = popRing();
+				if (out)
+				{
+					return out;
+				}
+
+				// Take lock and advertise we're parked before final check
+				THREADUTILS_ZONE("Wait for output");
+				std::unique_lock<ProfiledMutex> l(_outputMutex);
+				_parkedConsumers++;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				_outputSignal.wait(l, [&]() {
+					return !_poolRunning || !_outputRing->empty() || !_outputOverflow.empty();
+				});
+
+				_parkedConsumers--;
+
+				// If pool stopped with nothing left buffered return nothing
+				if (!_poolRunning)
+				{
+					out = takeOutput();
+					return out;
+				}
+			}
+		}
+
+		/**
+		 * @brief Blocking bulk fetch from lock-free ring
+		 *
+		 * @param n Maximum number of outputs to fetch
+		 * @param out Iterator outputs are written to
+		 * @return size_t Number of outputs fetched (0 once pool stopped and ring empty)
+		 */
+		template <typename OutputIterator>
+		size_t fetchBulkFromRing(size_t n, OutputIterator out)
+		{
+			// Block for first output
+			Optional<T> value = fetchFromRing();
+			if (!value)
+			{
+				return 0;
+			}
+
+			*out = std::move(*value);
+			++out;
+
+			// Take whatever else is ready
+			size_t count = 1;
+			while (count < n && (value = popRing()))
+			{
+				*out = std::move(*value);
+				++out;
+				count++;
+			}
+
+			return count;
+		}
+
+		/**
+		 * @brief Push to lock-free ring, waking a parked consumer if needed
+		 *
+		 * A full ring is retried a few times, then the worker parks until a
+		 * consumer makes room.  Once the pool is stopping or draining the
+		 * value spills over instead, nobody may be left to consume.
+		 *
+		 * @param value Value to push
+		 */
+		void feedOutputRing(T &&value)
+		{
+			// Spilled output goes after it, keeping FIFO order
+			uint32_t attempts = 0;
+			while (_overflowCount > 0 || !_outputRing->tryPush(std::move(value)))
+			{
+				if (_overflowCount == 0 && attempts < FetchYieldCount)
+				{
+					attempts++;
+					std::this_thread::yield();
+					continue;
+				}
+
+				if (waitForRing(value))
+				{
+					break;
+				}
+			}
+
+			_activeProcesses--;
+			THREADUTILS_PLOT("Active processes", _activeProcesses.load());
+			signalCapacity();
+
+			// Only signal if a consumer is parked (or suspended)
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_parkedConsumers > 0 || _suspendedFetchCount > 0)
+			{
+				std::unique_lock<ProfiledMutex> l(_outputMutex);
+				l.unlock();
+				wakeConsumers(1);
+			}
+		}
+
+		/**
+		 * @brief Wait for room in full ring, or spill value over if pool is stopping
+		 *
+		 * @param value Value to push, moved from if spilled
+		 * @return true Value spilled over
+		 * @return false Ring may have room, try again
+		 */
+		bool waitForRing(T &value)
+		{
+			THREADUTILS_ZONE("Wait for output room");
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
+
+			// Advertise before final check, pairs with fence in popRing
+			_parkedProducers++;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			auto stopping = [&]() { return !_poolRunning || _draining || _closing; };
+			_ringRoomSignal.wait(l, [&]() {
+				return stopping() || _overflowCount > 0 || _outputRing->size() < _outputRing->capacity();
+			});
+			_parkedProducers--;
+
+			if (!stopping() && _overflowCount == 0)
+			{
+				return false;
+			}
+
+			_outputOverflow.emplace_back(std::move(value));
+			_overflowCount++;
+
+			return true;
+		}
+
+		/**
+		 * @brief Take output from ring, then from whatever spilled over
+		 *
+		 * @return Optional<T> Output, empty if none
+		 */
+		Optional<T> popRing()
+		{
+			Optional<T> out = _outputRing->tryPop();
+			if (out)
+			{
+				// Let a producer parked on the full ring know there's room
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (_parkedProducers > 0)
+				{
+					std::unique_lock<ProfiledMutex> l(_outputMutex);
+					l.unlock();
+					_ringRoomSignal.notify_one();
+				}
+
+				return out;
+			}
+
+			if (_overflowCount == 0)
+			{
+				return out;
+			}
+
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
+			return takeOverflow();
+		}
+
+		/**
+		 * @brief Take output spilled over from full ring.  Output mutex held.
+		 *
+		 * Only taken once the ring is empty, overflow is newer than anything in it.
+		 *
+		 * @return Optional<T> Output, empty if none
+		 */
+		Optional<T> takeOverflow()
+		{
+			Optional<T> out;
+			if (!_outputOverflow.empty() && _outputRing->empty())
+			{
+				out.emplace(std::move(_outputOverflow.front()));
+				_outputOverflow.pop_front();
+				_overflowCount--;
+			}
+
+			return out;
+		}
+
+		/**
+		 * @brief Take front output.  Output mutex held.
+		 *
+		 * @return Optional<T> Output, empty if buffer empty
+		 */
+		Optional<T> takeOutput()
+		{
+			if (_outputRing)
+			{
+				Optional<T> out = _outputRing->tryPop();
+				if (!out)
+				{
+					out = takeOverflow();
+				}
+				else if (_parkedProducers > 0)
+				{
+					_ringRoomSignal.notify_one();
+				}
+
+				return out;
+			}
+
+			Optional<T> out;
+			if (!_outputBuffer.empty())
+			{
+				out.emplace(std::move(_outputBuffer.front()));
+				_outputBuffer.pop_front();
+			}
+
+			return out;
+		}
+
+		/**
+		 * @brief Register suspended fetch, unless output arrived meanwhile
+		 *
+		 * @param waiter Fetch to register
+		 * @return true Fetch registered, it's resumed once output is handed to it
+		 * @return false Output (or pool stopped) already, don't suspend
+		 */
+		bool suspendFetch(FetchWaiter *waiter)
+		{
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
+
+			// Advertise before final check, pairs with fence in feedOutputRing
+			_suspendedFetchCount++;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			waiter->value = takeOutput();
+			if (waiter->value || !_poolRunning)
+			{
+				_suspendedFetchCount--;
+				return false;
+			}
+
+			_suspendedFetches.push_back(waiter);
+
+			return true;
+		}
+
+		/**
+		 * @brief Hand outputs to suspended fetches, oldest first, and resume them
+		 *
+		 */
+		void resumeSuspendedFetches()
+		{
+			while (true)
+			{
+				std::unique_lock<ProfiledMutex> l(_outputMutex);
+				if (_suspendedFetches.empty())
+				{
+					return;
+				}
+
+				Optional<T> value = takeOutput();
+				if (!value)
+				{
+					return;
+				}
+
+				FetchWaiter *waiter = _suspendedFetches.front();
+				_suspendedFetches.pop_front();
+				_suspendedFetchCount--;
+				waiter->value = std::move(value);
+
+				// Waiter lives in coroutine frame, gone once resumed
+				void *coroutine = waiter->coroutine;
+				void (*resume)(void*) = waiter->resume;
+				l.unlock();
+
+				resume(coroutine);
+			}
+		}
+
+		/**
+		 * @brief Move every queued task out, input included.  Queue mutex held.
+		 *
+		 * @param out Tasks taken
+		 */
+		virtual void takeQueued(std::vector<Task> &out) override
+		{
+			Threadpool::takeQueued(out);
+
+			while (!_inputQueue.empty())
+			{
+				out.push_back(std::move(_inputQueue.front()));
+				_inputQueue.pop_front();
+			}
+			THREADUTILS_PLOT("Input queue depth", _inputQueue.size());
+		}
+
+		/**
+		 * @brief Wake workers parked on a full output ring so they spill over
+		 *
+		 */
+		virtual void notifyStopping() override
+		{
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
+			l.unlock();
+			_ringRoomSignal.notify_all();
+		}
+
+		/**
+		 * @brief Wake blocked and suspended fetches so they see the pool stopped
+		 *
+		 * Output still buffered is handed out first.
+		 *
+		 */
+		virtual void notifyStopped() override
+		{
+			std::unique_lock<ProfiledMutex> l(_outputMutex);
+			l.unlock();
+			_outputSignal.notify_all();
+
+			resumeSuspendedFetches();
+
+			// Whoever is left gets nothing
+			while (true)
+			{
+				l.lock();
+				if (_suspendedFetches.empty())
+				{
+					return;
+				}
+
+				FetchWaiter *waiter = _suspendedFetches.front();
+				_suspendedFetches.pop_front();
+				_suspendedFetchCount--;
+
+				void *coroutine = waiter->coroutine;
+				void (*resume)(void*) = waiter->resume;
+				l.unlock();
+
+				resume(coroutine);
+			}
 		}
 
-	protected:
 		/**
 		 * @brief Predicate for determining if processing thread to be run
 		 *
+		 * Input only counts while fewer than numThreads() items are being
+		 * processed, so workers park rather than spin at the cap.
+		 *
 		 */
 		virtual bool inputPredicate() override
 		{
-			return !_poolRunning || !_inputQueue.empty() || !_queue.empty();
+			return !_poolRunning || !_queue.empty() || (!_inputQueue.empty() && _activeProcesses < numThreads());
+		}
+
+		/**
+		 * @brief Wake a worker parked at the active process cap, after decrementing it
+		 *
+		 * Only takes the queue mutex if a worker is parked.
+		 *
+		 */
+		void signalCapacity()
+		{
+			if (_sleepingThreads == 0)
+			{
+				return;
+			}
+
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			bool waiting = !_inputQueue.empty();
+			l.unlock();
+
+			if (waiting)
+			{
+				wakeWorkers(1);
+			}
 		}
 
 		/**
@@ -119,64 +980,76 @@ namespace ThreadUtils
 		 */
 		virtual void threadRunner() override
 		{
-			// While pool active
-			while (poolRunning())
+			// Identity (and context) of this worker, passed to every task run
+			const WorkerIdentity &worker = currentWorker();
+
+			// Spin budget before parking
+			AdaptiveSpin spin;
+
+			// While pool active (and worker still wanted)
+			while (workerWanted())
 			{
 				// Grab lock
-				std::unique_lock<std::mutex> l(_queueMutex);
+				std::unique_lock<ProfiledMutex> l(_queueMutex);
 
-				// Pointer to runnable
-				AbstractRunnable *runnable = nullptr;
+				// Task to run
+				Task task;
 
 				// Wait for change in queue or pool status
-				_inputCV.wait(l, [&](){ return inputPredicate(); });
+				waitForInput(l, spin);
 
-				// If pool killed
-				if (!poolRunning())
+				// If pool killed (or worker retired)
+				if (!workerWanted())
 				{
 					// Release lock
 					l.unlock();
 					break;
 				}
 
-				// If threadpool has capacity to pull from input queue
-				if (!_inputQueue.empty() && _activeProcesses != _numThreads)
+				// If threadpool has capacity to pull from input queue (and no urgent lane is waiting)
+				if (!_queue.hasUrgent() && !_inputQueue.empty() && _activeProcesses < numThreads())
 				{
-					runnable = _inputQueue.front();
+					task = std::move(_inputQueue.front());
 					_inputQueue.pop_front();
 					_activeProcesses++;
+					THREADUTILS_PLOT("Input queue depth", _inputQueue.size());
+					THREADUTILS_PLOT("Active processes", _activeProcesses.load());
+					signalRoom();
 				}
-				else if (!_queue.empty())
+				else if (_queue.pop(task))
 				{
-					runnable = _queue.front();
-					_queue.pop_front();
+					signalRoom();
 				}
 				else
 				{
 					l.unlock();
+
+					// Nothing this worker can take while draining, busy ones finish the rest
+					if (_draining)
+					{
+						break;
+					}
+
 					continue;
 				}
 
 				// Release lock
 				l.unlock();
 
-				// Execute runnable
-				runnable->run();
-
-				// Delete runnable
-				delete runnable;
+				// Execute task, destroying it when done
+				runTask(task, worker);
 			}
 		}
 
 	protected:
 		/// @brief Mutex to lock output queue
-		std::mutex _outputMutex;
+		THREADUTILS_LOCKABLE(_outputMutex);
 
 		/// @brief Condition variable for data added to back buffer
-		std::condition_variable _outputSignal;
+		ProfiledConditionVariable _outputSignal;
 
-		/// @brief Input Runnable Queue
-		std::deque<AbstractRunnable*> _inputQueue;
+		/// @brief Input task queue
+		TaskDeque _inputQueue;
 
 		/// @brief Output buffer
 		std::deque<T> _outputBuffer;
@@ -184,6 +1057,30 @@ namespace ThreadUtils
 		/// @brief Active processes
 		std::atomic_uint32_t _activeProcesses;
 
+		/// @brief Lock-free output buffer, used instead of _outputBuffer if set
+		std::unique_ptr<MpmcRingBuffer<T>> _outputRing;
+
+		/// @brief Consumers parked waiting for output
+		std::atomic_uint32_t _parkedConsumers;
+
+		/// @brief Fetches suspended waiting for output, oldest first (guarded by output mutex)
+		std::deque<FetchWaiter*> _suspendedFetches;
+
+		/// @brief Number of suspended fetches
+		std::atomic_uint32_t _suspendedFetchCount;
+
+		/// @brief Signalled when a consumer takes from the output ring (or pool stops)
+		ProfiledConditionVariable _ringRoomSignal;
+
+		/// @brief Workers parked waiting for room in the output ring
+		std::atomic_uint32_t _parkedProducers;
+
+		/// @brief Output spilled over from full ring while stopping (guarded by output mutex)
+		std::deque<T> _outputOverflow;
+
+		/// @brief Number of outputs spilled over
+		std::atomic<size_t> _overflowCount;
+
 	};
 };
 
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file completionlatch.hpp
+ * @author Evan Stoddard
+ * @brief Countdown of outstanding pool tasks that waiters help along
+ */
+
+#ifndef COMPLETIONLATCH_H_
+#define COMPLETIONLATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include "backoff.hpp"
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Counts outstanding tasks, letting a waiter help run them
+	 *
+	 * wait() runs whatever help it's given (queued pool tasks) until the
+	 * count reaches zero, spinning briefly and then parking once there's
+	 * nothing to run.  A parked waiter is woken by the last countDown(), or
+	 * by wake() when more work it could help with is queued, so it never
+	 * polls.
+	 *
+	 */
+	class CompletionLatch
+	{
+	public:
+		/**
+		 * @brief Construct a new Completion Latch object, with nothing outstanding
+		 *
+		 */
+		CompletionLatch() :
+			_count(0),
+			_wakeups(0),
+			_waiters(0)
+		{
+		}
+
+		CompletionLatch(const CompletionLatch &) = delete;
+		CompletionLatch &operator=(const CompletionLatch &) = delete;
+
+		/**
+		 * @brief Count tasks as outstanding
+		 *
+		 * @param count Number of tasks
+		 */
+		void add(size_t count = 1)
+		{
+			_count.fetch_add(count, std::memory_order_relaxed);
+		}
+
+		/**
+		 * @brief Count a task done, waking waiters if it was the last
+		 *
+		 * The last task takes the mutex before reaching zero, so a waiter
+		 * can't see zero and destroy the latch while it's still signalling.
+		 *
+		 */
+		void countDown()
+		{
+			size_t count = _count.load(std::memory_order_relaxed);
+			while (true)
+			{
+				if (count == 1)
+				{
+					std::unique_lock<std::mutex> l(_mutex);
+					if (_count.compare_exchange_strong(count, 0, std::memory_order_acq_rel))
+					{
+						_signal.notify_all();
+						return;
+					}
+				}
+				else if (_count.compare_exchange_weak(count, count - 1, std::memory_order_acq_rel))
+				{
+					return;
+				}
+			}
+		}
+
+		/**
+		 * @brief Let parked waiters know there's new work to help with
+		 *
+		 * Called after queueing it.  Only takes the mutex if somebody is
+		 * parked.
+		 *
+		 */
+		void wake()
+		{
+			_wakeups.fetch_add(1);
+			if (_waiters.load() > 0)
+			{
+				std::unique_lock<std::mutex> l(_mutex);
+				l.unlock();
+				_signal.notify_all();
+			}
+		}
+
+		/**
+		 * @brief Returns number of tasks outstanding
+		 *
+		 */
+		size_t count() const { return _count.load(std::memory_order_acquire); }
+
+		/**
+		 * @brief Returns whether every task is done
+		 *
+		 */
+		bool done() const { return count() == 0; }
+
+		/**
+		 * @brief Help run work until every task is done
+		 *
+		 * @tparam Help Callable running one piece of work, returning false if there was none
+		 * @param help Runs work on the calling thread
+		 */
+		template <typename Help>
+		void wait(Help help)
+		{
+			AdaptiveSpin spin;
+
+			while (!done())
+			{
+				// Taken before looking for work, so work queued after that wakes us
+				uint64_t wakeups = _wakeups.load();
+				auto ready = [&]() { return done() || _wakeups.load() != wakeups; };
+
+				if (help() || spin.spinUntil(ready))
+				{
+					continue;
+				}
+
+				std::unique_lock<std::mutex> l(_mutex);
+				_waiters++;
+				_signal.wait(l, ready);
+				_waiters--;
+			}
+
+			// Last task may still hold mutex while signalling
+			std::unique_lock<std::mutex> l(_mutex);
+		}
+
+	private:
+		/// @brief Tasks not yet done
+		std::atomic<size_t> _count;
+
+		/// @brief Bumped by wake()
+		std::atomic<uint64_t> _wakeups;
+
+		/// @brief Waiters parked on signal
+		std::atomic_uint32_t _waiters;
+
+		/// @brief Mutex parked waiters (and last task) hold
+		std::mutex _mutex;
+
+		/// @brief Signalled by last task and wake()
+		std::condition_variable _signal;
+	};
+};
+
+#endif /* COMPLETIONLATCH_H_ */
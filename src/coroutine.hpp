@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file coroutine.hpp
+ * @author Evan Stoddard
+ * @brief C++20 coroutine support, compiled only where the compiler has it
+ *
+ * Defines THREADUTILS_HAS_COROUTINES when coroutines are available (and
+ * THREADUTILS_DISABLE_COROUTINES isn't defined).  Everything coroutine
+ * related in the other headers is guarded by it, so they still build as
+ * C++14.
+ */
+
+#ifndef COROUTINE_H_
+#define COROUTINE_H_
+
+#if !defined(THREADUTILS_DISABLE_COROUTINES) && defined(__cpp_impl_coroutine)
+#if __cpp_impl_coroutine >= 201902L
+#define THREADUTILS_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef THREADUTILS_HAS_COROUTINES
+
+#include <stddef.h>
+#include <coroutine>
+#include "task.hpp"
+
+namespace ThreadUtils
+{
+	class Threadpool;
+
+	/**
+	 * @brief Task callable resuming a suspended coroutine
+	 *
+	 * If cancelled (dropped by the overflow policy or discarded by a
+	 * shutdown) the coroutine frame is destroyed without resuming it, so a
+	 * coroutine returning Future<R> completes it with a broken_promise
+	 * error.
+	 *
+	 */
+	class ResumeTask : public RunOrCancel<ResumeTask, std::coroutine_handle<>>
+	{
+	public:
+		explicit ResumeTask(std::coroutine_handle<> handle) :
+			RunOrCancel(handle)
+		{
+		}
+
+		ResumeTask(ResumeTask &&) = default;
+
+		~ResumeTask() { cancelIfOwned(); }
+
+		void operator()()
+		{
+			release().resume();
+		}
+
+		/**
+		 * @brief Destroy coroutine frame without resuming it
+		 *
+		 */
+		void cancel()
+		{
+			release().destroy();
+		}
+
+		/**
+		 * @brief Give up coroutine without resuming or destroying it
+		 *
+		 * @return std::coroutine_handle<> Coroutine
+		 */
+		std::coroutine_handle<> release()
+		{
+			return take();
+		}
+	};
+
+	/**
+	 * @brief Awaitable resuming the awaiting coroutine on a pool worker
+	 *
+	 * Returned by Threadpool::schedule(), await_suspend and await_resume
+	 * are defined in threadpool.hpp.
+	 *
+	 */
+	class ScheduleAwaiter
+	{
+	public:
+		ScheduleAwaiter(Threadpool *pool, size_t lane) :
+			_pool(pool),
+			_lane(lane),
+			_cancelled(false)
+		{
+		}
+
+		bool await_ready() const noexcept { return false; }
+
+		bool await_suspend(std::coroutine_handle<> handle);
+
+		void await_resume() const;
+
+	private:
+		/// @brief Pool to resume on
+		Threadpool *_pool;
+
+		/// @brief Priority lane resumption is queued in
+		size_t _lane;
+
+		/// @brief Pool was shutting down, carried on without it
+		bool _cancelled;
+	};
+};
+
+#endif /* THREADUTILS_HAS_COROUTINES */
+
+#endif /* COROUTINE_H_ */
@@ -0,0 +1,1136 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file future.hpp
+ * @author Evan Stoddard
+ * @brief Lightweight future returned when submitting tasks to a threadpool
+ */
+
+#ifndef FUTURE_H_
+#define FUTURE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "coroutine.hpp"
+#include "task.hpp"
+
+namespace ThreadUtils
+{
+	class ContinuationScheduler;
+
+	class ContinuationLink;
+
+	/**
+	 * @brief Where a future's continuations go: a link and the generation it was taken at
+	 *
+	 * Plain pointer and counter, so submitting a task touches no reference
+	 * count.
+	 *
+	 */
+	struct ContinuationRoute
+	{
+		/// @brief Link to scheduler (nullptr to run continuations inline)
+		ContinuationLink *link;
+
+		/// @brief Generation of link when route was taken
+		uint64_t generation;
+	};
+
+	/**
+	 * @brief Handle on a scheduler, used by the futures it created
+	 *
+	 * Futures can outlive their pool.  The pool detaches the link as it's
+	 * destroyed, waiting for continuations being handed to it, and
+	 * continuations scheduled through the link after that are cancelled.
+	 * Links are never freed: a detached link moves on to its next generation
+	 * and is reused by a later scheduler, routes of the old one no longer
+	 * match it.
+	 *
+	 */
+	class ContinuationLink
+	{
+	public:
+		/**
+		 * @brief Returns a link to scheduler, reusing a detached one if there is one
+		 *
+		 * @param scheduler Scheduler linked to
+		 * @return ContinuationLink* Link, handed back by detach
+		 */
+		static ContinuationLink *attach(ContinuationScheduler *scheduler)
+		{
+			Spares &spares = spareLinks();
+
+			std::unique_lock<std::mutex> l(spares.mutex);
+			ContinuationLink *link = spares.first;
+			if (link != nullptr)
+			{
+				spares.first = link->_nextSpare;
+			}
+			l.unlock();
+
+			if (link == nullptr)
+			{
+				link = new ContinuationLink();
+			}
+
+			std::lock_guard<std::mutex> linkLock(link->_mutex);
+			link->_scheduler = scheduler;
+			link->_nextSpare = nullptr;
+
+			return link;
+		}
+
+		/**
+		 * @brief Returns route through this link's current generation
+		 *
+		 */
+		ContinuationRoute route()
+		{
+			std::lock_guard<std::mutex> l(_mutex);
+			ContinuationRoute route = { this, _generation };
+			return route;
+		}
+
+		/**
+		 * @brief Hand continuation to scheduler, cancelling it once detached
+		 *
+		 * @param generation Generation of route continuation came through
+		 * @param task Continuation
+		 */
+		inline void schedule(uint64_t generation, Task task);
+
+		/**
+		 * @brief Stop handing continuations to scheduler and make link spare
+		 *
+		 * Returns once no other thread is inside the scheduler through this
+		 * link.
+		 *
+		 */
+		void detach()
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			_scheduler = nullptr;
+			_generation++;
+			_idle.wait(l, [&]() { return _users == 0; });
+			l.unlock();
+
+			Spares &spares = spareLinks();
+			std::lock_guard<std::mutex> sparesLock(spares.mutex);
+			_nextSpare = spares.first;
+			spares.first = this;
+		}
+
+	private:
+		/**
+		 * @brief Detached links waiting for a scheduler
+		 *
+		 */
+		struct Spares
+		{
+			Spares() :
+				first(nullptr)
+			{
+			}
+
+			std::mutex mutex;
+			ContinuationLink *first;
+		};
+
+		ContinuationLink() :
+			_scheduler(nullptr),
+			_generation(0),
+			_users(0),
+			_nextSpare(nullptr)
+		{
+		}
+
+		/**
+		 * @brief Returns spare links (never destroyed, futures may outlive statics)
+		 *
+		 */
+		static Spares &spareLinks()
+		{
+			static Spares *spares = new Spares;
+			return *spares;
+		}
+
+		/**
+		 * @brief Leave scheduler, waking detach if last one out
+		 *
+		 */
+		void leave()
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			if (--_users == 0)
+			{
+				l.unlock();
+				_idle.notify_all();
+			}
+		}
+
+	private:
+		/// @brief Mutex guarding scheduler, generation and user count
+		std::mutex _mutex;
+
+		/// @brief Condition variable signalled when last user leaves
+		std::condition_variable _idle;
+
+		/// @brief Scheduler linked to (nullptr once detached)
+		ContinuationScheduler *_scheduler;
+
+		/// @brief Bumped on detach, routes taken before no longer reach a scheduler
+		uint64_t _generation;
+
+		/// @brief Threads inside scheduler through this link
+		uint32_t _users;
+
+		/// @brief Next spare link while detached
+		ContinuationLink *_nextSpare;
+	};
+
+	/**
+	 * @brief Where continuations of a future run, implemented by Threadpool
+	 *
+	 */
+	class ContinuationScheduler
+	{
+	public:
+		/**
+		 * @brief Construct a new Continuation Scheduler object
+		 *
+		 */
+		ContinuationScheduler() :
+			_continuationRoute(ContinuationLink::attach(this)->route())
+		{
+		}
+
+		ContinuationScheduler(const ContinuationScheduler &) = delete;
+		ContinuationScheduler &operator=(const ContinuationScheduler &) = delete;
+
+		/**
+		 * @brief Run (or cancel) continuation of a ready future
+		 *
+		 * @param task Continuation
+		 */
+		virtual void scheduleContinuation(Task task) = 0;
+
+		/**
+		 * @brief Returns route held by futures of this scheduler
+		 *
+		 */
+		const ContinuationRoute &continuationRoute() const { return _continuationRoute; }
+
+	protected:
+		~ContinuationScheduler() {}
+
+		/**
+		 * @brief Cancel continuations of this scheduler's futures from now on
+		 *
+		 * Called by the scheduler as it's destroyed, while
+		 * scheduleContinuation can still run.
+		 *
+		 */
+		void detachContinuations()
+		{
+			_continuationRoute.link->detach();
+		}
+
+	private:
+		/// @brief Route held by futures
+		ContinuationRoute _continuationRoute;
+	};
+
+	inline void ContinuationLink::schedule(uint64_t generation, Task task)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		ContinuationScheduler *scheduler = generation == _generation ? _scheduler : nullptr;
+		if (scheduler == nullptr)
+		{
+			l.unlock();
+			task.cancel();
+			return;
+		}
+		_users++;
+		l.unlock();
+
+		// Leave even if scheduling throws, detach waits for us
+		struct Leave
+		{
+			~Leave() { link.leave(); }
+			ContinuationLink &link;
+		} leave = { *this };
+
+		scheduler->scheduleContinuation(std::move(task));
+	}
+
+	template <typename R>
+	class Future;
+
+	/**
+	 * @brief Reference counted state shared by a future and its producer
+	 *
+	 * States come from the task allocator, as does the callable of a
+	 * submitted task sharing the allocation.
+	 *
+	 */
+	class FutureStateBase : public TaskAllocated
+	{
+	public:
+		/**
+		 * @brief Construct a new Future State Base object
+		 *
+		 * @param route Where continuations are scheduled (null link to run them inline)
+		 */
+		explicit FutureStateBase(const ContinuationRoute &route) :
+			_refs(1),
+			_status(0),
+			_route(route)
+		{
+		}
+
+		/**
+		 * @brief Destroy the Future State Base object
+		 *
+		 */
+		virtual ~FutureStateBase() {}
+
+		/**
+		 * @brief Add reference to state
+		 *
+		 */
+		void retain()
+		{
+			_refs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		/**
+		 * @brief Drop reference to state, deleting it when last one goes
+		 *
+		 */
+		void release()
+		{
+			if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				delete this;
+			}
+		}
+
+		/**
+		 * @brief Returns whether result (or exception) has been set
+		 *
+		 */
+		bool ready() const { return (_status.load(std::memory_order_acquire) & Ready) != 0; }
+
+		/**
+		 * @brief Block until result is ready
+		 *
+		 */
+		void wait()
+		{
+			// Skip lock if already done
+			if (ready())
+			{
+				return;
+			}
+
+			std::unique_lock<std::mutex> l(_mutex);
+			if (!expectSignal())
+			{
+				return;
+			}
+
+			_readySignal.wait(l, [&]() { return ready(); });
+		}
+
+		/**
+		 * @brief Block until result is ready or timeout expires
+		 *
+		 * @param timeout Maximum time to wait
+		 * @return true Result ready
+		 * @return false Timed out
+		 */
+		template <typename Rep, typename Period>
+		bool waitFor(const std::chrono::duration<Rep, Period> &timeout)
+		{
+			if (ready())
+			{
+				return true;
+			}
+
+			std::unique_lock<std::mutex> l(_mutex);
+			if (!expectSignal())
+			{
+				return true;
+			}
+
+			return _readySignal.wait_for(l, timeout, [&]() { return ready(); });
+		}
+
+		/**
+		 * @brief Complete state with exception
+		 *
+		 * @param error Exception to rethrow from get()
+		 */
+		void setException(std::exception_ptr error)
+		{
+			_error = error;
+			markReady();
+		}
+
+		/**
+		 * @brief Schedule task on pool once state is ready
+		 *
+		 * @param continuation Task to schedule
+		 */
+		void onReady(Task continuation)
+		{
+			// Take lock
+			std::unique_lock<std::mutex> l(_mutex);
+
+			// Store continuation until producer finishes
+			if (expectSignal())
+			{
+				_continuation = std::move(continuation);
+				return;
+			}
+
+			l.unlock();
+
+			// Already finished, schedule right away
+			schedule(std::move(continuation));
+		}
+
+		/**
+		 * @brief Returns where continuations are scheduled (null link if inline)
+		 *
+		 */
+		const ContinuationRoute &route() const { return _route; }
+
+	protected:
+		/**
+		 * @brief Mark state ready, wake waiters and schedule continuation
+		 *
+		 */
+		void markReady()
+		{
+			// Nobody waiting and no continuation, skip lock and notify
+			if ((_status.fetch_or(Ready, std::memory_order_acq_rel) & Waiting) == 0)
+			{
+				return;
+			}
+
+			// Take lock, a waiter past expectSignal is then inside wait
+			std::unique_lock<std::mutex> l(_mutex);
+
+			Task continuation = std::move(_continuation);
+
+			// Release lock and notify
+			l.unlock();
+			_readySignal.notify_all();
+
+			if (continuation)
+			{
+				schedule(std::move(continuation));
+			}
+		}
+
+		/**
+		 * @brief Hand continuation to scheduler, or run it here if there's none
+		 *
+		 * Once the scheduler's pool is destroyed the continuation is
+		 * cancelled.
+		 *
+		 * @param continuation Continuation
+		 */
+		void schedule(Task continuation)
+		{
+			// Futures of coroutines have no pool, continue on completing thread
+			if (_route.link == nullptr)
+			{
+				continuation();
+				return;
+			}
+
+			_route.link->schedule(_route.generation, std::move(continuation));
+		}
+
+		/**
+		 * @brief Rethrow stored exception if there is one
+		 *
+		 */
+		void rethrowIfError()
+		{
+			if (_error)
+			{
+				std::rethrow_exception(_error);
+			}
+		}
+
+	private:
+		/**
+		 * @brief Ask markReady to signal, returns false if already ready
+		 *
+		 * Called with mutex held by a waiter or continuation about to be
+		 * stored.
+		 *
+		 */
+		bool expectSignal()
+		{
+			return (_status.fetch_or(Waiting, std::memory_order_acquire) & Ready) == 0;
+		}
+
+	private:
+		/// @brief Status bits
+		enum Status : uint32_t
+		{
+			/// @brief Result or exception set
+			Ready = 1,
+
+			/// @brief Waiter or continuation may need markReady to signal
+			Waiting = 2
+		};
+
+		/// @brief Reference count
+		std::atomic_uint32_t _refs;
+
+		/// @brief Ready and Waiting bits
+		std::atomic_uint32_t _status;
+
+		/// @brief Mutex guarding continuation and waiters
+		std::mutex _mutex;
+
+		/// @brief Condition variable signalled once ready
+		std::condition_variable _readySignal;
+
+		/// @brief Exception thrown by producer
+		std::exception_ptr _error;
+
+		/// @brief Task scheduled when ready
+		Task _continuation;
+
+		/// @brief Where continuations are scheduled (null link to run them inline)
+		ContinuationRoute _route;
+	};
+
+	/**
+	 * @brief Future state holding a result of type R
+	 *
+	 * @tparam R Result type
+	 */
+	template <typename R>
+	class FutureState : public FutureStateBase
+	{
+	public:
+		/**
+		 * @brief Construct a new Future State object
+		 *
+		 * @param route Where continuations are scheduled (null link to run them inline)
+		 */
+		explicit FutureState(const ContinuationRoute &route) :
+			FutureStateBase(route),
+			_hasValue(false)
+		{
+		}
+
+		/**
+		 * @brief Destroy the Future State object
+		 *
+		 */
+		virtual ~FutureState()
+		{
+			if (_hasValue)
+			{
+				value().~R();
+			}
+		}
+
+		/**
+		 * @brief Complete state with value
+		 *
+		 * @param result Result to store
+		 */
+		template <typename V>
+		void setValue(V &&result)
+		{
+			new (&_storage) R(std::forward<V>(result));
+			_hasValue = true;
+			markReady();
+		}
+
+		/**
+		 * @brief Wait for and take result, rethrowing producer exception
+		 *
+		 * @return R Result
+		 */
+		R get()
+		{
+			wait();
+			rethrowIfError();
+
+			return std::move(value());
+		}
+
+	private:
+		R &value() { return *reinterpret_cast<R*>(&_storage); }
+
+	private:
+		/// @brief Storage for result
+		typename std::aligned_storage<sizeof(R), alignof(R)>::type _storage;
+
+		/// @brief Result constructed in storage
+		bool _hasValue;
+	};
+
+	/**
+	 * @brief Future state for tasks without a result
+	 *
+	 */
+	template <>
+	class FutureState<void> : public FutureStateBase
+	{
+	public:
+		/**
+		 * @brief Construct a new Future State object
+		 *
+		 * @param route Where continuations are scheduled (null link to run them inline)
+		 */
+		explicit FutureState(const ContinuationRoute &route) :
+			FutureStateBase(route)
+		{
+		}
+
+		/**
+		 * @brief Complete state
+		 *
+		 */
+		void setValue()
+		{
+			markReady();
+		}
+
+		/**
+		 * @brief Wait for completion, rethrowing producer exception
+		 *
+		 */
+		void get()
+		{
+			wait();
+			rethrowIfError();
+		}
+	};
+
+	/**
+	 * @brief Run callable and store its result (or exception) in state
+	 *
+	 */
+	template <typename R>
+	struct FutureSetter
+	{
+		template <typename State, typename Func>
+		static void run(State &state, Func &func)
+		{
+			state.setValue(func());
+		}
+	};
+
+	template <>
+	struct FutureSetter<void>
+	{
+		template <typename State, typename Func>
+		static void run(State &state, Func &func)
+		{
+			func();
+			state.setValue();
+		}
+	};
+
+	/**
+	 * @brief Future state with the producing callable embedded in it
+	 *
+	 * @tparam R Result type
+	 * @tparam Func Callable type
+	 */
+	template <typename R, typename Func>
+	class SubmitState : public FutureState<R>
+	{
+	public:
+		/**
+		 * @brief Construct a new Submit State object
+		 *
+		 * @param route Where continuations are scheduled (null link to run them inline)
+		 * @param args Arguments constructing callable producing result
+		 */
+		template <typename ...Args>
+		SubmitState(const ContinuationRoute &route, Args &&...args) :
+			FutureState<R>(route),
+			_function(std::forward<Args>(args)...)
+		{
+		}
+
+		/**
+		 * @brief Run callable, storing result or exception
+		 *
+		 */
+		void run()
+		{
+			try
+			{
+				FutureSetter<R>::run(*this, _function);
+			}
+			catch (...)
+			{
+				this->setException(std::current_exception());
+			}
+		}
+
+	private:
+		/// @brief Callable producing result
+		Func _function;
+	};
+
+	/**
+	 * @brief Task callable running a state and holding a reference to it
+	 *
+	 * If cancelled (or destroyed) without running the future is completed
+	 * with a broken_promise error rather than leaving waiters blocked
+	 * forever.
+	 *
+	 */
+	template <typename State>
+	class StateTask : public RunOrCancel<StateTask<State>, State*>
+	{
+	public:
+		explicit StateTask(State *state) :
+			RunOrCancel<StateTask, State*>(state)
+		{
+		}
+
+		StateTask(StateTask &&) = default;
+
+		~StateTask() { this->cancelIfOwned(); }
+
+		void operator()()
+		{
+			State *state = this->take();
+
+			state->run();
+			state->release();
+		}
+
+		/**
+		 * @brief Break promise without running
+		 *
+		 */
+		void cancel()
+		{
+			State *state = this->take();
+
+			if (!state->ready())
+			{
+				state->setException(std::make_exception_ptr(
+					std::future_error(std::future_errc::broken_promise)
+				));
+			}
+
+			state->release();
+		}
+	};
+
+	/**
+	 * @brief Result type of continuation taking R
+	 *
+	 */
+	template <typename Func, typename R>
+	struct ContinuationResult
+	{
+		typedef typename std::decay<
+			decltype(std::declval<Func&>()(std::declval<R>()))
+		>::type type;
+	};
+
+	template <typename Func>
+	struct ContinuationResult<Func, void>
+	{
+		typedef typename std::decay<decltype(std::declval<Func&>()())>::type type;
+	};
+
+	/**
+	 * @brief Callable passing parent result on to continuation
+	 *
+	 */
+	template <typename Func, typename R>
+	struct ContinuationCall
+	{
+		decltype(auto) operator()() { return (*function)(parent->get()); }
+
+		Func *function;
+		FutureState<R> *parent;
+	};
+
+	template <typename Func>
+	struct ContinuationCall<Func, void>
+	{
+		decltype(auto) operator()()
+		{
+			parent->get();
+			return (*function)();
+		}
+
+		Func *function;
+		FutureState<void> *parent;
+	};
+
+	/**
+	 * @brief Future state for a continuation of another future
+	 *
+	 * @tparam U Continuation result type
+	 * @tparam R Parent result type
+	 * @tparam Func Continuation callable type
+	 */
+	template <typename U, typename R, typename Func>
+	class ContinuationState : public FutureState<U>
+	{
+	public:
+		/**
+		 * @brief Construct a new Continuation State object
+		 *
+		 * @param parent Parent state, reference is adopted
+		 * @param func Continuation callable
+		 */
+		template <typename F>
+		ContinuationState(FutureState<R> *parent, F &&func) :
+			FutureState<U>(parent->route()),
+			_parent(parent),
+			_function(std::forward<F>(func))
+		{
+		}
+
+		/**
+		 * @brief Destroy the Continuation State object
+		 *
+		 */
+		virtual ~ContinuationState()
+		{
+			_parent->release();
+		}
+
+		/**
+		 * @brief Run continuation on parent result
+		 *
+		 * Parent exceptions propagate to this state without calling the
+		 * continuation.
+		 *
+		 */
+		void run()
+		{
+			ContinuationCall<Func, R> call = { &_function, _parent };
+
+			try
+			{
+				FutureSetter<U>::run(*this, call);
+			}
+			catch (...)
+			{
+				this->setException(std::current_exception());
+			}
+		}
+
+	private:
+		/// @brief Parent state
+		FutureState<R> *_parent;
+
+		/// @brief Continuation callable
+		Func _function;
+	};
+
+#ifdef THREADUTILS_HAS_COROUTINES
+	/**
+	 * @brief Awaitable taking the result of a future
+	 *
+	 * The awaiting coroutine is resumed like a continuation: on the future's
+	 * pool, or on the completing thread if it has none.
+	 *
+	 * @tparam R Result type
+	 */
+	template <typename R>
+	class FutureAwaiter
+	{
+	public:
+		/**
+		 * @brief Construct a new Future Awaiter object adopting a state reference
+		 *
+		 * @param state Shared state
+		 */
+		explicit FutureAwaiter(FutureState<R> *state) :
+			_state(state)
+		{
+		}
+
+		FutureAwaiter(const FutureAwaiter &) = delete;
+		FutureAwaiter &operator=(const FutureAwaiter &) = delete;
+
+		~FutureAwaiter()
+		{
+			_state->release();
+		}
+
+		bool await_ready() const { return _state->ready(); }
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			_state->onReady(Task(ResumeTask(handle)));
+		}
+
+		R await_resume() { return _state->get(); }
+
+	private:
+		/// @brief Shared state
+		FutureState<R> *_state;
+	};
+
+	/**
+	 * @brief Coroutine promise completing a future, lets coroutines return Future<R>
+	 *
+	 * The coroutine starts running on the calling thread, continuations
+	 * (and coroutines awaiting it) run on whichever thread completes it.  If
+	 * the frame is destroyed before returning (its resumption cancelled by a
+	 * pool) the future holds a broken_promise error.
+	 *
+	 */
+	template <typename R>
+	class FuturePromiseBase
+	{
+	public:
+		FuturePromiseBase() :
+			_state(new FutureState<R>(ContinuationRoute()))
+		{
+		}
+
+		FuturePromiseBase(const FuturePromiseBase &) = delete;
+		FuturePromiseBase &operator=(const FuturePromiseBase &) = delete;
+
+		~FuturePromiseBase()
+		{
+			if (!_state->ready())
+			{
+				_state->setException(std::make_exception_ptr(
+					std::future_error(std::future_errc::broken_promise)
+				));
+			}
+
+			_state->release();
+		}
+
+		Future<R> get_return_object()
+		{
+			_state->retain();
+			return Future<R>(_state);
+		}
+
+		std::suspend_never initial_suspend() const noexcept { return {}; }
+
+		std::suspend_never final_suspend() const noexcept { return {}; }
+
+		void unhandled_exception() { _state->setException(std::current_exception()); }
+
+	protected:
+		/// @brief Shared state
+		FutureState<R> *_state;
+	};
+
+	template <typename R>
+	class FuturePromise : public FuturePromiseBase<R>
+	{
+	public:
+		template <typename V>
+		void return_value(V &&result) { this->_state->setValue(std::forward<V>(result)); }
+	};
+
+	template <>
+	class FuturePromise<void> : public FuturePromiseBase<void>
+	{
+	public:
+		void return_void() { _state->setValue(); }
+	};
+#endif
+
+	/**
+	 * @brief Handle to result of task submitted to threadpool
+	 *
+	 * @tparam R Result type
+	 */
+	template <typename R>
+	class Future
+	{
+	public:
+		/**
+		 * @brief Construct an empty Future object
+		 *
+		 */
+		Future() :
+			_state(nullptr)
+		{
+		}
+
+		/**
+		 * @brief Construct a Future object adopting a state reference
+		 *
+		 * @param state Shared state
+		 */
+		explicit Future(FutureState<R> *state) :
+			_state(state)
+		{
+		}
+
+		Future(Future &&other) noexcept :
+			_state(other._state)
+		{
+			other._state = nullptr;
+		}
+
+		Future &operator=(Future &&other) noexcept
+		{
+			if (this != &other)
+			{
+				if (_state != nullptr)
+				{
+					_state->release();
+				}
+
+				_state = other._state;
+				other._state = nullptr;
+			}
+
+			return *this;
+		}
+
+		Future(const Future &) = delete;
+		Future &operator=(const Future &) = delete;
+
+		/**
+		 * @brief Destroy the Future object
+		 *
+		 */
+		~Future()
+		{
+			if (_state != nullptr)
+			{
+				_state->release();
+			}
+		}
+
+		/**
+		 * @brief Returns whether future refers to a state
+		 *
+		 */
+		bool valid() const { return _state != nullptr; }
+
+		/**
+		 * @brief Returns whether result is available without blocking
+		 *
+		 */
+		bool ready() const { return _state->ready(); }
+
+		/**
+		 * @brief Block until result is ready
+		 *
+		 */
+		void wait() const { _state->wait(); }
+
+		/**
+		 * @brief Block until result is ready or timeout expires
+		 *
+		 * @param timeout Maximum time to wait
+		 * @return true Result ready
+		 * @return false Timed out
+		 */
+		template <typename Rep, typename Period>
+		bool waitFor(const std::chrono::duration<Rep, Period> &timeout) const
+		{
+			return _state->waitFor(timeout);
+		}
+
+		/**
+		 * @brief Wait for and take result.  Future is invalid afterwards.
+		 *
+		 * @return R Result, rethrows exception thrown by task
+		 */
+		R get()
+		{
+			FutureState<R> *state = _state;
+			_state = nullptr;
+
+			// Drop reference even if result rethrows
+			struct Release
+			{
+				~Release() { state->release(); }
+				FutureState<R> *state;
+			} release = { state };
+
+			return state->get();
+		}
+
+		/**
+		 * @brief Run continuation on pool with result once ready.
+		 *
+		 * No worker blocks waiting for the result.  Future is invalid
+		 * afterwards.
+		 *
+		 * @param func Continuation taking R (or nothing for void)
+		 * @return Future<U> Future of continuation result
+		 */
+		template <typename Func>
+		Future<typename ContinuationResult<typename std::decay<Func>::type, R>::type> then(Func &&func)
+		{
+			typedef typename std::decay<Func>::type F;
+			typedef typename ContinuationResult<F, R>::type U;
+			typedef ContinuationState<U, R, F> State;
+
+			// Continuation adopts our reference to parent
+			State *state = new State(_state, std::forward<Func>(func));
+			FutureState<R> *parent = _state;
+			_state = nullptr;
+
+			// One reference for returned future, one for continuation task
+			state->retain();
+			parent->onReady(Task(StateTask<State>(state)));
+
+			return Future<U>(state);
+		}
+
+#ifdef THREADUTILS_HAS_COROUTINES
+		/// @brief Coroutines may return a Future
+		typedef FuturePromise<R> promise_type;
+
+		/**
+		 * @brief Await result without blocking.  Future is invalid afterwards.
+		 *
+		 * @return FutureAwaiter<R> Awaitable producing R, rethrows exception thrown by task
+		 */
+		FutureAwaiter<R> operator co_await()
+		{
+			FutureState<R> *state = _state;
+			_state = nullptr;
+
+			return FutureAwaiter<R>(state);
+		}
+#endif
+
+	private:
+		/// @brief Shared state
+		FutureState<R> *_state;
+	};
+};
+
+#endif /* FUTURE_H_ */
@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file metrics.hpp
+ * @author Evan Stoddard
+ * @brief Always on pool counters and latency histograms
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Monotonic timestamp used by metrics
+	 *
+	 * @return uint64_t Nanoseconds since steady clock epoch
+	 */
+	inline uint64_t metricsNow()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+	}
+
+	/**
+	 * @brief Histogram of durations with power of two nanosecond buckets
+	 *
+	 * Bucket i counts durations below 2^i ns (and at least 2^(i-1) ns), the
+	 * last bucket counts everything longer.
+	 *
+	 */
+	struct LatencyHistogram
+	{
+		/// @brief Number of buckets (last one is ~550s and up)
+		static constexpr size_t NumBuckets = 40;
+
+		LatencyHistogram() :
+			buckets(),
+			count(0),
+			sumNanos(0)
+		{
+		}
+
+		/**
+		 * @brief Returns bucket duration falls in
+		 *
+		 * @param nanos Duration in nanoseconds
+		 */
+		static size_t bucketFor(uint64_t nanos)
+		{
+			size_t bucket = 0;
+			while (nanos != 0 && bucket < NumBuckets - 1)
+			{
+				nanos >>= 1;
+				bucket++;
+			}
+
+			return bucket;
+		}
+
+		/**
+		 * @brief Returns exclusive upper bound of bucket in nanoseconds
+		 *
+		 */
+		static uint64_t upperBound(size_t bucket) { return (uint64_t)1 << bucket; }
+
+		/**
+		 * @brief Estimate percentile as upper bound of bucket it falls in
+		 *
+		 * @param p Percentile (0 - 1)
+		 * @return uint64_t Duration in nanoseconds (0 if empty)
+		 */
+		uint64_t percentile(double p) const
+		{
+			if (count == 0)
+			{
+				return 0;
+			}
+
+			uint64_t rank = (uint64_t)(p * (count - 1)) + 1;
+			uint64_t seen = 0;
+			for (size_t i = 0; i < NumBuckets; i++)
+			{
+				seen += buckets[i];
+				if (seen >= rank)
+				{
+					return upperBound(i);
+				}
+			}
+
+			return upperBound(NumBuckets - 1);
+		}
+
+		/**
+		 * @brief Returns mean duration in nanoseconds
+		 *
+		 */
+		double mean() const { return count > 0 ? (double)sumNanos / count : 0.0; }
+
+		/// @brief Count per bucket
+		uint64_t buckets[NumBuckets];
+
+		/// @brief Number of durations recorded
+		uint64_t count;
+
+		/// @brief Sum of durations recorded
+		uint64_t sumNanos;
+	};
+
+	/**
+	 * @brief Live counters of one worker
+	 *
+	 * Only the owning worker writes its counters (except tasksEnqueued, and the
+	 * slot shared by non-workers), so recording is a plain load and store and
+	 * never contends.  Padding keeps neighbouring workers' counters off each
+	 * other's cache lines.
+	 *
+	 */
+	class WorkerMetrics
+	{
+	public:
+		WorkerMetrics() :
+			tasksEnqueued(0),
+			tasksCompleted(0),
+			queueWaitSum(0),
+			runTimeSum(0),
+			busy(false)
+		{
+			for (size_t i = 0; i < LatencyHistogram::NumBuckets; i++)
+			{
+				queueWait[i].store(0, std::memory_order_relaxed);
+				runTime[i].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * @brief Count tasks enqueued, safe from any thread
+		 *
+		 * @param count Number of tasks
+		 */
+		void addEnqueued(uint64_t count)
+		{
+			tasksEnqueued.fetch_add(count, std::memory_order_relaxed);
+		}
+
+		/**
+		 * @brief Record a completed task
+		 *
+		 * @param waitNanos Time task spent queued
+		 * @param runNanos Time task took to run
+		 * @param exclusive Caller is the only thread writing these counters
+		 */
+		void recordRun(uint64_t waitNanos, uint64_t runNanos, bool exclusive = true)
+		{
+			bump(queueWait[LatencyHistogram::bucketFor(waitNanos)], 1, exclusive);
+			bump(queueWaitSum, waitNanos, exclusive);
+			bump(runTime[LatencyHistogram::bucketFor(runNanos)], 1, exclusive);
+			bump(runTimeSum, runNanos, exclusive);
+
+			// Counted last, so a snapshot seeing it complete sees its histograms too
+			std::atomic_thread_fence(std::memory_order_release);
+			bump(tasksCompleted, 1, exclusive);
+		}
+
+		/**
+		 * @brief Add counters to histograms and totals of a snapshot
+		 *
+		 */
+		void accumulate(LatencyHistogram &waitOut, LatencyHistogram &runOut, uint64_t &enqueued, uint64_t &completed) const
+		{
+			completed += tasksCompleted.load(std::memory_order_acquire);
+
+			for (size_t i = 0; i < LatencyHistogram::NumBuckets; i++)
+			{
+				uint64_t waits = queueWait[i].load(std::memory_order_relaxed);
+				uint64_t runs = runTime[i].load(std::memory_order_relaxed);
+
+				waitOut.buckets[i] += waits;
+				waitOut.count += waits;
+				runOut.buckets[i] += runs;
+				runOut.count += runs;
+			}
+
+			waitOut.sumNanos += queueWaitSum.load(std::memory_order_relaxed);
+			runOut.sumNanos += runTimeSum.load(std::memory_order_relaxed);
+			enqueued += tasksEnqueued.load(std::memory_order_relaxed);
+		}
+
+	private:
+		/**
+		 * @brief Add to counter, without a locked instruction if single writer
+		 *
+		 */
+		static void bump(std::atomic<uint64_t> &counter, uint64_t value, bool exclusive)
+		{
+			if (!exclusive)
+			{
+				counter.fetch_add(value, std::memory_order_relaxed);
+				return;
+			}
+
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+	public:
+		/// @brief Tasks enqueued by this worker (or by non-workers for the shared slot)
+		std::atomic<uint64_t> tasksEnqueued;
+
+		/// @brief Tasks run to completion
+		std::atomic<uint64_t> tasksCompleted;
+
+		/// @brief Queue wait histogram buckets
+		std::atomic<uint64_t> queueWait[LatencyHistogram::NumBuckets];
+
+		/// @brief Run time histogram buckets
+		std::atomic<uint64_t> runTime[LatencyHistogram::NumBuckets];
+
+		/// @brief Sum of queue waits
+		std::atomic<uint64_t> queueWaitSum;
+
+		/// @brief Sum of run times
+		std::atomic<uint64_t> runTimeSum;
+
+		/// @brief Worker currently running a task
+		std::atomic_bool busy;
+
+	private:
+		/// @brief Keep next worker's counters off our last cache line
+		char _padding[64];
+	};
+
+	/**
+	 * @brief Point in time view of a pool's metrics
+	 *
+	 */
+	struct MetricsSnapshot
+	{
+		MetricsSnapshot() :
+			workers(0),
+			busyWorkers(0),
+			idleWorkers(0),
+			tasksEnqueued(0),
+			tasksCompleted(0),
+			tasksRejected(0),
+			tasksDropped(0),
+			queueDepth(0),
+			inputQueueDepth(0),
+			outputBufferDepth(0),
+			activeProcesses(0)
+		{
+		}
+
+		/**
+		 * @brief Export snapshot in Prometheus text format
+		 *
+		 * @param prefix Prefix of metric names
+		 * @return std::string Text export
+		 */
+		std::string toText(const std::string &prefix = "threadutils") const
+		{
+			std::ostringstream out;
+
+			writeValue(out, prefix + "_workers", "gauge", workers);
+			writeValue(out, prefix + "_busy_workers", "gauge", busyWorkers);
+			writeValue(out, prefix + "_idle_workers", "gauge", idleWorkers);
+			writeValue(out, prefix + "_tasks_enqueued_total", "counter", tasksEnqueued);
+			writeValue(out, prefix + "_tasks_completed_total", "counter", tasksCompleted);
+			writeValue(out, prefix + "_tasks_rejected_total", "counter", tasksRejected);
+			writeValue(out, prefix + "_tasks_dropped_total", "counter", tasksDropped);
+			writeValue(out, prefix + "_queue_depth", "gauge", queueDepth);
+			writeValue(out, prefix + "_input_queue_depth", "gauge", inputQueueDepth);
+			writeValue(out, prefix + "_output_buffer_depth", "gauge", outputBufferDepth);
+			writeValue(out, prefix + "_active_processes", "gauge", activeProcesses);
+
+			out << "# TYPE " << prefix << "_lane_queue_depth gauge\n";
+			for (size_t lane = 0; lane < laneDepths.size(); lane++)
+			{
+				out << prefix << "_lane_queue_depth{lane=\"" << lane << "\"} " << laneDepths[lane] << "\n";
+			}
+
+			writeHistogram(out, prefix + "_queue_wait_ns", queueWait);
+			writeHistogram(out, prefix + "_run_time_ns", runTime);
+
+			return out.str();
+		}
+
+		/// @brief Number of worker threads
+		uint32_t workers;
+
+		/// @brief Workers running a task
+		uint32_t busyWorkers;
+
+		/// @brief Workers not running a task
+		uint32_t idleWorkers;
+
+		/// @brief Tasks enqueued in total
+		uint64_t tasksEnqueued;
+
+		/// @brief Tasks run to completion in total
+		uint64_t tasksCompleted;
+
+		/// @brief Tasks rejected by a full queue's overflow policy
+		uint64_t tasksRejected;
+
+		/// @brief Tasks discarded to make room by DropOldest
+		uint64_t tasksDropped;
+
+		/// @brief Tasks waiting in runnable queue (and worker deques)
+		uint64_t queueDepth;
+
+		/// @brief Tasks waiting in input queue (buffered pools)
+		uint64_t inputQueueDepth;
+
+		/// @brief Results waiting in output buffer (buffered pools)
+		uint64_t outputBufferDepth;
+
+		/// @brief Input tasks taken but not yet output (buffered pools)
+		uint64_t activeProcesses;
+
+		/// @brief Tasks waiting in each priority lane of runnable queue (most urgent first)
+		std::vector<uint64_t> laneDepths;
+
+		/// @brief Time from enqueue to start of run
+		LatencyHistogram queueWait;
+
+		/// @brief Time taken to run
+		LatencyHistogram runTime;
+
+	private:
+		static void writeValue(std::ostringstream &out, const std::string &name, const char *type, uint64_t value)
+		{
+			out << "# TYPE " << name << " " << type << "\n";
+			out << name << " " << value << "\n";
+		}
+
+		static void writeHistogram(std::ostringstream &out, const std::string &name, const LatencyHistogram &histogram)
+		{
+			out << "# TYPE " << name << " histogram\n";
+
+			uint64_t cumulative = 0;
+			for (size_t i = 0; i < LatencyHistogram::NumBuckets - 1; i++)
+			{
+				cumulative += histogram.buckets[i];
+				// Prometheus bounds are inclusive, bucket i holds whole nanoseconds up to 2^i - 1
+				out << name << "_bucket{le=\"" << LatencyHistogram::upperBound(i) - 1 << "\"} " << cumulative << "\n";
+			}
+
+			out << name << "_bucket{le=\"+Inf\"} " << histogram.count << "\n";
+			out << name << "_sum " << histogram.sumNanos << "\n";
+			out << name << "_count " << histogram.count << "\n";
+		}
+	};
+};
+
+#endif /* METRICS_H_ */
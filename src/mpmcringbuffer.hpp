@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file mpmcringbuffer.hpp
+ * @author Evan Stoddard
+ * @brief Bounded lock-free multi producer, multi consumer ring buffer
+ */
+
+#ifndef MPMCRINGBUFFER_H_
+#define MPMCRINGBUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "optional.hpp"
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Bounded lock-free MPMC ring buffer.
+	 *
+	 * Every slot carries a sequence number telling producers and consumers
+	 * whose turn it is (Vyukov's bounded queue).  Slots are padded to a cache
+	 * line so neighbouring producers and consumers don't false share.
+	 *
+	 * @tparam T Element type
+	 */
+	template <typename T>
+	class MpmcRingBuffer
+	{
+	public:
+		/// @brief Assumed cache line size
+		static constexpr size_t CacheLineSize = 64;
+
+		/**
+		 * @brief Construct a new Mpmc Ring Buffer object
+		 *
+		 * @param capacity Capacity (rounded up to power of two)
+		 */
+		explicit MpmcRingBuffer(size_t capacity) :
+			_capacity(roundCapacity(capacity)),
+			_mask(_capacity - 1),
+			_memory(new unsigned char[_capacity * sizeof(Slot) + CacheLineSize]),
+			_enqueuePos(0),
+			_dequeuePos(0)
+		{
+			// Align slots to cache line
+			uintptr_t address = reinterpret_cast<uintptr_t>(_memory);
+			address = (address + CacheLineSize - 1) & ~(uintptr_t)(CacheLineSize - 1);
+			_slots = reinterpret_cast<Slot*>(address);
+
+			for (size_t i = 0; i < _capacity; i++)
+			{
+				new (&_slots[i]) Slot();
+				_slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * @brief Destroy the Mpmc Ring Buffer object
+		 *
+		 */
+		~MpmcRingBuffer()
+		{
+			// Destroy anything left in buffer
+			size_t end = _enqueuePos.load(std::memory_order_relaxed);
+			for (size_t pos = _dequeuePos.load(std::memory_order_relaxed); pos != end; pos++)
+			{
+				reinterpret_cast<T*>(&_slots[pos & _mask].storage)->~T();
+			}
+
+			for (size_t i = 0; i < _capacity; i++)
+			{
+				_slots[i].~Slot();
+			}
+
+			delete[] _memory;
+		}
+
+		MpmcRingBuffer(const MpmcRingBuffer &) = delete;
+		MpmcRingBuffer &operator=(const MpmcRingBuffer &) = delete;
+
+		/**
+		 * @brief Attempt to push value.  Value is only moved from on success.
+		 *
+		 * @param value Value to push
+		 * @return true Value pushed
+		 * @return false Buffer full
+		 */
+		bool tryPush(T &&value)
+		{
+			Slot *slot = claim(_enqueuePos, 0);
+			if (slot == nullptr)
+			{
+				return false;
+			}
+
+			new (&slot->storage) T(std::move(value));
+			slot->sequence.store(slot->turn + 1, std::memory_order_release);
+
+			return true;
+		}
+
+		/**
+		 * @brief Attempt to push copy of value
+		 *
+		 * @param value Value to push
+		 * @return true Value pushed
+		 * @return false Buffer full
+		 */
+		bool tryPush(const T &value)
+		{
+			T copy(value);
+			return tryPush(std::move(copy));
+		}
+
+		/**
+		 * @brief Attempt to pop value
+		 *
+		 * @param value Popped value
+		 * @return true Value popped
+		 * @return false Buffer empty
+		 */
+		bool tryPop(T &value)
+		{
+			Slot *slot = claim(_dequeuePos, 1);
+			if (slot == nullptr)
+			{
+				return false;
+			}
+
+			T *stored = reinterpret_cast<T*>(&slot->storage);
+			value = std::move(*stored);
+			stored->~T();
+			slot->sequence.store(slot->turn + _mask + 1, std::memory_order_release);
+
+			return true;
+		}
+
+		/**
+		 * @brief Attempt to pop value without needing a default constructed T
+		 *
+		 * @return Optional<T> Popped value, empty if buffer empty
+		 */
+		Optional<T> tryPop()
+		{
+			Optional<T> value;
+
+			Slot *slot = claim(_dequeuePos, 1);
+			if (slot == nullptr)
+			{
+				return value;
+			}
+
+			T *stored = reinterpret_cast<T*>(&slot->storage);
+			value.emplace(std::move(*stored));
+			stored->~T();
+			slot->sequence.store(slot->turn + _mask + 1, std::memory_order_release);
+
+			return value;
+		}
+
+		/**
+		 * @brief Approximate number of items in buffer
+		 *
+		 * @return size_t Number of items
+		 */
+		size_t size() const
+		{
+			size_t enqueued = _enqueuePos.load(std::memory_order_relaxed);
+			size_t dequeued = _dequeuePos.load(std::memory_order_relaxed);
+			return enqueued > dequeued ? enqueued - dequeued : 0;
+		}
+
+		/**
+		 * @brief Returns whether buffer appears empty
+		 *
+		 */
+		bool empty() const { return size() == 0; }
+
+		/**
+		 * @brief Returns capacity of buffer
+		 *
+		 */
+		size_t capacity() const { return _capacity; }
+
+	private:
+		/**
+		 * @brief Cache line padded slot
+		 *
+		 */
+		struct alignas(CacheLineSize) Slot
+		{
+			/// @brief Position of the operation whose turn it is
+			std::atomic<size_t> sequence;
+
+			/// @brief Position claimed by last producer or consumer
+			size_t turn;
+
+			/// @brief Storage for element
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		};
+
+		/**
+		 * @brief Claim slot at position for producer (offset 0) or consumer (offset 1)
+		 *
+		 * @param position Enqueue or dequeue position
+		 * @param offset Sequence offset meaning slot is ready for us
+		 * @return Slot* Claimed slot or nullptr if full/empty
+		 */
+		Slot *claim(std::atomic<size_t> &position, size_t offset)
+		{
+			size_t pos = position.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				Slot *slot = &_slots[pos & _mask];
+				size_t sequence = slot->sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + offset);
+
+				if (diff == 0)
+				{
+					// Slot ready, race others for position
+					if (position.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						slot->turn = pos;
+						return slot;
+					}
+				}
+				else if (diff < 0)
+				{
+					// Full (producer) or empty (consumer)
+					return nullptr;
+				}
+				else
+				{
+					// Somebody else took position, catch up
+					pos = position.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/**
+		 * @brief Round capacity up to next power of two
+		 *
+		 */
+		static size_t roundCapacity(size_t capacity)
+		{
+			size_t rounded = 2;
+			while (rounded < capacity)
+			{
+				rounded <<= 1;
+			}
+
+			return rounded;
+		}
+
+	private:
+		/// @brief Number of slots
+		size_t _capacity;
+
+		/// @brief Mask to wrap positions
+		size_t _mask;
+
+		/// @brief Raw memory backing slots
+		unsigned char *_memory;
+
+		/// @brief Cache line aligned slots
+		Slot *_slots;
+
+		/// @brief Keep positions off the slot pointer's cache line
+		char _padding0[CacheLineSize];
+
+		/// @brief Next position to push to
+		std::atomic<size_t> _enqueuePos;
+
+		/// @brief Keep producer and consumer positions apart
+		char _padding1[CacheLineSize - sizeof(std::atomic<size_t>)];
+
+		/// @brief Next position to pop from
+		std::atomic<size_t> _dequeuePos;
+	};
+};
+
+#endif /* MPMCRINGBUFFER_H_ */
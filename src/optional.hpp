@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file optional.hpp
+ * @author Evan Stoddard
+ * @brief Optional value, std::optional when available
+ */
+
+#ifndef OPTIONAL_H_
+#define OPTIONAL_H_
+
+#if __cplusplus >= 201703L
+#include <optional>
+#else
+#include <new>
+#include <type_traits>
+#include <utility>
+#endif
+
+namespace ThreadUtils
+{
+#if __cplusplus >= 201703L
+	template <typename T>
+	using Optional = std::optional<T>;
+#else
+	/**
+	 * @brief Minimal stand in for std::optional on C++14.
+	 *
+	 * Only the subset of the std::optional interface used by ThreadUtils is
+	 * provided, so code written against it also compiles with std::optional.
+	 *
+	 * @tparam T Value type
+	 */
+	template <typename T>
+	class Optional
+	{
+	public:
+		/**
+		 * @brief Construct an empty Optional object
+		 *
+		 */
+		Optional() noexcept :
+			_hasValue(false)
+		{
+		}
+
+		/**
+		 * @brief Construct an Optional object holding a copy of value
+		 *
+		 */
+		Optional(const T &value) :
+			_hasValue(false)
+		{
+			emplace(value);
+		}
+
+		/**
+		 * @brief Construct an Optional object holding moved value
+		 *
+		 */
+		Optional(T &&value) :
+			_hasValue(false)
+		{
+			emplace(std::move(value));
+		}
+
+		Optional(const Optional &other) :
+			_hasValue(false)
+		{
+			if (other._hasValue)
+			{
+				emplace(*other);
+			}
+		}
+
+		Optional(Optional &&other) noexcept(std::is_nothrow_move_constructible<T>::value) :
+			_hasValue(false)
+		{
+			if (other._hasValue)
+			{
+				emplace(std::move(*other));
+			}
+		}
+
+		Optional &operator=(const Optional &other)
+		{
+			if (this != &other)
+			{
+				reset();
+				if (other._hasValue)
+				{
+					emplace(*other);
+				}
+			}
+
+			return *this;
+		}
+
+		Optional &operator=(Optional &&other) noexcept(std::is_nothrow_move_constructible<T>::value)
+		{
+			if (this != &other)
+			{
+				reset();
+				if (other._hasValue)
+				{
+					emplace(std::move(*other));
+				}
+			}
+
+			return *this;
+		}
+
+		/**
+		 * @brief Destroy the Optional object
+		 *
+		 */
+		~Optional()
+		{
+			reset();
+		}
+
+		/**
+		 * @brief Construct value in place, destroying any held value
+		 *
+		 * @return T& Constructed value
+		 */
+		template <typename ...Args>
+		T &emplace(Args &&...args)
+		{
+			reset();
+			new (&_storage) T(std::forward<Args>(args)...);
+			_hasValue = true;
+
+			return **this;
+		}
+
+		/**
+		 * @brief Destroy held value
+		 *
+		 */
+		void reset()
+		{
+			if (_hasValue)
+			{
+				(**this).~T();
+				_hasValue = false;
+			}
+		}
+
+		/**
+		 * @brief Returns whether a value is held
+		 *
+		 */
+		bool has_value() const { return _hasValue; }
+		explicit operator bool() const { return _hasValue; }
+
+		/**
+		 * @brief Access held value (must have one)
+		 *
+		 */
+		T &operator*() & { return *reinterpret_cast<T*>(&_storage); }
+		const T &operator*() const & { return *reinterpret_cast<const T*>(&_storage); }
+		T &&operator*() && { return std::move(*reinterpret_cast<T*>(&_storage)); }
+		T *operator->() { return reinterpret_cast<T*>(&_storage); }
+		const T *operator->() const { return reinterpret_cast<const T*>(&_storage); }
+
+		/**
+		 * @brief Returns held value or fallback
+		 *
+		 */
+		template <typename U>
+		T value_or(U &&fallback) const &
+		{
+			return _hasValue ? **this : static_cast<T>(std::forward<U>(fallback));
+		}
+
+		template <typename U>
+		T value_or(U &&fallback) &&
+		{
+			return _hasValue ? std::move(**this) : static_cast<T>(std::forward<U>(fallback));
+		}
+
+	private:
+		/// @brief Storage for value
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage;
+
+		/// @brief Value constructed in storage
+		bool _hasValue;
+	};
+#endif
+};
+
+#endif /* OPTIONAL_H_ */
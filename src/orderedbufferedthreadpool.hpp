@@ -11,298 +11,989 @@
 #ifndef ORDEREDBUFFEREDTHREADPOOL_HPP_
 #define ORDEREDBUFFEREDTHREADPOOL_HPP_
 
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
 #include "bufferedthreadpool.hpp"
 
 namespace ThreadUtils
 {
-	template <typename T, typename TagType>
+	/**
+	 * @brief Snapshot of reorder window statistics
+	 *
+	 */
+	struct ReorderStats
+	{
+		/// @brief Number of items that may be in flight or awaiting release
+		uint64_t windowSize;
+
+		/// @brief Items released in order so far
+		uint64_t itemsReleased;
+
+		/// @brief Items that finished before an earlier item and had to wait
+		uint64_t itemsHeldBack;
+
+		/// @brief Most items held back at once
+		uint64_t maxHeldBack;
+
+		/// @brief Times a worker waited with input queued because window was full
+		uint64_t headOfLineBlocks;
+	};
+
+	/**
+	 * @brief std::hash of tag type if it has one, void otherwise
+	 *
+	 */
+	template <typename TagType>
+	struct DefaultTagHash
+	{
+		typedef typename std::conditional<
+			std::is_default_constructible<std::hash<TagType>>::value,
+			std::hash<TagType>,
+			void
+		>::type type;
+	};
+
+	/**
+	 * @brief Buffered threadpool releasing output in the order input was fed
+	 *
+	 * A task completing the item it's running finds its reorder slot
+	 * directly.  Completing another item by tag looks the tag up in a hash
+	 * index of tags in flight, or without a hash searches the window with
+	 * TagType's operator==.
+	 *
+	 * @tparam T Output type
+	 * @tparam TagType Tag identifying each input
+	 * @tparam TagHash Hash of TagType indexing tags in flight (void for none, std::hash if TagType has one)
+	 */
+	template <typename T, typename TagType, typename TagHash = typename DefaultTagHash<TagType>::type>
 	class OrderedBufferedThreadpool : public BufferedThreadpool<T>
 	{
 	public:
+		/// @brief Default reorder window size as multiple of thread count
+		static constexpr uint32_t DefaultWindowFactor = 4;
+
+		/**
+		 * @brief Handle on the reorder slot of an item in flight
+		 *
+		 * Given to tasks fed with feedQueueWithTicket.  Completing an item
+		 * through its ticket indexes the reorder ring directly, without
+		 * looking up a tag.
+		 *
+		 */
+		class Ticket
+		{
+		public:
+			/**
+			 * @brief Returns sequence number of item, its position in input order
+			 *
+			 */
+			uint64_t sequence() const { return _sequence; }
+
+		private:
+			friend class OrderedBufferedThreadpool;
+
+			explicit Ticket(uint64_t sequence) :
+				_sequence(sequence)
+			{
+			}
+
+		private:
+			/// @brief Sequence number of item
+			uint64_t _sequence;
+		};
+
 		/**
 		 * @brief Construct a new Ordered Buffered Threadpool object
 		 *
+		 * The reorder window bounds how many items may be running or finished
+		 * and waiting for an earlier item, and so how many results are held in
+		 * memory.  A window larger than the thread count lets workers keep
+		 * taking input while a slow item holds up the head.
+		 *
 		 * @param numThreads Number of threads
+		 * @param reorderWindow Reorder window size (0 for DefaultWindowFactor * numThreads)
 		 */
-		explicit OrderedBufferedThreadpool(uint32_t numThreads) :
+		explicit OrderedBufferedThreadpool(uint32_t numThreads, size_t reorderWindow = 0) :
 			BufferedThreadpool<T>(numThreads),
-			_outputContainers(numThreads),
+			_reorderSlots(reorderWindow > 0 ? reorderWindow : (size_t)numThreads * DefaultWindowFactor),
+			_startSequence(0),
+			_releaseSequence(0),
+			_heldBack(0),
+			_itemsHeldBack(0),
+			_maxHeldBack(0),
+			_headOfLineBlocks(0),
 			_maxInputQueueSize(-1)
 		{
+			// Never more tags in flight than slots, so the index never rehashes
+			reserveTags(IndexedTags());
+		}
+
+		/**
+		 * @brief Destroy the Ordered Buffered Threadpool object
+		 *
+		 * Shuts down while the input tags and reorder window are still around.
+		 *
+		 */
+		virtual ~OrderedBufferedThreadpool()
+		{
+			BufferedThreadpool<T>::shutdown();
 		}
 
 		/**
 		 * @brief Feed input queue with runnable and tag
 		 *
-		 * @param runnable Runnable
+		 * @param runnable Runnable, deleted after it has run (or if rejected)
+		 * @param tag Tag
+		 * @return true Runnable fed
+		 * @return false Input queue full, see setBackpressure
+		 */
+		bool feedQueue(AbstractRunnable *runnable, TagType tag)
+		{
+			return feedQueue(Task(runnable), tag);
+		}
+
+		/**
+		 * @brief Feed input queue with task and tag
+		 *
+		 * @param task Task, cancelled if rejected
 		 * @param tag Tag
+		 * @return true Task fed
+		 * @return false Input queue full (see setMaxInputQueueSize and setBackpressure) or pool shutting down
+		 */
+		bool feedQueue(Task task, TagType tag)
+		{
+			return feedInput(std::move(task), Optional<TagType>(std::move(tag)));
+		}
+
+		/**
+		 * @brief Feed input queue with function taking the item's Ticket
+		 *
+		 * The function completes its item with feedOutputQueue(value, ticket)
+		 * or invalidateTicket(ticket), which find its reorder slot from the
+		 * ticket alone.  The item has no tag.
+		 *
+		 * @tparam Func Function taking Ticket
+		 * @param func Function to run
+		 * @return true Function fed
+		 * @return false Input queue full (see setMaxInputQueueSize and setBackpressure) or pool shutting down
+		 */
+		template <typename Func>
+		bool feedQueueWithTicket(Func &&func)
+		{
+			return feedInput(
+				Task::create<TicketCall<typename std::decay<Func>::type>>(std::forward<Func>(func)),
+				Optional<TagType>()
+			);
+		}
+
+		/**
+		 * @brief Feed input queue with range of tasks and their tags under one lock
+		 *
+		 * Stops at the first task rejected by the overflow policy.
+		 *
+		 * @tparam TaskIterator Iterator over Task or AbstractRunnable*, tasks are moved from
+		 * @tparam TagIterator Iterator over TagType
+		 * @param begin First task
+		 * @param end One past last task
+		 * @param tags Tag of first task
+		 * @return size_t Number of tasks fed
 		 */
-		void feedQueue(AbstractRunnable *runnable, TagType tag)
+		template <typename TaskIterator, typename TagIterator>
+		size_t feedQueueBulk(TaskIterator begin, TaskIterator end, TagIterator tags)
 		{
+			// Dropped tasks are cancelled after lock is released
+			std::vector<Task> dropped;
+
 			// Take input mutex
-			std::unique_lock<std::mutex> l(BufferedThreadpool<T>::_queueMutex);
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_queueMutex);
 
-			if (BufferedThreadpool<T>::_inputQueue.size() >= _maxInputQueueSize)
+			std::chrono::steady_clock::time_point deadline = BufferedThreadpool<T>::enqueueDeadline();
+			uint64_t now = metricsNow();
+			size_t count = 0;
+			for (TaskIterator it = begin; it != end; ++it, ++tags, count++)
 			{
-				l.unlock();
-				return;
+				if (inputFull() || !BufferedThreadpool<T>::waitForRoom(l, BufferedThreadpool<T>::_inputQueue, deadline, DropInput{*this, dropped}))
+				{
+					break;
+				}
+
+				// Push task and its tag
+				BufferedThreadpool<T>::_inputQueue.emplace_back(std::move(*it));
+				BufferedThreadpool<T>::_inputQueue.back().setEnqueueTime(now);
+				_inputTags.emplace_back(*tags);
 			}
+			THREADUTILS_PLOT("Input queue depth", BufferedThreadpool<T>::_inputQueue.size());
 
-			// Push runnable and process container
-			Container container;
-			container.tag = tag;
-			BufferedThreadpool<T>::_inputQueue.emplace_back(runnable);
-			_inputContainers.emplace_back(container);
+			// Release mutex and wake one worker per task
+			l.unlock();
+			BufferedThreadpool<T>::cancelTasks(dropped);
+			BufferedThreadpool<T>::enqueuerMetrics().addEnqueued(count);
+			BufferedThreadpool<T>::wakeWorkers(count);
 
-			std::unique_lock<std::mutex> ol(BufferedThreadpool<T>::_outputMutex);
-			_outputOrder.emplace_back(tag);
-			ol.unlock();
+			return count;
+		}
 
-			// Release mutex and signal condition variable
-			l.unlock();
-			BufferedThreadpool<T>::_inputCV.notify_all();
+		/**
+		 * @brief Feed output queue with copy of value
+		 *
+		 * A tag matching the item the calling task is running completes that
+		 * item.  Any other tag completes the earliest item in flight with it.
+		 *
+		 * @param value Value to feed queue
+		 * @param tag Tag to order output
+		 * @throws std::invalid_argument Tag not in flight
+		 */
+		void feedOutputQueue(const T &value, const TagType &tag)
+		{
+			// Update output buffer
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_outputMutex);
+			updateOutputBuffer(l, sequenceOfTag(l, tag), &value);
 		}
 
 		/**
-		 * @brief Feed output queue
+		 * @brief Feed output queue, moving value into buffer
 		 *
 		 * @param value Value to feed queue
 		 * @param tag Tag to order output
+		 * @throws std::invalid_argument Tag not in flight
 		 */
-		void feedOutputQueue(T value, TagType tag)
+		void feedOutputQueue(T &&value, const TagType &tag)
 		{
 			// Update output buffer
-			updateOutputBuffer(value, tag, true);
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_outputMutex);
+			updateOutputBuffer(l, sequenceOfTag(l, tag), &value);
+		}
+
+		/**
+		 * @brief Feed output queue with copy of value, completing ticket's item
+		 *
+		 * @param value Value to feed queue
+		 * @param ticket Ticket of item
+		 * @throws std::invalid_argument Item already completed
+		 */
+		void feedOutputQueue(const T &value, Ticket ticket)
+		{
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_outputMutex);
+			updateOutputBuffer(l, sequenceOfTicket(l, ticket), &value);
+		}
+
+		/**
+		 * @brief Feed output queue, moving value into buffer and completing ticket's item
+		 *
+		 * @param value Value to feed queue
+		 * @param ticket Ticket of item
+		 * @throws std::invalid_argument Item already completed
+		 */
+		void feedOutputQueue(T &&value, Ticket ticket)
+		{
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_outputMutex);
+			updateOutputBuffer(l, sequenceOfTicket(l, ticket), &value);
 		}
 
 		/**
 		 * @brief Invalidate tag
 		 *
 		 * @param tag Tag to invalidate
+		 * @throws std::invalid_argument Tag not in flight
 		 */
-		void invalidateTag(TagType tag)
+		void invalidateTag(const TagType &tag)
 		{
-			updateOutputBuffer(T(), tag, false);
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_outputMutex);
+			updateOutputBuffer<T>(l, sequenceOfTag(l, tag), nullptr);
+		}
+
+		/**
+		 * @brief Complete ticket's item without output
+		 *
+		 * @param ticket Ticket of item
+		 * @throws std::invalid_argument Item already completed
+		 */
+		void invalidateTicket(Ticket ticket)
+		{
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_outputMutex);
+			updateOutputBuffer<T>(l, sequenceOfTicket(l, ticket), nullptr);
 		}
 
 		/**
 		 * @brief Set the Max Input Queue Size object
 		 *
+		 * Tasks fed to a queue at this size are rejected (and cancelled),
+		 * whatever the overflow policy.  Independent of setBackpressure, which
+		 * bounds enqueue as well and applies its policy below this limit.
+		 *
 		 * @param maxSize Max size of queue (-1 unlimited)
 		 */
 		void setMaxInputQueueSize(uint64_t maxSize)
 		{
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_queueMutex);
 			_maxInputQueueSize = maxSize;
 		}
 
+		/**
+		 * @brief Returns reorder window size
+		 *
+		 */
+		size_t reorderWindow() const { return _reorderSlots.size(); }
+
+		/**
+		 * @brief Returns snapshot of reorder window statistics
+		 *
+		 * @return ReorderStats Statistics
+		 */
+		ReorderStats reorderStats()
+		{
+			// Take lock
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_outputMutex);
+
+			ReorderStats stats;
+			stats.windowSize = _reorderSlots.size();
+			stats.itemsReleased = _releaseSequence;
+			stats.itemsHeldBack = _itemsHeldBack;
+			stats.maxHeldBack = _maxHeldBack;
+			stats.headOfLineBlocks = _headOfLineBlocks;
+
+			return stats;
+		}
+
 	protected:
+		/**
+		 * @brief Move every queued task out, dropping tags of input.  Queue mutex held.
+		 *
+		 * @param out Tasks taken
+		 */
+		virtual void takeQueued(std::vector<Task> &out) override
+		{
+			BufferedThreadpool<T>::takeQueued(out);
+			_inputTags.clear();
+		}
+
+		/**
+		 * @brief Predicate for determining if processing thread to be run
+		 *
+		 * Input only counts while the reorder window has a free slot, so
+		 * workers sleep rather than spin while the head item is running.
+		 *
+		 */
+		virtual bool inputPredicate() override
+		{
+			return
+				!BufferedThreadpool<T>::_poolRunning ||
+				!BufferedThreadpool<T>::_queue.empty() ||
+				(!BufferedThreadpool<T>::_inputQueue.empty() && windowHasRoom());
+		}
+
 		/**
 		 * @brief Process run in threads
 		 *
 		 */
 		virtual void threadRunner() override
 		{
-			// While pool active
-			while (BufferedThreadpool<T>::poolRunning())
+			// Identity (and context) of this worker, passed to every task run
+			const typename BufferedThreadpool<T>::WorkerIdentity &worker = BufferedThreadpool<T>::currentWorker();
+
+			// Spin budget before parking
+			AdaptiveSpin spin;
+
+			// While pool active (and worker still wanted)
+			while (BufferedThreadpool<T>::workerWanted())
 			{
 				// Grab lock
-				std::unique_lock<std::mutex> l(BufferedThreadpool<T>::_queueMutex);
+				std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_queueMutex);
+
+				// Task to run
+				Task task;
 
-				// Pointer to runnable
-				AbstractRunnable *runnable = nullptr;
+				// Sequence of task if taken from input queue
+				bool sequenced = false;
+				uint64_t sequence = 0;
+
+				// Count waits caused only by a full window
+				if (
+					BufferedThreadpool<T>::_queue.empty() &&
+					!BufferedThreadpool<T>::_inputQueue.empty() &&
+					!windowHasRoom()
+				)
+				{
+					_headOfLineBlocks++;
+				}
 
 				// Wait for change in queue or pool status
-				BufferedThreadpool<T>::_inputCV.wait(l, [&](){ return BufferedThreadpool<T>::inputPredicate(); });
+				BufferedThreadpool<T>::waitForInput(l, spin);
 
-				// If pool killed
-				if (!BufferedThreadpool<T>::poolRunning())
+				// If pool killed (or worker retired)
+				if (!BufferedThreadpool<T>::workerWanted())
 				{
 					// Release lock
 					l.unlock();
 					break;
 				}
 
-				// Attempt to take output lock
-				std::unique_lock<std::mutex> ol(BufferedThreadpool<T>::_outputMutex);
-
-				// If threadpool has capacity to pull from input queue
-				if
-				(
+				// If reorder window has a slot for the next input (and no urgent lane is waiting)
+				if (
+					!BufferedThreadpool<T>::_queue.hasUrgent() &&
 					!BufferedThreadpool<T>::_inputQueue.empty() &&
-					BufferedThreadpool<T>::_activeProcesses != BufferedThreadpool<T>::_numThreads
+					windowHasRoom()
 				)
 				{
-					runnable = BufferedThreadpool<T>::_inputQueue.front();
+					task = std::move(BufferedThreadpool<T>::_inputQueue.front());
 					BufferedThreadpool<T>::_inputQueue.pop_front();
+					BufferedThreadpool<T>::signalRoom();
 					BufferedThreadpool<T>::_activeProcesses++;
-
-					// Find and update first available container
-					for (auto &container : _outputContainers)
+					THREADUTILS_PLOT("Input queue depth", BufferedThreadpool<T>::_inputQueue.size());
+					THREADUTILS_PLOT("Active processes", BufferedThreadpool<T>::_activeProcesses.load());
+
+					// Claim slot for next sequence number
+					std::unique_lock<ProfiledMutex> ol(BufferedThreadpool<T>::_outputMutex);
+					sequence = _startSequence++;
+					sequenced = true;
+
+					// Tagged items can be looked up by tag from now on
+					Slot &slot = slotFor(sequence);
+					slot.inFlight = true;
+					if (_inputTags.front())
 					{
-						if (container.slotAvailable)
-						{
-							container = _inputContainers.front();
-							container.slotAvailable = false;
-							_inputContainers.pop_front();
-							break;
-						}
+						slot.tag.emplace(std::move(*_inputTags.front()));
+						indexTag(sequence, slot, IndexedTags());
 					}
+					ol.unlock();
 
+					_inputTags.pop_front();
 				}
-				else if (!BufferedThreadpool<T>::_queue.empty())
+				else if (BufferedThreadpool<T>::_queue.pop(task))
 				{
-					runnable = BufferedThreadpool<T>::_queue.front();
-					BufferedThreadpool<T>::_queue.pop_front();
+					BufferedThreadpool<T>::signalRoom();
 				}
 				else
 				{
 					l.unlock();
-					ol.unlock();
+
+					// Nothing this worker can take while draining, others finish the window
+					if (BufferedThreadpool<T>::_draining)
+					{
+						break;
+					}
+
 					continue;
 				}
 
-				// Release output lock
-				ol.unlock();
-
 				// Release lock
 				l.unlock();
 
-				// Execute runnable
-				runnable->run();
+				// Let the task find its own item's slot
+				CurrentItem &current = currentItem();
+				current.pool = sequenced ? this : nullptr;
+				current.sequence = sequence;
+
+				// Execute task, destroying it when done
+				BufferedThreadpool<T>::runTask(task, worker);
 
-				// Delete runnable
-				delete runnable;
+				current.pool = nullptr;
 			}
 		}
 
 	private:
+		/// @brief Marks end of a run of items sharing a tag
+		static constexpr uint64_t NoSequence = std::numeric_limits<uint64_t>::max();
+
+		/// @brief Whether tags in flight are indexed by TagHash
+		typedef std::integral_constant<bool, !std::is_void<TagHash>::value> IndexedTags;
+
 		/**
-		 * @brief Update the output buffer
+		 * @brief Earliest and latest unfinished item with a tag
 		 *
-		 * @param value Value to feed buffer
-		 * @param tag Tag associated with update
-		 * @param valid Whether value valid or not
 		 */
-		void updateOutputBuffer(T value, TagType tag, bool valid)
+		struct TagRun
 		{
-			// Take lock
-			std::unique_lock<std::mutex> l(BufferedThreadpool<T>::_outputMutex);
+			uint64_t first;
+			uint64_t last;
+		};
+
+		/**
+		 * @brief Stands in for the tag index when TagHash is void
+		 *
+		 */
+		struct NoTagIndex
+		{
+		};
+
+		/// @brief Runs of unfinished tagged items, by tag
+		typedef typename std::conditional<
+			IndexedTags::value,
+			std::unordered_map<
+				TagType,
+				TagRun,
+				TagHash,
+				std::equal_to<TagType>,
+				TaskStdAllocator<std::pair<const TagType, TagRun>>
+			>,
+			NoTagIndex
+		>::type TagIndex;
+
+		/**
+		 * @brief Slot of reorder ring holding an item in flight
+		 *
+		 */
+		struct Slot
+		{
+			Slot() :
+				value(),
+				tag(),
+				previousSameTag(NoSequence),
+				nextSameTag(NoSequence),
+				inFlight(false),
+				finishedProcessing(false)
+			{}
+
+			/// @brief Finished value waiting for release (empty if invalidated)
+			Optional<T> value;
+
+			/// @brief Tag of unfinished item (empty if ticketed or finished)
+			Optional<TagType> tag;
 
-			// Bool indicating container found
-			bool foundContainer = false;
-			Container matchingContainer;
+			/// @brief Unfinished items fed before and after this one with the same tag (indexed tags only)
+			uint64_t previousSameTag;
+			uint64_t nextSameTag;
 
-			// Iterate through output containers
-			for (auto &container : _outputContainers)
+			bool inFlight;
+			bool finishedProcessing;
+		};
+
+		/**
+		 * @brief Callable passing the Ticket of the item being run to a function
+		 *
+		 */
+		template <typename Func>
+		struct TicketCall
+		{
+			template <typename F>
+			explicit TicketCall(F &&func) :
+				function(std::forward<F>(func))
 			{
-				if (container.tag == tag)
+			}
+
+			void operator()()
+			{
+				// Set by the worker that took the item from the input queue
+				function(Ticket(currentItem().sequence));
+			}
+
+			Func function;
+		};
+
+		/**
+		 * @brief Sequenced item the calling worker is running
+		 *
+		 */
+		struct CurrentItem
+		{
+			/// @brief Pool item belongs to (nullptr if none)
+			OrderedBufferedThreadpool *pool;
+
+			/// @brief Sequence number of item
+			uint64_t sequence;
+		};
+
+		/**
+		 * @brief Drops oldest input task and its tag for waitForRoom
+		 *
+		 */
+		struct DropInput
+		{
+			/// @brief Pool to drop from
+			OrderedBufferedThreadpool &pool;
+
+			/// @brief Dropped tasks, destroyed once lock is released
+			std::vector<Task> &dropped;
+
+			void operator()()
+			{
+				dropped.emplace_back(std::move(pool._inputQueue.front()));
+				pool._inputQueue.pop_front();
+				pool._inputTags.pop_front();
+			}
+		};
+
+		/**
+		 * @brief Returns sequenced item calling worker is running
+		 *
+		 */
+		static CurrentItem &currentItem()
+		{
+			static thread_local CurrentItem item = { nullptr, 0 };
+			return item;
+		}
+
+		/**
+		 * @brief Returns whether input queue is at its own limit, counting a rejection if so.  Queue mutex held.
+		 *
+		 */
+		bool inputFull()
+		{
+			if (BufferedThreadpool<T>::_inputQueue.size() < _maxInputQueueSize)
+			{
+				return false;
+			}
+
+			BufferedThreadpool<T>::_tasksRejected++;
+			return true;
+		}
+
+		/**
+		 * @brief Returns reorder slot of sequence number
+		 *
+		 */
+		Slot &slotFor(uint64_t sequence)
+		{
+			return _reorderSlots[sequence % _reorderSlots.size()];
+		}
+
+		/**
+		 * @brief Whether another item may start without overwriting a slot
+		 *
+		 */
+		bool windowHasRoom() const
+		{
+			return _startSequence - _releaseSequence < _reorderSlots.size();
+		}
+
+		/**
+		 * @brief Feed input queue with task and tag (none if ticketed)
+		 *
+		 * @param task Task, cancelled if rejected
+		 * @param tag Tag of item
+		 * @return true Task fed
+		 * @return false Input queue full or pool shutting down
+		 */
+		bool feedInput(Task task, Optional<TagType> tag)
+		{
+			// Dropped tasks are cancelled after lock is released
+			std::vector<Task> dropped;
+
+			// Take input mutex
+			std::unique_lock<ProfiledMutex> l(BufferedThreadpool<T>::_queueMutex);
+
+			// Input limit turns new task away whatever the overflow policy
+			if (inputFull())
+			{
+				l.unlock();
+				task.cancel();
+				return false;
+			}
+
+			// Wait for room
+			if (!BufferedThreadpool<T>::waitForRoom(
+				l,
+				BufferedThreadpool<T>::_inputQueue,
+				BufferedThreadpool<T>::enqueueDeadline(),
+				DropInput{*this, dropped}
+			))
+			{
+				l.unlock();
+				task.cancel();
+				return false;
+			}
+
+			// Push task and its tag (if any)
+			task.setEnqueueTime(metricsNow());
+			BufferedThreadpool<T>::_inputQueue.emplace_back(std::move(task));
+			_inputTags.emplace_back(std::move(tag));
+			THREADUTILS_PLOT("Input queue depth", BufferedThreadpool<T>::_inputQueue.size());
+
+			// Release mutex and signal condition variable
+			l.unlock();
+			BufferedThreadpool<T>::cancelTasks(dropped);
+			BufferedThreadpool<T>::enqueuerMetrics().addEnqueued(1);
+			BufferedThreadpool<T>::wakeWorkers(1);
+
+			return true;
+		}
+
+		/**
+		 * @brief Returns sequence number of unfinished item with tag.  Output mutex held.
+		 *
+		 * The calling task's own item if it has the tag, otherwise the
+		 * earliest in flight with it.
+		 *
+		 * @param l Lock on output mutex, released if throwing
+		 * @param tag Tag to look for
+		 * @throws std::invalid_argument Tag not in flight
+		 */
+		uint64_t sequenceOfTag(std::unique_lock<ProfiledMutex> &l, const TagType &tag)
+		{
+			// Own item is still unfinished while its slot holds its tag
+			const CurrentItem &current = currentItem();
+			if (current.pool == this && current.sequence >= _releaseSequence)
+			{
+				const Slot &slot = slotFor(current.sequence);
+				if (slot.tag && *slot.tag == tag)
 				{
-					// Update container values
-					container.value = value;
-					container.finishedProcessing = true;
-					container.valid = valid;
-					container.slotAvailable = (container.tag == _outputOrder.front());
-
-					// Indicate container found
-					matchingContainer = container;
-					foundContainer = true;
+					return current.sequence;
 				}
 			}
 
-			// Throw exception if tag not found
-			if (!foundContainer)
+			uint64_t sequence = findTag(tag, IndexedTags());
+			if (sequence == NoSequence)
 			{
 				l.unlock();
 				throw std::invalid_argument("Tag does not exist.");
 			}
 
-			// If slot ready to be available again
-			if (matchingContainer.slotAvailable)
+			return sequence;
+		}
+
+		/**
+		 * @brief Reserve tag index for a full window
+		 *
+		 */
+		void reserveTags(std::true_type)
+		{
+			_inFlightTags.reserve(_reorderSlots.size());
+		}
+
+		void reserveTags(std::false_type)
+		{
+		}
+
+		/**
+		 * @brief Add item to end of run of its tag.  Output mutex held.
+		 *
+		 * @param sequence Sequence number of item
+		 * @param slot Slot of item, holding its tag
+		 */
+		void indexTag(uint64_t sequence, Slot &slot, std::true_type)
+		{
+			auto inserted = _inFlightTags.emplace(*slot.tag, TagRun{ sequence, sequence });
+			if (inserted.second)
 			{
-				// Add value to output queue if valid
-				if (valid)
+				return;
+			}
+
+			TagRun &run = inserted.first->second;
+			slot.previousSameTag = run.last;
+			slotFor(run.last).nextSameTag = sequence;
+			run.last = sequence;
+		}
+
+		void indexTag(uint64_t, Slot &, std::false_type)
+		{
+		}
+
+		/**
+		 * @brief Take finishing item out of run of its tag.  Output mutex held.
+		 *
+		 * @param slot Slot of item, still holding its tag
+		 */
+		void unindexTag(Slot &slot, std::true_type)
+		{
+			// Neighbours in the run link past the item
+			if (slot.previousSameTag != NoSequence && slot.nextSameTag != NoSequence)
+			{
+				slotFor(slot.previousSameTag).nextSameTag = slot.nextSameTag;
+				slotFor(slot.nextSameTag).previousSameTag = slot.previousSameTag;
+			}
+			else if (slot.previousSameTag == NoSequence && slot.nextSameTag == NoSequence)
+			{
+				_inFlightTags.erase(*slot.tag);
+			}
+			else
+			{
+				TagRun &run = _inFlightTags.find(*slot.tag)->second;
+				if (slot.previousSameTag == NoSequence)
+				{
+					run.first = slot.nextSameTag;
+					slotFor(slot.nextSameTag).previousSameTag = NoSequence;
+				}
+				else
 				{
-					BufferedThreadpool<T>::_outputBuffer.emplace_back(matchingContainer.value);
+					run.last = slot.previousSameTag;
+					slotFor(slot.previousSameTag).nextSameTag = NoSequence;
 				}
+			}
 
-				// Decrement active process counter and pop output order queue
-				BufferedThreadpool<T>::_activeProcesses--;
-				_outputOrder.pop_front();
+			slot.previousSameTag = NoSequence;
+			slot.nextSameTag = NoSequence;
+		}
 
-				// Check remaining values in output containers
-				while(!_outputOrder.empty())
-				{
-					bool found = false;
+		void unindexTag(Slot &, std::false_type)
+		{
+		}
 
-					// Iterate through containers
-					for (auto &container : _outputContainers)
-					{
-						if (
-							container.tag == _outputOrder.front() &&
-							container.finishedProcessing &&
-							!container.slotAvailable
-						)
-						{
-							// Add value to output queue if available
-							if (container.valid)
-							{
-								BufferedThreadpool<T>::_outputBuffer.emplace_back(container.value);
-							}
-
-							// Make slot available
-							container.slotAvailable = true;
-
-							// Decrement active process counter and pop output order queue
-							BufferedThreadpool<T>::_activeProcesses--;
-							_outputOrder.pop_front();
-							found = true;
-							break;
-						}
-					}
+		/**
+		 * @brief Returns sequence number of earliest unfinished item with tag (NoSequence if none).  Output mutex held.
+		 *
+		 */
+		uint64_t findTag(const TagType &tag, std::true_type)
+		{
+			auto it = _inFlightTags.find(tag);
+			return it == _inFlightTags.end() ? NoSequence : it->second.first;
+		}
 
-					if (!found)
-					{
-						break;
-					}
+		uint64_t findTag(const TagType &tag, std::false_type)
+		{
+			// No hash, search window in feed order
+			for (uint64_t sequence = _releaseSequence; sequence != _startSequence; sequence++)
+			{
+				const Slot &slot = slotFor(sequence);
+				if (slot.tag && *slot.tag == tag)
+				{
+					return sequence;
 				}
 			}
 
-			// Release lock and notify
-			l.unlock();
-			BufferedThreadpool<T>::_outputSignal.notify_all();
+			return NoSequence;
 		}
 
-	private:
 		/**
-		 * @brief Container of output to hold tag, status, and value
+		 * @brief Returns sequence number of ticket's item, checking it's unfinished.  Output mutex held.
 		 *
+		 * @param l Lock on output mutex, released if throwing
+		 * @param ticket Ticket of item
+		 * @throws std::invalid_argument Item already completed
 		 */
-		struct Container
+		uint64_t sequenceOfTicket(std::unique_lock<ProfiledMutex> &l, Ticket ticket)
 		{
-			Container() :
-				value(),
-				tag(),
-				finishedProcessing(false),
-				valid(false),
-				slotAvailable(true)
-			{}
+			uint64_t sequence = ticket.sequence();
+			if (sequence < _releaseSequence || slotFor(sequence).finishedProcessing)
+			{
+				l.unlock();
+				throw std::invalid_argument("Ticket already completed.");
+			}
 
-			T value;
-			TagType tag;
-			bool finishedProcessing;
-			bool valid;
-			bool slotAvailable;
-		};
+			return sequence;
+		}
+
+		/**
+		 * @brief Update the output buffer
+		 *
+		 * An item finishing at the head of the window goes straight to the
+		 * output buffer, only items finishing early are parked in their slot.
+		 *
+		 * @tparam V T to move value from, const T to copy it
+		 * @param l Lock on output mutex, released on return
+		 * @param sequence Sequence number of unfinished item being completed
+		 * @param value Value to feed buffer (nullptr if invalidated)
+		 */
+		template <typename V>
+		void updateOutputBuffer(std::unique_lock<ProfiledMutex> &l, uint64_t sequence, V *value)
+		{
+			// Number of values released to output buffer
+			size_t released = 0;
+			size_t freed = 0;
+
+			// Item can't be looked up by tag any more
+			Slot &slot = slotFor(sequence);
+			if (slot.tag)
+			{
+				unindexTag(slot, IndexedTags());
+				slot.tag.reset();
+			}
+			if (sequence == _releaseSequence)
+			{
+				// At head, release without parking value in slot
+				if (value != nullptr)
+				{
+					BufferedThreadpool<T>::_outputBuffer.emplace_back(std::move(*value));
+					released++;
+				}
+
+				// Make slot available and advance window
+				slot.inFlight = false;
+				BufferedThreadpool<T>::_activeProcesses--;
+				_releaseSequence++;
+				freed++;
+			}
+			else
+			{
+				// Finished behind an unfinished head, has to wait
+				if (value != nullptr)
+				{
+					slot.value.emplace(std::move(*value));
+				}
+				slot.finishedProcessing = true;
+
+				_heldBack++;
+				_itemsHeldBack++;
+				_maxHeldBack = _heldBack > _maxHeldBack ? _heldBack : _maxHeldBack;
+			}
+
+			// Release finished items at head of window in order
+			while (_releaseSequence != _startSequence)
+			{
+				Slot &head = slotFor(_releaseSequence);
+				if (!head.finishedProcessing)
+				{
+					break;
+				}
+
+				// Everything after the item that just finished was held back
+				_heldBack--;
+
+				// Add value to output queue if valid
+				if (head.value)
+				{
+					BufferedThreadpool<T>::_outputBuffer.emplace_back(std::move(*head.value));
+					head.value.reset();
+					released++;
+				}
+
+				// Make slot available
+				head.inFlight = false;
+				head.finishedProcessing = false;
+
+				// Decrement active process counter and advance window
+				BufferedThreadpool<T>::_activeProcesses--;
+				_releaseSequence++;
+				freed++;
+			}
+
+			THREADUTILS_PLOT("Active processes", BufferedThreadpool<T>::_activeProcesses.load());
+			THREADUTILS_PLOT("Held back", _heldBack);
+
+			// Release lock and wake one consumer per released value
+			l.unlock();
+			BufferedThreadpool<T>::wakeConsumers(released);
+
+			// Window moved, workers parked on a full window can take input
+			if (freed > 0 && BufferedThreadpool<T>::_sleepingThreads > 0)
+			{
+				std::unique_lock<ProfiledMutex> ql(BufferedThreadpool<T>::_queueMutex);
+				ql.unlock();
+				BufferedThreadpool<T>::wakeWorkers(freed);
+			}
+		}
+
+	private:
+		/// @brief Tags of tasks in input queue (empty if ticketed)
+		std::deque<Optional<TagType>> _inputTags;
+
+		/// @brief Runs of tagged items in flight, by tag (guarded by output mutex)
+		TagIndex _inFlightTags;
+
+		/// @brief Ring of reorder slots indexed by sequence number
+		std::vector<Slot> _reorderSlots;
+
+		/// @brief Sequence number of next item to start
+		std::atomic<uint64_t> _startSequence;
+
+		/// @brief Sequence number of next item to release
+		std::atomic<uint64_t> _releaseSequence;
+
+		/// @brief Items currently finished but waiting for an earlier item
+		uint64_t _heldBack;
 
-		/// @brief Input queue for process containers
-		std::deque<Container> _inputContainers;
+		/// @brief Items that ever had to wait for an earlier item
+		uint64_t _itemsHeldBack;
 
-		/// @brief Vector containing output process containers
-		std::vector<Container> _outputContainers;
+		/// @brief Most items held back at once
+		uint64_t _maxHeldBack;
 
-		/// @brief Order of output
-		std::deque<TagType> _outputOrder;
+		/// @brief Waits caused only by a full reorder window
+		std::atomic<uint64_t> _headOfLineBlocks;
 
+		/// @brief Input queue size at which fed tasks are rejected (guarded by queue mutex)
 		uint64_t _maxInputQueueSize;
 
 	};
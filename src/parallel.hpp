@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file parallel.hpp
+ * @author Evan Stoddard
+ * @brief Parallel loops, transforms and reductions on a Threadpool
+ */
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "completionlatch.hpp"
+#include "optional.hpp"
+#include "threadpool.hpp"
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Pick grain giving a few pieces per thread (workers and caller)
+	 *
+	 * @param pool Pool pieces run on
+	 * @param size Number of indices
+	 * @return size_t Grain
+	 */
+	inline size_t parallelGrain(const Threadpool &pool, size_t size)
+	{
+		size_t pieces = ((size_t)pool.numThreads() + 1) * 4;
+		size_t grain = (size + pieces - 1) / pieces;
+
+		return grain > 0 ? grain : 1;
+	}
+
+	/**
+	 * @brief Runs a body over a range of indices split recursively across a pool
+	 *
+	 * Ranges larger than the grain are halved, the upper half enqueued and
+	 * the lower half split further, so idle workers pick up big pieces first.
+	 * The calling thread works through its own half and then runs queued
+	 * tasks until every piece is done, spinning briefly and then parking
+	 * once there are none left to run.  Pieces queued after that wake it.
+	 *
+	 * Pieces are enqueued as tasks small enough to be stored inline, so
+	 * nothing is allocated per element (or, outside work stealing mode, per
+	 * piece).  A piece cancelled by the pool (rejected or dropped by its
+	 * overflow policy, or discarded by a shutdown) is handed back to the
+	 * thread calling run().
+	 *
+	 * The first exception thrown by the body is rethrown on the calling
+	 * thread, pieces not yet started when it's thrown are skipped.
+	 *
+	 * @tparam Body Callable taking (size_t begin, size_t end)
+	 */
+	template <typename Body>
+	class ParallelRange
+	{
+	public:
+		/**
+		 * @brief Construct a new Parallel Range object
+		 *
+		 * @param pool Pool to run pieces on
+		 * @param grain Largest piece run without splitting (0 to pick automatically)
+		 * @param body Body run on each piece
+		 */
+		ParallelRange(Threadpool &pool, size_t grain, Body &body) :
+			_pool(pool),
+			_grain(grain),
+			_body(body),
+			_failed(false)
+		{
+		}
+
+		/**
+		 * @brief Run body over range and wait for it to finish
+		 *
+		 * @param begin First index
+		 * @param end One past last index
+		 */
+		void run(size_t begin, size_t end)
+		{
+			if (begin >= end)
+			{
+				return;
+			}
+
+			if (_grain == 0)
+			{
+				_grain = parallelGrain(_pool, end - begin);
+			}
+
+			// Our own piece counts until we're done with it
+			_pieces.add(1);
+			split(begin, end);
+			_pieces.countDown();
+
+			// Help with queued pieces (and pieces handed back) until all are done
+			_pieces.wait([this]() { return runLeftover() || _pool.runPendingTask(); });
+
+			if (_failed)
+			{
+				std::rethrow_exception(_error);
+			}
+		}
+
+	private:
+		/**
+		 * @brief Piece of range queued on pool
+		 *
+		 */
+		class Piece : public RunOrCancel<Piece, ParallelRange*>
+		{
+		public:
+			Piece(ParallelRange *range, size_t begin, size_t end) :
+				RunOrCancel<Piece, ParallelRange*>(range),
+				_begin(begin),
+				_end(end)
+			{
+			}
+
+			Piece(Piece &&) = default;
+
+			/**
+			 * @brief Destroy the Piece object, handing it back if it never ran
+			 *
+			 */
+			~Piece() { this->cancelIfOwned(); }
+
+			void operator()()
+			{
+				ParallelRange *range = this->take();
+
+				range->split(_begin, _end);
+				range->_pieces.countDown();
+			}
+
+			/**
+			 * @brief Hand piece back to the thread calling run(), still outstanding
+			 *
+			 */
+			void cancel()
+			{
+				ParallelRange *range = this->take();
+
+				std::unique_lock<std::mutex> l(range->_mutex);
+				range->_leftovers.emplace_back(_begin, _end);
+				l.unlock();
+
+				range->_pieces.wake();
+			}
+
+		private:
+			/// @brief First index
+			size_t _begin;
+
+			/// @brief One past last index
+			size_t _end;
+		};
+
+		/**
+		 * @brief Run a piece the pool handed back, if there is one
+		 *
+		 * @return true Piece run
+		 * @return false No pieces handed back
+		 */
+		bool runLeftover()
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			if (_leftovers.empty())
+			{
+				return false;
+			}
+
+			std::pair<size_t, size_t> piece = _leftovers.back();
+			_leftovers.pop_back();
+			l.unlock();
+
+			split(piece.first, piece.second);
+			_pieces.countDown();
+
+			return true;
+		}
+
+		/**
+		 * @brief Enqueue upper halves until piece fits grain, then run it
+		 *
+		 */
+		void split(size_t begin, size_t end)
+		{
+			while (end - begin > _grain && !_failed.load(std::memory_order_relaxed))
+			{
+				size_t middle = begin + (end - begin) / 2;
+
+				_pieces.add(1);
+				_pool.enqueue(Task(Piece(this, middle, end)));
+
+				// run() may be parked with nothing left to help with
+				_pieces.wake();
+
+				end = middle;
+			}
+
+			if (_failed.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			try
+			{
+				_body(begin, end);
+			}
+			catch (...)
+			{
+				std::unique_lock<std::mutex> l(_errorMutex);
+				if (!_failed)
+				{
+					_error = std::current_exception();
+					_failed = true;
+				}
+			}
+		}
+
+	private:
+		/// @brief Pool pieces run on
+		Threadpool &_pool;
+
+		/// @brief Largest piece run without splitting
+		size_t _grain;
+
+		/// @brief Body run on each piece
+		Body &_body;
+
+		/// @brief Pieces not yet finished
+		CompletionLatch _pieces;
+
+		/// @brief Body threw
+		std::atomic_bool _failed;
+
+		/// @brief First exception thrown by body
+		std::exception_ptr _error;
+
+		/// @brief Mutex guarding first exception
+		std::mutex _errorMutex;
+
+		/// @brief Pieces cancelled by the pool, left for run() (begin, end)
+		std::vector<std::pair<size_t, size_t>> _leftovers;
+
+		/// @brief Mutex guarding leftovers
+		std::mutex _mutex;
+	};
+
+	/**
+	 * @brief Run body over range of indices split across pool
+	 *
+	 * @param pool Pool to run on
+	 * @param begin First index
+	 * @param end One past last index
+	 * @param grain Largest piece run without splitting (0 to pick automatically)
+	 * @param body Body run on each piece, called with (size_t begin, size_t end)
+	 */
+	template <typename Body>
+	void parallel_for_range(Threadpool &pool, size_t begin, size_t end, size_t grain, Body body)
+	{
+		ParallelRange<Body> range(pool, grain, body);
+		range.run(begin, end);
+	}
+
+	/**
+	 * @brief Call func for every index of range, split across pool
+	 *
+	 * The calling thread runs part of the range itself.
+	 *
+	 * @tparam Index Integral index type
+	 * @tparam Func Callable taking an Index
+	 * @param pool Pool to run on
+	 * @param begin First index
+	 * @param end One past last index
+	 * @param grain Most indices run as one piece (0 to pick automatically)
+	 * @param func Function called with each index
+	 */
+	template <typename Index, typename Func>
+	void parallel_for(Threadpool &pool, Index begin, Index end, size_t grain, Func func)
+	{
+		if (!(begin < end))
+		{
+			return;
+		}
+
+		parallel_for_range(pool, 0, (size_t)(end - begin), grain, [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+			{
+				func((Index)(begin + (Index)i));
+			}
+		});
+	}
+
+	/**
+	 * @brief Call func for every index of range, picking grain automatically
+	 *
+	 * @param pool Pool to run on
+	 * @param begin First index
+	 * @param end One past last index
+	 * @param func Function called with each index
+	 */
+	template <typename Index, typename Func>
+	void parallel_for(Threadpool &pool, Index begin, Index end, Func func)
+	{
+		parallel_for(pool, begin, end, 0, std::move(func));
+	}
+
+	/**
+	 * @brief Write op applied to each input element to output, split across pool
+	 *
+	 * @tparam InputIt Random access input iterator
+	 * @tparam OutputIt Random access output iterator
+	 * @tparam UnaryOp Callable taking an input element
+	 * @param pool Pool to run on
+	 * @param first First input element
+	 * @param last One past last input element
+	 * @param out First output element
+	 * @param op Operation applied to each element
+	 * @param grain Most elements run as one piece (0 to pick automatically)
+	 * @return OutputIt One past last output element
+	 */
+	template <typename InputIt, typename OutputIt, typename UnaryOp>
+	OutputIt parallel_transform(Threadpool &pool, InputIt first, InputIt last, OutputIt out, UnaryOp op, size_t grain = 0)
+	{
+		size_t size = (size_t)std::distance(first, last);
+
+		parallel_for_range(pool, 0, size, grain, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				out[i] = op(first[i]);
+			}
+		});
+
+		return out + size;
+	}
+
+	/**
+	 * @brief Reduce elements with op, split across pool
+	 *
+	 * Like std::reduce, op must be associative and commutative.  Each piece
+	 * is reduced on its own into a slot of its own, without locking, and
+	 * the partials are folded into the result once every piece is done.
+	 * Pieces are never finer than the automatic grain, so there are a few
+	 * slots per thread rather than one per element.
+	 *
+	 * @tparam It Random access iterator
+	 * @tparam T Result type
+	 * @tparam BinaryOp Callable combining two values
+	 * @param pool Pool to run on
+	 * @param first First element
+	 * @param last One past last element
+	 * @param init Initial value
+	 * @param op Reduction
+	 * @param grain Most elements reduced as one piece (0 or anything finer than the automatic grain picks it)
+	 * @return T Reduction of init and every element
+	 */
+	template <typename It, typename T, typename BinaryOp>
+	T parallel_reduce(Threadpool &pool, It first, It last, T init, BinaryOp op, size_t grain = 0)
+	{
+		size_t size = (size_t)std::distance(first, last);
+		if (size == 0)
+		{
+			return init;
+		}
+
+		// Finer pieces would only add slots to fold, not parallelism
+		size_t minimum = parallelGrain(pool, size);
+		if (grain < minimum)
+		{
+			grain = minimum;
+		}
+
+		// Halving never leaves a piece under half the grain (unless the
+		// whole range is), so pieces start at least that far apart and
+		// begin / spacing gives each its own slot
+		size_t spacing = size > grain ? (grain + 1) / 2 : size;
+		std::vector<Optional<T>> partials((size + spacing - 1) / spacing);
+
+		parallel_for_range(pool, 0, size, grain, [&](size_t begin, size_t end) {
+			T partial = first[begin];
+			for (size_t i = begin + 1; i < end; i++)
+			{
+				partial = op(std::move(partial), first[i]);
+			}
+
+			partials[begin / spacing].emplace(std::move(partial));
+		});
+
+		T result = std::move(init);
+		for (auto &partial : partials)
+		{
+			if (partial)
+			{
+				result = op(std::move(result), std::move(*partial));
+			}
+		}
+
+		return result;
+	}
+};
+
+#endif /* PARALLEL_H_ */
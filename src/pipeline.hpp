@@ -0,0 +1,1066 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file pipeline.hpp
+ * @author Evan Stoddard
+ * @brief Multi-stage streaming pipeline run on a Threadpool
+ */
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "completionlatch.hpp"
+#include "mpmcringbuffer.hpp"
+#include "optional.hpp"
+#include "threadpool.hpp"
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief How a pipeline stage processes its items
+	 *
+	 */
+	enum class StageMode
+	{
+		/// @brief Up to parallelism items processed at once, in any order
+		Parallel,
+
+		/// @brief One item at a time, in the order they arrive
+		Serial,
+
+		/// @brief One item at a time, in the order they were fed to the pipeline
+		Ordered
+	};
+
+	/**
+	 * @brief Receiving end of a pipeline stage
+	 *
+	 * An empty value is a hole left by an item that was dropped upstream,
+	 * passed along so ordered stages don't wait for it.
+	 *
+	 * @tparam T Item type
+	 */
+	template <typename T>
+	class PipelineInput
+	{
+	public:
+		virtual ~PipelineInput() {}
+
+		/**
+		 * @brief Hand item to stage
+		 *
+		 * @param sequence Position item was fed to pipeline at
+		 * @param value Item, empty if dropped
+		 */
+		virtual void push(uint64_t sequence, Optional<T> &&value) = 0;
+	};
+
+	/**
+	 * @brief State shared by every stage of a pipeline
+	 *
+	 * Items in flight are counted from feed() until fetched (or dropped), so
+	 * at most maxTokens items exist at once anywhere in the pipeline.  This
+	 * is also what lets each stage's input be a fixed size ring that never
+	 * fills.
+	 *
+	 */
+	class PipelineControl
+	{
+	public:
+		/**
+		 * @brief Base of stages, letting pipeline own them whatever their types
+		 *
+		 */
+		class Stage
+		{
+		public:
+			virtual ~Stage() {}
+		};
+
+		PipelineControl(Threadpool &pool, size_t maxTokens) :
+			_pool(pool),
+			_maxTokens(maxTokens > 0 ? maxTokens : 1),
+			_inFlight(0),
+			_nextSequence(0),
+			_spawns(0),
+			_closed(false),
+			_failed(false),
+			_errorPending(false),
+			_waiting(0)
+		{
+		}
+
+		PipelineControl(const PipelineControl &) = delete;
+		PipelineControl &operator=(const PipelineControl &) = delete;
+
+		/**
+		 * @brief Destroy the Pipeline Control object, waiting for queued stage runs
+		 *
+		 * Helps run them while there are any to take, otherwise parks until
+		 * the last one finishes or another is queued.
+		 *
+		 */
+		~PipelineControl()
+		{
+			close();
+
+			_runners.wait([this]() { return runOrphan() || _pool.runPendingTask(); });
+		}
+
+		/**
+		 * @brief Returns pool stages run on
+		 *
+		 */
+		Threadpool &pool() { return _pool; }
+
+		/**
+		 * @brief Returns most items in flight at once
+		 *
+		 */
+		size_t maxTokens() const { return _maxTokens; }
+
+		/**
+		 * @brief Returns number of items in flight
+		 *
+		 */
+		size_t inFlight() const { return _inFlight.load(std::memory_order_acquire); }
+
+		/**
+		 * @brief Take token for a new item
+		 *
+		 * @param block Wait for a token if none are free
+		 * @param sequence Position assigned to item
+		 * @return true Token taken
+		 * @return false Pipeline closed, or no token free and not blocking
+		 */
+		bool acquire(bool block, uint64_t &sequence)
+		{
+			size_t count = _inFlight.load(std::memory_order_relaxed);
+			while (true)
+			{
+				if (_closed.load(std::memory_order_acquire))
+				{
+					return false;
+				}
+
+				if (count < _maxTokens)
+				{
+					if (_inFlight.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel))
+					{
+						break;
+					}
+					continue;
+				}
+
+				if (!block)
+				{
+					return false;
+				}
+
+				std::unique_lock<std::mutex> l(_mutex);
+				_waiting.fetch_add(1, std::memory_order_seq_cst);
+				_signal.wait(l, [this]() {
+					return _inFlight.load(std::memory_order_seq_cst) < _maxTokens || _closed.load(std::memory_order_seq_cst);
+				});
+				_waiting.fetch_sub(1, std::memory_order_relaxed);
+				count = _inFlight.load(std::memory_order_relaxed);
+			}
+
+			sequence = _nextSequence.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		/**
+		 * @brief Return token of item that was fetched or dropped
+		 *
+		 */
+		void release()
+		{
+			_inFlight.fetch_sub(1, std::memory_order_seq_cst);
+			wake();
+		}
+
+		/**
+		 * @brief Wake threads waiting for a token or for output
+		 *
+		 * Callers publish whatever waiters check for first.  Waiters register
+		 * before checking and sleep under the mutex, so taking it here means
+		 * a waiter that missed the change is already asleep and gets notified.
+		 *
+		 */
+		void wake()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_waiting.load(std::memory_order_seq_cst) > 0)
+			{
+				{
+					std::unique_lock<std::mutex> l(_mutex);
+				}
+				_signal.notify_all();
+			}
+		}
+
+		/**
+		 * @brief Stop accepting items
+		 *
+		 */
+		void close()
+		{
+			_closed.store(true, std::memory_order_seq_cst);
+			wake();
+		}
+
+		/**
+		 * @brief Returns whether pipeline stopped accepting items
+		 *
+		 */
+		bool closed() const { return _closed.load(std::memory_order_seq_cst); }
+
+		/**
+		 * @brief Returns whether a stage threw
+		 *
+		 */
+		bool failed() const { return _failed.load(std::memory_order_acquire); }
+
+		/**
+		 * @brief Returns whether a stage's exception is waiting to be rethrown
+		 *
+		 */
+		bool errorPending() const { return _errorPending.load(std::memory_order_acquire); }
+
+		/**
+		 * @brief Record first exception thrown by a stage and close pipeline
+		 *
+		 */
+		void fail(std::exception_ptr error)
+		{
+			{
+				std::unique_lock<std::mutex> l(_mutex);
+				if (!_error && !_failed)
+				{
+					_error = std::move(error);
+					_errorPending.store(true, std::memory_order_release);
+				}
+				_failed.store(true, std::memory_order_release);
+			}
+
+			close();
+		}
+
+		/**
+		 * @brief Rethrow exception thrown by a stage, once
+		 *
+		 */
+		void rethrow()
+		{
+			if (!_failed.load(std::memory_order_acquire))
+			{
+				return;
+			}
+
+			std::unique_lock<std::mutex> l(_mutex);
+			if (_error)
+			{
+				std::exception_ptr error = std::move(_error);
+				_error = nullptr;
+				_errorPending.store(false, std::memory_order_release);
+				l.unlock();
+
+				std::rethrow_exception(error);
+			}
+		}
+
+		/**
+		 * @brief Wait until ready returns true, helping run pool tasks meanwhile
+		 *
+		 * Queuing a stage run wakes waiters too, so a run nobody else is free
+		 * to take (e.g. pool stopped), or one the pool cancelled, still gets
+		 * done.
+		 *
+		 */
+		template <typename Ready>
+		void waitUntil(Ready ready)
+		{
+			while (!ready())
+			{
+				size_t spawns = _spawns.load(std::memory_order_seq_cst);
+				if (runOrphan() || _pool.runPendingTask())
+				{
+					continue;
+				}
+
+				std::unique_lock<std::mutex> l(_mutex);
+				_waiting.fetch_add(1, std::memory_order_seq_cst);
+				_signal.wait(l, [&]() { return ready() || _spawns.load(std::memory_order_seq_cst) != spawns; });
+				_waiting.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * @brief Queue run of stage on pool
+		 *
+		 * @tparam StageType Stage with a run() method
+		 */
+		template <typename StageType>
+		void spawn(StageType *stage)
+		{
+			_runners.add(1);
+			_pool.enqueue(Task(Runner<StageType>(this, stage)));
+
+			_spawns.fetch_add(1, std::memory_order_seq_cst);
+			wake();
+			_runners.wake();
+		}
+
+		/**
+		 * @brief Take ownership of stage
+		 *
+		 * @return StageType* Stage
+		 */
+		template <typename StageType>
+		StageType *adopt(StageType *stage)
+		{
+			_stages.emplace_back(stage);
+			return stage;
+		}
+
+		/**
+		 * @brief Link to first stage of pipeline
+		 *
+		 * @tparam T Item type fed
+		 */
+		template <typename T>
+		struct Entry : public Stage
+		{
+			Entry() :
+				first(nullptr)
+			{
+			}
+
+			/// @brief First stage
+			PipelineInput<T> *first;
+		};
+
+	private:
+		/**
+		 * @brief Keep stage run the pool cancelled for a waiting thread to run
+		 *
+		 * @param runner Stage run
+		 */
+		void orphan(Task runner)
+		{
+			{
+				std::unique_lock<std::mutex> l(_mutex);
+				_orphans.push_back(std::move(runner));
+			}
+
+			_spawns.fetch_add(1, std::memory_order_seq_cst);
+			wake();
+			_runners.wake();
+		}
+
+		/**
+		 * @brief Run a stage run the pool cancelled, if there is one
+		 *
+		 * @return true Stage run
+		 * @return false No stage runs cancelled
+		 */
+		bool runOrphan()
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			if (_orphans.empty())
+			{
+				return false;
+			}
+
+			Task runner = std::move(_orphans.back());
+			_orphans.pop_back();
+			l.unlock();
+
+			runner();
+
+			return true;
+		}
+
+		/**
+		 * @brief Queued run of a stage
+		 *
+		 * If the pool cancels it (overflow policy or shutdown) it is kept for
+		 * a thread waiting on the pipeline to run instead, as the stage counts
+		 * it as running.
+		 *
+		 */
+		template <typename StageType>
+		class Runner : public RunOrCancel<Runner<StageType>, StageType*>
+		{
+		public:
+			Runner(PipelineControl *control, StageType *stage) :
+				RunOrCancel<Runner, StageType*>(stage),
+				_control(control)
+			{
+			}
+
+			Runner(Runner &&) = default;
+
+			~Runner() { this->cancelIfOwned(); }
+
+			void operator()()
+			{
+				StageType *stage = this->take();
+
+				stage->run();
+				_control->_runners.countDown();
+			}
+
+			/**
+			 * @brief Hand run over to the pipeline's waiting threads
+			 *
+			 */
+			void cancel()
+			{
+				PipelineControl *control = _control;
+				control->orphan(Task(std::move(*this)));
+			}
+
+		private:
+			/// @brief Pipeline stage belongs to
+			PipelineControl *_control;
+		};
+
+	private:
+		/// @brief Pool stages run on
+		Threadpool &_pool;
+
+		/// @brief Most items in flight at once
+		size_t _maxTokens;
+
+		/// @brief Items fed and not yet fetched or dropped
+		std::atomic<size_t> _inFlight;
+
+		/// @brief Position of next item fed
+		std::atomic<uint64_t> _nextSequence;
+
+		/// @brief Stage runs queued or running
+		CompletionLatch _runners;
+
+		/// @brief Stage runs queued so far
+		std::atomic<size_t> _spawns;
+
+		/// @brief No more items accepted
+		std::atomic_bool _closed;
+
+		/// @brief A stage threw
+		std::atomic_bool _failed;
+
+		/// @brief First exception thrown by a stage, until rethrown
+		std::exception_ptr _error;
+
+		/// @brief Exception set and not yet rethrown (written under mutex)
+		std::atomic_bool _errorPending;
+
+		/// @brief Threads waiting for a token or for output
+		std::atomic<size_t> _waiting;
+
+		/// @brief Stage runs the pool cancelled, left for waiting threads (guarded by mutex)
+		std::vector<Task> _orphans;
+
+		/// @brief Mutex guarding exception, orphans and signal
+		std::mutex _mutex;
+
+		/// @brief Signalled when a token is returned, output arrives or pipeline closes
+		std::condition_variable _signal;
+
+		/// @brief Stages, in no particular order
+		std::vector<std::unique_ptr<Stage>> _stages;
+	};
+
+	/**
+	 * @brief Stage of a pipeline, applying a function to each item
+	 *
+	 * Items arrive through a lock-free ring (or, for ordered stages, a slot
+	 * per token indexed by sequence) and are processed by runs queued on the
+	 * pool, at most parallelism at a time.  Runs process a batch of items and
+	 * then requeue themselves so busy stages share workers with the rest.
+	 *
+	 * @tparam In Item type taken
+	 * @tparam Out Item type produced
+	 * @tparam Func Callable taking an In and returning an Out
+	 */
+	template <typename In, typename Out, typename Func>
+	class PipelineStage : public PipelineInput<In>, public PipelineControl::Stage
+	{
+	public:
+		/// @brief Most items processed per run before it requeues itself
+		static constexpr size_t BatchSize = 64;
+
+		template <typename F>
+		PipelineStage(PipelineControl *control, StageMode mode, size_t parallelism, F &&func) :
+			_control(control),
+			_mode(mode),
+			_parallelism(mode == StageMode::Parallel && parallelism > 0 ? parallelism : 1),
+			_func(std::forward<F>(func)),
+			_next(nullptr),
+			_ring(mode == StageMode::Ordered ? 1 : control->maxTokens()),
+			_numSlots(control->maxTokens()),
+			_expected(0),
+			_running(0)
+		{
+			if (_mode == StageMode::Ordered)
+			{
+				_slots.reset(new Slot[_numSlots]);
+			}
+		}
+
+		/**
+		 * @brief Set stage items are handed to
+		 *
+		 */
+		PipelineInput<Out> **output() { return &_next; }
+
+		void push(uint64_t sequence, Optional<In> &&value) override
+		{
+			if (_mode == StageMode::Ordered)
+			{
+				Slot &slot = _slots[sequence % _numSlots];
+				slot.value = std::move(value);
+				slot.ready.store(true, std::memory_order_release);
+			}
+			else
+			{
+				// Can't fail, ring holds as many items as there are tokens
+				_ring.tryPush(Item(sequence, std::move(value)));
+			}
+
+			// Pairs with fence in run(), one of us sees the other's change
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			startRun();
+		}
+
+		/**
+		 * @brief Process items until input is empty or batch is done
+		 *
+		 */
+		void run()
+		{
+			size_t processed = 0;
+			Item item;
+
+			while (true)
+			{
+				while (processed < BatchSize && take(item))
+				{
+					process(item);
+					processed++;
+				}
+
+				if (processed == BatchSize)
+				{
+					// Keep our place, let other stages at the pool first
+					_control->spawn(this);
+					return;
+				}
+
+				_running.fetch_sub(1, std::memory_order_seq_cst);
+
+				// Item pushed since we last looked may have seen us still running
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (!hasInput() || !claimRun())
+				{
+					return;
+				}
+			}
+		}
+
+	private:
+		/**
+		 * @brief Item in stage's input ring
+		 *
+		 */
+		struct Item
+		{
+			Item() :
+				sequence(0)
+			{
+			}
+
+			Item(uint64_t seq, Optional<In> &&item) :
+				sequence(seq),
+				value(std::move(item))
+			{
+			}
+
+			/// @brief Position item was fed at
+			uint64_t sequence;
+
+			/// @brief Item, empty if dropped
+			Optional<In> value;
+		};
+
+		/**
+		 * @brief Input slot of ordered stage
+		 *
+		 */
+		struct Slot
+		{
+			Slot() :
+				ready(false)
+			{
+			}
+
+			/// @brief Item (or hole) for slot's next sequence has arrived
+			std::atomic_bool ready;
+
+			/// @brief Item, empty if dropped
+			Optional<In> value;
+		};
+
+		/**
+		 * @brief Count another run and queue it, unless enough are running
+		 *
+		 */
+		void startRun()
+		{
+			if (claimRun())
+			{
+				_control->spawn(this);
+			}
+		}
+
+		/**
+		 * @brief Count a run if fewer than parallelism are running
+		 *
+		 */
+		bool claimRun()
+		{
+			size_t running = _running.load(std::memory_order_seq_cst);
+			while (running < _parallelism)
+			{
+				if (_running.compare_exchange_weak(running, running + 1, std::memory_order_seq_cst))
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		/**
+		 * @brief Returns whether an item is ready to take
+		 *
+		 */
+		bool hasInput()
+		{
+			if (_mode == StageMode::Ordered)
+			{
+				uint64_t expected = _expected.load(std::memory_order_relaxed);
+				return _slots[expected % _numSlots].ready.load(std::memory_order_acquire);
+			}
+
+			return !_ring.empty();
+		}
+
+		/**
+		 * @brief Take next item
+		 *
+		 * @return true Item taken
+		 * @return false None ready
+		 */
+		bool take(Item &item)
+		{
+			if (_mode != StageMode::Ordered)
+			{
+				return _ring.tryPop(item);
+			}
+
+			uint64_t expected = _expected.load(std::memory_order_relaxed);
+			Slot &slot = _slots[expected % _numSlots];
+			if (!slot.ready.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+
+			item.sequence = expected;
+			item.value = std::move(slot.value);
+			slot.value.reset();
+			slot.ready.store(false, std::memory_order_relaxed);
+			_expected.store(expected + 1, std::memory_order_relaxed);
+
+			return true;
+		}
+
+		/**
+		 * @brief Apply function to item and hand result on
+		 *
+		 * Once a stage has thrown items are dropped rather than processed.
+		 *
+		 */
+		void process(Item &item)
+		{
+			Optional<Out> result;
+
+			if (item.value && !_control->failed())
+			{
+				try
+				{
+					result.emplace(_func(std::move(*item.value)));
+				}
+				catch (...)
+				{
+					_control->fail(std::current_exception());
+				}
+			}
+			item.value.reset();
+
+			_next->push(item.sequence, std::move(result));
+		}
+
+	private:
+		/// @brief Pipeline stage belongs to
+		PipelineControl *_control;
+
+		/// @brief How items are processed
+		StageMode _mode;
+
+		/// @brief Most runs at once
+		size_t _parallelism;
+
+		/// @brief Function applied to each item
+		Func _func;
+
+		/// @brief Stage results are handed to
+		PipelineInput<Out> *_next;
+
+		/// @brief Input of Parallel and Serial stages
+		MpmcRingBuffer<Item> _ring;
+
+		/// @brief Number of slots (Ordered)
+		size_t _numSlots;
+
+		/// @brief Input slot per token, indexed by sequence (Ordered)
+		std::unique_ptr<Slot[]> _slots;
+
+		/// @brief Sequence of next item to process (Ordered)
+		std::atomic<uint64_t> _expected;
+
+		/// @brief Runs queued or running
+		std::atomic<size_t> _running;
+	};
+
+	/**
+	 * @brief End of a pipeline, holding results until fetched
+	 *
+	 * @tparam T Result type
+	 */
+	template <typename T>
+	class PipelineOutput : public PipelineInput<T>, public PipelineControl::Stage
+	{
+	public:
+		explicit PipelineOutput(PipelineControl *control) :
+			_control(control),
+			_ring(control->maxTokens())
+		{
+		}
+
+		void push(uint64_t, Optional<T> &&value) override
+		{
+			if (!value)
+			{
+				_control->release();
+				return;
+			}
+
+			// Can't fail, ring holds as many items as there are tokens
+			_ring.tryPush(std::move(*value));
+			_control->wake();
+		}
+
+		/**
+		 * @brief Take result, returning its token
+		 *
+		 * @return Optional<T> Result, empty if none ready
+		 */
+		Optional<T> tryPop()
+		{
+			Optional<T> value = _ring.tryPop();
+			if (value)
+			{
+				_control->release();
+			}
+
+			return value;
+		}
+
+		/**
+		 * @brief Returns whether a result is ready
+		 *
+		 */
+		bool ready() const { return !_ring.empty(); }
+
+	private:
+		/// @brief Pipeline output belongs to
+		PipelineControl *_control;
+
+		/// @brief Results not yet fetched
+		MpmcRingBuffer<T> _ring;
+	};
+
+	template <typename In, typename Out>
+	class PipelineBuilder;
+
+	/**
+	 * @brief Running pipeline, built with PipelineBuilder
+	 *
+	 * Items are fed in at one end and fetched from the other, passing through
+	 * each stage by move.  Stages run as tasks on the pool, so no thread is
+	 * dedicated to a stage and an idle stage costs nothing.
+	 *
+	 * Feeding blocks while maxTokens items are in flight, so a pipeline's
+	 * memory use stays flat however fast it's fed.  An item's token is
+	 * returned when its result is fetched, so something must be fetching
+	 * while something else feeds (or use tryFeed).
+	 *
+	 * A stage throwing closes the pipeline, items in flight are dropped and
+	 * the exception is rethrown from the next fetch.
+	 *
+	 * @note Destroying a pipeline waits for items in flight to be finished
+	 * by their stages, their results are then discarded.
+	 *
+	 * @tparam In Item type fed
+	 * @tparam Out Result type fetched
+	 */
+	template <typename In, typename Out>
+	class Pipeline
+	{
+	public:
+		Pipeline(Pipeline &&) = default;
+		Pipeline &operator=(Pipeline &&) = default;
+
+		/**
+		 * @brief Feed item, waiting for a token if too many are in flight
+		 *
+		 * @param item Item to feed
+		 * @return true Item fed
+		 * @return false Pipeline closed
+		 */
+		bool feed(In item)
+		{
+			uint64_t sequence;
+			if (!_control->acquire(true, sequence))
+			{
+				return false;
+			}
+
+			Optional<In> value;
+			value.emplace(std::move(item));
+			_input->push(sequence, std::move(value));
+
+			return true;
+		}
+
+		/**
+		 * @brief Feed item if a token is free
+		 *
+		 * @param item Item to feed, moved from only if fed
+		 * @return true Item fed
+		 * @return false Too many items in flight, or pipeline closed
+		 */
+		bool tryFeed(In &item)
+		{
+			uint64_t sequence;
+			if (!_control->acquire(false, sequence))
+			{
+				return false;
+			}
+
+			Optional<In> value;
+			value.emplace(std::move(item));
+			_input->push(sequence, std::move(value));
+
+			return true;
+		}
+
+		/**
+		 * @brief Fetch result, waiting for one
+		 *
+		 * The calling thread runs queued pool tasks while it waits.
+		 *
+		 * @return Optional<Out> Result, empty once closed and every item is done
+		 * @throws Exception thrown by a stage
+		 */
+		Optional<Out> fetch()
+		{
+			while (true)
+			{
+				_control->rethrow();
+
+				Optional<Out> value = _output->tryPop();
+				if (value)
+				{
+					return value;
+				}
+
+				if (_control->closed() && _control->inFlight() == 0)
+				{
+					_control->rethrow();
+					return value;
+				}
+
+				_control->waitUntil([this]() {
+					return _output->ready() || _control->errorPending() || (_control->closed() && _control->inFlight() == 0);
+				});
+			}
+		}
+
+		/**
+		 * @brief Fetch result if one is ready
+		 *
+		 * @return Optional<Out> Result, empty if none ready
+		 * @throws Exception thrown by a stage
+		 */
+		Optional<Out> tryFetch()
+		{
+			_control->rethrow();
+			return _output->tryPop();
+		}
+
+		/**
+		 * @brief Stop accepting items, fetch returns empty once the rest are done
+		 *
+		 */
+		void close() { _control->close(); }
+
+		/**
+		 * @brief Returns number of items fed and not yet fetched
+		 *
+		 */
+		size_t inFlight() const { return _control->inFlight(); }
+
+		/**
+		 * @brief Returns most items in flight at once
+		 *
+		 */
+		size_t maxTokens() const { return _control->maxTokens(); }
+
+	private:
+		friend class PipelineBuilder<In, Out>;
+
+		Pipeline(std::unique_ptr<PipelineControl> control, PipelineInput<In> *input, PipelineOutput<Out> *output) :
+			_control(std::move(control)),
+			_input(input),
+			_output(output)
+		{
+		}
+
+		/// @brief Shared state, owning every stage
+		std::unique_ptr<PipelineControl> _control;
+
+		/// @brief First stage
+		PipelineInput<In> *_input;
+
+		/// @brief End results are fetched from
+		PipelineOutput<Out> *_output;
+	};
+
+	/**
+	 * @brief Builds a pipeline one typed stage at a time
+	 *
+	 * Each stage() call returns a builder whose output type is the result
+	 * type of the stage added.
+	 *
+	 * @code
+	 * auto pipeline = PipelineBuilder<std::string>(pool, 64)
+	 *     .stage(StageMode::Parallel, 4, [](std::string line) { return parse(line); })
+	 *     .stage(StageMode::Ordered, 1, [](Record record) { return format(record); })
+	 *     .build();
+	 * @endcode
+	 *
+	 * @tparam In Item type fed
+	 * @tparam Out Result type of last stage added
+	 */
+	template <typename In, typename Out = In>
+	class PipelineBuilder
+	{
+	public:
+		/**
+		 * @brief Start building a pipeline
+		 *
+		 * @param pool Pool stages run on
+		 * @param maxTokens Most items in flight at once
+		 */
+		PipelineBuilder(Threadpool &pool, size_t maxTokens) :
+			_control(new PipelineControl(pool, maxTokens))
+		{
+			static_assert(std::is_same<In, Out>::value, "Pipeline must start with no stages");
+
+			_input = &_control->adopt(new PipelineControl::Entry<In>())->first;
+			_tail = _input;
+		}
+
+		/**
+		 * @brief Add stage
+		 *
+		 * @param mode How stage processes items
+		 * @param parallelism Most items processed at once (Parallel only)
+		 * @param func Function applied to each item, taking an Out
+		 * @return PipelineBuilder Builder with stage's result as output type
+		 */
+		template <typename Func,
+			typename Result = typename CallResult<typename std::decay<Func>::type, Out>::type>
+		PipelineBuilder<In, Result> stage(StageMode mode, size_t parallelism, Func &&func)
+		{
+			typedef PipelineStage<Out, Result, typename std::decay<Func>::type> StageType;
+
+			StageType *stage = _control->adopt(new StageType(_control.get(), mode, parallelism, std::forward<Func>(func)));
+			*_tail = stage;
+
+			return PipelineBuilder<In, Result>(std::move(_control), _input, stage->output());
+		}
+
+		/**
+		 * @brief Finish pipeline
+		 *
+		 * @return Pipeline<In, Out> Pipeline, ready to feed
+		 */
+		Pipeline<In, Out> build()
+		{
+			PipelineOutput<Out> *output = _control->adopt(new PipelineOutput<Out>(_control.get()));
+			*_tail = output;
+
+			return Pipeline<In, Out>(std::move(_control), *_input, output);
+		}
+
+	private:
+		template <typename, typename>
+		friend class PipelineBuilder;
+
+		PipelineBuilder(std::unique_ptr<PipelineControl> control, PipelineInput<In> **input, PipelineInput<Out> **tail) :
+			_control(std::move(control)),
+			_input(input),
+			_tail(tail)
+		{
+		}
+
+		/// @brief Shared state, owning stages added so far
+		std::unique_ptr<PipelineControl> _control;
+
+		/// @brief Link to first stage
+		PipelineInput<In> **_input;
+
+		/// @brief Where next stage is linked in
+		PipelineInput<Out> **_tail;
+	};
+};
+
+#endif /* PIPELINE_H_ */
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file profiling.hpp
+ * @author Evan Stoddard
+ * @brief Optional Tracy instrumentation, compiled out unless THREADUTILS_ENABLE_TRACY defined
+ */
+
+#ifndef PROFILING_H_
+#define PROFILING_H_
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef THREADUTILS_ENABLE_TRACY
+#include <stdio.h>
+#include <tracy/Tracy.hpp>
+
+/// @brief Zone covering rest of enclosing scope
+#define THREADUTILS_ZONE(name) ZoneScopedN(name)
+
+/// @brief Plot value (name must be a string literal)
+#define THREADUTILS_PLOT(name, value) TracyPlot(name, (int64_t)(value))
+
+/// @brief Declare mutex whose lock contention is reported
+#define THREADUTILS_LOCKABLE(varname) TracyLockable(std::mutex, varname)
+#else
+#define THREADUTILS_ZONE(name)
+#define THREADUTILS_PLOT(name, value) ((void)0)
+#define THREADUTILS_LOCKABLE(varname) std::mutex varname
+#endif
+
+namespace ThreadUtils
+{
+#ifdef THREADUTILS_ENABLE_TRACY
+	/// @brief Mutex type declared by THREADUTILS_LOCKABLE
+	typedef LockableBase(std::mutex) ProfiledMutex;
+
+	/// @brief Condition variable able to wait on ProfiledMutex
+	typedef std::condition_variable_any ProfiledConditionVariable;
+#else
+	typedef std::mutex ProfiledMutex;
+	typedef std::condition_variable ProfiledConditionVariable;
+#endif
+
+	/**
+	 * @brief Name calling worker thread in profiler
+	 *
+	 * @param index Index of worker
+	 */
+	inline void nameWorkerThread(uint32_t index)
+	{
+#ifdef THREADUTILS_ENABLE_TRACY
+		char name[32];
+		snprintf(name, sizeof(name), "ThreadUtils worker %u", index);
+		tracy::SetThreadName(name);
+#else
+		(void)index;
+#endif
+	}
+};
+
+#endif /* PROFILING_H_ */
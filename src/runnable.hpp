@@ -14,14 +14,18 @@
 #include <functional>
 #include <tuple>
 #include <utility>
+#include "slaballocator.hpp"
 
 namespace ThreadUtils
 {
 	/**
 	 * @brief Abstract representatation of runnable
 	 *
+	 * Runnables created with new are allocated by the task allocator, in
+	 * blocks sized for each Runnable instantiation.
+	 *
 	 */
-	class AbstractRunnable
+	class AbstractRunnable : public TaskAllocated
 	{
 	public:
 		virtual ~AbstractRunnable() {};
@@ -31,6 +35,10 @@ namespace ThreadUtils
 	/**
 	 * @brief Runnable object to handle execution of functor with ...params
 	 *
+	 * The functor is held as a std::function, see makeRunnable() to keep
+	 * its own type.  Parameters are moved into the functor, so a runnable
+	 * runs once.
+	 *
 	 * @tparam ReturnType Return type of functor
 	 * @tparam Params Type of arguments for functor
 	 */
@@ -42,11 +50,12 @@ namespace ThreadUtils
 		 * @brief Construct a new Runnable object
 		 *
 		 * @param f Functor to run
-		 * @param params Parameters to pass to functor
+		 * @param params Parameters to pass to functor, forwarded into runnable
 		 */
-		explicit Runnable(const std::function<void(Params...)> &&func, Params... params) :
+		template <typename ...Args>
+		explicit Runnable(std::function<void(Params...)> func, Args &&...params) :
 			_function(std::move(func)),
-			_params(params...) {}
+			_params(std::forward<Args>(params)...) {}
 
 		/**
 		 * @brief Destroy the Runnable object
@@ -55,38 +64,83 @@ namespace ThreadUtils
 		virtual ~Runnable() {}
 
 		/**
-		 * @brief Execute task
+		 * @brief Execute task, moving parameters into functor
 		 *
 		 */
 		void run() override
 		{
-			// Execute function defined by functor with parameters
-			callWithParams(_function, _params);
+			call(std::index_sequence_for<Params...>());
 		}
 
 	private:
-		template<typename F, typename Tuple, size_t ...S >
-		void appleTupleImpl(F&& func, Tuple&& t, std::index_sequence<S...>)
+		template <size_t ...S>
+		void call(std::index_sequence<S...>)
 		{
-			std::forward<F>(func)(std::get<S>(std::forward<Tuple>(t))...);
+			_function(std::get<S>(std::move(_params))...);
 		}
 
-		template<typename F, typename Tuple>
-		void callWithParams(F&& func, Tuple&& t)
+	private:
+		std::function<void(Params...)> _function;
+		std::tuple<Params...> _params;
+	};
+
+	/**
+	 * @brief Runnable keeping its functor's own type, created by makeRunnable()
+	 *
+	 * @tparam Func Functor type
+	 * @tparam Params Type of arguments for functor
+	 */
+	template <typename Func, typename ...Params>
+	class CallableRunnable : public AbstractRunnable
+	{
+	public:
+		/**
+		 * @brief Construct a new Callable Runnable object
+		 *
+		 * @param func Functor to run, forwarded into runnable
+		 * @param params Parameters to pass to functor, forwarded into runnable
+		 */
+		template <typename F, typename ...Args>
+		explicit CallableRunnable(F &&func, Args &&...params) :
+			_function(std::forward<F>(func)),
+			_params(std::forward<Args>(params)...) {}
+
+		/**
+		 * @brief Execute task, moving parameters into functor
+		 *
+		 */
+		void run() override
 		{
-			std::size_t constexpr tSize = std::tuple_size<typename std::remove_reference<Tuple>::type>::value;
-			appleTupleImpl
-			(
-				std::forward<F>(func),
-				std::forward<Tuple>(t),
-				std::make_index_sequence<tSize>()
-			);
+			call(std::index_sequence_for<Params...>());
 		}
 
 	private:
-		std::function<void(Params...)> _function;
+		template <size_t ...S>
+		void call(std::index_sequence<S...>)
+		{
+			_function(std::get<S>(std::move(_params))...);
+		}
+
+	private:
+		Func _function;
 		std::tuple<Params...> _params;
 	};
+
+	/**
+	 * @brief Create runnable binding functor to parameters, without type erasing functor
+	 *
+	 * @param func Functor to run
+	 * @param params Parameters to pass to functor
+	 * @return AbstractRunnable* New runnable, owned by whoever it's enqueued on
+	 */
+	template <typename Func, typename ...Params>
+	AbstractRunnable *makeRunnable(Func &&func, Params &&...params)
+	{
+		return new CallableRunnable<typename std::decay<Func>::type, typename std::decay<Params>::type...>(
+			std::forward<Func>(func),
+			std::forward<Params>(params)...
+		);
+	}
 };
 
 #endif /* RUNNABLE_H_ */
\ No newline at end of file
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file slaballocator.hpp
+ * @author Evan Stoddard
+ * @brief Recycling allocator for task memory (runnables, heap tasks, future states, queue nodes)
+ *
+ * Task memory is allocated on the submitting thread and freed on a worker,
+ * a pattern general purpose allocators handle poorly.  Everything the pools
+ * allocate per task goes through THREADUTILS_TASK_ALLOCATOR, SlabAllocator
+ * unless defined otherwise (before including any ThreadUtils header, and the
+ * same in every translation unit).  Define it as ThreadUtils::HeapAllocator
+ * to use the global heap, e.g. so AddressSanitizer catches use after free of
+ * task memory.
+ */
+
+#ifndef SLABALLOCATOR_H_
+#define SLABALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef THREADUTILS_TASK_ALLOCATOR
+#define THREADUTILS_TASK_ALLOCATOR ::ThreadUtils::SlabAllocator
+#endif
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Size classed block allocator with per thread free lists
+	 *
+	 * Blocks up to MaxBlockSize bytes are rounded up to a multiple of
+	 * Granularity and recycled, larger ones go to the global heap.  Each
+	 * thread allocates from and frees to its own lists without locking.
+	 * Lists move between threads a batch at a time through a shared depot,
+	 * so memory freed by workers finds its way back to submitting threads
+	 * with one lock per BatchSize blocks.  Once warmed up the global heap is
+	 * only touched when the depot overflows.
+	 *
+	 */
+	class SlabAllocator
+	{
+	public:
+		/// @brief Size classes are multiples of this (and blocks aligned to it)
+		static constexpr size_t Granularity = 16;
+
+		/// @brief Largest block recycled
+		static constexpr size_t MaxBlockSize = 1024;
+
+		/// @brief Number of size classes
+		static constexpr size_t NumClasses = MaxBlockSize / Granularity;
+
+		/// @brief Blocks moved between a thread and the depot at once
+		static constexpr uint32_t BatchSize = 32;
+
+		/// @brief Batches the depot keeps per size class, the rest are freed
+		static constexpr size_t MaxDepotBatches = 64;
+
+		/**
+		 * @brief Allocate block
+		 *
+		 * @param size Bytes needed
+		 * @return void* Block aligned to Granularity
+		 */
+		static void *allocate(size_t size)
+		{
+			if (size > MaxBlockSize)
+			{
+				return ::operator new(size);
+			}
+
+			size_t sizeClass = classOf(size);
+			ThreadCache *cache = threadCache();
+
+			// Thread is exiting, its lists are gone
+			if (cache == nullptr)
+			{
+				return ::operator new(classSize(sizeClass));
+			}
+
+			FreeList &list = cache->lists[sizeClass];
+			if (list.head == nullptr)
+			{
+				refill(list, sizeClass);
+			}
+
+			FreeBlock *block = list.head;
+			list.head = block->next;
+			list.count--;
+
+			return block;
+		}
+
+		/**
+		 * @brief Free block, on any thread
+		 *
+		 * @param block Block from allocate()
+		 * @param size Size it was allocated with
+		 */
+		static void deallocate(void *block, size_t size)
+		{
+			if (size > MaxBlockSize)
+			{
+				::operator delete(block);
+				return;
+			}
+
+			size_t sizeClass = classOf(size);
+			ThreadCache *cache = threadCache();
+
+			if (cache == nullptr)
+			{
+				::operator delete(block);
+				return;
+			}
+
+			FreeList &list = cache->lists[sizeClass];
+			FreeBlock *freed = static_cast<FreeBlock*>(block);
+			freed->next = list.head;
+			list.head = freed;
+			list.count++;
+
+			// Keep a batch for our own allocations, hand the next one back
+			if (list.count >= 2 * BatchSize)
+			{
+				flush(list, sizeClass, BatchSize);
+			}
+		}
+
+	private:
+		/**
+		 * @brief Free block, linked through its first bytes
+		 *
+		 */
+		struct FreeBlock
+		{
+			FreeBlock *next;
+		};
+
+		/**
+		 * @brief Thread's free list of one size class
+		 *
+		 */
+		struct FreeList
+		{
+			FreeBlock *head;
+			uint32_t count;
+		};
+
+		/**
+		 * @brief Linked blocks moved to or from the depot together
+		 *
+		 */
+		struct Batch
+		{
+			FreeBlock *head;
+			uint32_t count;
+		};
+
+		/**
+		 * @brief Batches of one size class shared by all threads
+		 *
+		 */
+		struct Depot
+		{
+			Depot()
+			{
+				// Never grows, so pushing never reaches the heap
+				batches.reserve(MaxDepotBatches);
+			}
+
+			std::mutex mutex;
+			std::vector<Batch> batches;
+		};
+
+		/// @brief Cache of thread not yet created, or destroyed as it exits
+		enum CacheState : uint8_t
+		{
+			CacheUnused = 0,
+			CacheLive,
+			CacheDestroyed
+		};
+
+		/**
+		 * @brief Free lists of a thread, handed to the depot when it exits
+		 *
+		 */
+		struct ThreadCache
+		{
+			ThreadCache()
+			{
+				for (size_t i = 0; i < NumClasses; i++)
+				{
+					lists[i].head = nullptr;
+					lists[i].count = 0;
+				}
+				cacheState() = CacheLive;
+			}
+
+			~ThreadCache()
+			{
+				for (size_t i = 0; i < NumClasses; i++)
+				{
+					while (lists[i].count > 0)
+					{
+						flush(lists[i], i, lists[i].count < BatchSize ? lists[i].count : BatchSize);
+					}
+				}
+				cacheState() = CacheDestroyed;
+			}
+
+			FreeList lists[NumClasses];
+		};
+
+		static size_t classOf(size_t size) { return size == 0 ? 0 : (size - 1) / Granularity; }
+
+		static size_t classSize(size_t sizeClass) { return (sizeClass + 1) * Granularity; }
+
+		/**
+		 * @brief Returns state of calling thread's cache (trivially destructible, so usable while exiting)
+		 *
+		 */
+		static uint8_t &cacheState()
+		{
+			static thread_local uint8_t state = CacheUnused;
+			return state;
+		}
+
+		/**
+		 * @brief Returns calling thread's cache, nullptr once destroyed
+		 *
+		 */
+		static ThreadCache *threadCache()
+		{
+			if (cacheState() == CacheDestroyed)
+			{
+				return nullptr;
+			}
+
+			static thread_local ThreadCache cache;
+			return &cache;
+		}
+
+		/**
+		 * @brief Returns depot of size class (never destroyed, threads may outlive statics)
+		 *
+		 */
+		static Depot &depot(size_t sizeClass)
+		{
+			static Depot *depots = new Depot[NumClasses];
+			return depots[sizeClass];
+		}
+
+		/**
+		 * @brief Fill empty list with a batch from the depot, or new blocks
+		 *
+		 */
+		static void refill(FreeList &list, size_t sizeClass)
+		{
+			Depot &shared = depot(sizeClass);
+			std::unique_lock<std::mutex> l(shared.mutex);
+			if (!shared.batches.empty())
+			{
+				Batch batch = shared.batches.back();
+				shared.batches.pop_back();
+				l.unlock();
+
+				list.head = batch.head;
+				list.count = batch.count;
+				return;
+			}
+			l.unlock();
+
+			// Blocks are allocated separately so any of them can go back to the heap
+			for (uint32_t i = 0; i < BatchSize; i++)
+			{
+				FreeBlock *block = static_cast<FreeBlock*>(::operator new(classSize(sizeClass)));
+				block->next = list.head;
+				list.head = block;
+				list.count++;
+			}
+		}
+
+		/**
+		 * @brief Move blocks from front of list to the depot
+		 *
+		 * @param list List to take from
+		 * @param sizeClass Size class of list
+		 * @param count Number of blocks to move (at most list's count)
+		 */
+		static void flush(FreeList &list, size_t sizeClass, uint32_t count)
+		{
+			Batch batch = { list.head, count };
+
+			FreeBlock *last = list.head;
+			for (uint32_t i = 1; i < count; i++)
+			{
+				last = last->next;
+			}
+			list.head = last->next;
+			list.count -= count;
+			last->next = nullptr;
+
+			Depot &shared = depot(sizeClass);
+			std::unique_lock<std::mutex> l(shared.mutex);
+			if (shared.batches.size() < MaxDepotBatches)
+			{
+				shared.batches.push_back(batch);
+				return;
+			}
+			l.unlock();
+
+			// Depot full, memory goes back to the heap
+			while (batch.head != nullptr)
+			{
+				FreeBlock *block = batch.head;
+				batch.head = block->next;
+				::operator delete(block);
+			}
+		}
+	};
+
+	/**
+	 * @brief Task allocator using the global heap
+	 *
+	 */
+	class HeapAllocator
+	{
+	public:
+		static void *allocate(size_t size) { return ::operator new(size); }
+
+		static void deallocate(void *block, size_t) { ::operator delete(block); }
+	};
+
+	/**
+	 * @brief Base giving a class (and classes derived from it) operator new and delete using the task allocator
+	 *
+	 * Deleting through a base pointer needs a virtual destructor, so the
+	 * size of the most derived class reaches operator delete.
+	 *
+	 */
+	class TaskAllocated
+	{
+	public:
+		static void *operator new(size_t size) { return THREADUTILS_TASK_ALLOCATOR::allocate(size); }
+
+		static void operator delete(void *block, size_t size) { THREADUTILS_TASK_ALLOCATOR::deallocate(block, size); }
+
+		// Class operator new hides the global placement form
+		static void *operator new(size_t, void *place) noexcept { return place; }
+
+		static void operator delete(void *, void *) noexcept {}
+
+#ifdef __cpp_aligned_new
+		// Over aligned classes bypass the task allocator
+		static void *operator new(size_t size, std::align_val_t alignment) { return ::operator new(size, alignment); }
+
+		static void operator delete(void *block, size_t, std::align_val_t alignment) { ::operator delete(block, alignment); }
+#endif
+	};
+
+	/**
+	 * @brief Construct object in memory from the task allocator
+	 *
+	 * Over aligned types use the global heap, aligned by hand since C++14's
+	 * operator new only guarantees alignof(max_align_t).  The block they were
+	 * carved from is kept just before them.
+	 *
+	 * @tparam T Type to construct
+	 * @param args Constructor arguments
+	 * @return T* New object, free with deleteTaskObject
+	 */
+	template <typename T, typename ...Args>
+	typename std::enable_if<alignof(T) <= alignof(max_align_t), T*>::type newTaskObject(Args &&...args)
+	{
+		void *block = THREADUTILS_TASK_ALLOCATOR::allocate(sizeof(T));
+		try
+		{
+			return ::new (block) T(std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			THREADUTILS_TASK_ALLOCATOR::deallocate(block, sizeof(T));
+			throw;
+		}
+	}
+
+	template <typename T, typename ...Args>
+	typename std::enable_if<(alignof(T) > alignof(max_align_t)), T*>::type newTaskObject(Args &&...args)
+	{
+		// At least alignof(max_align_t) bytes lie between block and object, room for the block pointer
+		void *block = ::operator new(sizeof(T) + alignof(T));
+		void *place = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(block) + alignof(T)) & ~(uintptr_t)(alignof(T) - 1));
+		static_cast<void**>(place)[-1] = block;
+		try
+		{
+			return ::new (place) T(std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			::operator delete(block);
+			throw;
+		}
+	}
+
+	/**
+	 * @brief Destroy object from newTaskObject
+	 *
+	 * @param object Object to destroy (exact type it was created as)
+	 */
+	template <typename T>
+	typename std::enable_if<alignof(T) <= alignof(max_align_t)>::type deleteTaskObject(T *object)
+	{
+		object->~T();
+		THREADUTILS_TASK_ALLOCATOR::deallocate(object, sizeof(T));
+	}
+
+	template <typename T>
+	typename std::enable_if<(alignof(T) > alignof(max_align_t))>::type deleteTaskObject(T *object)
+	{
+		void *block = static_cast<void**>(static_cast<void*>(object))[-1];
+		object->~T();
+		::operator delete(block);
+	}
+
+	/**
+	 * @brief Standard library allocator using the task allocator, for task queues
+	 *
+	 * @tparam T Element type
+	 */
+	template <typename T>
+	class TaskStdAllocator
+	{
+	public:
+		typedef T value_type;
+
+		TaskStdAllocator() noexcept {}
+
+		template <typename U>
+		TaskStdAllocator(const TaskStdAllocator<U> &) noexcept {}
+
+		T *allocate(size_t n)
+		{
+			return static_cast<T*>(THREADUTILS_TASK_ALLOCATOR::allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T *block, size_t n)
+		{
+			THREADUTILS_TASK_ALLOCATOR::deallocate(block, n * sizeof(T));
+		}
+
+		template <typename U>
+		bool operator==(const TaskStdAllocator<U> &) const noexcept { return true; }
+
+		template <typename U>
+		bool operator!=(const TaskStdAllocator<U> &) const noexcept { return false; }
+	};
+};
+
+#endif /* SLABALLOCATOR_H_ */
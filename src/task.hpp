@@ -0,0 +1,588 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file task.hpp
+ * @author Evan Stoddard
+ * @brief Move only, type erased task with small buffer storage
+ */
+
+#ifndef TASK_H_
+#define TASK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "runnable.hpp"
+#include "slaballocator.hpp"
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Whether callable has a cancel() member, run instead of the
+	 * callable when its task is thrown away
+	 *
+	 */
+	template <typename Func, typename = void>
+	struct HasCancel : std::false_type {};
+
+	template <typename Func>
+	struct HasCancel<Func, decltype(std::declval<Func&>().cancel(), void())> : std::true_type {};
+
+	/**
+	 * @brief Cancel callable, if it knows how to be cancelled
+	 *
+	 * @param func Callable being thrown away without running
+	 */
+	template <typename Func>
+	typename std::enable_if<HasCancel<Func>::value>::type cancelCallable(Func &func)
+	{
+		func.cancel();
+	}
+
+	template <typename Func>
+	typename std::enable_if<!HasCancel<Func>::value>::type cancelCallable(Func &)
+	{
+	}
+
+	/**
+	 * @brief CRTP base of task callables holding work that must be run or cancelled
+	 *
+	 * Holds the handle on the work (a state, node, coroutine, ...), empty
+	 * once run, cancelled or moved from.  A callable thrown away without
+	 * being cancelled by its owner cancels itself: its destructor calls
+	 * cancelIfOwned(), as by the time ours runs its own members are gone.
+	 *
+	 * @tparam Derived Callable, with a cancel() member taking the handle
+	 * @tparam Handle Handle on work, false when empty
+	 */
+	template <typename Derived, typename Handle>
+	class RunOrCancel
+	{
+	protected:
+		explicit RunOrCancel(Handle handle) :
+			_handle(handle)
+		{
+		}
+
+		RunOrCancel(RunOrCancel &&other) noexcept :
+			_handle(other._handle)
+		{
+			other._handle = Handle();
+		}
+
+		RunOrCancel(const RunOrCancel &) = delete;
+		RunOrCancel &operator=(const RunOrCancel &) = delete;
+		RunOrCancel &operator=(RunOrCancel &&) = delete;
+
+		~RunOrCancel() {}
+
+		/**
+		 * @brief Returns handle on work, leaving callable empty
+		 *
+		 */
+		Handle take()
+		{
+			Handle handle = _handle;
+			_handle = Handle();
+
+			return handle;
+		}
+
+		/**
+		 * @brief Returns handle on work without taking it
+		 *
+		 */
+		const Handle &handle() const { return _handle; }
+
+		/**
+		 * @brief Cancel work unless it was run, cancelled or moved away
+		 *
+		 */
+		void cancelIfOwned()
+		{
+			if (_handle)
+			{
+				static_cast<Derived*>(this)->cancel();
+			}
+		}
+
+	private:
+		/// @brief Handle on work (empty once run, cancelled or moved from)
+		Handle _handle;
+	};
+
+	/**
+	 * @brief Context object of the worker running a task
+	 *
+	 */
+	struct TaskContext
+	{
+		/// @brief Worker's context (nullptr if none)
+		void *context;
+
+		/// @brief Type tag of context (nullptr if none)
+		const void *type;
+	};
+
+	/**
+	 * @brief Whether callable takes the running worker's TaskContext, marked
+	 * by a TakesTaskContext typedef
+	 *
+	 */
+	template <typename Func, typename = void>
+	struct TakesTaskContext : std::false_type {};
+
+	template <typename Func>
+	struct TakesTaskContext<Func, typename Func::TakesTaskContext> : std::true_type {};
+
+	/**
+	 * @brief Call callable, passing context if it takes it
+	 *
+	 * @param func Callable to call
+	 * @param context Context of worker running it
+	 */
+	template <typename Func>
+	typename std::enable_if<TakesTaskContext<Func>::value>::type invokeCallable(Func &func, const TaskContext &context)
+	{
+		func(context);
+	}
+
+	template <typename Func>
+	typename std::enable_if<!TakesTaskContext<Func>::value>::type invokeCallable(Func &func, const TaskContext &)
+	{
+		func();
+	}
+
+	/**
+	 * @brief Move only wrapper around a nullary callable.
+	 *
+	 * Callables up to InlineSize bytes (and nothrow movable) are stored inline
+	 * without allocating, larger ones (and tasks allocated by work stealing
+	 * deques) come from the task allocator.
+	 *
+	 */
+	class Task : public TaskAllocated
+	{
+	public:
+		/// @brief Bytes of inline storage for callables
+		static constexpr size_t InlineSize = 64;
+
+		/**
+		 * @brief Construct an empty Task object
+		 *
+		 */
+		Task() noexcept :
+			_ops(nullptr),
+			_enqueueTime(0)
+		{
+		}
+
+		/**
+		 * @brief Construct a Task object from a nullary callable
+		 *
+		 * @tparam Func Callable type
+		 * @param func Callable to wrap
+		 */
+		template <
+			typename Func,
+			typename = typename std::enable_if<
+				!std::is_same<typename std::decay<Func>::type, Task>::value &&
+				!std::is_convertible<Func, AbstractRunnable*>::value
+			>::type
+		>
+		Task(Func &&func) :
+			_ops(nullptr),
+			_enqueueTime(0)
+		{
+			emplace<typename std::decay<Func>::type>(std::forward<Func>(func));
+		}
+
+		/**
+		 * @brief Create a Task object constructing its callable in place
+		 *
+		 * Arguments are forwarded straight to the callable's constructor, so
+		 * nothing is copied or moved on the way.
+		 *
+		 * @tparam Func Callable type
+		 * @param args Constructor arguments
+		 * @return Task Task holding new callable
+		 */
+		template <typename Func, typename ...Args>
+		static Task create(Args &&...args)
+		{
+			Task task;
+			task.emplace<Func>(std::forward<Args>(args)...);
+			return task;
+		}
+
+		/**
+		 * @brief Construct a Task object taking ownership of a runnable
+		 *
+		 * @param runnable Runnable to run and delete
+		 */
+		explicit Task(AbstractRunnable *runnable) :
+			_ops(nullptr),
+			_enqueueTime(0)
+		{
+			emplace<RunnableOwner>(runnable);
+		}
+
+		/**
+		 * @brief Move construct a Task object
+		 *
+		 * @param other Task to move from
+		 */
+		Task(Task &&other) noexcept :
+			_ops(other._ops),
+			_enqueueTime(other._enqueueTime)
+		{
+			if (_ops != nullptr)
+			{
+				_ops->move(&_storage, &other._storage);
+				other._ops = nullptr;
+			}
+		}
+
+		/**
+		 * @brief Move assign a Task object
+		 *
+		 * @param other Task to move from
+		 * @return Task& This task
+		 */
+		Task &operator=(Task &&other) noexcept
+		{
+			if (this != &other)
+			{
+				reset();
+
+				_ops = other._ops;
+				_enqueueTime = other._enqueueTime;
+				if (_ops != nullptr)
+				{
+					_ops->move(&_storage, &other._storage);
+					other._ops = nullptr;
+				}
+			}
+
+			return *this;
+		}
+
+		Task(const Task &) = delete;
+		Task &operator=(const Task &) = delete;
+
+		/**
+		 * @brief Destroy the Task object
+		 *
+		 */
+		~Task()
+		{
+			reset();
+		}
+
+		/**
+		 * @brief Execute task
+		 *
+		 */
+		void operator()()
+		{
+			TaskContext none = { nullptr, nullptr };
+			_ops->invoke(&_storage, none);
+		}
+
+		/**
+		 * @brief Execute task on a worker, passing its context to callables taking it
+		 *
+		 * @param context Context of worker
+		 */
+		void operator()(const TaskContext &context)
+		{
+			_ops->invoke(&_storage, context);
+		}
+
+		/**
+		 * @brief Throw task away without running it
+		 *
+		 * Callables with a cancel() member have it called first, so whoever is
+		 * waiting on them finds out (a future's promise is broken, a coroutine
+		 * frame destroyed, ...).  Pools cancel every task they drop, reject or
+		 * discard.  Cancelling never runs the task.
+		 *
+		 */
+		void cancel()
+		{
+			if (_ops != nullptr)
+			{
+				const Ops *ops = _ops;
+				_ops = nullptr;
+				ops->cancel(&_storage);
+			}
+		}
+
+		/**
+		 * @brief Returns held callable if it is a Func, like std::function::target()
+		 *
+		 * @tparam Func Callable type
+		 * @return Func* Held callable or nullptr
+		 */
+		template <typename Func>
+		Func *target()
+		{
+			if (_ops == &InlineOps<Func>::ops)
+			{
+				return static_cast<Func*>(static_cast<void*>(&_storage));
+			}
+			else if (_ops == &HeapOps<Func>::ops)
+			{
+				return HeapOps<Func>::get(&_storage);
+			}
+
+			return nullptr;
+		}
+
+		/**
+		 * @brief Returns whether task holds a callable
+		 *
+		 */
+		explicit operator bool() const { return _ops != nullptr; }
+
+		/**
+		 * @brief Record when task was queued, used for queue wait metrics
+		 *
+		 * @param time Timestamp from metricsNow()
+		 */
+		void setEnqueueTime(uint64_t time) { _enqueueTime = time; }
+
+		/**
+		 * @brief Returns when task was queued (0 if never)
+		 *
+		 */
+		uint64_t enqueueTime() const { return _enqueueTime; }
+
+		/**
+		 * @brief Destroy held callable, leaving task empty
+		 *
+		 */
+		void reset()
+		{
+			if (_ops != nullptr)
+			{
+				_ops->destroy(&_storage);
+				_ops = nullptr;
+			}
+		}
+
+	private:
+		/**
+		 * @brief Operations on type erased storage
+		 *
+		 */
+		struct Ops
+		{
+			void (*invoke)(void *storage, const TaskContext &context);
+			void (*move)(void *dst, void *src);
+			void (*destroy)(void *storage);
+			void (*cancel)(void *storage);
+		};
+
+		/**
+		 * @brief Operations for callables stored inline
+		 *
+		 */
+		template <typename Func>
+		struct InlineOps
+		{
+			static void invoke(void *storage, const TaskContext &context) { invokeCallable(*static_cast<Func*>(storage), context); }
+
+			static void move(void *dst, void *src)
+			{
+				new (dst) Func(std::move(*static_cast<Func*>(src)));
+				static_cast<Func*>(src)->~Func();
+			}
+
+			static void destroy(void *storage) { static_cast<Func*>(storage)->~Func(); }
+
+			static void cancel(void *storage)
+			{
+				cancelCallable(*static_cast<Func*>(storage));
+				destroy(storage);
+			}
+
+			static const Ops ops;
+		};
+
+		/**
+		 * @brief Operations for callables too large to store inline
+		 *
+		 */
+		template <typename Func>
+		struct HeapOps
+		{
+			static Func *&get(void *storage) { return *static_cast<Func**>(storage); }
+
+			static void invoke(void *storage, const TaskContext &context) { invokeCallable(*get(storage), context); }
+
+			static void move(void *dst, void *src)
+			{
+				new (dst) Func*(get(src));
+			}
+
+			static void destroy(void *storage) { deleteTaskObject(get(storage)); }
+
+			static void cancel(void *storage)
+			{
+				cancelCallable(*get(storage));
+				destroy(storage);
+			}
+
+			static const Ops ops;
+		};
+
+		/**
+		 * @brief Owns a heap allocated runnable
+		 *
+		 */
+		struct RunnableOwner
+		{
+			explicit RunnableOwner(AbstractRunnable *r) : runnable(r) {}
+
+			void operator()() { runnable->run(); }
+
+			std::unique_ptr<AbstractRunnable> runnable;
+		};
+
+		/**
+		 * @brief Whether callable type fits in inline storage
+		 *
+		 */
+		template <typename Func>
+		struct FitsInline
+		{
+			static constexpr bool value =
+				sizeof(Func) <= InlineSize &&
+				alignof(Func) <= alignof(max_align_t) &&
+				std::is_nothrow_move_constructible<Func>::value;
+		};
+
+		/**
+		 * @brief Construct callable inline
+		 *
+		 */
+		template <typename Func, typename ...Args>
+		typename std::enable_if<FitsInline<Func>::value>::type emplace(Args &&...args)
+		{
+			new (&_storage) Func(std::forward<Args>(args)...);
+			_ops = &InlineOps<Func>::ops;
+		}
+
+		/**
+		 * @brief Construct callable with task allocator
+		 *
+		 */
+		template <typename Func, typename ...Args>
+		typename std::enable_if<!FitsInline<Func>::value>::type emplace(Args &&...args)
+		{
+			new (&_storage) Func*(newTaskObject<Func>(std::forward<Args>(args)...));
+			_ops = &HeapOps<Func>::ops;
+		}
+
+	private:
+		/// @brief Storage for callable (or pointer to it)
+		typename std::aligned_storage<InlineSize, alignof(max_align_t)>::type _storage;
+
+		/// @brief Operations for held callable (nullptr if empty)
+		const Ops *_ops;
+
+		/// @brief Time task was queued
+		uint64_t _enqueueTime;
+	};
+
+	template <typename Func>
+	const Task::Ops Task::InlineOps<Func>::ops = {
+		&Task::InlineOps<Func>::invoke,
+		&Task::InlineOps<Func>::move,
+		&Task::InlineOps<Func>::destroy,
+		&Task::InlineOps<Func>::cancel
+	};
+
+	template <typename Func>
+	const Task::Ops Task::HeapOps<Func>::ops = {
+		&Task::HeapOps<Func>::invoke,
+		&Task::HeapOps<Func>::move,
+		&Task::HeapOps<Func>::destroy,
+		&Task::HeapOps<Func>::cancel
+	};
+
+	/// @brief Queue of tasks, its blocks recycled by the task allocator
+	typedef std::deque<Task, TaskStdAllocator<Task>> TaskDeque;
+
+	/**
+	 * @brief Decayed result type of calling a Func lvalue with Args
+	 *
+	 * Stands in for std::result_of, removed in C++20.
+	 *
+	 */
+	template <typename Func, typename ...Args>
+	struct CallResult
+	{
+		typedef typename std::decay<
+			decltype(std::declval<Func&>()(std::declval<Args>()...))
+		>::type type;
+	};
+
+	/**
+	 * @brief Callable binding a function to a tuple of arguments
+	 *
+	 * Bound arguments are moved into the function when called, so it can
+	 * only be called once.
+	 *
+	 * @tparam Func Function type
+	 * @tparam Params Bound argument types
+	 */
+	template <typename Func, typename ...Params>
+	class BoundCall
+	{
+	public:
+		/**
+		 * @brief Construct a new Bound Call object
+		 *
+		 * @param func Function to call
+		 * @param params Arguments to bind
+		 */
+		template <typename F, typename ...Args>
+		explicit BoundCall(F &&func, Args &&...params) :
+			_function(std::forward<F>(func)),
+			_params(std::forward<Args>(params)...)
+		{
+		}
+
+		/**
+		 * @brief Call function with bound arguments
+		 *
+		 * @return Whatever function returns
+		 */
+		decltype(auto) operator()()
+		{
+			return call(std::index_sequence_for<Params...>());
+		}
+
+	private:
+		template <size_t ...S>
+		decltype(auto) call(std::index_sequence<S...>)
+		{
+			return _function(std::get<S>(std::move(_params))...);
+		}
+
+	private:
+		Func _function;
+		std::tuple<Params...> _params;
+	};
+};
+
+#endif /* TASK_H_ */
@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file taskgraph.hpp
+ * @author Evan Stoddard
+ * @brief Dependency graph of tasks run on a Threadpool
+ */
+
+#ifndef TASKGRAPH_H_
+#define TASKGRAPH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "taskgroup.hpp"
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Directed acyclic graph of tasks
+	 *
+	 * Nodes run once all of their predecessors have.  Each node counts its
+	 * unfinished predecessors atomically and the predecessor that takes it
+	 * to zero schedules it, running one ready successor itself rather than
+	 * queueing it so chains don't bounce through the pool.
+	 *
+	 * Nodes are allocated when added, running the graph only resets their
+	 * counters, so a graph can be built once and run any number of times
+	 * (one run at a time).
+	 *
+	 */
+	class TaskGraph
+	{
+	public:
+		/// @brief Handle of a node within its graph
+		typedef size_t NodeId;
+
+		TaskGraph() :
+			_validated(false),
+			_group(nullptr)
+		{
+		}
+
+		TaskGraph(const TaskGraph &) = delete;
+		TaskGraph &operator=(const TaskGraph &) = delete;
+
+		/**
+		 * @brief Add node
+		 *
+		 * @param func Function node runs
+		 * @param dependencies Nodes that must run first
+		 * @return NodeId Handle of new node
+		 */
+		NodeId add(std::function<void()> func, std::initializer_list<NodeId> dependencies = {})
+		{
+			NodeId node = _nodes.size();
+			_nodes.emplace_back(node, std::move(func));
+
+			for (NodeId dependency : dependencies)
+			{
+				precede(dependency, node);
+			}
+
+			_validated = false;
+
+			return node;
+		}
+
+		/**
+		 * @brief Make one node run before another
+		 *
+		 * @param before Node that runs first
+		 * @param after Node that waits for it
+		 */
+		void precede(NodeId before, NodeId after)
+		{
+			if (before >= _nodes.size() || after >= _nodes.size())
+			{
+				throw std::out_of_range("TaskGraph node does not exist");
+			}
+
+			_nodes[before].successors.push_back(&_nodes[after]);
+			_nodes[after].predecessors++;
+
+			_validated = false;
+		}
+
+		/**
+		 * @brief Returns number of nodes
+		 *
+		 */
+		size_t size() const { return _nodes.size(); }
+
+		/**
+		 * @brief Run every node on pool, waiting until all have run
+		 *
+		 * The calling thread runs queued pool tasks while it waits, and nodes
+		 * the pool cancelled (overflow policy or shutdown).  The first
+		 * exception thrown by a node stops nodes that haven't started and is
+		 * rethrown here.
+		 *
+		 * @param pool Pool to run on
+		 * @throws std::logic_error Graph has a cycle
+		 */
+		void run(Threadpool &pool)
+		{
+			validate();
+
+			for (auto &node : _nodes)
+			{
+				node.pending.store(node.predecessors, std::memory_order_relaxed);
+			}
+			_error = nullptr;
+			_leftovers.clear();
+
+			TaskGroup group(pool);
+			setGroup(&group);
+
+			for (auto &node : _nodes)
+			{
+				if (node.predecessors == 0)
+				{
+					schedule(&node);
+				}
+			}
+
+			try
+			{
+				// Run nodes handed back by the pool here, until none are left
+				while (true)
+				{
+					group.wait();
+
+					Node *node = takeLeftover();
+					if (node == nullptr)
+					{
+						break;
+					}
+
+					try
+					{
+						execute(node);
+					}
+					catch (...)
+					{
+						fail(std::current_exception());
+					}
+				}
+			}
+			catch (...)
+			{
+				_leftovers.clear();
+				setGroup(nullptr);
+				throw;
+			}
+			setGroup(nullptr);
+
+			if (_error)
+			{
+				std::rethrow_exception(_error);
+			}
+		}
+
+		/**
+		 * @brief Stop nodes of current run that haven't started
+		 *
+		 */
+		void cancel()
+		{
+			std::unique_lock<std::mutex> l(_errorMutex);
+			if (_group != nullptr)
+			{
+				_group->cancel();
+			}
+		}
+
+	private:
+		/**
+		 * @brief Node and its edges
+		 *
+		 */
+		struct Node
+		{
+			Node(NodeId nodeId, std::function<void()> &&func) :
+				id(nodeId),
+				work(std::move(func)),
+				predecessors(0),
+				pending(0)
+			{
+			}
+
+			/// @brief Handle of node
+			NodeId id;
+
+			/// @brief Function node runs
+			std::function<void()> work;
+
+			/// @brief Nodes waiting on this one
+			std::vector<Node*> successors;
+
+			/// @brief Number of nodes this one waits on
+			uint32_t predecessors;
+
+			/// @brief Predecessors yet to run in current run
+			std::atomic<uint32_t> pending;
+		};
+
+		/**
+		 * @brief Queued run of a node
+		 *
+		 * If the pool cancels it (overflow policy or shutdown) the node is
+		 * handed back to the thread in run() instead.
+		 *
+		 */
+		class NodeTask : public RunOrCancel<NodeTask, Node*>
+		{
+		public:
+			NodeTask(TaskGraph *graph, Node *node) :
+				RunOrCancel(node),
+				_graph(graph)
+			{
+			}
+
+			NodeTask(NodeTask &&) = default;
+
+			~NodeTask() { cancelIfOwned(); }
+
+			void operator()()
+			{
+				_graph->execute(take());
+			}
+
+			/**
+			 * @brief Hand node back to run() unless the run is cancelled
+			 *
+			 */
+			void cancel()
+			{
+				Node *node = take();
+
+				if (!_graph->_group->cancelled())
+				{
+					std::unique_lock<std::mutex> l(_graph->_errorMutex);
+					_graph->_leftovers.push_back(node);
+				}
+			}
+
+		private:
+			/// @brief Graph node belongs to
+			TaskGraph *_graph;
+		};
+
+		/**
+		 * @brief Set group of current run
+		 *
+		 */
+		void setGroup(TaskGroup *group)
+		{
+			std::unique_lock<std::mutex> l(_errorMutex);
+			_group = group;
+		}
+
+		/**
+		 * @brief Take a node the pool handed back
+		 *
+		 * @return Node* Node, nullptr if none
+		 */
+		Node *takeLeftover()
+		{
+			std::unique_lock<std::mutex> l(_errorMutex);
+			if (_leftovers.empty())
+			{
+				return nullptr;
+			}
+
+			Node *node = _leftovers.back();
+			_leftovers.pop_back();
+
+			return node;
+		}
+
+		/**
+		 * @brief Queue node on current run's group
+		 *
+		 */
+		void schedule(Node *node)
+		{
+			_group->enqueue(NodeTask(this, node));
+		}
+
+		/**
+		 * @brief Run node, then successors it makes ready
+		 *
+		 */
+		void execute(Node *node)
+		{
+			while (node != nullptr && !_group->cancelled())
+			{
+				node->work();
+
+				// Keep first successor made ready, queue the rest
+				Node *next = nullptr;
+				for (Node *successor : node->successors)
+				{
+					if (successor->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					{
+						if (next == nullptr)
+						{
+							next = successor;
+						}
+						else
+						{
+							schedule(successor);
+						}
+					}
+				}
+
+				node = next;
+			}
+		}
+
+		/**
+		 * @brief Record exception thrown outside a group task and stop run
+		 *
+		 */
+		void fail(std::exception_ptr error)
+		{
+			std::unique_lock<std::mutex> l(_errorMutex);
+			if (!_error)
+			{
+				_error = std::move(error);
+			}
+			_group->cancel();
+		}
+
+		/**
+		 * @brief Check graph is acyclic (once per change)
+		 *
+		 */
+		void validate()
+		{
+			if (_validated)
+			{
+				return;
+			}
+
+			// Kahn's algorithm, every node must become ready
+			std::vector<uint32_t> pending(_nodes.size());
+			std::vector<const Node*> ready;
+			for (size_t i = 0; i < _nodes.size(); i++)
+			{
+				pending[i] = _nodes[i].predecessors;
+				if (pending[i] == 0)
+				{
+					ready.push_back(&_nodes[i]);
+				}
+			}
+
+			size_t visited = 0;
+			while (!ready.empty())
+			{
+				const Node *node = ready.back();
+				ready.pop_back();
+				visited++;
+
+				for (const Node *successor : node->successors)
+				{
+					if (--pending[successor->id] == 0)
+					{
+						ready.push_back(successor);
+					}
+				}
+			}
+
+			if (visited != _nodes.size())
+			{
+				throw std::logic_error("TaskGraph has a cycle");
+			}
+
+			_validated = true;
+		}
+
+	private:
+		/// @brief Nodes, deque so adding never moves existing ones
+		std::deque<Node> _nodes;
+
+		/// @brief Graph checked for cycles since last change
+		bool _validated;
+
+		/// @brief Group of current run (nullptr between runs)
+		TaskGroup *_group;
+
+		/// @brief First exception thrown outside a group task
+		std::exception_ptr _error;
+
+		/// @brief Nodes of current run cancelled by the pool, left for run()
+		std::vector<Node*> _leftovers;
+
+		/// @brief Mutex guarding exception, current group and leftovers
+		std::mutex _errorMutex;
+	};
+};
+
+#endif /* TASKGRAPH_H_ */
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file taskgroup.hpp
+ * @author Evan Stoddard
+ * @brief Group of pool tasks that can be waited on and cancelled together
+ */
+
+#ifndef TASKGROUP_H_
+#define TASKGROUP_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include "completionlatch.hpp"
+#include "optional.hpp"
+#include "threadpool.hpp"
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Tracks a set of tasks enqueued on a pool
+	 *
+	 * wait() runs queued pool tasks on the calling thread until the group's
+	 * tasks are done, so a worker waiting on subtasks keeps its core busy
+	 * (and can't deadlock the pool by waiting on work queued behind it).
+	 * Once there's nothing to run it parks until the last task is done or
+	 * another task joins the group.
+	 *
+	 * Groups can be nested: a group constructed from a parent shares its
+	 * pool and is cancelled along with it.  Cancelling skips tasks that
+	 * haven't started, tasks already running finish.  A task throwing
+	 * cancels its group and the first exception is rethrown from wait().
+	 *
+	 * Tasks cancelled by the pool (rejected or dropped by its overflow
+	 * policy, or discarded by a shutdown) never run and count as done, a
+	 * callable with a cancel() member has it called first.
+	 *
+	 */
+	class TaskGroup
+	{
+	public:
+		/**
+		 * @brief Construct a new Task Group object
+		 *
+		 * @param pool Pool tasks run on
+		 */
+		explicit TaskGroup(Threadpool &pool) :
+			_pool(pool),
+			_parent(nullptr),
+			_cancelled(false),
+			_failed(false)
+		{
+		}
+
+		/**
+		 * @brief Construct a new Task Group object nested in another
+		 *
+		 * @param parent Group whose pool tasks run on, cancelling it cancels this
+		 */
+		explicit TaskGroup(TaskGroup &parent) :
+			_pool(parent._pool),
+			_parent(&parent),
+			_cancelled(false),
+			_failed(false)
+		{
+		}
+
+		TaskGroup(const TaskGroup &) = delete;
+		TaskGroup &operator=(const TaskGroup &) = delete;
+
+		/**
+		 * @brief Destroy the Task Group object, waiting for outstanding tasks
+		 *
+		 * Exceptions thrown by tasks are discarded if wait() wasn't called.
+		 *
+		 */
+		~TaskGroup()
+		{
+			waitForTasks();
+		}
+
+		/**
+		 * @brief Enqueue task as part of group
+		 *
+		 * @param func Callable to run
+		 * @param lane Priority lane (least urgent if omitted)
+		 * @return true Task enqueued
+		 * @return false Task rejected by overflow policy, or group cancelled
+		 */
+		template <typename Func>
+		bool enqueue(Func &&func, size_t lane = TaskQueue::LowestLane)
+		{
+			if (cancelled())
+			{
+				return false;
+			}
+
+			_tasks.add(1);
+			bool enqueued = _pool.enqueue(Task(Member<typename std::decay<Func>::type>(this, std::forward<Func>(func))), lane);
+
+			// A waiter may be parked with nothing left to help with
+			_tasks.wake();
+
+			return enqueued;
+		}
+
+		/**
+		 * @brief Wait for every task of group, running queued pool tasks meanwhile
+		 *
+		 * Rethrows the first exception thrown by a task of the group.
+		 *
+		 */
+		void wait()
+		{
+			waitForTasks();
+
+			if (_failed)
+			{
+				_failed = false;
+				std::rethrow_exception(std::move(_error));
+			}
+		}
+
+		/**
+		 * @brief Skip tasks of group (and nested groups) that haven't started
+		 *
+		 */
+		void cancel()
+		{
+			_cancelled.store(true, std::memory_order_release);
+		}
+
+		/**
+		 * @brief Returns whether group, or a group it's nested in, is cancelled
+		 *
+		 */
+		bool cancelled() const
+		{
+			for (const TaskGroup *group = this; group != nullptr; group = group->_parent)
+			{
+				if (group->_cancelled.load(std::memory_order_acquire))
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		/**
+		 * @brief Returns number of tasks enqueued and not yet done
+		 *
+		 */
+		size_t outstanding() const { return _tasks.count(); }
+
+		/**
+		 * @brief Returns pool tasks run on
+		 *
+		 */
+		Threadpool &pool() { return _pool; }
+
+	private:
+		/**
+		 * @brief Task of group, counted done when run or cancelled
+		 *
+		 * The callable is destroyed before the task is counted done, so
+		 * nothing it owns outlives wait().
+		 *
+		 */
+		template <typename Func>
+		class Member : public RunOrCancel<Member<Func>, TaskGroup*>
+		{
+		public:
+			template <typename F>
+			Member(TaskGroup *group, F &&func) :
+				RunOrCancel<Member, TaskGroup*>(group)
+			{
+				_func.emplace(std::forward<F>(func));
+			}
+
+			Member(Member &&) = default;
+
+			~Member() { this->cancelIfOwned(); }
+
+			void operator()()
+			{
+				TaskGroup *group = this->take();
+
+				if (!group->cancelled())
+				{
+					try
+					{
+						(*_func)();
+					}
+					catch (...)
+					{
+						group->fail(std::current_exception());
+					}
+				}
+
+				_func.reset();
+				group->_tasks.countDown();
+			}
+
+			/**
+			 * @brief Count done without running, cancelling callable too
+			 *
+			 */
+			void cancel()
+			{
+				TaskGroup *group = this->take();
+
+				cancelCallable(*_func);
+				_func.reset();
+				group->_tasks.countDown();
+			}
+
+		private:
+			/// @brief Callable, reset before task counts as done
+			Optional<Func> _func;
+		};
+
+		/**
+		 * @brief Record first exception and cancel group
+		 *
+		 */
+		void fail(std::exception_ptr error)
+		{
+			std::unique_lock<std::mutex> l(_mutex);
+			if (!_failed)
+			{
+				_error = std::move(error);
+				_failed = true;
+			}
+			l.unlock();
+
+			cancel();
+		}
+
+		/**
+		 * @brief Help run queued tasks until outstanding count reaches zero
+		 *
+		 */
+		void waitForTasks()
+		{
+			_tasks.wait([this]() { return _pool.runPendingTask(); });
+		}
+
+	private:
+		/// @brief Pool tasks run on
+		Threadpool &_pool;
+
+		/// @brief Group this one is nested in (nullptr if none)
+		TaskGroup *_parent;
+
+		/// @brief Tasks enqueued and not yet done
+		CompletionLatch _tasks;
+
+		/// @brief Group cancelled
+		std::atomic_bool _cancelled;
+
+		/// @brief A task threw
+		bool _failed;
+
+		/// @brief First exception thrown by a task
+		std::exception_ptr _error;
+
+		/// @brief Mutex guarding exception
+		std::mutex _mutex;
+	};
+};
+
+#endif /* TASKGROUP_H_ */
@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file taskqueue.hpp
+ * @author Evan Stoddard
+ * @brief Task queue split into priority lanes
+ */
+
+#ifndef TASKQUEUE_H_
+#define TASKQUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <limits>
+#include <vector>
+#include "task.hpp"
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief How a TaskQueue picks the lane to dequeue from
+	 *
+	 */
+	enum class LanePolicy
+	{
+		/// @brief Always take from most urgent non-empty lane
+		Strict,
+
+		/// @brief Take up to weight tasks from each lane in turn
+		WeightedFair
+	};
+
+	/**
+	 * @brief Settings of one priority lane
+	 *
+	 */
+	struct LaneSettings
+	{
+		LaneSettings() :
+			weight(1),
+			maxDepth(std::numeric_limits<size_t>::max())
+		{
+		}
+
+		/// @brief Tasks taken per turn (WeightedFair)
+		uint32_t weight;
+
+		/// @brief Most tasks queued in lane before overflow policy applies
+		size_t maxDepth;
+	};
+
+	/**
+	 * @brief Number, settings and dequeue policy of priority lanes
+	 *
+	 * Lane 0 is the most urgent.  Tasks enqueued without a lane go to the last
+	 * lane.
+	 *
+	 */
+	struct PriorityLanes
+	{
+		/**
+		 * @brief Construct configuration of a single lane (plain FIFO)
+		 *
+		 */
+		PriorityLanes() :
+			policy(LanePolicy::Strict),
+			lanes(1),
+			maxSkips(0)
+		{
+		}
+
+		/**
+		 * @brief Strict priority lanes
+		 *
+		 * @param numLanes Number of lanes
+		 * @param maxSkips Pops a waiting lane is passed over before it's served anyway, give or take the number of lanes (0 to disable)
+		 */
+		static PriorityLanes strict(size_t numLanes, uint32_t maxSkips = 64)
+		{
+			PriorityLanes config;
+			config.lanes.resize(numLanes > 0 ? numLanes : 1);
+			config.maxSkips = maxSkips;
+			return config;
+		}
+
+		/**
+		 * @brief Weighted fair lanes, one per weight
+		 *
+		 * @param weights Tasks taken from each lane per turn
+		 */
+		static PriorityLanes weighted(const std::vector<uint32_t> &weights)
+		{
+			PriorityLanes config;
+			config.policy = LanePolicy::WeightedFair;
+			config.lanes.resize(weights.empty() ? 1 : weights.size());
+			for (size_t i = 0; i < weights.size(); i++)
+			{
+				config.lanes[i].weight = weights[i];
+			}
+			return config;
+		}
+
+		/// @brief How lane to dequeue from is picked
+		LanePolicy policy;
+
+		/// @brief Settings of each lane, most urgent first
+		std::vector<LaneSettings> lanes;
+
+		/// @brief Starvation protection, see strict()
+		uint32_t maxSkips;
+	};
+
+	/**
+	 * @brief FIFO of tasks per priority lane
+	 *
+	 * A bitmask of non-empty lanes keeps push and pop O(1) whatever the number
+	 * of lanes.  Starvation protection checks one waiting lane per pop, round
+	 * robin, and serves it if it's been passed over for more than maxSkips
+	 * pops since it was last served (or filled).  As a lane can wait up to a
+	 * round of checks for its turn, it's passed over at most maxSkips plus
+	 * the number of lanes times.
+	 *
+	 * Not thread safe, pools guard it with their queue mutex.
+	 *
+	 */
+	class TaskQueue
+	{
+	public:
+		/// @brief Most lanes a queue can have
+		static constexpr size_t MaxLanes = 64;
+
+		/// @brief Lane meaning least urgent, whatever the number of lanes
+		static constexpr size_t LowestLane = std::numeric_limits<size_t>::max();
+
+		/**
+		 * @brief Construct a new Task Queue object
+		 *
+		 * @param config Lane configuration
+		 */
+		explicit TaskQueue(const PriorityLanes &config = PriorityLanes()) :
+			_size(0),
+			_nonEmpty(0),
+			_pops(0),
+			_agingCursor(0),
+			_current(0),
+			_credits(0)
+		{
+			configure(config);
+		}
+
+		/**
+		 * @brief Change lane configuration
+		 *
+		 * Tasks queued in lanes that no longer exist move to the new last lane.
+		 *
+		 * @param config Lane configuration (at most MaxLanes lanes)
+		 */
+		void configure(const PriorityLanes &config)
+		{
+			_config = config;
+			if (_config.lanes.empty())
+			{
+				_config.lanes.resize(1);
+			}
+			if (_config.lanes.size() > MaxLanes)
+			{
+				_config.lanes.resize(MaxLanes);
+			}
+
+			// Rebuild lanes, moving tasks over in order
+			std::vector<TaskDeque> lanes(_config.lanes.size());
+			for (size_t i = 0; i < _lanes.size(); i++)
+			{
+				TaskDeque &to = lanes[i < lanes.size() ? i : lanes.size() - 1];
+				for (auto &task : _lanes[i])
+				{
+					to.emplace_back(std::move(task));
+				}
+			}
+			_lanes.swap(lanes);
+
+			_nonEmpty = 0;
+			for (size_t i = 0; i < _lanes.size(); i++)
+			{
+				if (!_lanes[i].empty())
+				{
+					_nonEmpty |= bit(i);
+				}
+			}
+
+			_lastServed.assign(_lanes.size(), _pops);
+			_agingCursor = 0;
+			_current = _lanes.size() - 1;
+			_credits = 0;
+		}
+
+		/**
+		 * @brief Returns lane configuration
+		 *
+		 */
+		const PriorityLanes &config() const { return _config; }
+
+		/**
+		 * @brief Returns number of lanes
+		 *
+		 */
+		size_t lanes() const { return _lanes.size(); }
+
+		/**
+		 * @brief Returns lane tasks pushed to lane end up in
+		 *
+		 * @param lane Requested lane, lanes past the last (e.g. LowestLane) map to the last
+		 */
+		size_t laneFor(size_t lane) const { return lane < _lanes.size() ? lane : _lanes.size() - 1; }
+
+		/**
+		 * @brief Returns number of tasks queued in all lanes
+		 *
+		 */
+		size_t size() const { return _size; }
+
+		/**
+		 * @brief Returns number of tasks queued in lane
+		 *
+		 * @param lane Lane
+		 */
+		size_t size(size_t lane) const { return _lanes[laneFor(lane)].size(); }
+
+		/**
+		 * @brief Returns whether no tasks are queued
+		 *
+		 */
+		bool empty() const { return _size == 0; }
+
+		/**
+		 * @brief Returns whether any lane more urgent than the last has tasks queued
+		 *
+		 */
+		bool hasUrgent() const { return (_nonEmpty & ~bit(_lanes.size() - 1)) != 0; }
+
+		/**
+		 * @brief Returns depth limit of lane
+		 *
+		 * @param lane Lane
+		 */
+		size_t maxDepth(size_t lane) const { return _config.lanes[laneFor(lane)].maxDepth; }
+
+		/**
+		 * @brief Returns least urgent lane with tasks queued.  Queue must not be empty.
+		 *
+		 */
+		size_t lowestNonEmpty() const { return highestBit(_nonEmpty); }
+
+		/**
+		 * @brief Push task to back of lane
+		 *
+		 * @param task Task to queue
+		 * @param lane Lane, see laneFor
+		 */
+		void push(Task &&task, size_t lane = LowestLane)
+		{
+			lane = laneFor(lane);
+
+			// Lane's wait for service starts now
+			if ((_nonEmpty & bit(lane)) == 0)
+			{
+				_nonEmpty |= bit(lane);
+				_lastServed[lane] = _pops;
+			}
+
+			_lanes[lane].emplace_back(std::move(task));
+			_size++;
+		}
+
+		/**
+		 * @brief Returns last task pushed to lane
+		 *
+		 * @param lane Lane, see laneFor
+		 */
+		Task &back(size_t lane = LowestLane) { return _lanes[laneFor(lane)].back(); }
+
+		/**
+		 * @brief Pop next task according to lane policy
+		 *
+		 * @param task Task popped
+		 * @return true Task popped
+		 * @return false Queue empty
+		 */
+		bool pop(Task &task)
+		{
+			if (_size == 0)
+			{
+				return false;
+			}
+
+			popFront(nextLane(), task);
+			return true;
+		}
+
+		/**
+		 * @brief Pop oldest task of lane, bypassing lane policy
+		 *
+		 * @param lane Lane
+		 * @param task Task popped
+		 * @return true Task popped
+		 * @return false Lane empty
+		 */
+		bool popFront(size_t lane, Task &task)
+		{
+			lane = laneFor(lane);
+			if (_lanes[lane].empty())
+			{
+				return false;
+			}
+
+			task = std::move(_lanes[lane].front());
+			_lanes[lane].pop_front();
+			_size--;
+
+			if (_lanes[lane].empty())
+			{
+				_nonEmpty &= ~bit(lane);
+			}
+
+			_lastServed[lane] = ++_pops;
+
+			return true;
+		}
+
+		/**
+		 * @brief Move every task of other queue to back of same lane of this one
+		 *
+		 * @param other Queue to empty
+		 */
+		void takeAll(TaskQueue &other)
+		{
+			Task task;
+			for (size_t lane = 0; lane < other.lanes(); lane++)
+			{
+				while (other.popFront(lane, task))
+				{
+					push(std::move(task), lane);
+				}
+			}
+		}
+
+	private:
+		/**
+		 * @brief Pick lane to pop from.  Queue must not be empty.
+		 *
+		 */
+		size_t nextLane()
+		{
+			// Starvation protection, one waiting lane checked per pop
+			if (_config.maxSkips > 0)
+			{
+				size_t waiting = nextSetBit(_agingCursor);
+				_agingCursor = waiting + 1 < _lanes.size() ? waiting + 1 : 0;
+
+				if (_pops - _lastServed[waiting] > _config.maxSkips)
+				{
+					return waiting;
+				}
+			}
+
+			if (_config.policy == LanePolicy::Strict)
+			{
+				return lowestBit(_nonEmpty);
+			}
+
+			// Weighted fair, stay on lane until its turn is used up
+			if (_credits == 0 || (_nonEmpty & bit(_current)) == 0)
+			{
+				_current = nextSetBit(_current + 1 < _lanes.size() ? _current + 1 : 0);
+				_credits = _config.lanes[_current].weight > 0 ? _config.lanes[_current].weight : 1;
+			}
+			_credits--;
+
+			return _current;
+		}
+
+		/**
+		 * @brief Returns first non-empty lane at or after lane, wrapping around
+		 *
+		 */
+		size_t nextSetBit(size_t lane) const
+		{
+			uint64_t after = _nonEmpty & (~(uint64_t)0 << lane);
+			return lowestBit(after != 0 ? after : _nonEmpty);
+		}
+
+		static uint64_t bit(size_t lane) { return (uint64_t)1 << lane; }
+
+		static size_t lowestBit(uint64_t mask)
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			return (size_t)__builtin_ctzll(mask);
+#else
+			size_t index = 0;
+			while ((mask & 1) == 0)
+			{
+				mask >>= 1;
+				index++;
+			}
+			return index;
+#endif
+		}
+
+		static size_t highestBit(uint64_t mask)
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			return 63 - (size_t)__builtin_clzll(mask);
+#else
+			size_t index = 0;
+			while (mask >>= 1)
+			{
+				index++;
+			}
+			return index;
+#endif
+		}
+
+	private:
+		/// @brief Lane configuration
+		PriorityLanes _config;
+
+		/// @brief Tasks of each lane
+		std::vector<TaskDeque> _lanes;
+
+		/// @brief Tasks queued in all lanes
+		size_t _size;
+
+		/// @brief Bit per non-empty lane
+		uint64_t _nonEmpty;
+
+		/// @brief Pops so far
+		uint64_t _pops;
+
+		/// @brief Pop count when each lane was last served or filled
+		std::vector<uint64_t> _lastServed;
+
+		/// @brief Next lane starvation protection checks
+		size_t _agingCursor;
+
+		/// @brief Lane whose turn it is (WeightedFair)
+		size_t _current;
+
+		/// @brief Tasks left in current lane's turn (WeightedFair)
+		uint32_t _credits;
+	};
+};
+
+#endif /* TASKQUEUE_H_ */
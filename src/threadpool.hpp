@@ -12,215 +12,2665 @@
 #define THREADPOOL_H_
 
 #include <stdint.h>
+#include <chrono>
+#include <limits>
 #include <vector>
 #include <deque>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include "backoff.hpp"
+#include "metrics.hpp"
+#include "profiling.hpp"
+#include "topology.hpp"
 #include "runnable.hpp"
+#include "task.hpp"
+#include "taskqueue.hpp"
+#include "coroutine.hpp"
+#include "future.hpp"
+#include "workstealingdeque.hpp"
 #include <iostream>
 
 namespace ThreadUtils
 {
+	/**
+	 * @brief How runnables are distributed between worker threads
+	 *
+	 */
+	enum class SchedulingMode
+	{
+		/// @brief All workers pull from a single mutex protected queue
+		SharedQueue,
+
+		/// @brief Each worker owns a deque, idle workers steal from others
+		WorkStealing
+	};
+
+	/**
+	 * @brief What feeding a full queue does
+	 *
+	 * Tasks fed from one of the pool's own workers never wait, as the workers
+	 * are what drain the queue.  With Block or BlockWithTimeout they're
+	 * admitted over the limit instead.
+	 *
+	 */
+	enum class OverflowPolicy
+	{
+		/// @brief Wait until a worker takes a task
+		Block,
+
+		/// @brief Wait until a worker takes a task or timeout expires
+		BlockWithTimeout,
+
+		/// @brief Return false straight away
+		TryAndReturnFalse,
+
+		/// @brief Discard oldest queued task to make room
+		DropOldest
+	};
+
+	/**
+	 * @brief What happened to queued tasks when a pool shut down
+	 *
+	 */
+	struct ShutdownReport
+	{
+		ShutdownReport() :
+			tasksRun(0),
+			tasksDiscarded(0),
+			tasksRejected(0),
+			drained(true)
+		{
+		}
+
+		/// @brief Tasks run from the call until workers stopped
+		uint64_t tasksRun;
+
+		/// @brief Queued tasks cancelled without running
+		uint64_t tasksDiscarded;
+
+		/// @brief Tasks enqueued during the call that were rejected (and cancelled)
+		uint64_t tasksRejected;
+
+		/// @brief Queued work finished before the deadline
+		bool drained;
+	};
+
+	/**
+	 * @brief When an elastic pool adds and retires workers
+	 *
+	 */
+	struct ElasticPolicy
+	{
+		/**
+		 * @brief Construct policy leaving worker count alone
+		 *
+		 */
+		ElasticPolicy() :
+			enabled(false),
+			minThreads(1),
+			maxThreads(1),
+			growAfter(std::chrono::milliseconds(1)),
+			keepAlive(std::chrono::seconds(30))
+		{
+		}
+
+		/**
+		 * @brief Keep worker count between bounds, following load
+		 *
+		 * @param minThreads Fewest workers kept however idle
+		 * @param maxThreads Most workers added however busy
+		 * @param growAfter Queue wait of a task with no worker idle that adds a worker
+		 * @param keepAlive How long a worker sits idle before retiring
+		 */
+		static ElasticPolicy between(
+			uint32_t minThreads,
+			uint32_t maxThreads,
+			std::chrono::nanoseconds growAfter = std::chrono::milliseconds(1),
+			std::chrono::nanoseconds keepAlive = std::chrono::seconds(30)
+		)
+		{
+			ElasticPolicy policy;
+			policy.enabled = true;
+			policy.minThreads = minThreads;
+			policy.maxThreads = maxThreads > minThreads ? maxThreads : minThreads;
+			policy.growAfter = growAfter;
+			policy.keepAlive = keepAlive;
+			return policy;
+		}
+
+		/// @brief Worker count follows load
+		bool enabled;
+
+		/// @brief Fewest workers kept however idle
+		uint32_t minThreads;
+
+		/// @brief Most workers added however busy
+		uint32_t maxThreads;
+
+		/// @brief Queue wait of a task with no worker idle that adds a worker
+		std::chrono::nanoseconds growAfter;
+
+		/// @brief How long a worker sits idle before retiring
+		std::chrono::nanoseconds keepAlive;
+	};
+
+	/**
+	 * @brief Callbacks run on each worker thread as it starts and leaves
+	 *
+	 * Both get the worker's index.  They run on the worker itself, so
+	 * thread affine state (library contexts, connections) can be set up and
+	 * torn down on the thread that uses it.
+	 *
+	 */
+	struct WorkerHooks
+	{
+		/// @brief Run before worker takes its first task
+		std::function<void(uint32_t)> onStart;
+
+		/// @brief Run after worker's last task, as it leaves (retired, drained or stopped)
+		std::function<void(uint32_t)> onExit;
+	};
+
+	class Threadpool : public ContinuationScheduler
+	{
+	public:
+		/// @brief Most workers a pool can be resized to, unless constructed with more
+		static constexpr uint32_t DefaultMaxThreads = 256;
+
+		/// @brief Free deque nodes each worker keeps for reuse (work stealing mode)
+		static constexpr size_t NodeCacheSize = 256;
+
+		/// @brief Index context factories get for a thread helping out that isn't a worker
+		static constexpr uint32_t HelperContextIndex = std::numeric_limits<uint32_t>::max();
+
+		/**
+		 * @brief Construct a new Threadpool:: Threadpool object
+		 *
+		 * @param numThreads Number of threads in thread ool
+		 * @param mode Scheduling mode used by worker threads
+		 */
+		explicit Threadpool(uint32_t numThreads, SchedulingMode mode = SchedulingMode::SharedQueue) :
+			_numThreads(numThreads),
+			_maxThreads(numThreads > DefaultMaxThreads ? numThreads : DefaultMaxThreads),
+			_slotsUsed(0),
+			_poolRunning(false),
+			_schedulingMode(mode),
+			_pendingTasks(0),
+			_sleepingThreads(0),
+			_inputEpoch(0),
+			_maxQueueSize(std::numeric_limits<size_t>::max()),
+			_overflowPolicy(OverflowPolicy::Block),
+			_enqueueTimeout(0),
+			_blockedProducers(0),
+			_tasksRejected(0),
+			_tasksDropped(0),
+			_elasticEnabled(false),
+			_elasticMin(0),
+			_elasticMax(0),
+			_growAfter(0),
+			_keepAlive(0),
+			_lastGrowth(0),
+			_draining(false),
+			_closing(false),
+			_contextType(nullptr)
+		{
+		}
+
+		/**
+		 * @brief Destroy the Threadpool object
+		 *
+		 */
+		virtual ~Threadpool()
+		{
+			// Stop threads and cancel whatever is left, while every member is alive
+			shutdown();
+
+			// Futures outliving us cancel their continuations from now on
+			detachContinuations();
+		}
+
+		/**
+		 * @brief Bound the queue fed by this pool's enqueue (or feedQueue)
+		 *
+		 * @param maxQueueSize Most tasks queued before overflow policy applies
+		 * @param policy What feeding a full queue does
+		 * @param timeout How long BlockWithTimeout waits
+		 */
+		void setBackpressure(
+			size_t maxQueueSize,
+			OverflowPolicy policy = OverflowPolicy::Block,
+			std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0)
+		)
+		{
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			_maxQueueSize = maxQueueSize;
+			_overflowPolicy = policy;
+			_enqueueTimeout = timeout;
+			l.unlock();
+
+			// Let blocked producers recheck against new limit
+			_notFullCV.notify_all();
+		}
+
+		/**
+		 * @brief Set where workers run, taking effect on next start()
+		 *
+		 * Workers can be pinned to a CPU set or spread across NUMA nodes.  In
+		 * work stealing mode each node can also get its own queue: outside
+		 * submitters feed the queue of the node they're running on, and
+		 * workers only take from other nodes once their own node has
+		 * nothing left.
+		 *
+		 * @param placement Worker placement
+		 */
+		void setPlacement(const WorkerPlacement &placement)
+		{
+			_placement = placement;
+		}
+
+		/**
+		 * @brief Set callbacks run by each worker as it starts and leaves
+		 *
+		 * Workers already running keep the hooks they started with (and run
+		 * their onExit), workers started from now on use these.  Hooks must
+		 * not start, stop or resize the pool.
+		 *
+		 * @param hooks Worker hooks
+		 */
+		void setWorkerHooks(const WorkerHooks &hooks)
+		{
+			std::unique_lock<ProfiledMutex> l(_resizeMutex);
+			_workerHooks = hooks;
+		}
+
+		/**
+		 * @brief Give each worker its own context object, for tasks to reuse
+		 *
+		 * Each worker creates its context on its own thread when it starts
+		 * (after WorkerHooks::onStart) and destroys it as it leaves (before
+		 * onExit).  Tasks enqueued with enqueueWithContext are passed the
+		 * context of the worker running them, without locking, as no other
+		 * thread touches it.  Like hooks, applies to workers started from now
+		 * on.
+		 *
+		 * @tparam Context Type of context
+		 * @param factory Creates context of worker with given index
+		 */
+		template <typename Context>
+		void setWorkerContext(std::function<std::unique_ptr<Context>(uint32_t)> factory)
+		{
+			std::unique_lock<ProfiledMutex> l(_resizeMutex);
+			_contextFactory = [factory](uint32_t index) { return std::shared_ptr<void>(factory(index)); };
+			_contextType.store(contextType<Context>(), std::memory_order_relaxed);
+		}
+
+		/**
+		 * @brief Give each worker its own default constructed context
+		 *
+		 * @tparam Context Type of context
+		 */
+		template <typename Context>
+		void setWorkerContext()
+		{
+			setWorkerContext<Context>([](uint32_t) { return std::unique_ptr<Context>(new Context()); });
+		}
+
+		/**
+		 * @brief Returns context of worker on calling thread
+		 *
+		 * For code that can't be handed the context, e.g. helpers called from
+		 * tasks: enqueueWithContext passes it straight to the task instead.
+		 * Threads helping out (e.g. waiting on a task group) have no worker
+		 * context, unless the thread is itself a worker.
+		 *
+		 * @tparam Context Type pool's context was set with
+		 * @return Context* Worker's context, nullptr if not on a worker with one of this type
+		 */
+		template <typename Context>
+		static Context *tryWorkerContext()
+		{
+			WorkerIdentity &worker = currentWorker();
+			if (worker.contextType != contextType<Context>())
+			{
+				return nullptr;
+			}
+
+			return static_cast<Context*>(worker.context);
+		}
+
+		/**
+		 * @brief Returns context of worker on calling thread
+		 *
+		 * @tparam Context Type pool's context was set with
+		 * @return Context& Worker's context
+		 * @throws std::logic_error Not on a worker with a context of this type
+		 */
+		template <typename Context>
+		static Context &workerContext()
+		{
+			Context *context = tryWorkerContext<Context>();
+			if (context == nullptr)
+			{
+				throw std::logic_error("Calling thread has no worker context of this type");
+			}
+
+			return *context;
+		}
+
+		/**
+		 * @brief Split runnable queue into priority lanes
+		 *
+		 * Lane 0 is the most urgent.  With LanePolicy::Strict workers always
+		 * take from the most urgent non-empty lane, with WeightedFair they take
+		 * up to each lane's weight in turn.  Each lane can have its own depth
+		 * limit on top of setBackpressure's, and starvation protection serves
+		 * a lane that's been passed over for too long.
+		 *
+		 * In work stealing mode lanes order the shared (and node) queues, tasks
+		 * spawned by a worker go to its own deque whatever their lane.
+		 *
+		 * @param lanes Lane configuration
+		 */
+		void setPriorityLanes(const PriorityLanes &lanes)
+		{
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			_queue.configure(lanes);
+			for (auto &queue : _nodeQueues)
+			{
+				queue->configure(lanes);
+			}
+			l.unlock();
+
+			// Let blocked producers recheck against new limits
+			_notFullCV.notify_all();
+		}
+
+		/**
+		 * @brief Enqueue runnable onto runnable queue
+		 *
+		 * @param runnable Runnable object, deleted after it has run (or if rejected)
+		 * @param lane Priority lane (least urgent if omitted)
+		 * @return true Runnable enqueued
+		 * @return false Queue full, see setBackpressure
+		 */
+		bool enqueue(AbstractRunnable *runnable, size_t lane = TaskQueue::LowestLane)
+		{
+			return enqueue(Task(runnable), lane);
+		}
+
+		/**
+		 * @brief Enqueue task onto runnable queue
+		 *
+		 * @param task Task to run, cancelled if rejected
+		 * @param lane Priority lane (least urgent if omitted)
+		 * @return true Task enqueued
+		 * @return false Queue full (see setBackpressure) or pool shutting down
+		 */
+		bool enqueue(Task task, size_t lane = TaskQueue::LowestLane)
+		{
+			if (!tryEnqueue(task, lane))
+			{
+				task.cancel();
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * @brief Enqueue task, leaving it with the caller if rejected
+		 *
+		 * @param task Task to run, only moved from if enqueued
+		 * @param lane Priority lane (least urgent if omitted)
+		 * @return true Task enqueued
+		 * @return false Queue full (see setBackpressure) or pool shutting down
+		 */
+		bool tryEnqueue(Task &task, size_t lane = TaskQueue::LowestLane)
+		{
+			// Record for queue wait metrics
+			task.setEnqueueTime(metricsNow());
+
+			// Tasks enqueued from our own workers stay local when stealing
+			if (_schedulingMode == SchedulingMode::WorkStealing)
+			{
+				return enqueueStealing(task, lane);
+			}
+
+			// Dropped tasks are cancelled after lock is released
+			std::vector<Task> dropped;
+
+			// Take lock
+			std::unique_lock<ProfiledMutex> lock(_queueMutex);
+
+			// Wait for room
+			LaneSlot slot = { _queue, _queue.laneFor(lane) };
+			if (!waitForRoom(lock, slot, enqueueDeadline(), DropFromLane{slot, dropped, nullptr}))
+			{
+				return false;
+			}
+
+			// Push to queue
+			_queue.push(std::move(task), slot.lane);
+			THREADUTILS_PLOT("Queue depth", _queue.size());
+
+			// Release lock
+			lock.unlock();
+			cancelTasks(dropped);
+
+			// Notify a thread of new data
+			enqueuerMetrics().addEnqueued(1);
+			wakeWorkers(1);
+
+			return true;
+		}
+
+		/**
+		 * @brief Enqueue range of tasks (or runnables) under one lock
+		 *
+		 * Wakes at most one worker per task enqueued.
+		 *
+		 * Stops at the first task rejected by the overflow policy, elements
+		 * from there on are left untouched.
+		 *
+		 * @tparam Iterator Iterator over Task or AbstractRunnable*, tasks are moved from
+		 * @param begin First element
+		 * @param end One past last element
+		 * @param lane Priority lane (least urgent if omitted)
+		 * @return size_t Number of tasks enqueued
+		 */
+		template <typename Iterator>
+		size_t enqueueBulk(Iterator begin, Iterator end, size_t lane = TaskQueue::LowestLane)
+		{
+			if (_schedulingMode == SchedulingMode::WorkStealing)
+			{
+				return enqueueBulkStealing(begin, end, lane);
+			}
+
+			// Dropped tasks are cancelled after lock is released
+			std::vector<Task> dropped;
+
+			// Take lock
+			std::unique_lock<ProfiledMutex> lock(_queueMutex);
+
+			// Push everything there's room for to queue
+			std::chrono::steady_clock::time_point deadline = enqueueDeadline();
+			uint64_t now = metricsNow();
+			size_t count = 0;
+			LaneSlot slot = { _queue, _queue.laneFor(lane) };
+			for (Iterator it = begin; it != end; ++it, count++)
+			{
+				if (!waitForRoom(lock, slot, deadline, DropFromLane{slot, dropped, nullptr}))
+				{
+					break;
+				}
+
+				_queue.push(Task(std::move(*it)), slot.lane);
+				_queue.back(slot.lane).setEnqueueTime(now);
+			}
+			THREADUTILS_PLOT("Queue depth", _queue.size());
+
+			// Release lock
+			lock.unlock();
+			cancelTasks(dropped);
+
+			enqueuerMetrics().addEnqueued(count);
+
+			// Notify as many threads as there is new data for
+			wakeWorkers(count);
+
+			return count;
+		}
+
+		/**
+		 * @brief Create and enqueue task binding function to parameters
+		 *
+		 * Function and parameters are forwarded into the task, rvalues are
+		 * moved once and lvalues copied once.  Parameters are moved into the
+		 * function when it runs.
+		 *
+		 * @tparam _Callable Function to run
+		 * @tparam Params Parameter types
+		 * @param func Function to run
+		 * @param params Parameters to pass to function
+		 * @return true Task enqueued
+		 * @return false Queue full, see setBackpressure
+		 */
+		template <typename Func, typename ...Params>
+		bool enqueue_new(Func &&func, Params &&...params)
+		{
+			return enqueue(Task::create<BoundCall<typename std::decay<Func>::type, typename std::decay<Params>::type...>>(
+				std::forward<Func>(func),
+				std::forward<Params>(params)...
+			));
+		}
+
+		/**
+		 * @brief Enqueue function taking the context of the worker running it
+		 *
+		 * The worker passes its context (see setWorkerContext) straight to
+		 * the function, so the task doesn't look it up.  Run by a thread
+		 * helping out, the task gets that thread's worker context instead, or
+		 * if it has none one made for that run (index HelperContextIndex).
+		 *
+		 * @tparam Context Type pool's context was set with
+		 * @tparam Func Function taking Context&
+		 * @param func Function to run
+		 * @param lane Priority lane (least urgent if omitted)
+		 * @return true Task enqueued
+		 * @return false Queue full (see setBackpressure) or pool shutting down
+		 * @throws std::logic_error Pool's context isn't of this type (see setWorkerContext)
+		 */
+		template <typename Context, typename Func>
+		bool enqueueWithContext(Func &&func, size_t lane = TaskQueue::LowestLane)
+		{
+			if (_contextType.load(std::memory_order_relaxed) != contextType<Context>())
+			{
+				throw std::logic_error("Pool has no worker context of this type");
+			}
+
+			return enqueue(Task::create<ContextCall<Context, typename std::decay<Func>::type>>(this, std::forward<Func>(func)), lane);
+		}
+
+		/**
+		 * @brief Submit function and parameters, returning future of result
+		 *
+		 * The callable and the future's shared state live in one allocation,
+		 * function and parameters are forwarded straight into it.  If the task
+		 * is rejected or dropped by the overflow policy the future holds a
+		 * broken_promise future_error.
+		 *
+		 * @tparam Func Function to run
+		 * @tparam Params Parameter types
+		 * @param func Function to run
+		 * @param params Parameters to pass to function
+		 * @return Future<R> Future of function's result
+		 */
+		template <typename Func, typename ...Params>
+		Future<typename CallResult<typename std::decay<Func>::type, typename std::decay<Params>::type...>::type>
+		submit(Func &&func, Params &&...params)
+		{
+			typedef BoundCall<typename std::decay<Func>::type, typename std::decay<Params>::type...> Bound;
+			typedef typename std::decay<decltype(std::declval<Bound&>()())>::type R;
+			typedef SubmitState<R, Bound> State;
+
+			State *state = new State(continuationRoute(), std::forward<Func>(func), std::forward<Params>(params)...);
+
+			// One reference for returned future, one for queued task
+			state->retain();
+			enqueue(Task(StateTask<State>(state)));
+
+			return Future<R>(state);
+		}
+
+		/**
+		 * @brief Schedule continuation of a future submitted to this pool
+		 *
+		 * Continuations run on a worker while the pool runs and inline on the
+		 * completing thread while it's stopped.  Once the pool is shutting
+		 * down (destroyed or stopNow()) they are cancelled instead, as are
+		 * continuations of futures outliving the pool.
+		 *
+		 * @param task Continuation
+		 */
+		virtual void scheduleContinuation(Task task) override
+		{
+			if (_closing)
+			{
+				task.cancel();
+				return;
+			}
+
+			if (!_poolRunning)
+			{
+				task();
+				return;
+			}
+
+			enqueue(std::move(task));
+		}
+
+#ifdef THREADUTILS_HAS_COROUTINES
+		/**
+		 * @brief Awaitable moving the awaiting coroutine onto a pool worker
+		 *
+		 * `co_await pool.schedule()` suspends the coroutine and queues its
+		 * resumption like any other task.  If the overflow policy rejects it
+		 * the coroutine carries on on the calling thread, if the pool is
+		 * shutting down the co_await throws a broken_promise future_error.
+		 * Dropped or discarded once queued, the coroutine frame is destroyed
+		 * without resuming.
+		 *
+		 * @param lane Priority lane (least urgent if omitted)
+		 * @return ScheduleAwaiter Awaitable
+		 */
+		ScheduleAwaiter schedule(size_t lane = TaskQueue::LowestLane)
+		{
+			return ScheduleAwaiter(this, lane);
+		}
+#endif
+
+		/**
+		 * @brief Starts threadpool
+		 *
+		 */
+		void start()
+		{
+			std::unique_lock<ProfiledMutex> l(_resizeMutex);
+
+			// Don't do anything if already running
+			if (_poolRunning)
+			{
+				return;
+			}
+
+			// Decide where each worker runs, placement may have changed since last start
+			placeWorkers();
+
+			// Set running flag, enqueues are welcome again after a shutdown
+			_closing = false;
+			_poolRunning = true;
+
+			// Create threads, once every slot they might steal from exists
+			uint32_t count = _numThreads;
+			if (count > 0)
+			{
+				prepareSlot(count - 1);
+			}
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				spawnWorker(i);
+			}
+		}
+
+		/**
+		 * @brief Stops threadpool
+		 *
+		 */
+		void stop()
+		{
+			// Set flag to false, checking it was running
+			std::unique_lock<ProfiledMutex> rl(_resizeMutex);
+			if (!_poolRunning.exchange(false))
+			{
+				return;
+			}
+
+			// Take threads, exiting workers need the resize mutex so it's released before joining
+			std::vector<std::thread*> threads;
+			uint32_t slots = _slotsUsed.load(std::memory_order_relaxed);
+			for (uint32_t i = 0; i < slots; i++)
+			{
+				WorkerSlot &slot = workerSlot(i);
+				if (slot.thread != nullptr)
+				{
+					threads.push_back(slot.thread);
+					slot.thread = nullptr;
+				}
+			}
+			rl.unlock();
+
+			// Notify threads (and blocked producers)
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			l.unlock();
+			_inputCV.notify_all();
+			_notFullCV.notify_all();
+			notifyStopping();
+
+			// Wait for thread to finish and delete
+			for (auto thread : threads)
+			{
+				thread->join();
+				delete thread;
+			}
+
+			// Move anything left in node queues and worker deques back to shared queue
+			l.lock();
+			for (auto &queue : _nodeQueues)
+			{
+				_queue.takeAll(*queue);
+			}
+			_nodeQueues.clear();
+
+			Task *node = nullptr;
+			for (uint32_t i = 0; i < slots; i++)
+			{
+				WorkStealingDeque<Task*> *deque = workerSlot(i).queue.get();
+				while (deque && deque->pop(node))
+				{
+					_queue.push(std::move(*node));
+					delete node;
+				}
+			}
+			l.unlock();
+
+			// Let anyone waiting on output know none is coming
+			notifyStopped();
+		}
+
+		/**
+		 * @brief Finish queued work, then stop
+		 *
+		 * Tasks enqueued from outside the pool are rejected from now on, tasks
+		 * run by the pool can still enqueue follow up work.  Workers leave once
+		 * they find nothing to do, so everything queued (and for buffered pools
+		 * fed, with ordered output released in order) has run when this
+		 * returns.  Does nothing on a stopped pool.
+		 *
+		 * @return ShutdownReport Tasks run, nothing discarded
+		 */
+		ShutdownReport drain()
+		{
+			return drainUntil(false, std::chrono::steady_clock::time_point());
+		}
+
+		/**
+		 * @brief Finish queued work, then stop, giving up after timeout
+		 *
+		 * As drain(), but once timeout passes the pool shuts down as by
+		 * stopNow(): workers stop after their current task, whatever is still
+		 * queued is discarded and further enqueues are rejected.
+		 *
+		 * @param timeout Longest to wait for queued work
+		 * @return ShutdownReport Tasks run and discarded, drained false if timed out
+		 */
+		ShutdownReport drain(std::chrono::nanoseconds timeout)
+		{
+			return drainUntil(true, std::chrono::steady_clock::now() + timeout);
+		}
+
+		/**
+		 * @brief Stop after running tasks finish, discarding everything queued
+		 *
+		 * Discarded tasks are cancelled without running, as if dropped by the
+		 * overflow policy: submitted futures hold a broken_promise error and
+		 * task group members count as done.  From the call on every enqueue
+		 * is rejected (and its task cancelled on the enqueuing thread), tasks
+		 * still running included, until the pool is started again.  Output
+		 * already buffered can still be fetched.
+		 *
+		 * @return ShutdownReport Tasks run, discarded and rejected
+		 */
+		ShutdownReport stopNow()
+		{
+			uint64_t completed = tasksCompleted();
+			uint64_t rejected = _tasksRejected;
+
+			ShutdownReport report;
+			shutdown(report);
+			report.tasksRun = tasksCompleted() - completed;
+			report.tasksRejected = _tasksRejected - rejected;
+			report.drained = report.tasksDiscarded == 0;
+
+			return report;
+		}
+
+		/**
+		 * @brief Change number of workers without stopping the pool
+		 *
+		 * New workers start straight away.  When shrinking, workers past the
+		 * new count finish the task they're running and leave, anything queued
+		 * stays queued for the rest.  On a stopped pool takes effect on start().
+		 *
+		 * @param numThreads Number of workers (at most maxThreads())
+		 */
+		void resize(uint32_t numThreads)
+		{
+			std::unique_lock<ProfiledMutex> l(_resizeMutex);
+			setWorkerCount(numThreads);
+		}
+
+		/**
+		 * @brief Let worker count follow load
+		 *
+		 * Adds a worker when a task has waited in the queue longer than
+		 * growAfter with no worker idle (at most one per growAfter), and
+		 * retires the highest numbered worker once it's been idle for
+		 * keepAlive.  Worker count stays between minThreads and maxThreads.
+		 * resize() still sets the count directly.
+		 *
+		 * @param policy Elastic policy (default constructed to disable)
+		 */
+		void setElastic(const ElasticPolicy &policy)
+		{
+			_elasticMin = policy.minThreads;
+			_elasticMax = policy.maxThreads < _maxThreads ? policy.maxThreads : _maxThreads;
+			_growAfter = (uint64_t)policy.growAfter.count();
+			_keepAlive = (uint64_t)policy.keepAlive.count();
+			_elasticEnabled = policy.enabled;
+
+			// Bring worker count within bounds
+			std::unique_lock<ProfiledMutex> rl(_resizeMutex);
+			if (policy.enabled && _numThreads < _elasticMin)
+			{
+				setWorkerCount(_elasticMin);
+			}
+			else if (policy.enabled && _numThreads > _elasticMax)
+			{
+				setWorkerCount(_elasticMax);
+			}
+			rl.unlock();
+
+			// Parked workers pick up new keepalive
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			l.unlock();
+			_inputCV.notify_all();
+		}
+
+		/**
+		 * @brief Returns whether threadpool is running
+		 *
+		 * @return true Threadpool running
+		 * @return false Threadpool not running
+		 */
+		bool poolRunning() { return _poolRunning; }
+
+		/**
+		 * @brief Returns whether pool is shutting down (destroyed or stopNow()), rejecting every enqueue
+		 *
+		 */
+		bool shuttingDown() const { return _closing; }
+
+		/**
+		 * @brief Returns number of worker threads
+		 *
+		 */
+		uint32_t numThreads() const { return _numThreads; }
+
+		/**
+		 * @brief Returns most workers pool can be resized to
+		 *
+		 */
+		uint32_t maxThreads() const { return _maxThreads; }
+
+		/**
+		 * @brief Run one queued task on the calling thread, if there is one
+		 *
+		 * Lets a thread waiting on work it submitted help instead of blocking
+		 * idle.  Also works while the pool is stopped.  Buffered pools' input
+		 * queues are left to their workers.
+		 *
+		 * @return true A task was run
+		 * @return false Nothing queued
+		 */
+		bool runPendingTask()
+		{
+			Task task;
+
+			if (_schedulingMode == SchedulingMode::WorkStealing)
+			{
+				WorkerIdentity &worker = currentWorker();
+				if (worker.pool == this && _poolRunning)
+				{
+					if (!findStealingWork(worker.index, task))
+					{
+						return false;
+					}
+				}
+				else if (!takeAnywhere(task))
+				{
+					return false;
+				}
+
+				_pendingTasks--;
+			}
+			else
+			{
+				std::unique_lock<ProfiledMutex> l(_queueMutex);
+				if (!_queue.pop(task))
+				{
+					return false;
+				}
+				signalRoom();
+				l.unlock();
+			}
+
+			runTask(task);
+
+			return true;
+		}
+
+		/**
+		 * @brief Returns scheduling mode of threadpool
+		 *
+		 * @return SchedulingMode Scheduling mode
+		 */
+		SchedulingMode schedulingMode() const { return _schedulingMode; }
+
+		/**
+		 * @brief Aggregate per worker counters into a snapshot
+		 *
+		 * Workers never synchronize on metrics, counters are only summed here.
+		 *
+		 * @return MetricsSnapshot Snapshot of pool metrics
+		 */
+		virtual MetricsSnapshot snapshot()
+		{
+			MetricsSnapshot snapshot;
+			snapshot.workers = _numThreads;
+
+			// Retired workers' counters still count towards totals
+			uint32_t slots = _slotsUsed.load(std::memory_order_acquire);
+			for (uint32_t i = 0; i <= slots; i++)
+			{
+				const WorkerMetrics &metrics = i < slots ? workerSlot(i).metrics : _sharedMetrics;
+				metrics.accumulate(snapshot.queueWait, snapshot.runTime, snapshot.tasksEnqueued, snapshot.tasksCompleted);
+
+				if (metrics.busy.load(std::memory_order_relaxed))
+				{
+					snapshot.busyWorkers++;
+				}
+			}
+
+			// A retiring worker may still be finishing its task
+			snapshot.idleWorkers = snapshot.workers > snapshot.busyWorkers ? snapshot.workers - snapshot.busyWorkers : 0;
+			snapshot.tasksRejected = _tasksRejected;
+			snapshot.tasksDropped = _tasksDropped;
+
+			if (_schedulingMode == SchedulingMode::WorkStealing)
+			{
+				// Pushed anywhere and not yet taken
+				int64_t pending = _pendingTasks;
+				snapshot.queueDepth = pending > 0 ? (uint64_t)pending : 0;
+			}
+			else
+			{
+				std::unique_lock<ProfiledMutex> l(_queueMutex);
+				snapshot.queueDepth = _queue.size();
+			}
+
+			// Tasks waiting in each lane of shared (and node) queues
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			snapshot.laneDepths.assign(_queue.lanes(), 0);
+			for (size_t lane = 0; lane < _queue.lanes(); lane++)
+			{
+				snapshot.laneDepths[lane] = _queue.size(lane);
+				for (auto &queue : _nodeQueues)
+				{
+					snapshot.laneDepths[lane] += queue->size(lane);
+				}
+			}
+			l.unlock();
+
+			return snapshot;
+		}
+
+	protected:
+		/**
+		 * @brief Identity of the worker running on the current thread
+		 *
+		 */
+		struct WorkerIdentity
+		{
+			/// @brief Pool owning the worker (nullptr if not a worker)
+			Threadpool *pool;
+
+			/// @brief Index of worker within pool
+			uint32_t index;
+
+			/// @brief Index of NUMA node worker is placed on
+			uint32_t node;
+
+			/// @brief Worker's context (nullptr if none)
+			void *context;
+
+			/// @brief Type tag of context, see contextType()
+			const void *contextType;
+		};
+
+		/**
+		 * @brief Returns identity of worker on calling thread
+		 *
+		 * @return WorkerIdentity& Thread local worker identity
+		 */
+		static WorkerIdentity &currentWorker()
+		{
+			static thread_local WorkerIdentity identity = { nullptr, 0, 0, nullptr, nullptr };
+			return identity;
+		}
+
+		/**
+		 * @brief Returns tag unique to a context type
+		 *
+		 */
+		template <typename Context>
+		static const void *contextType()
+		{
+			static const char tag = 0;
+			return &tag;
+		}
+
+		/**
+		 * @brief Callable passing worker's context to a function, see enqueueWithContext
+		 *
+		 */
+		template <typename Context, typename Func>
+		struct ContextCall
+		{
+			typedef void TakesTaskContext;
+
+			template <typename F>
+			ContextCall(Threadpool *pool, F &&func) :
+				pool(pool),
+				function(std::forward<F>(func))
+			{
+			}
+
+			void operator()(const TaskContext &worker)
+			{
+				if (worker.type == contextType<Context>())
+				{
+					function(*static_cast<Context*>(worker.context));
+					return;
+				}
+
+				// Not run by a worker with one (e.g. inline continuation), make one for this run
+				std::shared_ptr<void> context = pool->helperContext(contextType<Context>());
+				if (!context)
+				{
+					cancel();
+					return;
+				}
+
+				function(*static_cast<Context*>(context.get()));
+			}
+
+			void cancel()
+			{
+				cancelCallable(function);
+			}
+
+			Threadpool *pool;
+			Func function;
+		};
+
+		/**
+		 * @brief Make a context for a thread without one, running a task taking it
+		 *
+		 * @param type Type tag of context wanted
+		 * @return std::shared_ptr<void> Context, null if pool's context changed type since
+		 */
+		std::shared_ptr<void> helperContext(const void *type)
+		{
+			std::unique_lock<ProfiledMutex> l(_resizeMutex);
+			if (_contextType.load(std::memory_order_relaxed) != type)
+			{
+				return nullptr;
+			}
+
+			std::function<std::shared_ptr<void>(uint32_t)> contextFactory = _contextFactory;
+			l.unlock();
+
+			return contextFactory(HelperContextIndex);
+		}
+
+		/**
+		 * @brief State of one worker slot, kept once the slot is first used
+		 *
+		 */
+		struct WorkerSlot
+		{
+			WorkerSlot() :
+				thread(nullptr),
+				exited(false),
+				node(0)
+			{
+			}
+
+			/// @brief Worker's thread (nullptr if never started, guarded by resize mutex)
+			std::thread *thread;
+
+			/// @brief Worker has left its thread (guarded by resize mutex)
+			bool exited;
+
+			/// @brief Index of worker's NUMA node in CpuTopology (0 unless placed across nodes)
+			uint32_t node;
+
+			/// @brief CPUs worker is pinned to (empty if unpinned)
+			std::vector<uint32_t> cpus;
+
+			/// @brief Worker's deque (work stealing mode)
+			std::unique_ptr<WorkStealingDeque<Task*>> queue;
+
+			/// @brief Free deque nodes, only used by this worker (work stealing mode)
+			std::vector<std::unique_ptr<Task>> nodeCache;
+
+			/// @brief Worker's counters
+			WorkerMetrics metrics;
+		};
+
+		/// @brief Segments of worker slots, enough for any uint32_t index
+		static constexpr uint32_t SlotSegments = 32;
+
+		/**
+		 * @brief Returns segment holding slot, segment n holds slots 2^n - 1 to 2^(n+1) - 2
+		 *
+		 */
+		static uint32_t slotSegment(uint32_t index)
+		{
+			uint64_t position = (uint64_t)index + 1;
+#if defined(__GNUC__) || defined(__clang__)
+			return 63 - (uint32_t)__builtin_clzll(position);
+#else
+			uint32_t segment = 0;
+			while (position >>= 1)
+			{
+				segment++;
+			}
+			return segment;
+#endif
+		}
+
+		/**
+		 * @brief Returns slot of worker.  Slot must have been prepared.
+		 *
+		 * @param index Index of worker
+		 */
+		WorkerSlot &workerSlot(uint32_t index)
+		{
+			uint32_t segment = slotSegment(index);
+			return _slotSegments[segment][(size_t)index + 1 - ((size_t)1 << segment)];
+		}
+
+		const WorkerSlot &workerSlot(uint32_t index) const
+		{
+			uint32_t segment = slotSegment(index);
+			return _slotSegments[segment][(size_t)index + 1 - ((size_t)1 << segment)];
+		}
+
+		/**
+		 * @brief Entry point of worker threads
+		 *
+		 * @param index Index of worker
+		 */
+		void workerEntry(uint32_t index)
+		{
+			// Record identity so enqueue can find local deque
+			currentWorker().pool = this;
+			currentWorker().index = index;
+			currentWorker().node = workerSlot(index).node;
+
+			// Move to our CPUs before touching any memory
+			if (!workerSlot(index).cpus.empty())
+			{
+				pinCurrentThread(workerSlot(index).cpus);
+			}
+
+			nameWorkerThread(index);
+
+			// Hooks and context as set when we started, setting them doesn't affect running workers
+			std::unique_lock<ProfiledMutex> hl(_resizeMutex);
+			WorkerHooks hooks = _workerHooks;
+			std::function<std::shared_ptr<void>(uint32_t)> contextFactory = _contextFactory;
+			const void *type = _contextType.load(std::memory_order_relaxed);
+			hl.unlock();
+
+			if (hooks.onStart)
+			{
+				hooks.onStart(index);
+			}
+
+			std::shared_ptr<void> context;
+			if (contextFactory)
+			{
+				context = contextFactory(index);
+				currentWorker().context = context.get();
+				currentWorker().contextType = type;
+			}
+
+			while (true)
+			{
+				threadRunner();
+
+				// Leave, unless pool grew back past us meanwhile
+				std::unique_lock<ProfiledMutex> l(_resizeMutex);
+				if (workerWanted() && !_draining)
+				{
+					continue;
+				}
+
+				releaseWorkerQueue(index);
+				workerSlot(index).exited = true;
+				_exitCV.notify_all();
+				break;
+			}
+
+			// Tear down outside the resize mutex, stop() and respawning join us first
+			currentWorker().context = nullptr;
+			currentWorker().contextType = nullptr;
+			context.reset();
+
+			if (hooks.onExit)
+			{
+				hooks.onExit(index);
+			}
+
+			currentWorker().pool = nullptr;
+		}
+
+		/**
+		 * @brief Let workers run out of work and leave, then stop
+		 *
+		 * @param bounded Give up at deadline
+		 * @param deadline When to stop waiting for queued work
+		 * @return ShutdownReport Tasks run and discarded
+		 */
+		ShutdownReport drainUntil(bool bounded, std::chrono::steady_clock::time_point deadline)
+		{
+			uint64_t completed = tasksCompleted();
+			uint64_t rejected = _tasksRejected;
+
+			std::unique_lock<ProfiledMutex> rl(_resizeMutex);
+			if (!_poolRunning)
+			{
+				return ShutdownReport();
+			}
+			_draining = true;
+
+			// Wake parked workers, and producers blocked on a full queue so they give up
+			_inputEpoch.fetch_add(1, std::memory_order_release);
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			l.unlock();
+			_inputCV.notify_all();
+			_notFullCV.notify_all();
+			notifyStopping();
+
+			auto exited = [this]() { return workersExited(); };
+			bool finished = true;
+			if (bounded)
+			{
+				finished = _exitCV.wait_until(rl, deadline, exited);
+			}
+			else
+			{
+				_exitCV.wait(rl, exited);
+			}
+			rl.unlock();
+
+			ShutdownReport report;
+			if (finished)
+			{
+				stop();
+				report.tasksDiscarded = discardQueued();
+			}
+			else
+			{
+				// Workers still busy at deadline stop after their current task
+				shutdown(report);
+			}
+			report.tasksRun = tasksCompleted() - completed;
+			report.tasksRejected = _tasksRejected - rejected;
+			report.drained = report.tasksDiscarded == 0;
+
+			_draining = false;
+
+			return report;
+		}
+
+		/**
+		 * @brief Returns whether every started worker has left.  Resize mutex held.
+		 *
+		 */
+		bool workersExited() const
+		{
+			uint32_t slots = _slotsUsed.load(std::memory_order_relaxed);
+			for (uint32_t i = 0; i < slots; i++)
+			{
+				const WorkerSlot &slot = workerSlot(i);
+				if (slot.thread != nullptr && !slot.exited)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * @brief Cancel everything queued on a stopped pool
+		 *
+		 * Tasks are cancelled after the lock is released, as cancelling
+		 * completes futures and task groups waiting on them.
+		 *
+		 * @return size_t Number of tasks discarded
+		 */
+		size_t discardQueued()
+		{
+			std::vector<Task> discarded;
+
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			takeQueued(discarded);
+			if (_schedulingMode == SchedulingMode::WorkStealing)
+			{
+				_pendingTasks -= (int64_t)discarded.size();
+			}
+			signalRoom();
+			l.unlock();
+
+			size_t count = discarded.size();
+			cancelTasks(discarded);
+
+			return count;
+		}
+
+		/**
+		 * @brief Stop for good, rejecting enqueues and cancelling everything queued
+		 *
+		 * Called by the destructor of the most derived pool, so its queues (and
+		 * takeQueued() override) are still there to be emptied.
+		 *
+		 */
+		void shutdown()
+		{
+			ShutdownReport report;
+			shutdown(report);
+		}
+
+		/**
+		 * @brief Stop for good, counting tasks discarded into report
+		 *
+		 * @param report Report to fill in tasksDiscarded of
+		 */
+		void shutdown(ShutdownReport &report)
+		{
+			_closing = true;
+
+			// Wake producers blocked on a full queue so they see it
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			l.unlock();
+			_notFullCV.notify_all();
+
+			stop();
+			report.tasksDiscarded = discardQueued();
+		}
+
+		/**
+		 * @brief Cancel tasks thrown away by the pool.  No lock held.
+		 *
+		 * @param tasks Tasks to cancel, left empty
+		 */
+		static void cancelTasks(std::vector<Task> &tasks)
+		{
+			for (auto &task : tasks)
+			{
+				task.cancel();
+			}
+			tasks.clear();
+		}
+
+		/**
+		 * @brief Returns tasks run to completion so far, by any thread
+		 *
+		 */
+		uint64_t tasksCompleted() const
+		{
+			uint64_t completed = _sharedMetrics.tasksCompleted.load(std::memory_order_relaxed);
+
+			uint32_t slots = _slotsUsed.load(std::memory_order_acquire);
+			for (uint32_t i = 0; i < slots; i++)
+			{
+				completed += workerSlot(i).metrics.tasksCompleted.load(std::memory_order_relaxed);
+			}
+
+			return completed;
+		}
+
+		/**
+		 * @brief Move every queued task of a stopped pool out.  Queue mutex held.
+		 *
+		 * @param out Tasks taken
+		 */
+		virtual void takeQueued(std::vector<Task> &out)
+		{
+			Task task;
+			while (_queue.pop(task))
+			{
+				out.push_back(std::move(task));
+			}
+		}
+
+		/**
+		 * @brief Called as a stop (or drain) starts, before waiting for workers
+		 *
+		 * Lets workers blocked on something other than the pool's own queues
+		 * see it's stopping.
+		 *
+		 */
+		virtual void notifyStopping()
+		{
+		}
+
+		/**
+		 * @brief Called once a stop has joined every worker
+		 *
+		 */
+		virtual void notifyStopped()
+		{
+		}
+
+		/**
+		 * @brief Returns whether worker on calling thread should keep running
+		 *
+		 */
+		bool workerWanted()
+		{
+			return _poolRunning && currentWorker().index < _numThreads;
+		}
+
+		/**
+		 * @brief Set up per worker state of slot on first use.  Resize mutex held.
+		 *
+		 * Slots are only ever added, never freed or moved while the pool
+		 * lives, so workers can read any slot below the worker count without
+		 * locking.
+		 *
+		 * @param index Index of worker
+		 */
+		void prepareSlot(uint32_t index)
+		{
+			if (index < _slotsUsed.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			for (uint32_t i = _slotsUsed.load(std::memory_order_relaxed); i <= index; i++)
+			{
+				// First slot of a segment allocates the whole segment
+				uint32_t segment = slotSegment(i);
+				if (!_slotSegments[segment])
+				{
+					_slotSegments[segment].reset(new WorkerSlot[(size_t)1 << segment]);
+				}
+
+				if (_schedulingMode == SchedulingMode::WorkStealing)
+				{
+					workerSlot(i).queue.reset(new WorkStealingDeque<Task*>());
+				}
+				placeWorker(i);
+			}
+
+			_slotsUsed.store(index + 1, std::memory_order_release);
+		}
+
+		/**
+		 * @brief Start worker thread in prepared slot.  Resize mutex held.
+		 *
+		 * A worker that hasn't left yet just carries on, one that has is
+		 * joined and replaced.
+		 *
+		 * @param index Index of worker
+		 */
+		void spawnWorker(uint32_t index)
+		{
+			WorkerSlot &slot = workerSlot(index);
+
+			if (slot.thread != nullptr)
+			{
+				if (!slot.exited)
+				{
+					return;
+				}
+
+				slot.thread->join();
+				delete slot.thread;
+			}
+
+			slot.exited = false;
+			slot.thread = new std::thread(&Threadpool::workerEntry, this, index);
+		}
+
+		/**
+		 * @brief Start or retire workers to reach count.  Resize mutex held.
+		 *
+		 * @param numThreads Number of workers
+		 */
+		void setWorkerCount(uint32_t numThreads)
+		{
+			numThreads = numThreads < _maxThreads ? numThreads : _maxThreads;
+			uint32_t current = _numThreads;
+
+			if (!_poolRunning)
+			{
+				_numThreads = numThreads;
+				return;
+			}
+
+			if (numThreads > current)
+			{
+				prepareSlot(numThreads - 1);
+
+				// Publish count first, new workers check it
+				_numThreads = numThreads;
+
+				for (uint32_t i = current; i < numThreads; i++)
+				{
+					spawnWorker(i);
+				}
+			}
+			else if (numThreads < current)
+			{
+				_numThreads = numThreads;
+
+				// Wake spinning and parked workers so surplus ones notice
+				_inputEpoch.fetch_add(1, std::memory_order_release);
+				std::unique_lock<ProfiledMutex> l(_queueMutex);
+				l.unlock();
+				_inputCV.notify_all();
+			}
+		}
+
+		/**
+		 * @brief Move tasks left in a leaving worker's deque to shared queue
+		 *
+		 * @param index Index of worker
+		 */
+		void releaseWorkerQueue(uint32_t index)
+		{
+			WorkStealingDeque<Task*> *deque = workerSlot(index).queue.get();
+			if (deque == nullptr)
+			{
+				return;
+			}
+
+			size_t count = 0;
+			Task *node = nullptr;
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			while (deque->pop(node))
+			{
+				_queue.push(std::move(*node));
+				delete node;
+				count++;
+			}
+			l.unlock();
+
+			wakeWorkers(count);
+		}
+
+		/**
+		 * @brief Add a worker if a task queued too long with none idle (elastic)
+		 *
+		 * @param waitNanos Queue wait of task about to run
+		 */
+		void considerGrowing(uint64_t waitNanos)
+		{
+			uint64_t growAfter = _growAfter.load(std::memory_order_relaxed);
+			if (waitNanos <= growAfter || _sleepingThreads > 0 || _numThreads >= _elasticMax)
+			{
+				return;
+			}
+
+			// At most one new worker per growAfter
+			uint64_t now = metricsNow();
+			uint64_t last = _lastGrowth.load(std::memory_order_relaxed);
+			if (now - last < growAfter || !_lastGrowth.compare_exchange_strong(last, now))
+			{
+				return;
+			}
+
+			// Don't hold up a worker behind a resize in progress
+			std::unique_lock<ProfiledMutex> l(_resizeMutex, std::try_to_lock);
+			if (l.owns_lock() && _numThreads < _elasticMax)
+			{
+				setWorkerCount(_numThreads + 1);
+			}
+		}
+
+		/**
+		 * @brief Retire calling worker after keepalive if it's the highest numbered (elastic)
+		 *
+		 * Only the top worker retires so workers stay numbered 0 to count - 1.
+		 *
+		 */
+		void retireIdleWorker()
+		{
+			uint32_t index = currentWorker().index;
+			uint32_t count = index + 1;
+
+			if (count > _elasticMin)
+			{
+				_numThreads.compare_exchange_strong(count, index);
+			}
+		}
+
+		/**
+		 * @brief Park worker on input condition until ready or no longer wanted.  Queue mutex held.
+		 *
+		 * Elastic pools park for at most keepAlive, a worker still idle then
+		 * may retire.
+		 *
+		 * @param l Lock on queue mutex
+		 * @param ready Returns true once worker has something to do
+		 */
+		template <typename Ready>
+		void parkWorker(std::unique_lock<ProfiledMutex> &l, Ready ready)
+		{
+			_sleepingThreads++;
+			while (!ready() && workerWanted() && !_draining)
+			{
+				if (!_elasticEnabled)
+				{
+					_inputCV.wait(l);
+					continue;
+				}
+
+				std::chrono::nanoseconds keepAlive(_keepAlive.load(std::memory_order_relaxed));
+				if (_inputCV.wait_for(l, keepAlive) == std::cv_status::timeout && !ready())
+				{
+					retireIdleWorker();
+				}
+			}
+			_sleepingThreads--;
+		}
+
+		/**
+		 * @brief Work out CPUs and node of worker from placement.  Pool stopped or slot unused.
+		 *
+		 * @param index Index of worker
+		 */
+		void placeWorker(uint32_t index)
+		{
+			const CpuTopology &topology = CpuTopology::system();
+
+			WorkerSlot &slot = workerSlot(index);
+			slot.node = 0;
+			slot.cpus.clear();
+
+			if (!_placement.cpus.empty())
+			{
+				uint32_t cpu = _placement.cpus[index % _placement.cpus.size()];
+				slot.cpus.push_back(cpu);
+				slot.node = topology.nodeOfCpu(cpu);
+			}
+			else if (_placement.spreadAcrossNodes)
+			{
+				// Only nodes with CPUs are listed, so every worker is pinned
+				slot.node = index % topology.numNodes();
+				slot.cpus = topology.nodeCpus(slot.node);
+			}
+		}
+
+		/**
+		 * @brief Work out CPUs and node of each prepared worker from placement.  Pool stopped.
+		 *
+		 */
+		void placeWorkers()
+		{
+			const CpuTopology &topology = CpuTopology::system();
+
+			uint32_t slots = _slotsUsed.load(std::memory_order_relaxed);
+			for (uint32_t i = 0; i < slots; i++)
+			{
+				placeWorker(i);
+			}
+
+			// One queue per node outside submitters feed
+			if (_schedulingMode == SchedulingMode::WorkStealing && _placement.nodeQueues)
+			{
+				std::unique_lock<ProfiledMutex> l(_queueMutex);
+				for (size_t node = 0; node < topology.numNodes(); node++)
+				{
+					_nodeQueues.emplace_back(new TaskQueue(_queue.config()));
+				}
+			}
+		}
+
+		/**
+		 * @brief Returns queue outside submitters on calling thread feed.  Queue mutex held.
+		 *
+		 * @param node Node of calling thread
+		 */
+		TaskQueue &submitQueue(uint32_t node)
+		{
+			return _nodeQueues.empty() ? _queue : *_nodeQueues[node % _nodeQueues.size()];
+		}
+
+		/**
+		 * @brief Function run in threads
+		 *
+		 */
+		virtual void threadRunner()
+		{
+			if (_schedulingMode == SchedulingMode::WorkStealing)
+			{
+				stealingThreadRunner();
+				return;
+			}
+
+			// Identity (and context) of this worker, passed to every task run
+			const WorkerIdentity &worker = currentWorker();
+
+			// Spin budget before parking
+			AdaptiveSpin spin;
+
+			// While pool active (and worker still wanted)
+			while (workerWanted())
+			{
+				// Grab lock
+				std::unique_lock<ProfiledMutex> l(_queueMutex);
+
+				// Task to run
+				Task task;
+
+				if (!workerWanted())
+				{
+					break;
+					l.unlock();
+				}
+
+				// Wait for change in queue or pool status
+				waitForInput(l, spin);
+
+				// If pool killed (or worker retired)
+				if (!workerWanted())
+				{
+					// Release lock
+					l.unlock();
+					break;
+				}
+
+				if (!_queue.pop(task))
+				{
+					l.unlock();
+
+					// Nothing left to drain
+					if (_draining)
+					{
+						break;
+					}
+
+					continue;
+				}
+
+				THREADUTILS_PLOT("Queue depth", _queue.size());
+				signalRoom();
+				l.unlock();
+
+				// Execute task, destroying it when done
+				runTask(task, worker);
+			}
+		}
+
+		/**
+		 * @brief Returns when blocking enqueues started now give up
+		 *
+		 */
+		std::chrono::steady_clock::time_point enqueueDeadline() const
+		{
+			if (_overflowPolicy != OverflowPolicy::BlockWithTimeout)
+			{
+				return std::chrono::steady_clock::time_point::max();
+			}
+
+			return std::chrono::steady_clock::now() +
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(_enqueueTimeout);
+		}
+
+		/**
+		 * @brief Drops oldest task of a queue for waitForRoom
+		 *
+		 * Dropped tasks are kept to be destroyed once the lock is released, as
+		 * destroying a submitted task completes its future.
+		 *
+		 */
+		struct DropFromQueue
+		{
+			/// @brief Queue to drop from
+			TaskDeque &queue;
+
+			/// @brief Dropped tasks
+			std::vector<Task> &dropped;
+
+			/// @brief Counter of queued tasks to decrement (nullptr if none)
+			std::atomic<int64_t> *pending;
+
+			void operator()()
+			{
+				dropped.emplace_back(std::move(queue.front()));
+				queue.pop_front();
+
+				if (pending != nullptr)
+				{
+					(*pending)--;
+				}
+			}
+		};
+
+		/**
+		 * @brief Lane of a task queue about to be pushed to
+		 *
+		 */
+		struct LaneSlot
+		{
+			/// @brief Queue
+			TaskQueue &queue;
+
+			/// @brief Lane within queue
+			size_t lane;
+		};
+
+		/**
+		 * @brief Drops oldest task of a lane (or least urgent lane) for waitForRoom
+		 *
+		 * If the lane is at its own limit its oldest task goes, otherwise the
+		 * whole queue is full and the least urgent work is shed first.
+		 *
+		 */
+		struct DropFromLane
+		{
+			/// @brief Lane about to be pushed to
+			LaneSlot slot;
+
+			/// @brief Dropped tasks
+			std::vector<Task> &dropped;
+
+			/// @brief Counter of queued tasks to decrement (nullptr if none)
+			std::atomic<int64_t> *pending;
+
+			void operator()()
+			{
+				size_t lane = slot.queue.size(slot.lane) >= slot.queue.maxDepth(slot.lane) ?
+					slot.lane : slot.queue.lowestNonEmpty();
+
+				dropped.emplace_back();
+				slot.queue.popFront(lane, dropped.back());
+
+				if (pending != nullptr)
+				{
+					(*pending)--;
+				}
+			}
+		};
+
+		/**
+		 * @brief Returns whether queue is below limit
+		 *
+		 */
+		bool hasRoom(const TaskDeque &queue) const { return queue.size() < _maxQueueSize; }
+
+		/**
+		 * @brief Returns whether queue and lane are below their limits
+		 *
+		 */
+		bool hasRoom(const LaneSlot &slot) const
+		{
+			return slot.queue.size() < _maxQueueSize && slot.queue.size(slot.lane) < slot.queue.maxDepth(slot.lane);
+		}
+
+		/**
+		 * @brief Returns whether dropping tasks could ever make room
+		 *
+		 */
+		bool canMakeRoom(const TaskDeque &) const { return _maxQueueSize > 0; }
+
+		/**
+		 * @brief Returns whether dropping tasks could ever make room
+		 *
+		 */
+		bool canMakeRoom(const LaneSlot &slot) const { return _maxQueueSize > 0 && slot.queue.maxDepth(slot.lane) > 0; }
+
+		/**
+		 * @brief Make room for one more task in queue according to overflow policy
+		 *
+		 * Blocking policies wait on the not full condition, which workers
+		 * signal as they take tasks.
+		 *
+		 * @param l Lock on queue mutex, held on entry and exit
+		 * @param queue Queue (or LaneSlot) about to be pushed to
+		 * @param deadline When BlockWithTimeout gives up
+		 * @param dropOldest Removes oldest task from queue (DropOldest)
+		 * @return true Room for task
+		 * @return false Task rejected
+		 */
+		template <typename Queue, typename DropOldest>
+		bool waitForRoom(
+			std::unique_lock<ProfiledMutex> &l,
+			const Queue &queue,
+			std::chrono::steady_clock::time_point deadline,
+			DropOldest dropOldest
+		)
+		{
+			// Shutting down pool takes nothing more, draining pool only
+			// takes follow up work from its own tasks
+			if (_closing || (_draining && currentWorker().pool != this))
+			{
+				_tasksRejected++;
+				return false;
+			}
+
+			if (hasRoom(queue))
+			{
+				return true;
+			}
+
+			switch (_overflowPolicy)
+			{
+			case OverflowPolicy::TryAndReturnFalse:
+				_tasksRejected++;
+				return false;
+
+			case OverflowPolicy::DropOldest:
+				if (!canMakeRoom(queue))
+				{
+					_tasksRejected++;
+					return false;
+				}
+
+				while (!hasRoom(queue))
+				{
+					dropOldest();
+					_tasksDropped++;
+				}
+
+				return true;
+
+			default:
+				break;
+			}
+
+			// Our own workers drain the queue, they mustn't wait on it.  Nor
+			// can anyone wait on a pool that isn't running.
+			if (currentWorker().pool == this || !_poolRunning)
+			{
+				return true;
+			}
+
+			// Make sure workers are up to drain what's there
+			_inputEpoch.fetch_add(1, std::memory_order_release);
+			if (_sleepingThreads > 0)
+			{
+				_inputCV.notify_all();
+			}
+
+			THREADUTILS_ZONE("Wait for room");
+
+			auto room = [&]() { return hasRoom(queue) || !_poolRunning || _draining || _closing; };
+
+			_blockedProducers++;
+			bool admitted = true;
+			if (_overflowPolicy == OverflowPolicy::Block)
+			{
+				_notFullCV.wait(l, room);
+			}
+			else
+			{
+				admitted = _notFullCV.wait_until(l, deadline, room);
+			}
+			_blockedProducers--;
+
+			// Drain (or shutdown) started while waiting
+			if (_draining || _closing)
+			{
+				admitted = false;
+			}
+
+			if (!admitted)
+			{
+				_tasksRejected++;
+			}
+
+			return admitted;
+		}
 
-	class Threadpool
-	{
-	public:
 		/**
-		 * @brief Construct a new Threadpool:: Threadpool object
+		 * @brief Signal producers blocked on a full queue.  Queue mutex held.
+		 *
+		 * Producers of different queues (e.g. enqueue and feedQueue) share the
+		 * condition, so all are woken to recheck their own queue.
 		 *
-		 * @param numThreads Number of threads in thread ool
 		 */
-		explicit Threadpool(uint32_t numThreads) :
-			_numThreads(numThreads),
-			_poolRunning(false)
+		void signalRoom()
 		{
+			if (_blockedProducers > 0)
+			{
+				_notFullCV.notify_all();
+			}
 		}
 
 		/**
-		 * @brief Destroy the Threadpool object
+		 * @brief Execute task and destroy it on calling thread, recording metrics
 		 *
+		 * @param task Task to run, empty afterwards
 		 */
-		~Threadpool()
+		void runTask(Task &task)
 		{
-			// Stop and delete threads
-			stop();
+			runTask(task, currentWorker());
 		}
 
 		/**
-		 * @brief Enqueue runnable onto runnable queue
+		 * @brief Execute task and destroy it, recording metrics
 		 *
-		 * @param runnable Runnable object
+		 * Worker loops look up their identity once and pass it in, its context
+		 * goes to tasks taking it.  Runs on other threads (see runPendingTask)
+		 * are recorded in the slot shared by non-workers and don't count as
+		 * busy workers.
+		 *
+		 * @param task Task to run, empty afterwards
+		 * @param worker Identity of calling thread
 		 */
-		void enqueue(AbstractRunnable *runnable)
+		void runTask(Task &task, const WorkerIdentity &worker)
 		{
-			// Take lock
-			std::unique_lock<std::mutex> lock(_queueMutex);
+			THREADUTILS_ZONE("Run task");
 
-			// Push to queue
-			_queue.emplace_back(runnable);
+			bool ownWorker = worker.pool == this;
+			WorkerMetrics &metrics = ownWorker ? workerSlot(worker.index).metrics : _sharedMetrics;
+			uint64_t queued = task.enqueueTime();
+			uint64_t start = metricsNow();
+			uint64_t wait = queued != 0 && start > queued ? start - queued : 0;
 
-			// Release lock
-			lock.unlock();
+			if (ownWorker && _elasticEnabled)
+			{
+				considerGrowing(wait);
+			}
 
-			// Notify threads of new data
-			_inputCV.notify_all();
+			if (ownWorker)
+			{
+				metrics.busy.store(true, std::memory_order_relaxed);
+			}
+			TaskContext context = { worker.context, worker.contextType };
+			task(context);
+			task.reset();
+			if (ownWorker)
+			{
+				metrics.busy.store(false, std::memory_order_relaxed);
+			}
+
+			metrics.recordRun(wait, metricsNow() - start, ownWorker);
 		}
 
 		/**
-		 * @brief Create and enqueue Runnable
+		 * @brief Returns counters enqueues from calling thread are added to
 		 *
-		 * @tparam _Callable Function to run
-		 * @tparam Params Parameter types
-		 * @param func Function to run
-		 * @param params Parameters to pass to function
+		 * @return WorkerMetrics& Calling worker's counters, or counters shared by non-workers
 		 */
-		template <typename Func, typename ...Params>
-		void enqueue_new(Func &&func, Params ...params)
+		WorkerMetrics &enqueuerMetrics()
 		{
-			enqueue(new Runnable<Params...>(std::move(func), params...));
+			WorkerIdentity &worker = currentWorker();
+			return worker.pool == this ? workerSlot(worker.index).metrics : _sharedMetrics;
 		}
 
 		/**
-		 * @brief Starts threadpool
+		 * @brief Predicate dicating whether thread runner should perform action
 		 *
+		 * @return Condition that requires thread intervention
 		 */
-		void start()
+		virtual bool inputPredicate()
+		{
+			return !_queue.empty() || !poolRunning();
+		}
+
+		/**
+		 * @brief Wait on input condition variable until input predicate holds
+		 *
+		 * Spins with the lock released first, as under load new input usually
+		 * arrives before a park/unpark round trip would complete.  Parked
+		 * workers are counted so producers only signal when somebody sleeps.
+		 *
+		 * @param l Lock on queue mutex, held on entry and exit
+		 * @param spin Spin budget of calling worker
+		 */
+		void waitForInput(std::unique_lock<ProfiledMutex> &l, AdaptiveSpin &spin)
 		{
-			// Don't do anything if threads already exist
-			if (!_threads.empty())
+			// Draining workers leave rather than wait
+			if (inputPredicate() || !workerWanted() || _draining)
 			{
 				return;
 			}
 
-			// Set running flag
-			_poolRunning = true;
+			THREADUTILS_ZONE("Wait for input");
+
+			// Spin until a producer signals new input
+			uint64_t epoch = _inputEpoch.load(std::memory_order_acquire);
+			l.unlock();
+			spin.spinUntil([&]() {
+				return _inputEpoch.load(std::memory_order_acquire) != epoch || !workerWanted() || _draining;
+			});
+			l.lock();
+
+			// Park
+			parkWorker(l, [&](){ return inputPredicate(); });
+		}
+
+		/**
+		 * @brief Signal new input, waking at most one parked worker per item
+		 *
+		 * Must be called after pushing (and releasing queue mutex).
+		 *
+		 * @param count Number of items pushed
+		 */
+		void wakeWorkers(size_t count)
+		{
+			// Let spinning workers know
+			_inputEpoch.fetch_add(1, std::memory_order_release);
+
+			uint32_t sleeping = _sleepingThreads;
+			if (count >= sleeping)
+			{
+				if (sleeping > 0)
+				{
+					_inputCV.notify_all();
+				}
+
+				return;
+			}
 
-			// Create threads
-			for (uint32_t i = 0; i < _numThreads; i++)
+			for (size_t i = 0; i < count; i++)
 			{
-				std::thread *thread = new std::thread(&Threadpool::threadRunner, this);
-				_threads.push_back(thread);
+				_inputCV.notify_one();
 			}
 		}
 
 		/**
-		 * @brief Stops threadpool
+		 * @brief Enqueue range of tasks in work stealing mode
 		 *
+		 * @param begin First element
+		 * @param end One past last element
+		 * @param lane Priority lane in shared (or node) queue
+		 * @return size_t Number of tasks enqueued
 		 */
-		void stop()
+		template <typename Iterator>
+		size_t enqueueBulkStealing(Iterator begin, Iterator end, size_t lane)
 		{
-			// Check if thread vector empty
-			if (_threads.empty())
+			WorkerIdentity &worker = currentWorker();
+			uint64_t now = metricsNow();
+			size_t count = 0;
+
+			if (worker.pool == this && _poolRunning && !_closing)
 			{
-				return;
+				// Push to calling worker's own deque
+				for (Iterator it = begin; it != end; ++it, count++)
+				{
+					Task task(std::move(*it));
+					Task *node = acquireNode(worker.index, task);
+					node->setEnqueueTime(now);
+					workerSlot(worker.index).queue->push(node);
+				}
+
+				_pendingTasks += count;
+				enqueuerMetrics().addEnqueued(count);
+
+				// Only pay for lock and signal if somebody is asleep
+				if (_sleepingThreads > 0)
+				{
+					std::unique_lock<ProfiledMutex> l(_queueMutex);
+					l.unlock();
+					wakeWorkers(count);
+				}
+
+				return count;
 			}
 
-			// Set flag to false and notify threads
-			_poolRunning = false;
-			_inputCV.notify_all();
+			// Outside submitters feed the shared queue (or their node's queue)
+			uint32_t node = CpuTopology::system().currentNode();
+			std::vector<Task> dropped;
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			TaskQueue &queue = submitQueue(node);
+			LaneSlot slot = { queue, queue.laneFor(lane) };
+			std::chrono::steady_clock::time_point deadline = enqueueDeadline();
+			for (Iterator it = begin; it != end; ++it, count++)
+			{
+				if (!waitForRoom(l, slot, deadline, DropFromLane{slot, dropped, &_pendingTasks}))
+				{
+					break;
+				}
 
-			// Wait for thread to finish and delete
-			for (auto thread : _threads)
+				queue.push(Task(std::move(*it)), slot.lane);
+				queue.back(slot.lane).setEnqueueTime(now);
+				_pendingTasks++;
+			}
+			l.unlock();
+			cancelTasks(dropped);
+
+			enqueuerMetrics().addEnqueued(count);
+
+			wakeWorkers(count);
+
+			return count;
+		}
+
+		/**
+		 * @brief Enqueue task in work stealing mode
+		 *
+		 * Workers' own deques are unbounded, only the shared (or node) queue
+		 * fed by outside submitters applies backpressure.
+		 *
+		 * @param task Task to run, only moved from if enqueued
+		 * @param lane Priority lane in shared (or node) queue
+		 * @return true Task enqueued
+		 * @return false Shared queue full or pool shutting down
+		 */
+		bool enqueueStealing(Task &task, size_t lane)
+		{
+			WorkerIdentity &worker = currentWorker();
+
+			if (worker.pool == this && _poolRunning && !_closing)
 			{
-				thread->join();
-				delete thread;
+				// Push to calling worker's own deque
+				workerSlot(worker.index).queue->push(acquireNode(worker.index, task));
+				_pendingTasks++;
+				enqueuerMetrics().addEnqueued(1);
+
+				// Only pay for lock and signal if somebody is asleep
+				if (_sleepingThreads > 0)
+				{
+					std::unique_lock<ProfiledMutex> l(_queueMutex);
+					l.unlock();
+					wakeWorkers(1);
+				}
+
+				return true;
+			}
+
+			// Outside submitters feed the shared queue (or their node's queue)
+			uint32_t node = CpuTopology::system().currentNode();
+			std::vector<Task> dropped;
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			TaskQueue &queue = submitQueue(node);
+			LaneSlot slot = { queue, queue.laneFor(lane) };
+			if (!waitForRoom(l, slot, enqueueDeadline(), DropFromLane{slot, dropped, &_pendingTasks}))
+			{
+				return false;
 			}
 
-			// Clear array of threads
-			_threads.clear();
+			queue.push(std::move(task), slot.lane);
+			_pendingTasks++;
+			THREADUTILS_PLOT("Queue depth", queue.size());
+			l.unlock();
+			cancelTasks(dropped);
+
+			enqueuerMetrics().addEnqueued(1);
+			wakeWorkers(1);
+
+			return true;
 		}
 
 		/**
-		 * @brief Returns whether threadpool is running
+		 * @brief Take next task from queue, making room for blocked producers.  Queue mutex held.
 		 *
-		 * @return true Threadpool running
-		 * @return false Threadpool not running
+		 * @param queue Queue to take from
+		 * @param task Task taken
+		 * @return true Task taken
+		 * @return false Queue empty
 		 */
-		bool poolRunning() { return _poolRunning; }
+		bool takeFrom(TaskQueue &queue, Task &task)
+		{
+			if (!queue.pop(task))
+			{
+				return false;
+			}
+
+			signalRoom();
+
+			return true;
+		}
 
-	protected:
 		/**
-		 * @brief Function run in threads
+		 * @brief Steal from other workers, starting at neighbour
 		 *
+		 * @param index Index of worker
+		 * @param sameNode Only steal from workers on same node (otherwise only other nodes)
+		 * @param node Task stolen
+		 * @return true Task stolen
+		 * @return false Nothing to steal
 		 */
-		virtual void threadRunner()
+		bool stealFromWorkers(uint32_t index, bool sameNode, Task *&node)
 		{
-			// While pool active
-			while (poolRunning())
+			// Workers past the count have handed their tasks back
+			uint32_t count = _numThreads;
+			for (uint32_t i = 1; i < count; i++)
 			{
-				// Grab lock
-				std::unique_lock<std::mutex> l(_queueMutex);
+				uint32_t victim = (index + i) % count;
+				const WorkerSlot &slot = workerSlot(victim);
+				if ((slot.node == workerSlot(index).node) != sameNode)
+				{
+					continue;
+				}
+
+				if (slot.queue->steal(node))
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
 
-				// Pointer to runnable
-				AbstractRunnable *runnable = nullptr;
+		/**
+		 * @brief Find task for a thread that isn't one of our workers (work stealing mode)
+		 *
+		 * @param task Task found
+		 * @return true Task found
+		 * @return false No task found anywhere
+		 */
+		bool takeAnywhere(Task &task)
+		{
+			std::unique_lock<ProfiledMutex> l(_queueMutex);
+			if (takeFrom(_queue, task))
+			{
+				return true;
+			}
 
-				if (!poolRunning())
+			for (auto &queue : _nodeQueues)
+			{
+				if (takeFrom(*queue, task))
 				{
-					break;
-					l.unlock();
+					return true;
 				}
+			}
 
-				// Wait for change in queue or pool status
-				_inputCV.wait(l, [&](){ return inputPredicate(); });
+			// Worker deques only exist once their slot is used
+			Task *node = nullptr;
+			uint32_t slots = _slotsUsed.load(std::memory_order_acquire);
+			for (uint32_t i = 0; i < slots && node == nullptr; i++)
+			{
+				workerSlot(i).queue->steal(node);
+			}
+			l.unlock();
+
+			if (node == nullptr)
+			{
+				return false;
+			}
+
+			task = std::move(*node);
+			delete node;
+
+			return true;
+		}
 
-				// If pool killed
-				if (!poolRunning())
+		/**
+		 * @brief Find task for worker in work stealing mode
+		 *
+		 * Looks close to home first: own deque, own node's queue and shared
+		 * queue, workers on the same node, then other nodes' queues and
+		 * workers.
+		 *
+		 * @param index Index of worker
+		 * @param task Task found
+		 * @return true Task found
+		 * @return false No task found anywhere
+		 */
+		bool findStealingWork(uint32_t index, Task &task)
+		{
+			Task *node = nullptr;
+			WorkerSlot &slot = workerSlot(index);
+			uint32_t workerNode = slot.node;
+
+			// Own deque first
+			if (!slot.queue->pop(node))
+			{
+				// Then own node's queue and shared queue
+				std::unique_lock<ProfiledMutex> l(_queueMutex);
+				if ((!_nodeQueues.empty() && takeFrom(*_nodeQueues[workerNode % _nodeQueues.size()], task))
+					|| takeFrom(_queue, task))
 				{
-					// Release lock
-					l.unlock();
-					break;
+					return true;
 				}
+				l.unlock();
 
-				if (_queue.empty())
+				// Then steal from workers on same node
+				if (!stealFromWorkers(index, true, node))
 				{
+					// Only then cross to other nodes
+					l.lock();
+					for (size_t i = 1; i < _nodeQueues.size(); i++)
+					{
+						if (takeFrom(*_nodeQueues[(workerNode + i) % _nodeQueues.size()], task))
+						{
+							return true;
+						}
+					}
 					l.unlock();
-					continue;
+
+					stealFromWorkers(index, false, node);
 				}
+			}
 
-				runnable = _queue.front();
-				_queue.pop_front();
-				l.unlock();
+			if (node == nullptr)
+			{
+				return false;
+			}
+
+			// Take task out of its node, keeping node for our next push
+			releaseNode(index, node, task);
 
-				// Execute runnable
-				runnable->run();
+			return true;
+		}
 
-				// Delete runnable when done
-				delete runnable;
+		/**
+		 * @brief Wrap task in a deque node, reusing one the worker freed
+		 *
+		 * Only called by the worker owning the cache, so it isn't locked.
+		 *
+		 * @param index Index of calling worker
+		 * @param task Task, moved into node
+		 * @return Task* Node to push
+		 */
+		Task *acquireNode(uint32_t index, Task &task)
+		{
+			std::vector<std::unique_ptr<Task>> &cache = workerSlot(index).nodeCache;
+			if (cache.empty())
+			{
+				return new Task(std::move(task));
 			}
+
+			Task *node = cache.back().release();
+			cache.pop_back();
+			*node = std::move(task);
+
+			return node;
 		}
 
 		/**
-		 * @brief Predicate dicating whether thread runner should perform action
+		 * @brief Move task out of deque node, keeping node in worker's cache
 		 *
-		 * @return Condition that requires thread intervention
+		 * Nodes stolen from other workers go to the thief's cache, so each
+		 * cache is only touched by its own worker.
+		 *
+		 * @param index Index of calling worker
+		 * @param node Node popped or stolen
+		 * @param task Task taken out of node
 		 */
-		virtual bool inputPredicate()
+		void releaseNode(uint32_t index, Task *node, Task &task)
 		{
-			return !_queue.empty() || !poolRunning();
+			task = std::move(*node);
+
+			std::vector<std::unique_ptr<Task>> &cache = workerSlot(index).nodeCache;
+			if (cache.size() < NodeCacheSize)
+			{
+				cache.emplace_back(node);
+			}
+			else
+			{
+				delete node;
+			}
+		}
+
+		/**
+		 * @brief Function run in threads in work stealing mode
+		 *
+		 */
+		void stealingThreadRunner()
+		{
+			const WorkerIdentity &worker = currentWorker();
+			uint32_t index = worker.index;
+
+			// Task to run
+			Task task;
+
+			// Spin budget before parking
+			AdaptiveSpin spin;
+
+			// While pool active (and worker still wanted)
+			while (workerWanted())
+			{
+				if (!findStealingWork(index, task))
+				{
+					// Nothing left to drain
+					if (_draining)
+					{
+						break;
+					}
+
+					// Spin a little in case something is pushed soon
+					if (spin.spinUntil([&]() { return _pendingTasks > 0 || !workerWanted() || _draining; }))
+					{
+						continue;
+					}
+
+					// Sleep until something is pushed anywhere
+					THREADUTILS_ZONE("Wait for input");
+					std::unique_lock<ProfiledMutex> l(_queueMutex);
+					parkWorker(l, [&]() { return _pendingTasks > 0; });
+					l.unlock();
+
+					continue;
+				}
+
+				_pendingTasks--;
+				THREADUTILS_PLOT("Pending tasks", _pendingTasks.load());
+
+				// Execute task, destroying it when done
+				runTask(task, worker);
+			}
 		}
 
 	protected:
-		/// @brief Size of thread pool
-		uint32_t _numThreads;
+		/// @brief Number of workers wanted, workers numbered from here up leave
+		std::atomic_uint32_t _numThreads;
+
+		/// @brief Most workers pool can be resized to
+		uint32_t _maxThreads;
+
+		/// @brief Worker slots set up so far (never shrinks)
+		std::atomic_uint32_t _slotsUsed;
 
 		/// @brief Thread pool currently active
 		std::atomic_bool _poolRunning;
 
-		/// @brief Queue of runnables
-		std::deque<AbstractRunnable*> _queue;
+		/// @brief Queue of tasks, split into priority lanes
+		TaskQueue _queue;
 
-		/// @brief Vector of threads
-		std::vector<std::thread*> _threads;
+		/// @brief Mutex serializing start, stop, resizes and workers leaving
+		THREADUTILS_LOCKABLE(_resizeMutex);
 
 		/// @brief Mutex synchronizing access to runnable queue
-		std::mutex _queueMutex;
+		THREADUTILS_LOCKABLE(_queueMutex);
 
 		/// @brief Condition variable to notify threads
-		std::condition_variable _inputCV;
+		ProfiledConditionVariable _inputCV;
+
+		/// @brief Condition variable signalled when a worker leaves (with resize mutex)
+		ProfiledConditionVariable _exitCV;
+
+		/// @brief Scheduling mode of pool
+		SchedulingMode _schedulingMode;
+
+		/// @brief Where workers run
+		WorkerPlacement _placement;
+
+		/// @brief Per node queues fed by outside submitters (work stealing mode with node queues)
+		std::vector<std::unique_ptr<TaskQueue>> _nodeQueues;
+
+		/// @brief Worker slots in segments of 1, 2, 4, ... slots, allocated as slots are first used
+		std::unique_ptr<WorkerSlot[]> _slotSegments[SlotSegments];
+
+		/// @brief Runnables pushed but not yet taken (work stealing mode)
+		std::atomic<int64_t> _pendingTasks;
+
+		/// @brief Workers parked waiting for work
+		std::atomic_uint32_t _sleepingThreads;
+
+		/// @brief Bumped on every push so spinning workers notice new input
+		std::atomic<uint64_t> _inputEpoch;
+
+		/// @brief Counters shared by threads that aren't workers
+		WorkerMetrics _sharedMetrics;
+
+		/// @brief Most tasks queued before overflow policy applies
+		size_t _maxQueueSize;
+
+		/// @brief What feeding a full queue does
+		OverflowPolicy _overflowPolicy;
+
+		/// @brief How long BlockWithTimeout waits for room
+		std::chrono::nanoseconds _enqueueTimeout;
+
+		/// @brief Condition variable signalled when a task is taken from a queue
+		ProfiledConditionVariable _notFullCV;
+
+		/// @brief Producers waiting for room (guarded by queue mutex)
+		uint32_t _blockedProducers;
+
+		/// @brief Tasks rejected by overflow policy
+		std::atomic<uint64_t> _tasksRejected;
+
+		/// @brief Tasks discarded by DropOldest
+		std::atomic<uint64_t> _tasksDropped;
+
+		/// @brief Worker count follows load
+		std::atomic_bool _elasticEnabled;
+
+		/// @brief Fewest workers elastic pool keeps
+		std::atomic_uint32_t _elasticMin;
+
+		/// @brief Most workers elastic pool adds
+		std::atomic_uint32_t _elasticMax;
+
+		/// @brief Queue wait that adds a worker (ns)
+		std::atomic<uint64_t> _growAfter;
+
+		/// @brief Idle time that retires a worker (ns)
+		std::atomic<uint64_t> _keepAlive;
+
+		/// @brief When elastic pool last added a worker (metricsNow)
+		std::atomic<uint64_t> _lastGrowth;
+
+		/// @brief Workers leave once out of work, outside enqueues rejected
+		std::atomic_bool _draining;
+
+		/// @brief Pool is shutting down, every enqueue rejected until next start
+		std::atomic_bool _closing;
+
+		/// @brief Callbacks run by workers as they start and leave (guarded by resize mutex)
+		WorkerHooks _workerHooks;
+
+		/// @brief Creates each worker's context, empty if none (guarded by resize mutex)
+		std::function<std::shared_ptr<void>(uint32_t)> _contextFactory;
+
+		/// @brief Type tag of context _contextFactory creates (set under resize mutex)
+		std::atomic<const void*> _contextType;
 	};
 
+#ifdef THREADUTILS_HAS_COROUTINES
+	inline bool ScheduleAwaiter::await_suspend(std::coroutine_handle<> handle)
+	{
+		Task task = Task::create<ResumeTask>(handle);
+		if (_pool->tryEnqueue(task, _lane))
+		{
+			return true;
+		}
+
+		// Rejected, carry on here rather than resuming from inside the pool
+		task.target<ResumeTask>()->release();
+		_cancelled = _pool->shuttingDown();
+
+		return false;
+	}
+
+	inline void ScheduleAwaiter::await_resume() const
+	{
+		if (_cancelled)
+		{
+			throw std::future_error(std::future_errc::broken_promise);
+		}
+	}
+#endif
+
 };
 
 #endif /* THREADPOOL_H_ */
\ No newline at end of file
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file topology.hpp
+ * @author Evan Stoddard
+ * @brief CPU/NUMA topology discovery and thread pinning
+ */
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief NUMA nodes of the machine and the CPUs in each
+	 *
+	 * Read from sysfs on Linux.  Elsewhere (or if sysfs is unreadable) the
+	 * machine is treated as a single node holding every CPU.  Only nodes
+	 * with CPUs are listed, numbered 0 to numNodes() - 1 in order of their
+	 * (possibly sparse) sysfs ids, which nodeId() returns.  Memory-only
+	 * nodes (CXL, HBM) are left out, no worker could run on them.
+	 *
+	 */
+	class CpuTopology
+	{
+	public:
+		/**
+		 * @brief Returns topology of this machine, read once
+		 *
+		 */
+		static const CpuTopology &system()
+		{
+			static const CpuTopology topology = read("/sys/devices/system/node");
+			return topology;
+		}
+
+		/**
+		 * @brief Read topology from a sysfs node directory
+		 *
+		 * Nodes are listed by has_cpu (or online, on kernels without it), each
+		 * node's CPUs by its nodeN/cpulist.
+		 *
+		 * @param nodeDirectory Directory such as /sys/devices/system/node
+		 * @return CpuTopology Topology read (a single node of every CPU if unreadable)
+		 */
+		static CpuTopology read(const std::string &nodeDirectory)
+		{
+			CpuTopology topology;
+
+			std::vector<uint32_t> ids = parseCpuList(readLine(nodeDirectory + "/has_cpu"));
+			if (ids.empty())
+			{
+				ids = parseCpuList(readLine(nodeDirectory + "/online"));
+			}
+
+			for (uint32_t id : ids)
+			{
+				std::vector<uint32_t> cpus = parseCpuList(readLine(nodeDirectory + "/node" + std::to_string(id) + "/cpulist"));
+				if (cpus.empty())
+				{
+					continue;
+				}
+
+				uint32_t node = (uint32_t)topology._nodeCpus.size();
+				for (uint32_t cpu : cpus)
+				{
+					if (cpu >= topology._cpuNodes.size())
+					{
+						topology._cpuNodes.resize(cpu + 1, 0);
+					}
+					topology._cpuNodes[cpu] = node;
+				}
+
+				topology._nodeIds.push_back(id);
+				topology._nodeCpus.push_back(cpus);
+			}
+
+			// Fall back to a single node of every CPU
+			if (topology._nodeCpus.empty())
+			{
+				uint32_t numCpus = std::thread::hardware_concurrency();
+				topology._nodeIds.push_back(0);
+				topology._nodeCpus.emplace_back();
+				for (uint32_t cpu = 0; cpu < (numCpus > 0 ? numCpus : 1); cpu++)
+				{
+					topology._nodeCpus[0].push_back(cpu);
+				}
+			}
+
+			return topology;
+		}
+
+		/**
+		 * @brief Returns number of NUMA nodes with CPUs
+		 *
+		 */
+		size_t numNodes() const { return _nodeCpus.size(); }
+
+		/**
+		 * @brief Returns sysfs id of node
+		 *
+		 * @param node Node index
+		 */
+		uint32_t nodeId(size_t node) const { return _nodeIds[node]; }
+
+		/**
+		 * @brief Returns CPUs of node
+		 *
+		 * @param node Node index
+		 */
+		const std::vector<uint32_t> &nodeCpus(size_t node) const { return _nodeCpus[node]; }
+
+		/**
+		 * @brief Returns index of node CPU belongs to (0 if unknown)
+		 *
+		 * @param cpu CPU number
+		 */
+		uint32_t nodeOfCpu(uint32_t cpu) const
+		{
+			return cpu < _cpuNodes.size() ? _cpuNodes[cpu] : 0;
+		}
+
+		/**
+		 * @brief Returns index of node calling thread is currently running on (0 if unknown)
+		 *
+		 */
+		uint32_t currentNode() const
+		{
+			if (numNodes() <= 1)
+			{
+				return 0;
+			}
+
+#ifdef __linux__
+			int cpu = sched_getcpu();
+			if (cpu >= 0)
+			{
+				return nodeOfCpu((uint32_t)cpu);
+			}
+#endif
+
+			return 0;
+		}
+
+		/**
+		 * @brief Parse a sysfs CPU list such as "0-3,8-11"
+		 *
+		 * @param list CPU list
+		 * @return std::vector<uint32_t> CPUs in list
+		 */
+		static std::vector<uint32_t> parseCpuList(const std::string &list)
+		{
+			std::vector<uint32_t> cpus;
+			std::stringstream ranges(list);
+			std::string range;
+
+			while (std::getline(ranges, range, ','))
+			{
+				if (range.empty() || range[0] < '0' || range[0] > '9')
+				{
+					continue;
+				}
+
+				size_t dash = range.find('-');
+				uint32_t first = (uint32_t)std::stoul(range.substr(0, dash));
+				uint32_t last = dash == std::string::npos ? first : (uint32_t)std::stoul(range.substr(dash + 1));
+
+				for (uint32_t cpu = first; cpu <= last; cpu++)
+				{
+					cpus.push_back(cpu);
+				}
+			}
+
+			return cpus;
+		}
+
+	private:
+		CpuTopology()
+		{
+		}
+
+		/**
+		 * @brief Returns first line of file (empty if unreadable)
+		 *
+		 */
+		static std::string readLine(const std::string &path)
+		{
+			std::ifstream file(path);
+			std::string line;
+			if (!file || !std::getline(file, line))
+			{
+				return std::string();
+			}
+
+			return line;
+		}
+
+	private:
+		/// @brief Sysfs id of each node
+		std::vector<uint32_t> _nodeIds;
+
+		/// @brief CPUs of each node
+		std::vector<std::vector<uint32_t>> _nodeCpus;
+
+		/// @brief Index of node of each CPU
+		std::vector<uint32_t> _cpuNodes;
+	};
+
+	/**
+	 * @brief Restrict calling thread to a set of CPUs
+	 *
+	 * @param cpus CPUs thread may run on
+	 * @return true Thread pinned
+	 * @return false Pinning unsupported or failed
+	 */
+	inline bool pinCurrentThread(const std::vector<uint32_t> &cpus)
+	{
+#ifdef __linux__
+		if (cpus.empty())
+		{
+			return false;
+		}
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (uint32_t cpu : cpus)
+		{
+			if (cpu < CPU_SETSIZE)
+			{
+				CPU_SET(cpu, &set);
+			}
+		}
+
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		(void)cpus;
+		return false;
+#endif
+	}
+
+	/**
+	 * @brief Where worker threads run and which queue submitters feed
+	 *
+	 */
+	struct WorkerPlacement
+	{
+		/**
+		 * @brief Construct placement leaving workers wherever the OS puts them
+		 *
+		 */
+		WorkerPlacement() :
+			spreadAcrossNodes(false),
+			nodeQueues(false)
+		{
+		}
+
+		/**
+		 * @brief Pin worker i to cpus[i % cpus.size()]
+		 *
+		 * @param cpus CPU set
+		 */
+		static WorkerPlacement pinned(std::vector<uint32_t> cpus)
+		{
+			WorkerPlacement placement;
+			placement.cpus = std::move(cpus);
+			return placement;
+		}
+
+		/**
+		 * @brief Deal workers round robin across NUMA nodes, pinned to their node
+		 *
+		 * @param withNodeQueues Give each node its own queue (work stealing mode)
+		 */
+		static WorkerPlacement numa(bool withNodeQueues = true)
+		{
+			WorkerPlacement placement;
+			placement.spreadAcrossNodes = true;
+			placement.nodeQueues = withNodeQueues;
+			return placement;
+		}
+
+		/// @brief CPUs workers are pinned to one each, round robin (empty if unpinned)
+		std::vector<uint32_t> cpus;
+
+		/// @brief Spread workers across nodes, each pinned to its node's CPUs
+		bool spreadAcrossNodes;
+
+		/// @brief Submitters feed a queue local to their node (work stealing mode)
+		bool nodeQueues;
+	};
+};
+
+#endif /* TOPOLOGY_H_ */
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file workstealingdeque.hpp
+ * @author Evan Stoddard
+ * @brief Chase-Lev work stealing deque
+ */
+
+#ifndef WORKSTEALINGDEQUE_H_
+#define WORKSTEALINGDEQUE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace ThreadUtils
+{
+	/**
+	 * @brief Single owner, multiple thief deque (Chase-Lev).
+	 *
+	 * The owning thread pushes and pops at the bottom, any other thread may
+	 * steal from the top.  Arrays replaced while growing are retired and only
+	 * freed when the deque is destroyed, as thieves may still be reading them.
+	 *
+	 * @tparam T Trivially copyable element type (usually a pointer)
+	 */
+	template <typename T>
+	class WorkStealingDeque
+	{
+	public:
+		/**
+		 * @brief Construct a new Work Stealing Deque object
+		 *
+		 * @param capacity Initial capacity (rounded up to power of two)
+		 */
+		explicit WorkStealingDeque(int64_t capacity = 256) :
+			_top(0),
+			_bottom(0),
+			_array(new Array(roundCapacity(capacity)))
+		{
+		}
+
+		/**
+		 * @brief Destroy the Work Stealing Deque object
+		 *
+		 */
+		~WorkStealingDeque()
+		{
+			for (auto array : _retired)
+			{
+				delete array;
+			}
+
+			delete _array.load(std::memory_order_relaxed);
+		}
+
+		WorkStealingDeque(const WorkStealingDeque &) = delete;
+		WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+		/**
+		 * @brief Push item onto bottom of deque.  Owner thread only.
+		 *
+		 * @param item Item to push
+		 */
+		void push(T item)
+		{
+			int64_t b = _bottom.load(std::memory_order_relaxed);
+			int64_t t = _top.load(std::memory_order_acquire);
+			Array *array = _array.load(std::memory_order_relaxed);
+
+			// Grow if full
+			if (b - t > array->capacity - 1)
+			{
+				array = grow(array, b, t);
+			}
+
+			// Publish item to thieves
+			array->put(b, item);
+			_bottom.store(b + 1, std::memory_order_release);
+		}
+
+		/**
+		 * @brief Pop item from bottom of deque.  Owner thread only.
+		 *
+		 * @param item Popped item
+		 * @return true Item popped
+		 * @return false Deque empty
+		 */
+		bool pop(T &item)
+		{
+			int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+			Array *array = _array.load(std::memory_order_relaxed);
+			_bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = _top.load(std::memory_order_relaxed);
+
+			// Deque empty
+			if (t > b)
+			{
+				_bottom.store(b + 1, std::memory_order_relaxed);
+				return false;
+			}
+
+			T bottomItem = array->get(b);
+
+			// More than one item left, no race with thieves
+			if (t != b)
+			{
+				item = bottomItem;
+				return true;
+			}
+
+			// Last item, race thieves for it
+			bool won = _top.compare_exchange_strong(
+				t,
+				t + 1,
+				std::memory_order_seq_cst,
+				std::memory_order_relaxed
+			);
+			_bottom.store(b + 1, std::memory_order_relaxed);
+
+			if (won)
+			{
+				item = bottomItem;
+			}
+
+			return won;
+		}
+
+		/**
+		 * @brief Steal item from top of deque.  Safe from any thread.
+		 *
+		 * @param item Stolen item
+		 * @return true Item stolen
+		 * @return false Deque empty or lost race
+		 */
+		bool steal(T &item)
+		{
+			int64_t t = _top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = _bottom.load(std::memory_order_acquire);
+
+			if (t >= b)
+			{
+				return false;
+			}
+
+			Array *array = _array.load(std::memory_order_acquire);
+			T topItem = array->get(t);
+
+			// Lost race with owner or another thief
+			if (!_top.compare_exchange_strong(
+				t,
+				t + 1,
+				std::memory_order_seq_cst,
+				std::memory_order_relaxed
+			))
+			{
+				return false;
+			}
+
+			item = topItem;
+			return true;
+		}
+
+		/**
+		 * @brief Approximate number of items in deque
+		 *
+		 * @return int64_t Number of items
+		 */
+		int64_t size() const
+		{
+			int64_t b = _bottom.load(std::memory_order_relaxed);
+			int64_t t = _top.load(std::memory_order_relaxed);
+			return b > t ? b - t : 0;
+		}
+
+		/**
+		 * @brief Returns whether deque appears empty
+		 *
+		 */
+		bool empty() const { return size() == 0; }
+
+	private:
+		/**
+		 * @brief Circular array backing the deque
+		 *
+		 */
+		struct Array
+		{
+			explicit Array(int64_t cap) :
+				capacity(cap),
+				mask(cap - 1),
+				items(new std::atomic<T>[cap])
+			{}
+
+			~Array() { delete[] items; }
+
+			T get(int64_t i) { return items[i & mask].load(std::memory_order_relaxed); }
+			void put(int64_t i, T item) { items[i & mask].store(item, std::memory_order_relaxed); }
+
+			int64_t capacity;
+			int64_t mask;
+			std::atomic<T> *items;
+		};
+
+		/**
+		 * @brief Double the size of the backing array
+		 *
+		 * @param array Current array
+		 * @param b Bottom index
+		 * @param t Top index
+		 * @return Array* New array
+		 */
+		Array *grow(Array *array, int64_t b, int64_t t)
+		{
+			Array *grown = new Array(array->capacity * 2);
+
+			for (int64_t i = t; i < b; i++)
+			{
+				grown->put(i, array->get(i));
+			}
+
+			_retired.push_back(array);
+			_array.store(grown, std::memory_order_release);
+
+			return grown;
+		}
+
+		/**
+		 * @brief Round capacity up to next power of two
+		 *
+		 */
+		static int64_t roundCapacity(int64_t capacity)
+		{
+			int64_t rounded = 2;
+			while (rounded < capacity)
+			{
+				rounded <<= 1;
+			}
+
+			return rounded;
+		}
+
+	private:
+		/// @brief Index thieves steal from
+		std::atomic<int64_t> _top;
+
+		/// @brief Keep thieves and owner on separate cache lines
+		char _padding[64 - sizeof(std::atomic<int64_t>)];
+
+		/// @brief Index owner pushes and pops at
+		std::atomic<int64_t> _bottom;
+
+		/// @brief Current backing array
+		std::atomic<Array*> _array;
+
+		/// @brief Arrays replaced while growing
+		std::vector<Array*> _retired;
+	};
+};
+
+#endif /* WORKSTEALINGDEQUE_H_ */
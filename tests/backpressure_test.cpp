@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file backpressure_test.cpp
+ * @author Evan Stoddard
+ * @brief Bounded queue and overflow policy tests
+ */
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <thread>
+#include <gtest/gtest.h>
+#include "bufferedthreadpool.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::BufferedThreadpool;
+using ThreadUtils::Future;
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Task;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/// @brief Queue limit of every test
+static const size_t MaxQueueSize = 2;
+
+/// @brief BlockWithTimeout's timeout
+static const std::chrono::milliseconds Timeout(50);
+
+/**
+ * @brief Keeps a pool's only worker busy until opened
+ *
+ * Opens when destroyed, so declare it after the pool.
+ *
+ */
+class Gate
+{
+public:
+	Gate() :
+		_entered(false),
+		_open(false)
+	{
+	}
+
+	~Gate() { open(); }
+
+	Task task()
+	{
+		return Task([this]() {
+			_entered = true;
+			while (!_open.load())
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		});
+	}
+
+	bool waitEntered() { return eventually([this]() { return _entered.load(); }); }
+
+	void open() { _open = true; }
+
+private:
+	std::atomic<bool> _entered;
+	std::atomic<bool> _open;
+};
+
+/**
+ * @brief Counts runs of its tasks, and cancels of those the pool rejected or dropped
+ *
+ */
+struct Counters
+{
+	Counters() :
+		runs(0),
+		cancels(0)
+	{
+	}
+
+	Task task()
+	{
+		struct Counted
+		{
+			Counters *counters;
+
+			void operator()() { counters->runs++; }
+
+			void cancel() { counters->cancels++; }
+		};
+
+		return Task(Counted{ this });
+	}
+
+	std::atomic<int> runs;
+	std::atomic<int> cancels;
+};
+
+/**
+ * @brief Start pool with its only worker held by gate and its queue full
+ *
+ */
+template <typename Feed>
+static void fillQueue(Threadpool &pool, Feed feed, Gate &gate, Counters &counters)
+{
+	pool.start();
+	ASSERT_TRUE(feed(gate.task()));
+	ASSERT_TRUE(gate.waitEntered());
+
+	for (size_t i = 0; i < MaxQueueSize; i++)
+	{
+		ASSERT_TRUE(feed(counters.task()));
+	}
+}
+
+template <typename Feed>
+static void checkBlock(Threadpool &pool, Feed feed)
+{
+	pool.setBackpressure(MaxQueueSize, OverflowPolicy::Block);
+
+	Counters counters;
+	Gate gate;
+	ASSERT_NO_FATAL_FAILURE(fillQueue(pool, feed, gate, counters));
+
+	std::atomic<bool> returned(false);
+	bool admitted = false;
+	std::thread producer([&]() {
+		admitted = feed(counters.task());
+		returned = true;
+	});
+
+	// Held back while the queue is full, let in once the worker takes from it
+	std::this_thread::sleep_for(Timeout);
+	EXPECT_FALSE(returned.load());
+	gate.open();
+	producer.join();
+
+	EXPECT_TRUE(admitted);
+	EXPECT_TRUE(eventually([&]() { return counters.runs.load() == 3; }));
+	EXPECT_EQ(counters.cancels.load(), 0);
+	EXPECT_EQ(pool.snapshot().tasksRejected, 0u);
+}
+
+template <typename Feed>
+static void checkBlockWithTimeout(Threadpool &pool, Feed feed)
+{
+	pool.setBackpressure(MaxQueueSize, OverflowPolicy::BlockWithTimeout, Timeout);
+
+	Counters counters;
+	Gate gate;
+	ASSERT_NO_FATAL_FAILURE(fillQueue(pool, feed, gate, counters));
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	EXPECT_FALSE(feed(counters.task()));
+	std::chrono::steady_clock::duration waited = std::chrono::steady_clock::now() - start;
+
+	EXPECT_GE(waited, Timeout);
+	EXPECT_LT(waited, Timeout * 20);
+	EXPECT_EQ(counters.cancels.load(), 1);
+	EXPECT_EQ(pool.snapshot().tasksRejected, 1u);
+
+	gate.open();
+	EXPECT_TRUE(eventually([&]() { return counters.runs.load() == 2; }));
+}
+
+template <typename Feed>
+static void checkTryAndReturnFalse(Threadpool &pool, Feed feed)
+{
+	pool.setBackpressure(MaxQueueSize, OverflowPolicy::TryAndReturnFalse);
+
+	Counters counters;
+	Gate gate;
+	ASSERT_NO_FATAL_FAILURE(fillQueue(pool, feed, gate, counters));
+
+	EXPECT_FALSE(feed(counters.task()));
+	EXPECT_FALSE(feed(counters.task()));
+	EXPECT_EQ(counters.cancels.load(), 2);
+	EXPECT_EQ(pool.snapshot().tasksRejected, 2u);
+
+	gate.open();
+	EXPECT_TRUE(eventually([&]() { return counters.runs.load() == 2; }));
+}
+
+template <typename Feed>
+static void checkDropOldest(Threadpool &pool, Feed feed)
+{
+	pool.setBackpressure(MaxQueueSize, OverflowPolicy::DropOldest);
+
+	Counters oldest;
+	Counters counters;
+	Gate gate;
+	pool.start();
+	ASSERT_TRUE(feed(gate.task()));
+	ASSERT_TRUE(gate.waitEntered());
+	ASSERT_TRUE(feed(oldest.task()));
+	ASSERT_TRUE(feed(counters.task()));
+
+	// Admitted, the oldest queued task makes room
+	EXPECT_TRUE(feed(counters.task()));
+	EXPECT_EQ(oldest.cancels.load(), 1);
+	EXPECT_EQ(counters.cancels.load(), 0);
+	EXPECT_EQ(pool.snapshot().tasksDropped, 1u);
+	EXPECT_EQ(pool.snapshot().tasksRejected, 0u);
+
+	gate.open();
+	EXPECT_TRUE(eventually([&]() { return counters.runs.load() == 2; }));
+	EXPECT_EQ(oldest.runs.load(), 0);
+}
+
+/**
+ * @brief Threadpool::enqueue tests, run against each scheduling mode
+ *
+ */
+class BackpressureTest : public ::testing::TestWithParam<SchedulingMode>
+{
+protected:
+	BackpressureTest() :
+		pool(1, GetParam()),
+		enqueue([this](Task task) { return pool.enqueue(std::move(task)); })
+	{
+	}
+
+	Threadpool pool;
+	std::function<bool(Task)> enqueue;
+};
+
+TEST_P(BackpressureTest, BlockThrottlesThenAdmits)
+{
+	checkBlock(pool, enqueue);
+}
+
+TEST_P(BackpressureTest, BlockWithTimeoutRejectsAfterTimeout)
+{
+	checkBlockWithTimeout(pool, enqueue);
+}
+
+TEST_P(BackpressureTest, TryAndReturnFalseRejects)
+{
+	checkTryAndReturnFalse(pool, enqueue);
+}
+
+TEST_P(BackpressureTest, DropOldestCancelsOldestTask)
+{
+	checkDropOldest(pool, enqueue);
+}
+
+TEST_P(BackpressureTest, DropOldestBreaksPromiseOfDroppedTask)
+{
+	pool.setBackpressure(MaxQueueSize, OverflowPolicy::DropOldest);
+
+	Gate gate;
+	pool.start();
+	ASSERT_TRUE(pool.enqueue(gate.task()));
+	ASSERT_TRUE(gate.waitEntered());
+
+	Future<int> oldest = pool.submit([]() { return 1; });
+	Future<int> second = pool.submit([]() { return 2; });
+	Future<int> third = pool.submit([]() { return 3; });
+	gate.open();
+
+	EXPECT_EQ(second.get(), 2);
+	EXPECT_EQ(third.get(), 3);
+	try
+	{
+		oldest.get();
+		ADD_FAILURE() << "Dropped task ran";
+	}
+	catch (std::future_error &error)
+	{
+		EXPECT_EQ(error.code(), std::future_errc::broken_promise);
+	}
+}
+
+/**
+ * @brief Runs task then feeds an output, as each task fed to a buffered pool must
+ *
+ */
+struct Feeding
+{
+	BufferedThreadpool<int> *pool;
+	Task task;
+
+	void operator()()
+	{
+		task();
+		pool->feedOutputQueue(0);
+	}
+
+	void cancel() { task.cancel(); }
+};
+
+/**
+ * @brief Returns feed function of buffered pool
+ *
+ */
+static std::function<bool(Task)> feedQueue(BufferedThreadpool<int> &pool)
+{
+	return [&pool](Task task) { return pool.feedQueue(Task(Feeding{ &pool, std::move(task) })); };
+}
+
+TEST(BufferedBackpressure, BlockThrottlesThenAdmits)
+{
+	BufferedThreadpool<int> pool(1);
+	checkBlock(pool, feedQueue(pool));
+}
+
+TEST(BufferedBackpressure, BlockWithTimeoutRejectsAfterTimeout)
+{
+	BufferedThreadpool<int> pool(1);
+	checkBlockWithTimeout(pool, feedQueue(pool));
+}
+
+TEST(BufferedBackpressure, TryAndReturnFalseRejects)
+{
+	BufferedThreadpool<int> pool(1);
+	checkTryAndReturnFalse(pool, feedQueue(pool));
+}
+
+TEST(BufferedBackpressure, DropOldestCancelsOldestTask)
+{
+	BufferedThreadpool<int> pool(1);
+	checkDropOldest(pool, feedQueue(pool));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	BackpressureTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
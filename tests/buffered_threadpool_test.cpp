@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file buffered_threadpool_test.cpp
+ * @author Evan Stoddard
+ * @brief Buffered threadpool tests
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "bufferedthreadpool.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::BufferedThreadpool;
+using ThreadUtils::Optional;
+using ThreadUtils::Task;
+using ThreadUtilsTest::eventually;
+
+/// @brief Items per test
+static const int NumItems = 1000;
+
+/**
+ * @brief Buffered threadpool tests, run against the deque (0) and the ring output buffer
+ *
+ */
+class BufferedThreadpoolTest : public ::testing::TestWithParam<size_t>
+{
+};
+
+TEST_P(BufferedThreadpoolTest, MoveOnlyOutputIsFetched)
+{
+	BufferedThreadpool<std::unique_ptr<int>> pool(3, GetParam());
+	pool.start();
+
+	for (int i = 0; i < NumItems; i++)
+	{
+		pool.feedQueue(Task([&pool, i]() { pool.feedOutputQueue(std::unique_ptr<int>(new int(i))); }));
+	}
+
+	// Single, bulk and non-blocking fetches all move out of the buffer
+	std::vector<bool> seen(NumItems, false);
+	int fetched = 0;
+	auto see = [&](const std::unique_ptr<int> &value) {
+		ASSERT_TRUE(value);
+		EXPECT_FALSE(seen[(size_t)*value]);
+		seen[(size_t)*value] = true;
+		fetched++;
+	};
+
+	while (fetched < NumItems)
+	{
+		Optional<std::unique_ptr<int>> value = pool.fetch();
+		ASSERT_TRUE(value);
+		see(*value);
+
+		std::vector<std::unique_ptr<int>> batch;
+		pool.fetchFromBuffer(std::min(8, NumItems - fetched), std::back_inserter(batch));
+		for (const auto &item : batch)
+		{
+			see(item);
+		}
+
+		std::unique_ptr<int> single;
+		if (fetched < NumItems && pool.tryFetch(single))
+		{
+			see(single);
+		}
+	}
+
+	EXPECT_FALSE(pool.tryFetch());
+}
+
+TEST_P(BufferedThreadpoolTest, OutputWakesWorkerParkedAtActiveCap)
+{
+	BufferedThreadpool<int> pool(2, GetParam());
+	pool.start();
+
+	// Inputs return without output, so each stays active until fed from here
+	std::atomic<int> started(0);
+	for (int i = 0; i < 3; i++)
+	{
+		pool.feedQueue(Task([&started]() { started++; }));
+	}
+
+	// Two threads, so the third input waits with both workers parked
+	EXPECT_TRUE(eventually([&]() { return started.load() == 2; }));
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(started.load(), 2);
+	EXPECT_EQ(pool.snapshot().activeProcesses, 2u);
+
+	pool.feedOutputQueue(0);
+	EXPECT_TRUE(eventually([&]() { return started.load() == 3; }));
+
+	pool.feedOutputQueue(1);
+	pool.feedOutputQueue(2);
+	for (int i = 0; i < 3; i++)
+	{
+		Optional<int> value = pool.fetch();
+		ASSERT_TRUE(value);
+		EXPECT_EQ(*value, i);
+	}
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	OutputBuffers,
+	BufferedThreadpoolTest,
+	::testing::Values((size_t)0, (size_t)64),
+	[](const ::testing::TestParamInfo<size_t> &info) { return info.param == 0 ? std::string("Deque") : std::string("Ring"); }
+);
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file bulk_test.cpp
+ * @author Evan Stoddard
+ * @brief Bulk enqueue, feed and fetch tests
+ */
+
+#include <atomic>
+#include <iterator>
+#include <vector>
+#include <gtest/gtest.h>
+#include "orderedbufferedthreadpool.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::BufferedThreadpool;
+using ThreadUtils::Optional;
+using ThreadUtils::OrderedBufferedThreadpool;
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Task;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/// @brief Tasks per batch
+static const int BatchSize = 1000;
+
+/// @brief Queue limit of rejection tests
+static const size_t MaxQueueSize = 4;
+
+/**
+ * @brief Counts runs of its tasks, and cancels of those the pool rejected
+ *
+ */
+struct Counted
+{
+	std::atomic<int> *runs;
+	std::atomic<int> *cancels;
+
+	void operator()() { (*runs)++; }
+
+	void cancel() { (*cancels)++; }
+};
+
+/**
+ * @brief Checks tasks from first on were neither moved from nor cancelled
+ *
+ */
+static void expectUntouched(const std::vector<Task> &tasks, size_t first, const std::atomic<int> &cancels)
+{
+	for (size_t i = first; i < tasks.size(); i++)
+	{
+		EXPECT_TRUE(tasks[i]) << "task " << i << " moved from";
+	}
+	EXPECT_EQ(cancels.load(), 0);
+}
+
+/**
+ * @brief Bulk enqueue tests, run against each scheduling mode
+ *
+ */
+class BulkTest : public ::testing::TestWithParam<SchedulingMode>
+{
+};
+
+TEST_P(BulkTest, EnqueueBulkRunsWholeBatch)
+{
+	Threadpool pool(3, GetParam());
+	pool.start();
+
+	std::atomic<int> runs(0);
+	std::atomic<int> cancels(0);
+	std::vector<Task> tasks;
+	for (int i = 0; i < BatchSize; i++)
+	{
+		tasks.emplace_back(Counted{ &runs, &cancels });
+	}
+
+	EXPECT_EQ(pool.enqueueBulk(tasks.begin(), tasks.end()), (size_t)BatchSize);
+	EXPECT_TRUE(eventually([&]() { return runs.load() == BatchSize; }));
+	EXPECT_EQ(cancels.load(), 0);
+	EXPECT_EQ(pool.snapshot().tasksEnqueued, (uint64_t)BatchSize);
+}
+
+TEST_P(BulkTest, EnqueueBulkStopsAtFirstRejectedTask)
+{
+	// Never started, so tasks stay queued
+	Threadpool pool(2, GetParam());
+	pool.setBackpressure(MaxQueueSize, OverflowPolicy::TryAndReturnFalse);
+
+	std::atomic<int> runs(0);
+	std::atomic<int> cancels(0);
+	std::vector<Task> tasks;
+	for (int i = 0; i < 10; i++)
+	{
+		tasks.emplace_back(Counted{ &runs, &cancels });
+	}
+
+	EXPECT_EQ(pool.enqueueBulk(tasks.begin(), tasks.end()), MaxQueueSize);
+	expectUntouched(tasks, MaxQueueSize, cancels);
+	EXPECT_EQ(pool.snapshot().tasksRejected, 1u);
+
+	while (pool.runPendingTask())
+	{
+	}
+	EXPECT_EQ(runs.load(), (int)MaxQueueSize);
+}
+
+TEST(BufferedBulk, FeedQueueBulkAndFetchWholeBatch)
+{
+	BufferedThreadpool<int> pool(3);
+	pool.start();
+
+	std::vector<Task> tasks;
+	for (int i = 0; i < BatchSize; i++)
+	{
+		tasks.emplace_back([&pool, i]() { pool.feedOutputQueue(i); });
+	}
+	EXPECT_EQ(pool.feedQueueBulk(tasks.begin(), tasks.end()), (size_t)BatchSize);
+
+	// Each bulk fetch returns at least one output and at most n
+	std::vector<int> out;
+	while (out.size() < (size_t)BatchSize)
+	{
+		size_t before = out.size();
+		size_t fetched = pool.fetchFromBuffer(64, std::back_inserter(out));
+		EXPECT_GE(fetched, 1u);
+		EXPECT_LE(fetched, 64u);
+		EXPECT_EQ(out.size(), before + fetched);
+	}
+
+	std::vector<bool> seen(BatchSize, false);
+	for (int value : out)
+	{
+		EXPECT_FALSE(seen[(size_t)value]);
+		seen[(size_t)value] = true;
+	}
+	EXPECT_EQ(out.size(), (size_t)BatchSize);
+}
+
+TEST(BufferedBulk, FetchFromBufferTakesUpToN)
+{
+	BufferedThreadpool<int> pool(1);
+	pool.start();
+
+	for (int i = 0; i < 10; i++)
+	{
+		pool.feedQueue(Task([&pool, i]() { pool.feedOutputQueue(i); }));
+	}
+	EXPECT_TRUE(eventually([&]() { return pool.snapshot().outputBufferDepth == 10; }));
+
+	std::vector<int> out;
+	EXPECT_EQ(pool.fetchFromBuffer(4, std::back_inserter(out)), 4u);
+	EXPECT_EQ(pool.fetchFromBuffer(100, std::back_inserter(out)), 6u);
+	EXPECT_EQ(pool.fetchFromBuffer(0, std::back_inserter(out)), 0u);
+	EXPECT_EQ(out, std::vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }));
+
+	// Stopped and empty
+	pool.stop();
+	EXPECT_EQ(pool.fetchFromBuffer(4, std::back_inserter(out)), 0u);
+}
+
+TEST(BufferedBulk, FeedQueueBulkStopsAtFirstRejectedTask)
+{
+	// Never started, so tasks stay queued
+	BufferedThreadpool<int> pool(2);
+	pool.setBackpressure(MaxQueueSize, OverflowPolicy::TryAndReturnFalse);
+
+	std::atomic<int> runs(0);
+	std::atomic<int> cancels(0);
+	std::vector<Task> tasks;
+	for (int i = 0; i < 10; i++)
+	{
+		tasks.emplace_back(Counted{ &runs, &cancels });
+	}
+
+	EXPECT_EQ(pool.feedQueueBulk(tasks.begin(), tasks.end()), MaxQueueSize);
+	expectUntouched(tasks, MaxQueueSize, cancels);
+	EXPECT_EQ(pool.snapshot().inputQueueDepth, MaxQueueSize);
+	EXPECT_EQ(pool.snapshot().tasksRejected, 1u);
+}
+
+TEST(OrderedBulk, FeedQueueBulkKeepsTagOrder)
+{
+	OrderedBufferedThreadpool<int, int> pool(3);
+	pool.start();
+
+	std::vector<Task> tasks;
+	std::vector<int> tags;
+	for (int i = 0; i < BatchSize; i++)
+	{
+		tasks.emplace_back([&pool, i]() { pool.feedOutputQueue(i, i); });
+		tags.push_back(i);
+	}
+	EXPECT_EQ(pool.feedQueueBulk(tasks.begin(), tasks.end(), tags.begin()), (size_t)BatchSize);
+
+	for (int i = 0; i < BatchSize; i++)
+	{
+		Optional<int> value = pool.fetch();
+		ASSERT_TRUE(value);
+		EXPECT_EQ(*value, i);
+	}
+}
+
+TEST(OrderedBulk, FeedQueueBulkStopsAtFirstRejectedTask)
+{
+	// Never started until the untouched tasks have been checked
+	OrderedBufferedThreadpool<int, int> pool(2);
+	pool.setBackpressure(MaxQueueSize, OverflowPolicy::TryAndReturnFalse);
+
+	std::atomic<int> cancels(0);
+	std::vector<Task> tasks;
+	std::vector<int> tags;
+	for (int i = 0; i < 10; i++)
+	{
+		tasks.emplace_back([&pool, i]() { pool.feedOutputQueue(i, i); });
+		tags.push_back(i);
+	}
+
+	EXPECT_EQ(pool.feedQueueBulk(tasks.begin(), tasks.end(), tags.begin()), MaxQueueSize);
+	expectUntouched(tasks, MaxQueueSize, cancels);
+	EXPECT_EQ(pool.snapshot().tasksRejected, 1u);
+
+	// Only the tags fed are waited on
+	pool.start();
+	for (int i = 0; i < (int)MaxQueueSize; i++)
+	{
+		Optional<int> value = pool.fetch();
+		ASSERT_TRUE(value);
+		EXPECT_EQ(*value, i);
+	}
+	EXPECT_TRUE(eventually([&]() { return pool.snapshot().activeProcesses == 0; }));
+	EXPECT_FALSE(pool.tryFetch());
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	BulkTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file completion_latch_test.cpp
+ * @author Evan Stoddard
+ * @brief Completion latch tests
+ */
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "completionlatch.hpp"
+
+using ThreadUtils::CompletionLatch;
+
+TEST(CompletionLatch, WaitReturnsStraightAwayWithNothingOutstanding)
+{
+	CompletionLatch latch;
+	EXPECT_TRUE(latch.done());
+
+	int helped = 0;
+	latch.wait([&]() { helped++; return false; });
+	EXPECT_EQ(helped, 0);
+}
+
+TEST(CompletionLatch, ParkedWaiterIsWokenByLastCountDown)
+{
+	CompletionLatch latch;
+	latch.add(3);
+
+	std::atomic<bool> release(false);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 3; i++)
+	{
+		threads.emplace_back([&]() {
+			while (!release.load())
+			{
+				std::this_thread::yield();
+			}
+			latch.countDown();
+		});
+	}
+
+	// Nothing to help with, so the waiter parks until the last countDown
+	std::thread releaser([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		release = true;
+	});
+	latch.wait([]() { return false; });
+	EXPECT_TRUE(latch.done());
+
+	releaser.join();
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+}
+
+TEST(CompletionLatch, WakeLetsParkedWaiterHelpWithNewWork)
+{
+	CompletionLatch latch;
+	latch.add(1);
+
+	// Work handed over after the waiter has parked, only the waiter runs it
+	std::mutex mutex;
+	bool queued = false;
+	auto help = [&]() {
+		std::unique_lock<std::mutex> l(mutex);
+		if (!queued)
+		{
+			return false;
+		}
+
+		queued = false;
+		l.unlock();
+
+		latch.countDown();
+		return true;
+	};
+
+	std::thread producer([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+		std::unique_lock<std::mutex> l(mutex);
+		queued = true;
+		l.unlock();
+
+		latch.wake();
+	});
+
+	latch.wait(help);
+	EXPECT_TRUE(latch.done());
+
+	producer.join();
+}
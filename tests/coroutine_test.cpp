@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file coroutine_test.cpp
+ * @author Evan Stoddard
+ * @brief Coroutine tests, built as C++20
+ */
+
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "bufferedthreadpool.hpp"
+#include "testutils.hpp"
+
+#ifdef THREADUTILS_HAS_COROUTINES
+
+using ThreadUtils::BufferedThreadpool;
+using ThreadUtils::Future;
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Task;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Counts coroutine frames destroyed
+ *
+ */
+struct FrameGuard
+{
+	explicit FrameGuard(std::atomic<int> &destroyed) :
+		destroyed(destroyed)
+	{
+	}
+
+	~FrameGuard() { destroyed++; }
+
+	std::atomic<int> &destroyed;
+};
+
+/**
+ * @brief Moves onto pool, returning thread it carried on on
+ *
+ */
+static Future<std::thread::id> hop(Threadpool &pool, std::atomic<int> &destroyed)
+{
+	FrameGuard guard(destroyed);
+	co_await pool.schedule();
+	co_return std::this_thread::get_id();
+}
+
+/**
+ * @brief Awaits a task submitted to pool
+ *
+ */
+static Future<int> awaitSubmitted(Threadpool &pool, std::atomic<int> &destroyed)
+{
+	FrameGuard guard(destroyed);
+	int value = co_await pool.submit([]() { return 21; });
+	co_return value * 2;
+}
+
+/**
+ * @brief Returns whether future holds a broken_promise error
+ *
+ */
+template <typename R>
+static bool brokenPromise(Future<R> &future)
+{
+	try
+	{
+		future.get();
+	}
+	catch (std::future_error &error)
+	{
+		return error.code() == std::future_errc::broken_promise;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Coroutine tests, run against each scheduling mode
+ *
+ */
+class CoroutineTest : public ::testing::TestWithParam<SchedulingMode>
+{
+protected:
+	CoroutineTest() :
+		destroyed(0)
+	{
+	}
+
+	std::atomic<int> destroyed;
+};
+
+// Futures are completed just before the frame finishes, so frames are only
+// counted once the pool's workers have been joined
+
+TEST_P(CoroutineTest, ScheduleResumesOnWorker)
+{
+	{
+		Threadpool pool(2, GetParam());
+		pool.start();
+
+		Future<std::thread::id> future = hop(pool, destroyed);
+		EXPECT_NE(future.get(), std::this_thread::get_id());
+	}
+	EXPECT_EQ(destroyed.load(), 1);
+}
+
+TEST_P(CoroutineTest, AwaitsSubmittedTask)
+{
+	{
+		Threadpool pool(2, GetParam());
+		pool.start();
+
+		Future<int> future = awaitSubmitted(pool, destroyed);
+		EXPECT_EQ(future.get(), 42);
+	}
+	EXPECT_EQ(destroyed.load(), 1);
+}
+
+TEST_P(CoroutineTest, ManyCoroutinesResumeOnce)
+{
+	{
+		Threadpool pool(4, GetParam());
+		pool.start();
+
+		std::vector<Future<std::thread::id>> futures;
+		for (int i = 0; i < 1000; i++)
+		{
+			futures.push_back(hop(pool, destroyed));
+		}
+		for (auto &future : futures)
+		{
+			EXPECT_NE(future.get(), std::this_thread::get_id());
+		}
+	}
+	EXPECT_EQ(destroyed.load(), 1000);
+}
+
+TEST_P(CoroutineTest, ExceptionIsRethrownFromFuture)
+{
+	Threadpool pool(2, GetParam());
+	pool.start();
+
+	auto failing = [](Threadpool &pool) -> Future<int> {
+		co_await pool.schedule();
+		throw std::runtime_error("coroutine failed");
+	};
+
+	Future<int> future = failing(pool);
+	EXPECT_THROW(future.get(), std::runtime_error);
+}
+
+TEST_P(CoroutineTest, PoolTeardownDestroysSuspendedFrames)
+{
+	Future<std::thread::id> scheduled;
+	Future<int> awaiting;
+	{
+		// Never started, so both stay suspended until the pool goes away
+		Threadpool pool(2, GetParam());
+		scheduled = hop(pool, destroyed);
+		awaiting = awaitSubmitted(pool, destroyed);
+	}
+
+	EXPECT_TRUE(brokenPromise(scheduled));
+	EXPECT_TRUE(brokenPromise(awaiting));
+	EXPECT_EQ(destroyed.load(), 2);
+}
+
+TEST_P(CoroutineTest, RejectedScheduleCarriesOnOnCaller)
+{
+	Threadpool pool(1, GetParam());
+	pool.setBackpressure(0, OverflowPolicy::TryAndReturnFalse);
+	pool.start();
+
+	Future<std::thread::id> future = hop(pool, destroyed);
+	EXPECT_EQ(future.get(), std::this_thread::get_id());
+}
+
+TEST_P(CoroutineTest, ScheduleOnPoolShuttingDownThrows)
+{
+	Threadpool pool(1, GetParam());
+	pool.start();
+	pool.stopNow();
+
+	Future<std::thread::id> future = hop(pool, destroyed);
+	EXPECT_TRUE(brokenPromise(future));
+	EXPECT_EQ(destroyed.load(), 1);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	CoroutineTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
+
+TEST(BufferedThreadpoolCoroutine, FetchAsyncReceivesEveryOutput)
+{
+	BufferedThreadpool<int> pool(2);
+	pool.start();
+
+	auto consume = [](BufferedThreadpool<int> &pool, int count) -> Future<long> {
+		long total = 0;
+		for (int i = 0; i < count; i++)
+		{
+			auto output = co_await pool.fetchAsync();
+			if (!output)
+			{
+				break;
+			}
+			total += *output;
+		}
+		co_return total;
+	};
+
+	const int items = 1000;
+	Future<long> total = consume(pool, items);
+	for (int i = 0; i < items; i++)
+	{
+		pool.feedQueue(Task([&pool, i]() { pool.feedOutputQueue(i); }));
+	}
+
+	EXPECT_EQ(total.get(), (long)items * (items - 1) / 2);
+}
+
+#else
+
+TEST(Coroutine, Unsupported)
+{
+	GTEST_SKIP() << "Compiler has no coroutine support";
+}
+
+#endif /* THREADUTILS_HAS_COROUTINES */
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file metrics_test.cpp
+ * @author Evan Stoddard
+ * @brief Pool metrics and snapshot export tests
+ */
+
+#include <atomic>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "bufferedthreadpool.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::BufferedThreadpool;
+using ThreadUtils::LatencyHistogram;
+using ThreadUtils::MetricsSnapshot;
+using ThreadUtils::Optional;
+using ThreadUtils::PriorityLanes;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Task;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Returns sum of histogram's buckets
+ *
+ */
+static uint64_t bucketTotal(const LatencyHistogram &histogram)
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < LatencyHistogram::NumBuckets; i++)
+	{
+		total += histogram.buckets[i];
+	}
+	return total;
+}
+
+/**
+ * @brief Checks text is well formed Prometheus text exposition
+ *
+ * Every sample follows the TYPE line of its family, families are declared
+ * once, and histogram buckets are cumulative up to the +Inf bucket, which
+ * matches the count.
+ *
+ * @param text Exported text
+ * @param values Filled with value of each sample, by name and labels
+ */
+static void checkPrometheusText(const std::string &text, std::map<std::string, std::string> &values)
+{
+	static const std::regex typeLine("# TYPE ([a-zA-Z_:][a-zA-Z0-9_:]*) (counter|gauge|histogram)");
+	static const std::regex sampleLine(
+		"([a-zA-Z_:][a-zA-Z0-9_:]*)(\\{[a-zA-Z_][a-zA-Z0-9_]*=\"[^\"]*\"(,[a-zA-Z_][a-zA-Z0-9_]*=\"[^\"]*\")*\\})? ([0-9]+|\\+Inf)"
+	);
+
+	ASSERT_FALSE(text.empty());
+	ASSERT_EQ(text.back(), '\n');
+
+	std::map<std::string, std::string> families;
+	std::string family;
+	std::string type;
+	uint64_t lastBucket = 0;
+
+	std::istringstream lines(text);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		SCOPED_TRACE(line);
+		std::smatch match;
+
+		if (std::regex_match(line, match, typeLine))
+		{
+			family = match[1];
+			type = match[2];
+			EXPECT_EQ(families.count(family), 0u) << "family declared twice";
+			families[family] = type;
+			lastBucket = 0;
+			continue;
+		}
+
+		ASSERT_TRUE(std::regex_match(line, match, sampleLine)) << "malformed line";
+		std::string name = match[1];
+		std::string labels = match[2];
+		std::string value = match[4];
+		values[name + labels] = value;
+
+		if (type != "histogram")
+		{
+			EXPECT_EQ(name, family);
+			continue;
+		}
+
+		if (name == family + "_bucket")
+		{
+			ASSERT_NE(labels.find("le=\""), std::string::npos);
+			uint64_t count = std::stoull(value);
+			EXPECT_GE(count, lastBucket) << "buckets not cumulative";
+			lastBucket = count;
+		}
+		else if (name == family + "_count")
+		{
+			EXPECT_EQ(values[family + "_bucket{le=\"+Inf\"}"], value);
+		}
+		else
+		{
+			EXPECT_EQ(name, family + "_sum");
+		}
+	}
+}
+
+/**
+ * @brief Metrics tests, run against each scheduling mode
+ *
+ */
+class MetricsTest : public ::testing::TestWithParam<SchedulingMode>
+{
+};
+
+TEST_P(MetricsTest, SnapshotCountsKnownWorkload)
+{
+	const uint64_t tasks = 500;
+	Threadpool pool(2, GetParam());
+	pool.start();
+
+	std::atomic<int> runs(0);
+	for (uint64_t i = 0; i < tasks; i++)
+	{
+		pool.enqueue(Task([&runs]() { runs++; }));
+	}
+	EXPECT_TRUE(eventually([&]() { return pool.snapshot().tasksCompleted == tasks; }));
+
+	MetricsSnapshot snapshot = pool.snapshot();
+	EXPECT_EQ(snapshot.workers, 2u);
+	EXPECT_EQ(snapshot.tasksEnqueued, tasks);
+	EXPECT_EQ(snapshot.tasksCompleted, tasks);
+	EXPECT_EQ(snapshot.tasksRejected, 0u);
+	EXPECT_EQ(snapshot.tasksDropped, 0u);
+	EXPECT_EQ(snapshot.queueDepth, 0u);
+
+	// Every completed task lands in one bucket of each histogram
+	EXPECT_EQ(snapshot.queueWait.count, tasks);
+	EXPECT_EQ(snapshot.runTime.count, tasks);
+	EXPECT_EQ(bucketTotal(snapshot.queueWait), tasks);
+	EXPECT_EQ(bucketTotal(snapshot.runTime), tasks);
+}
+
+TEST_P(MetricsTest, SnapshotCountsQueuedTasksPerLane)
+{
+	// Never started, so tasks stay queued
+	Threadpool pool(2, GetParam());
+	pool.setPriorityLanes(PriorityLanes::strict(2));
+	for (int i = 0; i < 3; i++)
+	{
+		pool.enqueue(Task([]() {}), 0);
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		pool.enqueue(Task([]() {}));
+	}
+
+	MetricsSnapshot snapshot = pool.snapshot();
+	EXPECT_EQ(snapshot.tasksEnqueued, 5u);
+	EXPECT_EQ(snapshot.tasksCompleted, 0u);
+	EXPECT_EQ(snapshot.queueDepth, 5u);
+	EXPECT_EQ(snapshot.laneDepths, std::vector<uint64_t>({ 3, 2 }));
+}
+
+TEST_P(MetricsTest, ToTextIsWellFormedPrometheusText)
+{
+	const uint64_t tasks = 200;
+	Threadpool pool(2, GetParam());
+	pool.setPriorityLanes(PriorityLanes::strict(3));
+	pool.start();
+
+	for (uint64_t i = 0; i < tasks; i++)
+	{
+		pool.enqueue(Task([]() {}), i % 3);
+	}
+	EXPECT_TRUE(eventually([&]() { return pool.snapshot().tasksCompleted == tasks; }));
+
+	std::map<std::string, std::string> values;
+	checkPrometheusText(pool.snapshot().toText("pool"), values);
+
+	EXPECT_EQ(values["pool_workers"], "2");
+	EXPECT_EQ(values["pool_tasks_enqueued_total"], "200");
+	EXPECT_EQ(values["pool_tasks_completed_total"], "200");
+	EXPECT_EQ(values["pool_queue_wait_ns_count"], "200");
+	EXPECT_EQ(values["pool_run_time_ns_count"], "200");
+	EXPECT_EQ(values["pool_lane_queue_depth{lane=\"2\"}"], "0");
+}
+
+TEST(Metrics, ToTextCountsPowerOfTwoDurationsInTheirOwnBucket)
+{
+	// 1024ns opens the bucket [1024, 2048), Prometheus bounds are inclusive
+	MetricsSnapshot snapshot;
+	snapshot.runTime.buckets[LatencyHistogram::bucketFor(0)]++;
+	snapshot.runTime.buckets[LatencyHistogram::bucketFor(1024)]++;
+	snapshot.runTime.count = 2;
+	snapshot.runTime.sumNanos = 1024;
+
+	std::map<std::string, std::string> values;
+	checkPrometheusText(snapshot.toText("pool"), values);
+
+	EXPECT_EQ(values["pool_run_time_ns_bucket{le=\"0\"}"], "1");
+	EXPECT_EQ(values["pool_run_time_ns_bucket{le=\"1023\"}"], "1");
+	EXPECT_EQ(values["pool_run_time_ns_bucket{le=\"2047\"}"], "2");
+	EXPECT_EQ(values.count("pool_run_time_ns_bucket{le=\"1024\"}"), 0u);
+}
+
+TEST(BufferedMetrics, SnapshotReportsInputAndOutputDepths)
+{
+	const size_t capacities[] = { 0, 16 };
+	for (size_t capacity : capacities)
+	{
+		SCOPED_TRACE(capacity == 0 ? "deque" : "ring");
+		BufferedThreadpool<int> pool(1, capacity);
+
+		// Not started, fed tasks wait in the input queue
+		for (int i = 0; i < 5; i++)
+		{
+			pool.feedQueue(Task([&pool, i]() { pool.feedOutputQueue(i); }));
+		}
+		MetricsSnapshot snapshot = pool.snapshot();
+		EXPECT_EQ(snapshot.inputQueueDepth, 5u);
+		EXPECT_EQ(snapshot.outputBufferDepth, 0u);
+
+		// Run, every result buffered until fetched
+		pool.start();
+		EXPECT_TRUE(eventually([&]() {
+			MetricsSnapshot current = pool.snapshot();
+			return current.outputBufferDepth == 5 && current.tasksCompleted == 5;
+		}));
+		snapshot = pool.snapshot();
+		EXPECT_EQ(snapshot.inputQueueDepth, 0u);
+		EXPECT_EQ(snapshot.activeProcesses, 0u);
+		EXPECT_EQ(snapshot.tasksCompleted, 5u);
+
+		Optional<int> first = pool.fetch();
+		Optional<int> second = pool.fetch();
+		EXPECT_TRUE(first && second);
+		EXPECT_EQ(pool.snapshot().outputBufferDepth, 3u);
+
+		std::map<std::string, std::string> values;
+		checkPrometheusText(pool.snapshot().toText(), values);
+		EXPECT_EQ(values["threadutils_output_buffer_depth"], "3");
+		EXPECT_EQ(values["threadutils_input_queue_depth"], "0");
+	}
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	MetricsTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
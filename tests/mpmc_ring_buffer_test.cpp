@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file mpmc_ring_buffer_test.cpp
+ * @author Evan Stoddard
+ * @brief MPMC ring buffer and buffered pool output ring tests
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "bufferedthreadpool.hpp"
+#include "mpmcringbuffer.hpp"
+
+using ThreadUtils::BufferedThreadpool;
+using ThreadUtils::MpmcRingBuffer;
+using ThreadUtils::Optional;
+using ThreadUtils::Task;
+
+TEST(MpmcRingBuffer, KeepsFifoOrderAcrossWraparound)
+{
+	MpmcRingBuffer<int> ring(3);
+	ASSERT_EQ(ring.capacity(), 4u);
+
+	int next = 0;
+	int expected = 0;
+	for (int lap = 0; lap < 10; lap++)
+	{
+		while (ring.tryPush(next))
+		{
+			next++;
+		}
+		EXPECT_EQ(ring.size(), ring.capacity());
+
+		// Leave one behind so the next lap starts mid array
+		for (int i = 0; i < 3; i++)
+		{
+			int value = -1;
+			ASSERT_TRUE(ring.tryPop(value));
+			EXPECT_EQ(value, expected++);
+		}
+	}
+
+	while (Optional<int> value = ring.tryPop())
+	{
+		EXPECT_EQ(*value, expected++);
+	}
+	EXPECT_EQ(expected, next);
+}
+
+TEST(MpmcRingBuffer, DestroysItemsLeftInBuffer)
+{
+	auto item = std::make_shared<int>(1);
+	{
+		MpmcRingBuffer<std::shared_ptr<int>> ring(2);
+		ASSERT_TRUE(ring.tryPush(item));
+		ASSERT_TRUE(ring.tryPush(item));
+
+		std::shared_ptr<int> popped;
+		ASSERT_TRUE(ring.tryPop(popped));
+		ASSERT_TRUE(ring.tryPush(item));
+		EXPECT_EQ(item.use_count(), 4);
+	}
+	EXPECT_EQ(item.use_count(), 1);
+}
+
+TEST(MpmcRingBuffer, ManyProducersAndConsumersTakeEachItemOnce)
+{
+	const int producers = 4;
+	const int consumers = 4;
+	const int perProducer = 50000;
+	const int items = producers * perProducer;
+
+	// Small ring wraps thousands of times
+	MpmcRingBuffer<int> ring(4);
+	std::vector<std::atomic<int>> taken(items);
+	std::atomic<int> consumed(0);
+
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; p++)
+	{
+		threads.emplace_back([&, p]() {
+			for (int i = p * perProducer; i < (p + 1) * perProducer; i++)
+			{
+				while (!ring.tryPush(i))
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	for (int c = 0; c < consumers; c++)
+	{
+		threads.emplace_back([&]() {
+			int value;
+			while (consumed.load() < items)
+			{
+				if (ring.tryPop(value))
+				{
+					taken[(size_t)value].fetch_add(1, std::memory_order_relaxed);
+					consumed++;
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+
+	int wrong = 0;
+	for (auto &count : taken)
+	{
+		if (count.load() != 1)
+		{
+			wrong++;
+		}
+	}
+	EXPECT_EQ(wrong, 0);
+	EXPECT_TRUE(ring.empty());
+}
+
+TEST(BufferedThreadpool, FullOutputRingDoesNotHangShutdown)
+{
+	const int items = 100;
+	std::atomic<int> produced(0);
+	{
+		BufferedThreadpool<int> pool(2, 4);
+		pool.start();
+		for (int i = 0; i < items; i++)
+		{
+			pool.feedQueue(Task([&pool, &produced, i]() {
+				pool.feedOutputQueue(i);
+				produced++;
+			}));
+		}
+
+		// Nothing fetches, workers fill the ring then wait for room
+		while (produced.load() < 4)
+		{
+			std::this_thread::yield();
+		}
+	}
+	EXPECT_GE(produced.load(), 4);
+}
+
+TEST(BufferedThreadpool, OutputRingDeliversEachResultOnce)
+{
+	const int items = 20000;
+	BufferedThreadpool<int> pool(3, 2);
+	pool.start();
+
+	std::thread producer([&]() {
+		for (int i = 0; i < items; i++)
+		{
+			pool.feedQueue(Task([&pool, i]() { pool.feedOutputQueue(i); }));
+		}
+	});
+
+	std::vector<int> taken(items);
+	for (int i = 0; i < items; i++)
+	{
+		Optional<int> value = pool.fetch();
+		ASSERT_TRUE(value);
+		taken[(size_t)*value]++;
+	}
+	producer.join();
+
+	for (int i = 0; i < items; i++)
+	{
+		EXPECT_EQ(taken[(size_t)i], 1) << "result " << i;
+	}
+}
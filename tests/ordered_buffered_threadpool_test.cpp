@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file ordered_buffered_threadpool_test.cpp
+ * @author Evan Stoddard
+ * @brief Ordered buffered threadpool tests
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "orderedbufferedthreadpool.hpp"
+
+using ThreadUtils::Optional;
+using ThreadUtils::OrderedBufferedThreadpool;
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::ReorderStats;
+using ThreadUtils::Task;
+
+TEST(OrderedBufferedThreadpool, OutputIsFetchedInFeedOrder)
+{
+	OrderedBufferedThreadpool<int, int> pool(4);
+	pool.start();
+
+	const int items = 2000;
+	std::thread producer([&]() {
+		for (int i = 0; i < items; i++)
+		{
+			pool.feedQueue(Task([&pool, i]() {
+				if (i % 7 == 0)
+				{
+					std::this_thread::yield();
+				}
+				pool.feedOutputQueue(i, i);
+			}), i);
+		}
+	});
+
+	for (int i = 0; i < items; i++)
+	{
+		Optional<int> value = pool.fetch();
+		ASSERT_TRUE(value);
+		EXPECT_EQ(*value, i);
+	}
+	producer.join();
+}
+
+TEST(OrderedBufferedThreadpool, TicketedOutputIsFetchedInFeedOrder)
+{
+	typedef OrderedBufferedThreadpool<int, int> Pool;
+	Pool pool(4);
+	pool.start();
+
+	const int items = 2000;
+	std::atomic<int> reusesRejected(0);
+	for (int i = 0; i < items; i++)
+	{
+		pool.feedQueueWithTicket([&pool, &reusesRejected, i](Pool::Ticket ticket) {
+			if (i % 7 == 0)
+			{
+				std::this_thread::yield();
+			}
+
+			if (i % 3 == 0)
+			{
+				pool.invalidateTicket(ticket);
+			}
+			else
+			{
+				pool.feedOutputQueue(i, ticket);
+			}
+
+			// Item is complete, its ticket is spent
+			try
+			{
+				pool.feedOutputQueue(-1, ticket);
+			}
+			catch (std::invalid_argument &)
+			{
+				reusesRejected++;
+			}
+		});
+	}
+
+	for (int i = 0; i < items; i++)
+	{
+		if (i % 3 == 0)
+		{
+			continue;
+		}
+
+		Optional<int> value = pool.fetch();
+		ASSERT_TRUE(value);
+		EXPECT_EQ(*value, i);
+	}
+	pool.drain();
+
+	EXPECT_EQ(reusesRejected.load(), items);
+	EXPECT_EQ(pool.reorderStats().itemsReleased, (uint64_t)items);
+}
+
+/**
+ * @brief Tag with operator== and no std::hash, so tags in flight aren't indexed
+ *
+ */
+struct UnhashedTag
+{
+	int id;
+
+	bool operator==(const UnhashedTag &other) const { return id == other.id; }
+};
+
+/**
+ * @brief Feed items all sharing one tag, each completing its own item by that tag
+ *
+ */
+template <typename Pool, typename Tag>
+static void checkSharedTagCompletesOwnItem(Pool &pool, Tag tag)
+{
+	pool.start();
+
+	const int items = 500;
+	for (int i = 0; i < items; i++)
+	{
+		pool.feedQueue(Task([&pool, tag, i]() {
+			if (i % 5 == 0)
+			{
+				std::this_thread::yield();
+			}
+			pool.feedOutputQueue(i, tag);
+		}), tag);
+	}
+
+	for (int i = 0; i < items; i++)
+	{
+		Optional<int> value = pool.fetch();
+		ASSERT_TRUE(value);
+		EXPECT_EQ(*value, i);
+	}
+}
+
+TEST(OrderedBufferedThreadpool, SharedTagCompletesOwnItem)
+{
+	OrderedBufferedThreadpool<int, int> pool(4);
+	checkSharedTagCompletesOwnItem(pool, 7);
+}
+
+TEST(OrderedBufferedThreadpool, SharedUnhashedTagCompletesOwnItem)
+{
+	OrderedBufferedThreadpool<int, UnhashedTag> pool(4);
+	checkSharedTagCompletesOwnItem(pool, UnhashedTag{ 7 });
+}
+
+TEST(OrderedBufferedThreadpool, UnhashedTagOfAnotherItemFillsEarliestWithIt)
+{
+	OrderedBufferedThreadpool<int, UnhashedTag> pool(1);
+
+	// First two items return without output, the last completes them by tag
+	pool.feedQueue(Task([]() {}), UnhashedTag{ 1 });
+	pool.feedQueue(Task([]() {}), UnhashedTag{ 1 });
+	pool.feedQueue(Task([&pool]() {
+		pool.feedOutputQueue(10, UnhashedTag{ 1 });
+		pool.invalidateTag(UnhashedTag{ 1 });
+		pool.feedOutputQueue(30, UnhashedTag{ 3 });
+		EXPECT_THROW(pool.feedOutputQueue(40, UnhashedTag{ 1 }), std::invalid_argument);
+	}), UnhashedTag{ 3 });
+
+	pool.start();
+	Optional<int> first = pool.fetch();
+	Optional<int> second = pool.fetch();
+	ASSERT_TRUE(first);
+	ASSERT_TRUE(second);
+	EXPECT_EQ(*first, 10);
+	EXPECT_EQ(*second, 30);
+	EXPECT_EQ(pool.reorderStats().itemsReleased, 3u);
+}
+
+/**
+ * @brief Feed items whose even items take a while, so odd ones finish first
+ *
+ */
+static void feedSkewed(OrderedBufferedThreadpool<int, int> &pool, int items)
+{
+	for (int i = 0; i < items; i++)
+	{
+		pool.feedQueue(Task([&pool, i]() {
+			if (i % 2 == 0)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(500));
+			}
+			pool.feedOutputQueue(i, i);
+		}), i);
+	}
+}
+
+TEST(OrderedBufferedThreadpool, DefaultWindowScalesWithThreads)
+{
+	OrderedBufferedThreadpool<int, int> pool(3);
+	EXPECT_EQ(pool.reorderWindow(), 3u * (OrderedBufferedThreadpool<int, int>::DefaultWindowFactor));
+
+	ReorderStats stats = pool.reorderStats();
+	EXPECT_EQ(stats.windowSize, pool.reorderWindow());
+	EXPECT_EQ(stats.itemsReleased, 0u);
+	EXPECT_EQ(stats.itemsHeldBack, 0u);
+}
+
+TEST(OrderedBufferedThreadpool, WindowOfOneKeepsOrderWithoutHoldingBack)
+{
+	OrderedBufferedThreadpool<int, int> pool(4, 1);
+	EXPECT_EQ(pool.reorderWindow(), 1u);
+	pool.start();
+
+	const int items = 200;
+	std::thread producer([&]() { feedSkewed(pool, items); });
+
+	for (int i = 0; i < items; i++)
+	{
+		Optional<int> value = pool.fetch();
+		EXPECT_TRUE(value);
+		EXPECT_EQ(value ? *value : -1, i);
+	}
+	producer.join();
+
+	// One item at a time, nothing ever finishes out of order
+	ReorderStats stats = pool.reorderStats();
+	EXPECT_EQ(stats.windowSize, 1u);
+	EXPECT_EQ(stats.itemsReleased, (uint64_t)items);
+	EXPECT_EQ(stats.itemsHeldBack, 0u);
+	EXPECT_EQ(stats.maxHeldBack, 0u);
+}
+
+TEST(OrderedBufferedThreadpool, WindowSmallerThanThreadsKeepsOrder)
+{
+	OrderedBufferedThreadpool<int, int> pool(4, 2);
+	pool.start();
+
+	const int items = 200;
+	std::thread producer([&]() { feedSkewed(pool, items); });
+
+	for (int i = 0; i < items; i++)
+	{
+		Optional<int> value = pool.fetch();
+		EXPECT_TRUE(value);
+		EXPECT_EQ(value ? *value : -1, i);
+	}
+	producer.join();
+
+	// Odd items finish behind slow even ones, and the window keeps spare workers waiting
+	ReorderStats stats = pool.reorderStats();
+	EXPECT_EQ(stats.windowSize, 2u);
+	EXPECT_EQ(stats.itemsReleased, (uint64_t)items);
+	EXPECT_GT(stats.itemsHeldBack, 0u);
+	EXPECT_LE(stats.itemsHeldBack, (uint64_t)items);
+	EXPECT_EQ(stats.maxHeldBack, 1u);
+	EXPECT_GT(stats.headOfLineBlocks, 0u);
+}
+
+TEST(OrderedBufferedThreadpool, MoveOnlyOutputIsFetchedInFeedOrder)
+{
+	OrderedBufferedThreadpool<std::unique_ptr<int>, int> pool(4);
+	pool.start();
+
+	const int items = 500;
+	for (int i = 0; i < items; i++)
+	{
+		pool.feedQueue(Task([&pool, i]() { pool.feedOutputQueue(std::unique_ptr<int>(new int(i)), i); }), i);
+	}
+
+	for (int i = 0; i < items; i++)
+	{
+		Optional<std::unique_ptr<int>> value = pool.fetch();
+		ASSERT_TRUE(value);
+		ASSERT_TRUE(*value);
+		EXPECT_EQ(**value, i);
+	}
+}
+
+TEST(OrderedBufferedThreadpool, TaskFeedingAnotherItemsTagFillsThatItem)
+{
+	OrderedBufferedThreadpool<int, int> pool(2);
+	pool.start();
+
+	std::atomic<bool> firstRunning(false);
+	std::atomic<bool> secondDone(false);
+	std::atomic<bool> threw(false);
+
+	// First item waits, its output is fed by the second item's task
+	pool.feedQueue(Task([&]() {
+		firstRunning = true;
+		while (!secondDone.load())
+		{
+			std::this_thread::yield();
+		}
+	}), 1);
+	while (!firstRunning.load())
+	{
+		std::this_thread::yield();
+	}
+
+	pool.feedQueue(Task([&]() {
+		try
+		{
+			pool.feedOutputQueue(10, 1);
+			pool.feedOutputQueue(20, 2);
+		}
+		catch (std::invalid_argument &)
+		{
+			threw = true;
+		}
+		secondDone = true;
+	}), 2);
+
+	// Stopping waits for both tasks, then fetch can't block on missing output
+	while (!secondDone.load())
+	{
+		std::this_thread::yield();
+	}
+	pool.stop();
+
+	Optional<int> first = pool.fetch();
+	Optional<int> second = pool.fetch();
+	EXPECT_FALSE(threw.load());
+	ASSERT_TRUE(first);
+	ASSERT_TRUE(second);
+	EXPECT_EQ(*first, 10);
+	EXPECT_EQ(*second, 20);
+}
+
+TEST(OrderedBufferedThreadpool, UnknownTagThrowsWithoutTakingOwnSlot)
+{
+	OrderedBufferedThreadpool<int, int> pool(1);
+	pool.start();
+
+	std::atomic<bool> threw(false);
+	std::atomic<bool> fedOwn(false);
+	std::atomic<bool> done(false);
+	pool.feedQueue(Task([&]() {
+		try
+		{
+			pool.feedOutputQueue(1, 99);
+		}
+		catch (std::invalid_argument &)
+		{
+			threw = true;
+		}
+
+		try
+		{
+			pool.feedOutputQueue(30, 3);
+			fedOwn = true;
+		}
+		catch (std::invalid_argument &)
+		{
+		}
+		done = true;
+	}), 3);
+
+	while (!done.load())
+	{
+		std::this_thread::yield();
+	}
+	pool.stop();
+
+	Optional<int> value = pool.fetch();
+	EXPECT_TRUE(threw.load());
+	EXPECT_TRUE(fedOwn.load());
+	ASSERT_TRUE(value);
+	EXPECT_EQ(*value, 30);
+}
+
+TEST(OrderedBufferedThreadpool, InputLimitRejectsFeedsOnly)
+{
+	OrderedBufferedThreadpool<int, int> pool(1);
+	pool.setMaxInputQueueSize(2);
+
+	// Never started, so fed tasks stay queued
+	std::atomic<int> cancels(0);
+	struct CancelCounted
+	{
+		std::atomic<int> *cancels;
+
+		void operator()() {}
+
+		void cancel() { (*cancels)++; }
+	};
+
+	EXPECT_TRUE(pool.feedQueue(Task([&pool]() { pool.feedOutputQueue(1, 1); }), 1));
+	EXPECT_TRUE(pool.feedQueue(Task([&pool]() { pool.feedOutputQueue(2, 2); }), 2));
+	EXPECT_FALSE(pool.feedQueue(Task(CancelCounted{ &cancels }), 3));
+	EXPECT_EQ(cancels.load(), 1);
+	EXPECT_EQ(pool.snapshot().tasksRejected, 1u);
+
+	// Plain enqueue is bounded by backpressure, not the input limit
+	std::atomic<int> runs(0);
+	for (int i = 0; i < 100; i++)
+	{
+		EXPECT_TRUE(pool.enqueue(Task([&runs]() { runs++; })));
+	}
+
+	pool.start();
+	Optional<int> first = pool.fetch();
+	Optional<int> second = pool.fetch();
+	ASSERT_TRUE(first);
+	ASSERT_TRUE(second);
+	EXPECT_EQ(*first, 1);
+	EXPECT_EQ(*second, 2);
+}
+
+TEST(OrderedBufferedThreadpool, BackpressureAppliesBelowInputLimit)
+{
+	OrderedBufferedThreadpool<int, int> pool(1);
+	pool.setMaxInputQueueSize(10);
+	pool.setBackpressure(1, OverflowPolicy::TryAndReturnFalse);
+
+	EXPECT_TRUE(pool.feedQueue(Task([]() {}), 1));
+	EXPECT_FALSE(pool.feedQueue(Task([]() {}), 2));
+
+	// Raising backpressure leaves the input limit in place
+	pool.setBackpressure(100, OverflowPolicy::TryAndReturnFalse);
+	int fed = 1;
+	while (fed < 20 && pool.feedQueue(Task([]() {}), fed + 1))
+	{
+		fed++;
+	}
+	EXPECT_EQ(fed, 10);
+
+	std::vector<Task> tasks;
+	std::vector<int> tags;
+	for (int i = 0; i < 5; i++)
+	{
+		tasks.emplace_back([]() {});
+		tags.push_back(100 + i);
+	}
+	EXPECT_EQ(pool.feedQueueBulk(tasks.begin(), tasks.end(), tags.begin()), 0u);
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file parallel_test.cpp
+ * @author Evan Stoddard
+ * @brief Parallel algorithm tests
+ */
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+#include "parallel.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/// @brief Elements per test
+static const int NumElements = 10000;
+
+/**
+ * @brief Counts visits of each index
+ *
+ */
+class VisitCounts
+{
+public:
+	VisitCounts() :
+		_counts(new std::atomic<int>[NumElements])
+	{
+		for (int i = 0; i < NumElements; i++)
+		{
+			_counts[i] = 0;
+		}
+	}
+
+	void visit(int index) { _counts[index]++; }
+
+	/**
+	 * @brief Returns number of indices not visited exactly once
+	 *
+	 */
+	int wrong() const
+	{
+		int wrong = 0;
+		for (int i = 0; i < NumElements; i++)
+		{
+			if (_counts[i].load() != 1)
+			{
+				wrong++;
+			}
+		}
+		return wrong;
+	}
+
+private:
+	std::unique_ptr<std::atomic<int>[]> _counts;
+};
+
+/**
+ * @brief Parallel algorithm tests, run against each scheduling mode
+ *
+ */
+class ParallelTest : public ::testing::TestWithParam<SchedulingMode>
+{
+protected:
+	ParallelTest() :
+		pool(3, GetParam())
+	{
+	}
+
+	Threadpool pool;
+};
+
+TEST_P(ParallelTest, ForVisitsEachIndexOnce)
+{
+	pool.start();
+
+	VisitCounts counts;
+	ThreadUtils::parallel_for(pool, 0, NumElements, 16, [&counts](int i) { counts.visit(i); });
+
+	EXPECT_EQ(counts.wrong(), 0);
+}
+
+TEST_P(ParallelTest, StoppedPoolRunsEverythingOnCaller)
+{
+	VisitCounts counts;
+	ThreadUtils::parallel_for(pool, 0, NumElements, 16, [&counts](int i) { counts.visit(i); });
+
+	EXPECT_EQ(counts.wrong(), 0);
+}
+
+TEST_P(ParallelTest, PiecesRejectedByPoolRunOnCaller)
+{
+	pool.setBackpressure(1, OverflowPolicy::TryAndReturnFalse);
+	pool.start();
+
+	VisitCounts counts;
+	ThreadUtils::parallel_for(pool, 0, NumElements, 16, [&counts](int i) { counts.visit(i); });
+
+	EXPECT_EQ(counts.wrong(), 0);
+}
+
+TEST_P(ParallelTest, PiecesDroppedByPoolRunOnCaller)
+{
+	pool.setBackpressure(1, OverflowPolicy::DropOldest);
+	pool.start();
+
+	VisitCounts counts;
+	ThreadUtils::parallel_for(pool, 0, NumElements, 16, [&counts](int i) { counts.visit(i); });
+
+	EXPECT_EQ(counts.wrong(), 0);
+}
+
+TEST_P(ParallelTest, TransformAndReduce)
+{
+	pool.start();
+
+	std::vector<long> in(NumElements);
+	for (int i = 0; i < NumElements; i++)
+	{
+		in[(size_t)i] = i;
+	}
+
+	std::vector<long> out(in.size());
+	ThreadUtils::parallel_transform(pool, in.begin(), in.end(), out.begin(), [](long x) { return x * 2; });
+	long sum = ThreadUtils::parallel_reduce(pool, out.begin(), out.end(), 0L, std::plus<long>());
+
+	EXPECT_EQ(sum, (long)NumElements * (NumElements - 1));
+}
+
+TEST_P(ParallelTest, ReduceWithFineGrainIsCorrect)
+{
+	pool.start();
+
+	std::vector<long> in(NumElements);
+	for (int i = 0; i < NumElements; i++)
+	{
+		in[(size_t)i] = i;
+	}
+
+	// Grains of one or two are raised to the automatic grain
+	const size_t grains[] = { 1, 2 };
+	for (size_t grain : grains)
+	{
+		long sum = ThreadUtils::parallel_reduce(pool, in.begin(), in.end(), 5L, std::plus<long>(), grain);
+		EXPECT_EQ(sum, 5 + (long)NumElements * (NumElements - 1) / 2);
+	}
+}
+
+TEST_P(ParallelTest, ExceptionIsRethrownOnCaller)
+{
+	pool.start();
+
+	EXPECT_THROW(
+		ThreadUtils::parallel_for(pool, 0, NumElements, 16, [](int i) {
+			if (i == NumElements / 2)
+			{
+				throw std::runtime_error("element failed");
+			}
+		}),
+		std::runtime_error
+	);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	ParallelTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
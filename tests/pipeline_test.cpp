@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file pipeline_test.cpp
+ * @author Evan Stoddard
+ * @brief Pipeline tests
+ */
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <gtest/gtest.h>
+#include "pipeline.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::Optional;
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::PipelineBuilder;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::StageMode;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Tracks how many callers are inside at once, and the most there were
+ *
+ */
+class ConcurrencyGauge
+{
+public:
+	ConcurrencyGauge() :
+		_current(0),
+		_most(0)
+	{
+	}
+
+	void enter()
+	{
+		int current = ++_current;
+		int most = _most.load();
+		while (current > most && !_most.compare_exchange_weak(most, current))
+		{
+		}
+	}
+
+	void leave() { _current--; }
+
+	int most() const { return _most.load(); }
+
+private:
+	std::atomic<int> _current;
+	std::atomic<int> _most;
+};
+
+/**
+ * @brief Pipeline tests, run against each scheduling mode
+ *
+ */
+class PipelineTest : public ::testing::TestWithParam<SchedulingMode>
+{
+protected:
+	PipelineTest() :
+		pool(4, GetParam())
+	{
+	}
+
+	Threadpool pool;
+};
+
+TEST_P(PipelineTest, OrderedStageRestoresFeedOrder)
+{
+	pool.start();
+
+	auto pipeline = PipelineBuilder<int>(pool, 8)
+		.stage(StageMode::Parallel, 4, [](int value) { return value * 2; })
+		.stage(StageMode::Ordered, 1, [](int value) { return value + 1; })
+		.build();
+
+	const int items = 2000;
+	std::thread producer([&]() {
+		for (int i = 0; i < items; i++)
+		{
+			pipeline.feed(i);
+		}
+		pipeline.close();
+	});
+
+	int expected = 0;
+	while (Optional<int> value = pipeline.fetch())
+	{
+		EXPECT_EQ(*value, expected * 2 + 1);
+		expected++;
+	}
+	producer.join();
+
+	EXPECT_EQ(expected, items);
+	EXPECT_EQ(pipeline.inFlight(), 0u);
+}
+
+TEST_P(PipelineTest, TokensBoundItemsInFlight)
+{
+	pool.start();
+
+	const size_t tokens = 4;
+	ConcurrencyGauge gauge;
+	auto pipeline = PipelineBuilder<int>(pool, tokens)
+		.stage(StageMode::Parallel, 16, [&gauge](int value) {
+			gauge.enter();
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			gauge.leave();
+			return value;
+		})
+		.build();
+
+	// Nothing fetched, so every token is taken and the next feed is refused
+	for (size_t i = 0; i < tokens; i++)
+	{
+		int item = (int)i;
+		EXPECT_TRUE(pipeline.tryFeed(item));
+	}
+	int extra = -1;
+	EXPECT_FALSE(pipeline.tryFeed(extra));
+	EXPECT_EQ(extra, -1);
+	EXPECT_EQ(pipeline.inFlight(), tokens);
+
+	// Fetching returns a token
+	EXPECT_TRUE(pipeline.fetch());
+	EXPECT_TRUE(pipeline.tryFeed(extra));
+
+	std::thread producer([&]() {
+		for (int i = 0; i < 200; i++)
+		{
+			pipeline.feed(i);
+			EXPECT_LE(pipeline.inFlight(), tokens);
+		}
+		pipeline.close();
+	});
+
+	int fetched = 0;
+	while (pipeline.fetch())
+	{
+		fetched++;
+	}
+	producer.join();
+
+	EXPECT_EQ(fetched, 200 + (int)tokens);
+	EXPECT_LE(gauge.most(), (int)tokens);
+}
+
+TEST_P(PipelineTest, ParallelismBoundsStage)
+{
+	pool.start();
+
+	ConcurrencyGauge parallel;
+	ConcurrencyGauge serial;
+	auto pipeline = PipelineBuilder<int>(pool, 32)
+		.stage(StageMode::Parallel, 2, [&parallel](int value) {
+			parallel.enter();
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			parallel.leave();
+			return value;
+		})
+		.stage(StageMode::Serial, 1, [&serial](int value) {
+			serial.enter();
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			serial.leave();
+			return value;
+		})
+		.build();
+
+	std::thread producer([&]() {
+		for (int i = 0; i < 500; i++)
+		{
+			pipeline.feed(i);
+		}
+		pipeline.close();
+	});
+
+	int fetched = 0;
+	while (pipeline.fetch())
+	{
+		fetched++;
+	}
+	producer.join();
+
+	EXPECT_EQ(fetched, 500);
+	EXPECT_LE(parallel.most(), 2);
+	EXPECT_EQ(serial.most(), 1);
+}
+
+TEST_P(PipelineTest, StageExceptionClosesAndIsRethrownFromFetch)
+{
+	pool.start();
+
+	auto pipeline = PipelineBuilder<int>(pool, 8)
+		.stage(StageMode::Parallel, 4, [](int value) {
+			if (value == 10)
+			{
+				throw std::runtime_error("stage failed");
+			}
+			return value;
+		})
+		.stage(StageMode::Ordered, 1, [](int value) { return value; })
+		.build();
+
+	std::thread producer([&]() {
+		for (int i = 0; i < 1000; i++)
+		{
+			if (!pipeline.feed(i))
+			{
+				break;
+			}
+		}
+		pipeline.close();
+	});
+
+	bool fetchedFailed = false;
+	EXPECT_THROW({
+		while (Optional<int> value = pipeline.fetch())
+		{
+			fetchedFailed |= *value == 10;
+		}
+	}, std::runtime_error);
+	producer.join();
+
+	EXPECT_FALSE(fetchedFailed);
+	EXPECT_FALSE(pipeline.feed(0));
+}
+
+TEST_P(PipelineTest, FetchAfterRethrowFinishesDroppedItems)
+{
+	// Never started, so fetching threads run every stage
+	auto pipeline = PipelineBuilder<int>(pool, 256)
+		.stage(StageMode::Serial, 1, [](int value) {
+			if (value == 0)
+			{
+				throw std::runtime_error("stage failed");
+			}
+			return value;
+		})
+		.build();
+
+	for (int i = 0; i < 150; i++)
+	{
+		ASSERT_TRUE(pipeline.feed(i));
+	}
+	pipeline.close();
+
+	EXPECT_THROW(pipeline.fetch(), std::runtime_error);
+
+	// The rest are dropped, not left waiting on an exception already rethrown
+	EXPECT_FALSE(pipeline.fetch());
+	EXPECT_EQ(pipeline.inFlight(), 0u);
+}
+
+TEST_P(PipelineTest, StagesRejectedByPoolRunOnCaller)
+{
+	pool.setBackpressure(0, OverflowPolicy::TryAndReturnFalse);
+	pool.start();
+
+	auto pipeline = PipelineBuilder<int>(pool, 8)
+		.stage(StageMode::Parallel, 4, [](int value) { return value * 2; })
+		.stage(StageMode::Ordered, 1, [](int value) { return value + 1; })
+		.build();
+
+	std::thread producer([&]() {
+		for (int i = 0; i < 500; i++)
+		{
+			pipeline.feed(i);
+		}
+		pipeline.close();
+	});
+
+	int expected = 0;
+	while (Optional<int> value = pipeline.fetch())
+	{
+		EXPECT_EQ(*value, expected * 2 + 1);
+		expected++;
+	}
+	producer.join();
+
+	EXPECT_EQ(expected, 500);
+}
+
+TEST_P(PipelineTest, DestroyingWaitsForItemsInFlight)
+{
+	pool.start();
+
+	std::atomic<int> processed(0);
+	{
+		auto pipeline = PipelineBuilder<int>(pool, 16)
+			.stage(StageMode::Parallel, 4, [&processed](int value) {
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				processed++;
+				return value;
+			})
+			.build();
+
+		for (int i = 0; i < 16; i++)
+		{
+			pipeline.feed(i);
+		}
+	}
+
+	EXPECT_EQ(processed.load(), 16);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	PipelineTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
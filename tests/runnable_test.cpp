@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file runnable_test.cpp
+ * @author Evan Stoddard
+ * @brief Runnable tests
+ */
+
+#include <memory>
+#include <gtest/gtest.h>
+#include "runnable.hpp"
+
+using ThreadUtils::AbstractRunnable;
+using ThreadUtils::Runnable;
+using ThreadUtils::makeRunnable;
+
+TEST(Runnable, RunMovesParametersIntoFunctor)
+{
+	int seen = 0;
+	Runnable<std::unique_ptr<int>> runnable([&seen](std::unique_ptr<int> value) {
+		seen = *value;
+	}, std::unique_ptr<int>(new int(5)));
+
+	runnable.run();
+
+	EXPECT_EQ(seen, 5);
+}
+
+TEST(Runnable, MakeRunnableMovesParametersIntoFunctor)
+{
+	int seen = 0;
+	std::unique_ptr<AbstractRunnable> runnable(makeRunnable([&seen](std::unique_ptr<int> value) {
+		seen = *value;
+	}, std::unique_ptr<int>(new int(7))));
+
+	runnable->run();
+
+	EXPECT_EQ(seen, 7);
+}
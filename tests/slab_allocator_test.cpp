@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file slab_allocator_test.cpp
+ * @author Evan Stoddard
+ * @brief Slab allocator tests
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "slaballocator.hpp"
+
+using ThreadUtils::SlabAllocator;
+
+/**
+ * @brief Blocks handed from allocating threads to freeing threads
+ *
+ */
+class BlockQueue
+{
+public:
+	struct Block
+	{
+		void *memory;
+		size_t size;
+		uint8_t stamp;
+	};
+
+	void push(const Block &block)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		_blocks.push_back(block);
+		_cv.notify_one();
+	}
+
+	/**
+	 * @brief Pop block, waiting for one
+	 *
+	 * @return false Queue closed and empty
+	 */
+	bool pop(Block &block)
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		_cv.wait(l, [this]() { return !_blocks.empty() || _closed; });
+		if (_blocks.empty())
+		{
+			return false;
+		}
+
+		block = _blocks.front();
+		_blocks.pop_front();
+		return true;
+	}
+
+	void close()
+	{
+		std::unique_lock<std::mutex> l(_mutex);
+		_closed = true;
+		_cv.notify_all();
+	}
+
+private:
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::deque<Block> _blocks;
+	bool _closed = false;
+};
+
+/**
+ * @brief Returns whether every byte of memory is stamp
+ *
+ */
+static bool stamped(const void *memory, size_t size, uint8_t stamp)
+{
+	const uint8_t *bytes = static_cast<const uint8_t*>(memory);
+	return std::all_of(bytes, bytes + size, [stamp](uint8_t byte) { return byte == stamp; });
+}
+
+TEST(SlabAllocator, BlocksFreedOnOtherThreadsAreReusedSafely)
+{
+	const int allocators = 3;
+	const int freers = 3;
+	const int perAllocator = 20000;
+
+	BlockQueue queue;
+	std::atomic<int> corrupted(0);
+
+	std::vector<std::thread> freeing;
+	for (int i = 0; i < freers; i++)
+	{
+		freeing.emplace_back([&]() {
+			BlockQueue::Block block;
+			while (queue.pop(block))
+			{
+				// A block handed out twice would have been overwritten
+				if (!stamped(block.memory, block.size, block.stamp))
+				{
+					corrupted++;
+				}
+				SlabAllocator::deallocate(block.memory, block.size);
+			}
+		});
+	}
+
+	std::vector<std::thread> allocating;
+	for (int i = 0; i < allocators; i++)
+	{
+		allocating.emplace_back([&, i]() {
+			for (int n = 0; n < perAllocator; n++)
+			{
+				// Mix of size classes, plus blocks too big to recycle
+				size_t size = 16 + (size_t)((n * 37 + i * 101) % 1100);
+				uint8_t stamp = (uint8_t)(n + i);
+
+				void *memory = SlabAllocator::allocate(size);
+				memset(memory, stamp, size);
+				queue.push({ memory, size, stamp });
+			}
+		});
+	}
+
+	for (auto &thread : allocating)
+	{
+		thread.join();
+	}
+	queue.close();
+	for (auto &thread : freeing)
+	{
+		thread.join();
+	}
+
+	EXPECT_EQ(corrupted.load(), 0);
+}
+
+TEST(SlabAllocator, ExitingThreadReturnsBlocksToDepot)
+{
+	// Size class no other test allocates, so the depot only holds these
+	const size_t size = SlabAllocator::MaxBlockSize - SlabAllocator::Granularity / 2;
+	const size_t count = 2 * SlabAllocator::BatchSize;
+
+	std::vector<void*> blocks;
+	std::thread allocating([&]() {
+		for (size_t i = 0; i < count; i++)
+		{
+			blocks.push_back(SlabAllocator::allocate(size));
+		}
+	});
+	allocating.join();
+
+	// Frees a batch to the depot as it goes, the rest as it exits
+	std::thread freeing([&]() {
+		for (void *block : blocks)
+		{
+			SlabAllocator::deallocate(block, size);
+		}
+	});
+	freeing.join();
+
+	std::vector<void*> reused;
+	std::thread reusing([&]() {
+		for (size_t i = 0; i < count; i++)
+		{
+			reused.push_back(SlabAllocator::allocate(size));
+		}
+	});
+	reusing.join();
+
+	std::set<void*> freed(blocks.begin(), blocks.end());
+	std::set<void*> taken(reused.begin(), reused.end());
+	EXPECT_EQ(taken, freed);
+
+	for (void *block : reused)
+	{
+		SlabAllocator::deallocate(block, size);
+	}
+}
+
+TEST(SlabAllocator, BlocksAreAlignedAndSized)
+{
+	for (size_t size = 1; size <= SlabAllocator::MaxBlockSize + 64; size += 7)
+	{
+		void *block = SlabAllocator::allocate(size);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % SlabAllocator::Granularity, 0u) << "size " << size;
+
+		// Whole block is usable
+		memset(block, 0xab, size);
+		EXPECT_TRUE(stamped(block, size, 0xab));
+
+		SlabAllocator::deallocate(block, size);
+	}
+}
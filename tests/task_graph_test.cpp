@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file task_graph_test.cpp
+ * @author Evan Stoddard
+ * @brief Task graph tests
+ */
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+#include "taskgraph.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::TaskGraph;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Graph whose nodes check every predecessor finished before them
+ *
+ */
+class CheckedGraph
+{
+public:
+	explicit CheckedGraph(size_t nodes) :
+		_finished(new std::atomic<bool>[nodes]),
+		_runs(new std::atomic<int>[nodes]),
+		_predecessors(nodes),
+		_early(0)
+	{
+		for (size_t i = 0; i < nodes; i++)
+		{
+			_finished[i] = false;
+			_runs[i] = 0;
+
+			graph.add([this, i]() {
+				for (size_t predecessor : _predecessors[i])
+				{
+					if (!_finished[predecessor].load())
+					{
+						_early++;
+					}
+				}
+				_runs[i]++;
+				_finished[i] = true;
+			});
+		}
+	}
+
+	void precede(size_t before, size_t after)
+	{
+		graph.precede(before, after);
+		_predecessors[after].push_back(before);
+	}
+
+	/**
+	 * @brief Run graph, returning nodes that didn't run once, or ran early
+	 *
+	 */
+	size_t run(Threadpool &pool)
+	{
+		for (size_t i = 0; i < _predecessors.size(); i++)
+		{
+			_finished[i] = false;
+			_runs[i] = 0;
+		}
+		_early = 0;
+
+		graph.run(pool);
+
+		size_t wrong = (size_t)_early.load();
+		for (size_t i = 0; i < _predecessors.size(); i++)
+		{
+			if (_runs[i].load() != 1)
+			{
+				wrong++;
+			}
+		}
+		return wrong;
+	}
+
+	TaskGraph graph;
+
+private:
+	std::unique_ptr<std::atomic<bool>[]> _finished;
+	std::unique_ptr<std::atomic<int>[]> _runs;
+	std::vector<std::vector<size_t>> _predecessors;
+	std::atomic<int> _early;
+};
+
+/**
+ * @brief Diamond: 0 before 1 and 2, both before 3
+ *
+ */
+static void makeDiamond(CheckedGraph &diamond)
+{
+	diamond.precede(0, 1);
+	diamond.precede(0, 2);
+	diamond.precede(1, 3);
+	diamond.precede(2, 3);
+}
+
+/**
+ * @brief Task graph tests, run against each scheduling mode
+ *
+ */
+class TaskGraphTest : public ::testing::TestWithParam<SchedulingMode>
+{
+protected:
+	TaskGraphTest() :
+		pool(2, GetParam())
+	{
+	}
+
+	Threadpool pool;
+};
+
+TEST_P(TaskGraphTest, DiamondRunsEachNodeAfterItsPredecessors)
+{
+	pool.start();
+
+	CheckedGraph diamond(4);
+	makeDiamond(diamond);
+
+	// Graph is reusable
+	for (int run = 0; run < 100; run++)
+	{
+		ASSERT_EQ(diamond.run(pool), 0u) << "run " << run;
+	}
+}
+
+TEST_P(TaskGraphTest, LayeredGraphRunsEachNodeAfterItsPredecessors)
+{
+	pool.start();
+
+	// Layers of 16, each node waiting on three nodes of the layer before
+	const size_t width = 16;
+	const size_t layers = 20;
+	CheckedGraph layered(width * layers);
+	for (size_t layer = 1; layer < layers; layer++)
+	{
+		for (size_t i = 0; i < width; i++)
+		{
+			for (size_t offset = 0; offset < 3; offset++)
+			{
+				layered.precede((layer - 1) * width + (i + offset * 5) % width, layer * width + i);
+			}
+		}
+	}
+
+	for (int run = 0; run < 10; run++)
+	{
+		ASSERT_EQ(layered.run(pool), 0u) << "run " << run;
+	}
+}
+
+TEST_P(TaskGraphTest, CycleThrowsWithoutRunningAnything)
+{
+	pool.start();
+
+	std::atomic<int> runs(0);
+	TaskGraph graph;
+	TaskGraph::NodeId a = graph.add([&runs]() { runs++; });
+	TaskGraph::NodeId b = graph.add([&runs]() { runs++; }, { a });
+	graph.add([&runs]() { runs++; }, { b });
+	graph.precede(b, a);
+
+	EXPECT_THROW(graph.run(pool), std::logic_error);
+	EXPECT_EQ(runs.load(), 0);
+
+	TaskGraph selfLoop;
+	TaskGraph::NodeId node = selfLoop.add([&runs]() { runs++; });
+	selfLoop.precede(node, node);
+
+	EXPECT_THROW(selfLoop.run(pool), std::logic_error);
+	EXPECT_EQ(runs.load(), 0);
+}
+
+TEST_P(TaskGraphTest, PrecedingMissingNodeThrows)
+{
+	TaskGraph graph;
+	TaskGraph::NodeId node = graph.add([]() {});
+
+	EXPECT_THROW(graph.precede(node, node + 1), std::out_of_range);
+	EXPECT_THROW(graph.add([]() {}, { node + 5 }), std::out_of_range);
+}
+
+TEST_P(TaskGraphTest, ExceptionSkipsSuccessorsAndIsRethrown)
+{
+	pool.start();
+
+	std::atomic<int> after(0);
+	TaskGraph graph;
+	TaskGraph::NodeId failing = graph.add([]() { throw std::runtime_error("node failed"); });
+	TaskGraph::NodeId next = graph.add([&after]() { after++; }, { failing });
+	graph.add([&after]() { after++; }, { next });
+
+	EXPECT_THROW(graph.run(pool), std::runtime_error);
+	EXPECT_EQ(after.load(), 0);
+
+	// Next run starts clean and fails the same way
+	EXPECT_THROW(graph.run(pool), std::runtime_error);
+	EXPECT_EQ(after.load(), 0);
+}
+
+TEST_P(TaskGraphTest, CancelFromNodeSkipsNodesNotStarted)
+{
+	pool.start();
+
+	std::atomic<int> after(0);
+	TaskGraph graph;
+	TaskGraph::NodeId first = graph.add([&graph]() { graph.cancel(); });
+	TaskGraph::NodeId second = graph.add([&after]() { after++; }, { first });
+	graph.add([&after]() { after++; }, { second });
+	graph.add([&after]() { after++; }, { first });
+
+	EXPECT_NO_THROW(graph.run(pool));
+	EXPECT_EQ(after.load(), 0);
+}
+
+TEST_P(TaskGraphTest, NodesRejectedByPoolRunOnCaller)
+{
+	pool.setBackpressure(0, OverflowPolicy::TryAndReturnFalse);
+	pool.start();
+
+	CheckedGraph diamond(4);
+	makeDiamond(diamond);
+
+	EXPECT_EQ(diamond.run(pool), 0u);
+}
+
+TEST_P(TaskGraphTest, StoppedPoolRunsNodesOnCaller)
+{
+	CheckedGraph diamond(4);
+	makeDiamond(diamond);
+
+	EXPECT_EQ(diamond.run(pool), 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	TaskGraphTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
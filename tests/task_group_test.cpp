@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file task_group_test.cpp
+ * @author Evan Stoddard
+ * @brief Task group tests
+ */
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <gtest/gtest.h>
+#include "taskgroup.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::ShutdownReport;
+using ThreadUtils::TaskGroup;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Callable counting runs and cancels
+ *
+ */
+struct Counted
+{
+	std::atomic<int> *runs;
+	std::atomic<int> *cancels;
+
+	void operator()() { (*runs)++; }
+
+	void cancel() { (*cancels)++; }
+};
+
+/**
+ * @brief Task group tests, run against each scheduling mode
+ *
+ */
+class TaskGroupTest : public ::testing::TestWithParam<SchedulingMode>
+{
+protected:
+	TaskGroupTest() :
+		pool(2, GetParam())
+	{
+	}
+
+	Threadpool pool;
+};
+
+TEST_P(TaskGroupTest, WaitsForEveryTask)
+{
+	pool.start();
+
+	std::atomic<int> runs(0);
+	TaskGroup group(pool);
+	for (int i = 0; i < 1000; i++)
+	{
+		EXPECT_TRUE(group.enqueue([&runs]() { runs++; }));
+	}
+	group.wait();
+
+	EXPECT_EQ(runs.load(), 1000);
+	EXPECT_EQ(group.outstanding(), 0u);
+}
+
+TEST_P(TaskGroupTest, WorkersWaitOnNestedGroupsWithoutDeadlock)
+{
+	pool.start();
+
+	// Recursion far deeper than there are workers, each level waiting on the next
+	std::atomic<int> runs(0);
+	std::function<void(TaskGroup &, int)> recurse = [&](TaskGroup &parent, int depth) {
+		runs++;
+		if (depth == 0)
+		{
+			return;
+		}
+
+		TaskGroup child(parent);
+		for (int i = 0; i < 3; i++)
+		{
+			child.enqueue([&, depth]() { recurse(child, depth - 1); });
+		}
+		child.wait();
+	};
+
+	TaskGroup root(pool);
+	root.enqueue([&]() { recurse(root, 5); });
+	root.wait();
+
+	EXPECT_EQ(runs.load(), 1 + 3 + 9 + 27 + 81 + 243);
+}
+
+TEST_P(TaskGroupTest, CancelSkipsTasksNotStarted)
+{
+	pool.start();
+
+	std::atomic<int> started(0);
+	std::atomic<bool> release(false);
+	std::atomic<int> runs(0);
+
+	TaskGroup group(pool);
+
+	// Keep both workers busy so the rest stay queued
+	for (int i = 0; i < 2; i++)
+	{
+		group.enqueue([&]() {
+			started++;
+			while (!release.load())
+			{
+				std::this_thread::yield();
+			}
+		});
+	}
+	while (started.load() < 2)
+	{
+		std::this_thread::yield();
+	}
+
+	for (int i = 0; i < 100; i++)
+	{
+		group.enqueue([&runs]() { runs++; });
+	}
+
+	group.cancel();
+	release = true;
+	group.wait();
+
+	EXPECT_EQ(runs.load(), 0);
+	EXPECT_TRUE(group.cancelled());
+	EXPECT_FALSE(group.enqueue([&runs]() { runs++; }));
+}
+
+TEST_P(TaskGroupTest, CancellingParentCancelsNestedGroups)
+{
+	TaskGroup parent(pool);
+	TaskGroup child(parent);
+	TaskGroup grandchild(child);
+
+	parent.cancel();
+
+	EXPECT_TRUE(child.cancelled());
+	EXPECT_TRUE(grandchild.cancelled());
+}
+
+TEST_P(TaskGroupTest, FirstExceptionIsRethrownFromWait)
+{
+	pool.start();
+
+	TaskGroup group(pool);
+	group.enqueue([]() { throw std::runtime_error("task failed"); });
+	EXPECT_THROW(group.wait(), std::runtime_error);
+
+	// Rethrown once, the group stays cancelled
+	EXPECT_NO_THROW(group.wait());
+	EXPECT_TRUE(group.cancelled());
+}
+
+TEST_P(TaskGroupTest, RejectedTasksCountDoneAndAreCancelled)
+{
+	pool.setBackpressure(0, OverflowPolicy::TryAndReturnFalse);
+	pool.start();
+
+	std::atomic<int> runs(0);
+	std::atomic<int> cancels(0);
+	auto owned = std::make_shared<int>(1);
+
+	TaskGroup group(pool);
+	EXPECT_FALSE(group.enqueue(Counted{ &runs, &cancels }));
+	EXPECT_FALSE(group.enqueue([owned]() {}));
+	group.wait();
+
+	EXPECT_EQ(runs.load(), 0);
+	EXPECT_EQ(cancels.load(), 1);
+	EXPECT_EQ(owned.use_count(), 1);
+}
+
+TEST_P(TaskGroupTest, StopNowCancelsQueuedTasks)
+{
+	std::atomic<int> runs(0);
+	std::atomic<int> cancels(0);
+
+	// Never started, so everything enqueued stays queued
+	TaskGroup group(pool);
+	for (int i = 0; i < 10; i++)
+	{
+		group.enqueue(Counted{ &runs, &cancels });
+	}
+
+	ShutdownReport report = pool.stopNow();
+	group.wait();
+
+	EXPECT_EQ(report.tasksDiscarded, 10u);
+	EXPECT_EQ(runs.load(), 0);
+	EXPECT_EQ(cancels.load(), 10);
+
+	// Rejected until started again
+	EXPECT_FALSE(group.enqueue(Counted{ &runs, &cancels }));
+	group.wait();
+	EXPECT_EQ(cancels.load(), 11);
+}
+
+TEST_P(TaskGroupTest, StoppedPoolRunsTasksOnWaitingThread)
+{
+	std::atomic<int> runs(0);
+	TaskGroup group(pool);
+	for (int i = 0; i < 100; i++)
+	{
+		group.enqueue([&runs]() { runs++; });
+	}
+	group.wait();
+
+	EXPECT_EQ(runs.load(), 100);
+}
+
+TEST_P(TaskGroupTest, ShortLivedGroupsOutliveNoTask)
+{
+	pool.start();
+
+	for (int i = 0; i < 20000; i++)
+	{
+		TaskGroup group(pool);
+		group.enqueue([]() {});
+		group.wait();
+	}
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	TaskGroupTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
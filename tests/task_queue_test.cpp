@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file task_queue_test.cpp
+ * @author Evan Stoddard
+ * @brief Priority lane tests
+ */
+
+#include <atomic>
+#include <vector>
+#include <gtest/gtest.h>
+#include "taskqueue.hpp"
+#include "threadpool.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::OverflowPolicy;
+using ThreadUtils::PriorityLanes;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Task;
+using ThreadUtils::TaskQueue;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Returns task recording its lane when run
+ *
+ */
+static Task laneTask(size_t lane, size_t &ran)
+{
+	return Task([lane, &ran]() { ran = lane; });
+}
+
+/**
+ * @brief Pops and runs next task, returning its lane
+ *
+ */
+static size_t popLane(TaskQueue &queue, size_t &ran)
+{
+	Task task;
+	EXPECT_TRUE(queue.pop(task));
+	task();
+	return ran;
+}
+
+TEST(TaskQueue, StrictTakesMostUrgentLaneFirst)
+{
+	size_t ran = 0;
+	TaskQueue queue(PriorityLanes::strict(3, 0));
+
+	for (int i = 0; i < 4; i++)
+	{
+		queue.push(laneTask(2, ran), 2);
+		queue.push(laneTask(0, ran), 0);
+		queue.push(laneTask(1, ran), 1);
+	}
+	queue.push(laneTask(2, ran));
+
+	std::vector<size_t> lanes;
+	while (!queue.empty())
+	{
+		lanes.push_back(popLane(queue, ran));
+	}
+
+	std::vector<size_t> expected = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2 };
+	EXPECT_EQ(lanes, expected);
+}
+
+TEST(TaskQueue, WeightedFairTakesLanesInProportionToWeight)
+{
+	size_t ran = 0;
+	TaskQueue queue(PriorityLanes::weighted({ 3, 1 }));
+
+	for (int i = 0; i < 100; i++)
+	{
+		queue.push(laneTask(0, ran), 0);
+		queue.push(laneTask(1, ran), 1);
+	}
+
+	// While both lanes have tasks every four pops are three from lane 0, one from lane 1
+	for (int turn = 0; turn < 25; turn++)
+	{
+		size_t counts[2] = { 0, 0 };
+		for (int i = 0; i < 4; i++)
+		{
+			counts[popLane(queue, ran)]++;
+		}
+		EXPECT_EQ(counts[0], 3u);
+		EXPECT_EQ(counts[1], 1u);
+	}
+
+	// Lane 1 gets the rest once lane 0 is empty
+	EXPECT_EQ(queue.size(0), 25u);
+	EXPECT_EQ(queue.size(1), 75u);
+}
+
+TEST(TaskQueue, StarvationProtectionBoundsPassOvers)
+{
+	const uint32_t maxSkips = 3;
+
+	for (size_t numLanes = 2; numLanes <= 5; numLanes++)
+	{
+		size_t ran = 0;
+		TaskQueue queue(PriorityLanes::strict(numLanes, maxSkips));
+
+		// Lane 0 never runs dry, every other lane has one task waiting
+		for (size_t i = 0; i < 4; i++)
+		{
+			queue.push(laneTask(0, ran), 0);
+		}
+		for (size_t lane = 1; lane < numLanes; lane++)
+		{
+			queue.push(laneTask(lane, ran), lane);
+		}
+
+		std::vector<size_t> served(numLanes, 0);
+		for (size_t pop = 1; pop <= 100; pop++)
+		{
+			size_t lane = popLane(queue, ran);
+			if (lane == 0)
+			{
+				queue.push(laneTask(0, ran), 0);
+			}
+			else if (served[lane] == 0)
+			{
+				served[lane] = pop;
+			}
+		}
+
+		for (size_t lane = 1; lane < numLanes; lane++)
+		{
+			SCOPED_TRACE(testing::Message() << numLanes << " lanes, lane " << lane);
+			EXPECT_GT(served[lane], 0u);
+			EXPECT_LE(served[lane] - 1, maxSkips + numLanes);
+		}
+	}
+}
+
+TEST(TaskQueue, StarvationProtectionDisabledWithZeroSkips)
+{
+	size_t ran = 0;
+	TaskQueue queue(PriorityLanes::strict(2, 0));
+
+	queue.push(laneTask(1, ran), 1);
+	for (int pop = 0; pop < 200; pop++)
+	{
+		queue.push(laneTask(0, ran), 0);
+		EXPECT_EQ(popLane(queue, ran), 0u);
+	}
+	EXPECT_EQ(queue.size(1), 1u);
+}
+
+/**
+ * @brief Callable counting its runs, or cancels if the pool drops it
+ *
+ */
+struct LaneCounted
+{
+	std::atomic<int> *runs;
+	std::atomic<int> *cancels;
+
+	void operator()() { (*runs)++; }
+
+	void cancel() { (*cancels)++; }
+};
+
+/**
+ * @brief Pool priority lane tests, run against each scheduling mode
+ *
+ */
+class PriorityLanesTest : public ::testing::TestWithParam<SchedulingMode>
+{
+};
+
+TEST_P(PriorityLanesTest, LaneDepthLimitRejectsOnlyThatLane)
+{
+	std::atomic<int> runs(0);
+	std::atomic<int> cancels(0);
+
+	// Never started, so tasks stay queued
+	Threadpool pool(2, GetParam());
+	PriorityLanes lanes = PriorityLanes::strict(2);
+	lanes.lanes[0].maxDepth = 2;
+	pool.setPriorityLanes(lanes);
+	pool.setBackpressure(100, OverflowPolicy::TryAndReturnFalse);
+
+	EXPECT_TRUE(pool.enqueue(Task(LaneCounted{ &runs, &cancels }), 0));
+	EXPECT_TRUE(pool.enqueue(Task(LaneCounted{ &runs, &cancels }), 0));
+	EXPECT_FALSE(pool.enqueue(Task(LaneCounted{ &runs, &cancels }), 0));
+	EXPECT_EQ(cancels.load(), 1);
+
+	for (int i = 0; i < 10; i++)
+	{
+		EXPECT_TRUE(pool.enqueue(Task(LaneCounted{ &runs, &cancels }), 1));
+	}
+	EXPECT_EQ(pool.snapshot().tasksRejected, 1u);
+
+	while (pool.runPendingTask())
+	{
+	}
+	EXPECT_EQ(runs.load(), 12);
+	EXPECT_EQ(cancels.load(), 1);
+}
+
+TEST_P(PriorityLanesTest, DropOldestShedsLeastUrgentLane)
+{
+	std::atomic<int> urgentRuns(0);
+	std::atomic<int> lowRuns(0);
+	std::atomic<int> urgentCancels(0);
+	std::atomic<int> lowCancels(0);
+
+	// Never started, so tasks stay queued
+	Threadpool pool(1, GetParam());
+	pool.setPriorityLanes(PriorityLanes::strict(3));
+	pool.setBackpressure(4, OverflowPolicy::DropOldest);
+
+	pool.enqueue(Task(LaneCounted{ &lowRuns, &lowCancels }), 2);
+	pool.enqueue(Task(LaneCounted{ &urgentRuns, &urgentCancels }), 0);
+	pool.enqueue(Task(LaneCounted{ &lowRuns, &lowCancels }), 2);
+	pool.enqueue(Task(LaneCounted{ &urgentRuns, &urgentCancels }), 1);
+
+	// Full, each urgent task sheds a lane 2 task rather than an older urgent one
+	EXPECT_TRUE(pool.enqueue(Task(LaneCounted{ &urgentRuns, &urgentCancels }), 0));
+	EXPECT_TRUE(pool.enqueue(Task(LaneCounted{ &urgentRuns, &urgentCancels }), 0));
+	EXPECT_EQ(lowCancels.load(), 2);
+	EXPECT_EQ(urgentCancels.load(), 0);
+	EXPECT_EQ(pool.snapshot().tasksDropped, 2u);
+
+	// With lane 2 empty the least urgent left is lane 1
+	EXPECT_TRUE(pool.enqueue(Task(LaneCounted{ &urgentRuns, &urgentCancels }), 0));
+	EXPECT_EQ(urgentCancels.load(), 1);
+
+	while (pool.runPendingTask())
+	{
+	}
+	EXPECT_EQ(urgentRuns.load(), 4);
+	EXPECT_EQ(lowRuns.load(), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	PriorityLanesTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file task_test.cpp
+ * @author Evan Stoddard
+ * @brief Task inline and heap storage tests
+ */
+
+#include <stdint.h>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "task.hpp"
+
+using ThreadUtils::Task;
+
+/**
+ * @brief Live and run counts of Tracked callables
+ *
+ */
+struct Counts
+{
+	int live = 0;
+	int destroyed = 0;
+	int runs = 0;
+	int misaligned = 0;
+
+	/// @brief Where callable was when it last ran
+	const void *ranAt = nullptr;
+};
+
+/**
+ * @brief Callable counting its live instances and runs
+ *
+ * @tparam Size Bytes of payload
+ * @tparam Align Alignment of callable
+ */
+template <size_t Size, size_t Align = alignof(void*)>
+struct alignas(Align) Tracked
+{
+	explicit Tracked(Counts *counts) :
+		counts(counts)
+	{
+		counts->live++;
+	}
+
+	Tracked(Tracked &&other) noexcept :
+		counts(other.counts)
+	{
+		counts->live++;
+	}
+
+	~Tracked()
+	{
+		counts->live--;
+		counts->destroyed++;
+	}
+
+	void operator()()
+	{
+		counts->runs++;
+		counts->ranAt = this;
+		if (reinterpret_cast<uintptr_t>(this) % Align != 0)
+		{
+			counts->misaligned++;
+		}
+	}
+
+	Counts *counts;
+	char payload[Size];
+};
+
+/// @brief Fits inline storage
+typedef Tracked<16> Small;
+
+/// @brief Larger than inline storage
+typedef Tracked<Task::InlineSize * 2> Large;
+
+/// @brief Small, but aligned more strictly than inline storage
+typedef Tracked<8, 64> OverAligned;
+
+/**
+ * @brief Returns whether address lies inside task itself
+ *
+ */
+static bool insideTask(const Task &task, const void *address)
+{
+	const char *begin = static_cast<const char*>(static_cast<const void*>(&task));
+	const char *at = static_cast<const char*>(address);
+	return at >= begin && at < begin + sizeof(Task);
+}
+
+TEST(Task, SmallCallableIsStoredInline)
+{
+	Counts counts;
+	{
+		Task task(Small{ &counts });
+		EXPECT_EQ(counts.live, 1);
+
+		task();
+		EXPECT_EQ(counts.runs, 1);
+		EXPECT_TRUE(insideTask(task, counts.ranAt));
+	}
+	EXPECT_EQ(counts.live, 0);
+}
+
+TEST(Task, CallableLargerThanInlineSizeIsStoredOnHeap)
+{
+	static_assert(sizeof(Large) > Task::InlineSize, "Large fits inline");
+
+	Counts counts;
+	{
+		Task task(Large{ &counts });
+		task();
+		EXPECT_FALSE(insideTask(task, counts.ranAt));
+
+		// Moving hands over the heap callable instead of moving it
+		const void *callable = counts.ranAt;
+		int destroyed = counts.destroyed;
+		Task moved(std::move(task));
+		EXPECT_EQ(counts.live, 1);
+		EXPECT_EQ(counts.destroyed, destroyed);
+
+		moved();
+		EXPECT_EQ(counts.runs, 2);
+		EXPECT_EQ(counts.ranAt, callable);
+	}
+	EXPECT_EQ(counts.live, 0);
+}
+
+TEST(Task, OverAlignedCallableIsAligned)
+{
+	static_assert(sizeof(OverAligned) <= Task::InlineSize, "OverAligned doesn't fit inline");
+
+	Counts counts;
+	{
+		// Allocate several so a lucky first block can't hide misalignment
+		std::vector<Task> tasks;
+		for (int i = 0; i < 16; i++)
+		{
+			tasks.emplace_back(OverAligned{ &counts });
+		}
+
+		for (Task &task : tasks)
+		{
+			task();
+			EXPECT_FALSE(insideTask(task, counts.ranAt));
+		}
+		EXPECT_EQ(counts.runs, 16);
+		EXPECT_EQ(counts.misaligned, 0);
+		EXPECT_EQ(counts.live, 16);
+	}
+	EXPECT_EQ(counts.live, 0);
+}
+
+TEST(Task, MoveOnlyCapturesMoveWithTask)
+{
+	int seen = 0;
+	std::unique_ptr<int> value(new int(7));
+	Task small([&seen, value = std::move(value)]() { seen += *value; });
+
+	// Padded past inline storage
+	struct Padded
+	{
+		std::unique_ptr<int> value;
+		int *seen;
+		char payload[Task::InlineSize];
+
+		void operator()() { *seen += *value; }
+	};
+	static_assert(sizeof(Padded) > Task::InlineSize, "Padded fits inline");
+	Task large(Padded{ std::unique_ptr<int>(new int(35)), &seen, {} });
+
+	Task movedSmall(std::move(small));
+	Task movedLarge;
+	movedLarge = std::move(large);
+	EXPECT_FALSE(small);
+	EXPECT_FALSE(large);
+
+	movedSmall();
+	movedLarge();
+	EXPECT_EQ(seen, 42);
+}
+
+/**
+ * @brief Moves task about, checking moved from tasks are empty and only the last one destroys callable
+ *
+ */
+template <typename Func>
+static void checkMovedFromTasks()
+{
+	Counts counts;
+	{
+		Task moved;
+		{
+			Task task(Func{ &counts });
+			Task constructed(std::move(task));
+			EXPECT_FALSE(task);
+			EXPECT_TRUE(constructed);
+
+			moved = std::move(constructed);
+			EXPECT_FALSE(constructed);
+			EXPECT_TRUE(moved);
+
+			// Resetting a moved from task is a no-op too
+			task.reset();
+			constructed.reset();
+			EXPECT_EQ(counts.live, 1);
+		}
+
+		// Moved from tasks destroyed, callable lives on
+		EXPECT_EQ(counts.live, 1);
+		moved();
+		EXPECT_EQ(counts.runs, 1);
+
+		// Assigning over a task destroys its callable
+		moved = Task();
+		EXPECT_FALSE(moved);
+		EXPECT_EQ(counts.live, 0);
+	}
+	EXPECT_EQ(counts.live, 0);
+	EXPECT_EQ(counts.runs, 1);
+}
+
+TEST(Task, MovedFromInlineTaskDestroysNothing)
+{
+	checkMovedFromTasks<Small>();
+}
+
+TEST(Task, MovedFromHeapTaskDestroysNothing)
+{
+	checkMovedFromTasks<Large>();
+}
+
+TEST(Task, MovedFromOverAlignedTaskDestroysNothing)
+{
+	checkMovedFromTasks<OverAligned>();
+}
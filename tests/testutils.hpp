@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file testutils.hpp
+ * @author Evan Stoddard
+ * @brief Helpers shared by tests
+ */
+
+#ifndef TESTUTILS_H_
+#define TESTUTILS_H_
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+#include "threadpool.hpp"
+
+namespace ThreadUtilsTest
+{
+	/// @brief Every scheduling mode, for tests run against each
+	static const ThreadUtils::SchedulingMode AllSchedulingModes[] = {
+		ThreadUtils::SchedulingMode::SharedQueue,
+		ThreadUtils::SchedulingMode::WorkStealing
+	};
+
+	/**
+	 * @brief Names tests parameterized by scheduling mode
+	 *
+	 * @param info Test parameter
+	 * @return std::string Name of mode
+	 */
+	inline std::string schedulingModeName(const ::testing::TestParamInfo<ThreadUtils::SchedulingMode> &info)
+	{
+		return info.param == ThreadUtils::SchedulingMode::WorkStealing ? "WorkStealing" : "SharedQueue";
+	}
+
+	/**
+	 * @brief Poll condition until it holds or timeout passes
+	 *
+	 * @param condition Condition to wait for
+	 * @param timeout How long to wait
+	 * @return true Condition held
+	 * @return false Timed out
+	 */
+	template <typename Condition>
+	bool eventually(Condition condition, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+	{
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+		while (!condition())
+		{
+			if (std::chrono::steady_clock::now() >= deadline)
+			{
+				return false;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		return true;
+	}
+};
+
+#endif /* TESTUTILS_H_ */
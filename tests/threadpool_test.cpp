@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file threadpool_test.cpp
+ * @author Evan Stoddard
+ * @brief Threadpool lifetime, shutdown and sizing tests
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "orderedbufferedthreadpool.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::BufferedThreadpool;
+using ThreadUtils::ElasticPolicy;
+using ThreadUtils::Future;
+using ThreadUtils::Optional;
+using ThreadUtils::OrderedBufferedThreadpool;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::ShutdownReport;
+using ThreadUtils::Task;
+using ThreadUtils::Threadpool;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Returns whether future holds a broken_promise error
+ *
+ */
+template <typename R>
+static bool brokenPromise(Future<R> &future)
+{
+	try
+	{
+		future.get();
+	}
+	catch (std::future_error &error)
+	{
+		return error.code() == std::future_errc::broken_promise;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Threadpool tests, run against each scheduling mode
+ *
+ */
+class ThreadpoolTest : public ::testing::TestWithParam<SchedulingMode>
+{
+};
+
+TEST_P(ThreadpoolTest, TeardownBreaksPromisesOfQueuedTasksAndContinuations)
+{
+	Future<int> queued;
+	Future<int> continuation;
+	{
+		// Never started, the submitted task is discarded as the pool is destroyed
+		Threadpool pool(2, GetParam());
+		queued = pool.submit([]() { return 1; });
+		continuation = pool.submit([]() { return 1; }).then([](int value) { return value + 1; });
+	}
+
+	EXPECT_TRUE(brokenPromise(queued));
+	EXPECT_TRUE(brokenPromise(continuation));
+}
+
+TEST_P(ThreadpoolTest, ContinuationsRunOnPoolOrInlineOnceStopped)
+{
+	Threadpool pool(2, GetParam());
+	pool.start();
+
+	Future<int> running = pool.submit([]() { return 1; }).then([](int value) { return value + 1; });
+	EXPECT_EQ(running.get(), 2);
+
+	// Stopped pool runs continuations on the completing thread
+	Future<int> done = pool.submit([]() { return 5; });
+	done.wait();
+	pool.stop();
+
+	std::thread::id ranOn;
+	Future<int> stopped = done.then([&ranOn](int value) {
+		ranOn = std::this_thread::get_id();
+		return value * 2;
+	});
+	EXPECT_EQ(stopped.get(), 10);
+	EXPECT_EQ(ranOn, std::this_thread::get_id());
+}
+
+TEST_P(ThreadpoolTest, ContinuationOfFutureOutlivingPoolIsCancelled)
+{
+	Future<int> done;
+	{
+		Threadpool pool(2, GetParam());
+		pool.start();
+		done = pool.submit([]() { return 1; });
+		done.wait();
+	}
+
+	// Pool is gone, the continuation must not be handed to it
+	bool ran = false;
+	Future<int> continuation = done.then([&ran](int value) {
+		ran = true;
+		return value + 1;
+	});
+
+	EXPECT_TRUE(brokenPromise(continuation));
+	EXPECT_FALSE(ran);
+}
+
+TEST_P(ThreadpoolTest, ContinuationOfFutureOutlivingPoolSkipsPoolReusingItsLink)
+{
+	Future<int> done;
+	{
+		Threadpool pool(2, GetParam());
+		pool.start();
+		done = pool.submit([]() { return 1; });
+		done.wait();
+	}
+
+	// New pool takes over the detached link, the old future must not reach it
+	Threadpool pool(2, GetParam());
+	pool.start();
+
+	bool ran = false;
+	Future<int> continuation = done.then([&ran](int value) {
+		ran = true;
+		return value + 1;
+	});
+
+	EXPECT_TRUE(brokenPromise(continuation));
+	EXPECT_FALSE(ran);
+	EXPECT_EQ(pool.submit([]() { return 2; }).then([](int value) { return value + 1; }).get(), 3);
+}
+
+TEST_P(ThreadpoolTest, TasksLeftByStopRunOnRestartOrAreCancelled)
+{
+	const int children = 10;
+	std::atomic<int> runs(0);
+	std::atomic<int> cancels(0);
+	struct Child
+	{
+		std::atomic<int> *runs;
+		std::atomic<int> *cancels;
+
+		void operator()() { (*runs)++; }
+
+		void cancel() { (*cancels)++; }
+	};
+
+	// Parent enqueues children from its worker (its own deque when stealing), then stop() catches it
+	auto stopWithChildrenQueued = [&](Threadpool &pool) {
+		std::atomic<bool> enqueued(false);
+		std::atomic<bool> release(false);
+		pool.enqueue(Task([&]() {
+			for (int i = 0; i < children; i++)
+			{
+				pool.enqueue(Task(Child{ &runs, &cancels }));
+			}
+			enqueued = true;
+			while (!release.load())
+			{
+				std::this_thread::yield();
+			}
+		}));
+		EXPECT_TRUE(eventually([&]() { return enqueued.load(); }));
+
+		std::thread stopper([&]() { pool.stop(); });
+		EXPECT_TRUE(eventually([&]() { return !pool.poolRunning(); }));
+		release = true;
+		stopper.join();
+	};
+
+	{
+		Threadpool pool(1, GetParam());
+		pool.start();
+		stopWithChildrenQueued(pool);
+
+		pool.start();
+		EXPECT_TRUE(eventually([&]() { return runs.load() == children; }));
+	}
+	EXPECT_EQ(cancels.load(), 0);
+
+	runs = 0;
+	{
+		Threadpool pool(1, GetParam());
+		pool.start();
+		stopWithChildrenQueued(pool);
+	}
+	EXPECT_EQ(runs.load() + cancels.load(), children);
+}
+
+TEST_P(ThreadpoolTest, StopNowDiscardsQueuedAndRejectsNewTasks)
+{
+	Threadpool pool(1, GetParam());
+	pool.start();
+
+	std::atomic<bool> started(false);
+	std::atomic<int> runs(0);
+	Future<int> followUp;
+
+	// Keeps the only worker busy until stopNow() is under way, then enqueues more
+	pool.enqueue(Task([&]() {
+		started = true;
+		while (!pool.shuttingDown())
+		{
+			std::this_thread::yield();
+		}
+		followUp = pool.submit([&runs]() { return ++runs; });
+	}));
+	while (!started.load())
+	{
+		std::this_thread::yield();
+	}
+
+	std::vector<Future<int>> queued;
+	for (int i = 0; i < 5; i++)
+	{
+		queued.push_back(pool.submit([&runs]() { return ++runs; }));
+	}
+
+	ShutdownReport report = pool.stopNow();
+
+	EXPECT_EQ(report.tasksRun, 1u);
+	EXPECT_EQ(report.tasksDiscarded, 5u);
+	EXPECT_EQ(report.tasksRejected, 1u);
+	EXPECT_FALSE(report.drained);
+	EXPECT_EQ(runs.load(), 0);
+
+	for (auto &future : queued)
+	{
+		EXPECT_TRUE(brokenPromise(future));
+	}
+	EXPECT_TRUE(brokenPromise(followUp));
+
+	// Rejected until started again
+	EXPECT_FALSE(pool.enqueue(Task([&runs]() { runs++; })));
+	pool.start();
+	EXPECT_EQ(pool.submit([]() { return 3; }).get(), 3);
+	EXPECT_EQ(runs.load(), 0);
+}
+
+TEST_P(ThreadpoolTest, ResizeUnderLoadCompletesEveryTask)
+{
+	Threadpool pool(2, GetParam());
+	pool.start();
+
+	const int tasks = 20000;
+	std::atomic<int> runs(0);
+	std::thread producer([&]() {
+		for (int i = 0; i < tasks; i++)
+		{
+			pool.enqueue(Task([&runs]() { runs++; }));
+		}
+	});
+
+	const uint32_t sizes[] = { 6, 1, 4, 2, 8, 3 };
+	for (uint32_t size : sizes)
+	{
+		pool.resize(size);
+		EXPECT_EQ(pool.numThreads(), size);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	producer.join();
+
+	EXPECT_TRUE(eventually([&]() { return runs.load() == tasks; }));
+	EXPECT_EQ(pool.numThreads(), 3u);
+
+	// Slots added by each resize keep their counters
+	EXPECT_TRUE(eventually([&]() { return pool.snapshot().tasksCompleted == (uint64_t)tasks; }));
+}
+
+TEST_P(ThreadpoolTest, GrownWorkersRunConcurrently)
+{
+	Threadpool pool(1, GetParam());
+	pool.start();
+	pool.resize(4);
+
+	// Every task waits for the others, so they only finish if four workers run at once
+	std::atomic<int> arrived(0);
+	std::atomic<int> met(0);
+	for (int i = 0; i < 4; i++)
+	{
+		pool.enqueue(Task([&]() {
+			arrived++;
+			if (eventually([&]() { return arrived.load() == 4; }))
+			{
+				met++;
+			}
+		}));
+	}
+	EXPECT_TRUE(eventually([&]() { return met.load() == 4; }));
+
+	// Shrunk pool still runs what's queued
+	pool.resize(1);
+	std::atomic<int> runs(0);
+	for (int i = 0; i < 100; i++)
+	{
+		pool.enqueue(Task([&runs]() { runs++; }));
+	}
+	EXPECT_TRUE(eventually([&]() { return runs.load() == 100; }));
+}
+
+TEST_P(ThreadpoolTest, ElasticPoolGrowsToMaxAndRetiresToMin)
+{
+	Threadpool pool(1, GetParam());
+	pool.setElastic(ElasticPolicy::between(1, 4, std::chrono::milliseconds(1), std::chrono::milliseconds(50)));
+	pool.start();
+
+	// Slow tasks queue up behind the only worker, so waits pass growAfter
+	const int tasks = 400;
+	std::atomic<int> runs(0);
+	uint32_t most = 0;
+	for (int i = 0; i < tasks; i++)
+	{
+		pool.enqueue(Task([&runs]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			runs++;
+		}));
+	}
+	EXPECT_TRUE(eventually([&]() {
+		most = std::max(most, pool.numThreads());
+		return runs.load() == tasks;
+	}));
+	EXPECT_EQ(most, 4u);
+
+	// Idle workers retire after keepalive, down to minThreads
+	EXPECT_TRUE(eventually([&]() { return pool.numThreads() == 1; }));
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	EXPECT_EQ(pool.numThreads(), 1u);
+
+	// Retired pool still runs tasks
+	EXPECT_EQ(pool.submit([]() { return 7; }).get(), 7);
+}
+
+TEST(OrderedBufferedThreadpool, ResizeKeepsOutputInOrder)
+{
+	OrderedBufferedThreadpool<int, int> pool(2);
+	pool.start();
+
+	const int items = 5000;
+	std::atomic<bool> fed(false);
+	std::thread producer([&]() {
+		for (int i = 0; i < items; i++)
+		{
+			pool.feedQueue(Task([&pool, i]() {
+				if (i % 5 == 0)
+				{
+					std::this_thread::yield();
+				}
+				pool.feedOutputQueue(i, i);
+			}), i);
+		}
+		fed = true;
+	});
+
+	std::thread resizer([&]() {
+		const uint32_t sizes[] = { 6, 1, 4, 3, 8, 2 };
+		for (size_t i = 0; !fed.load(); i++)
+		{
+			pool.resize(sizes[i % 6]);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	for (int i = 0; i < items; i++)
+	{
+		Optional<int> value = pool.fetch();
+		EXPECT_TRUE(value);
+		if (!value)
+		{
+			break;
+		}
+		EXPECT_EQ(*value, i);
+	}
+	producer.join();
+	resizer.join();
+}
+
+TEST(BufferedThreadpool, TeardownWithQueuedTasks)
+{
+	std::atomic<int> runs(0);
+	{
+		BufferedThreadpool<int> buffered(2);
+		buffered.feedQueue(Task([&runs]() { runs++; }));
+
+		OrderedBufferedThreadpool<int, int> ordered(2);
+		ordered.feedQueue(Task([&runs]() { runs++; }), 1);
+	}
+	EXPECT_EQ(runs.load(), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	ThreadpoolTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);
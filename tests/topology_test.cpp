@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file topology_test.cpp
+ * @author Evan Stoddard
+ * @brief CPU topology and worker placement tests
+ */
+
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "threadpool.hpp"
+#include "testutils.hpp"
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using ThreadUtils::CpuTopology;
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Task;
+using ThreadUtils::Threadpool;
+using ThreadUtils::WorkerPlacement;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Returns tasks waiting in every lane of shared and node queues
+ *
+ */
+static uint64_t queuedInLanes(Threadpool &pool)
+{
+	std::vector<uint64_t> depths = pool.snapshot().laneDepths;
+	return std::accumulate(depths.begin(), depths.end(), (uint64_t)0);
+}
+
+TEST(CpuTopology, ParseCpuListExpandsRanges)
+{
+	EXPECT_EQ(CpuTopology::parseCpuList("0-3,8-11"), std::vector<uint32_t>({ 0, 1, 2, 3, 8, 9, 10, 11 }));
+}
+
+TEST(CpuTopology, ParseCpuListSingleCpu)
+{
+	EXPECT_EQ(CpuTopology::parseCpuList("5"), std::vector<uint32_t>({ 5 }));
+}
+
+TEST(CpuTopology, ParseCpuListEmpty)
+{
+	EXPECT_TRUE(CpuTopology::parseCpuList("").empty());
+}
+
+TEST(CpuTopology, SystemTopologyCoversEveryNode)
+{
+	const CpuTopology &topology = CpuTopology::system();
+	ASSERT_GE(topology.numNodes(), 1u);
+	for (size_t node = 0; node < topology.numNodes(); node++)
+	{
+		for (uint32_t cpu : topology.nodeCpus(node))
+		{
+			EXPECT_EQ(topology.nodeOfCpu(cpu), node);
+		}
+	}
+}
+
+#ifdef __linux__
+/**
+ * @brief Fake sysfs node directory
+ *
+ */
+class FakeNodeDirectory
+{
+public:
+	FakeNodeDirectory()
+	{
+		std::string pattern = ::testing::TempDir() + "/topology_XXXXXX";
+		std::vector<char> path(pattern.begin(), pattern.end());
+		path.push_back('\0');
+		_path = mkdtemp(path.data()) != nullptr ? path.data() : "";
+	}
+
+	~FakeNodeDirectory()
+	{
+		for (const std::string &file : _files)
+		{
+			unlink(file.c_str());
+		}
+		for (auto it = _directories.rbegin(); it != _directories.rend(); ++it)
+		{
+			rmdir(it->c_str());
+		}
+		rmdir(_path.c_str());
+	}
+
+	const std::string &path() const { return _path; }
+
+	/**
+	 * @brief Write one line file, relative to directory
+	 *
+	 */
+	void write(const std::string &name, const std::string &line)
+	{
+		_files.push_back(_path + "/" + name);
+		std::ofstream(_files.back()) << line << "\n";
+	}
+
+	/**
+	 * @brief Add node directory with its CPU list
+	 *
+	 */
+	void node(uint32_t id, const std::string &cpus)
+	{
+		std::string directory = "node" + std::to_string(id);
+		_directories.push_back(_path + "/" + directory);
+		mkdir(_directories.back().c_str(), 0700);
+		write(directory + "/cpulist", cpus);
+	}
+
+private:
+	std::string _path;
+	std::vector<std::string> _files;
+	std::vector<std::string> _directories;
+};
+
+TEST(CpuTopology, SparseNodeIdsAndMemoryOnlyNodes)
+{
+	FakeNodeDirectory sysfs;
+	ASSERT_FALSE(sysfs.path().empty());
+
+	// Node 1 has memory only, nodes 2 and 3 are missing
+	sysfs.write("online", "0-1,4");
+	sysfs.write("has_cpu", "0,4");
+	sysfs.node(0, "0-1");
+	sysfs.node(1, "");
+	sysfs.node(4, "2-3");
+
+	CpuTopology topology = CpuTopology::read(sysfs.path());
+	ASSERT_EQ(topology.numNodes(), 2u);
+	EXPECT_EQ(topology.nodeId(0), 0u);
+	EXPECT_EQ(topology.nodeId(1), 4u);
+	EXPECT_EQ(topology.nodeCpus(1), std::vector<uint32_t>({ 2, 3 }));
+	EXPECT_EQ(topology.nodeOfCpu(1), 0u);
+	EXPECT_EQ(topology.nodeOfCpu(3), 1u);
+}
+
+TEST(CpuTopology, OnlineListUsedWithoutHasCpu)
+{
+	FakeNodeDirectory sysfs;
+	ASSERT_FALSE(sysfs.path().empty());
+
+	// CPU-less nodes are still skipped
+	sysfs.write("online", "0-2");
+	sysfs.node(0, "0");
+	sysfs.node(1, "");
+	sysfs.node(2, "1");
+
+	CpuTopology topology = CpuTopology::read(sysfs.path());
+	ASSERT_EQ(topology.numNodes(), 2u);
+	EXPECT_EQ(topology.nodeId(1), 2u);
+	EXPECT_EQ(topology.nodeOfCpu(1), 1u);
+}
+#endif
+
+TEST(NumaPlacement, TasksFedThroughNodeQueuesAllRun)
+{
+	const int tasks = 2000;
+	Threadpool pool(4, SchedulingMode::WorkStealing);
+	pool.setPlacement(WorkerPlacement::numa(true));
+	pool.start();
+
+	// Fed from several threads, whichever node they're on
+	std::atomic<int> runs(0);
+	std::vector<std::thread> producers;
+	for (int p = 0; p < 4; p++)
+	{
+		producers.emplace_back([&]() {
+			for (int i = 0; i < tasks / 4; i++)
+			{
+				pool.enqueue(Task([&runs]() { runs++; }));
+			}
+		});
+	}
+	for (auto &producer : producers)
+	{
+		producer.join();
+	}
+
+	EXPECT_TRUE(eventually([&]() { return runs.load() == tasks; }));
+	EXPECT_EQ(queuedInLanes(pool), 0u);
+}
+
+TEST(NumaPlacement, StopMovesNodeQueuesBackToSharedQueue)
+{
+	const int tasks = 100;
+	Threadpool pool(1, SchedulingMode::WorkStealing);
+	pool.setPlacement(WorkerPlacement::numa(true));
+	pool.start();
+
+	// Hold the only worker so fed tasks stay in the node queues
+	std::atomic<bool> entered(false);
+	std::atomic<bool> open(false);
+	pool.enqueue(Task([&]() {
+		entered = true;
+		while (!open.load())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}));
+	ASSERT_TRUE(eventually([&]() { return entered.load(); }));
+
+	std::atomic<int> runs(0);
+	for (int i = 0; i < tasks; i++)
+	{
+		pool.enqueue(Task([&runs]() { runs++; }));
+	}
+	EXPECT_EQ(queuedInLanes(pool), (uint64_t)tasks);
+
+	// Stop while the worker is held, the worker may take a few tasks before it sees the stop
+	std::thread stopper([&]() { pool.stop(); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	open = true;
+	stopper.join();
+
+	// Whatever the worker left is back in the shared queue
+	EXPECT_EQ(queuedInLanes(pool) + (uint64_t)runs.load(), (uint64_t)tasks);
+	while (pool.runPendingTask())
+	{
+	}
+	EXPECT_EQ(runs.load(), tasks);
+
+	// Restarting builds fresh node queues
+	pool.start();
+	for (int i = 0; i < tasks; i++)
+	{
+		pool.enqueue(Task([&runs]() { runs++; }));
+	}
+	EXPECT_TRUE(eventually([&]() { return runs.load() == tasks * 2; }));
+}
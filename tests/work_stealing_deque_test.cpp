@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file work_stealing_deque_test.cpp
+ * @author Evan Stoddard
+ * @brief Work stealing deque tests
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "workstealingdeque.hpp"
+
+using ThreadUtils::WorkStealingDeque;
+
+/// @brief Thieves racing the owner
+static const int NumThieves = 3;
+
+/**
+ * @brief Counts how many times each item was taken, from any thread
+ *
+ */
+class TakenCounts
+{
+public:
+	explicit TakenCounts(size_t items) :
+		_counts(items)
+	{
+	}
+
+	void take(int item) { _counts[(size_t)item].fetch_add(1, std::memory_order_relaxed); }
+
+	/**
+	 * @brief Returns number of items not taken exactly once
+	 *
+	 */
+	size_t wrong() const
+	{
+		size_t wrong = 0;
+		for (auto &count : _counts)
+		{
+			if (count.load() != 1)
+			{
+				wrong++;
+			}
+		}
+		return wrong;
+	}
+
+private:
+	std::vector<std::atomic<int>> _counts;
+};
+
+TEST(WorkStealingDeque, OwnerPopsLifoThievesStealFifo)
+{
+	WorkStealingDeque<int> deque(4);
+	for (int i = 0; i < 3; i++)
+	{
+		deque.push(i);
+	}
+
+	int item = -1;
+	ASSERT_TRUE(deque.pop(item));
+	EXPECT_EQ(item, 2);
+	ASSERT_TRUE(deque.steal(item));
+	EXPECT_EQ(item, 0);
+	ASSERT_TRUE(deque.pop(item));
+	EXPECT_EQ(item, 1);
+
+	EXPECT_FALSE(deque.pop(item));
+	EXPECT_FALSE(deque.steal(item));
+	EXPECT_TRUE(deque.empty());
+}
+
+TEST(WorkStealingDeque, LastItemGoesToOwnerOrThiefOnce)
+{
+	const int rounds = 20000;
+	WorkStealingDeque<int> deque(2);
+	TakenCounts taken(rounds);
+	std::atomic<bool> done(false);
+
+	std::vector<std::thread> thieves;
+	for (int i = 0; i < NumThieves; i++)
+	{
+		thieves.emplace_back([&]() {
+			int item;
+			while (!done.load())
+			{
+				if (deque.steal(item))
+				{
+					taken.take(item);
+				}
+			}
+		});
+	}
+
+	// Deque only ever holds one item, so every pop races the thieves for it
+	for (int i = 0; i < rounds; i++)
+	{
+		deque.push(i);
+
+		int item;
+		if (deque.pop(item))
+		{
+			EXPECT_EQ(item, i);
+			taken.take(item);
+		}
+		EXPECT_TRUE(deque.empty());
+	}
+
+	done = true;
+	for (auto &thief : thieves)
+	{
+		thief.join();
+	}
+
+	EXPECT_EQ(taken.wrong(), 0u);
+}
+
+TEST(WorkStealingDeque, GrowsWhileThievesSteal)
+{
+	const int items = 200000;
+	WorkStealingDeque<int> deque(2);
+	TakenCounts taken(items);
+	std::atomic<bool> done(false);
+
+	std::vector<std::thread> thieves;
+	for (int i = 0; i < NumThieves; i++)
+	{
+		thieves.emplace_back([&]() {
+			int item;
+			while (!done.load() || !deque.empty())
+			{
+				if (deque.steal(item))
+				{
+					taken.take(item);
+				}
+			}
+		});
+	}
+
+	// Push in growing bursts so the array is replaced while thieves read it
+	int next = 0;
+	for (int burst = 1; next < items; burst *= 2)
+	{
+		for (int i = 0; i < burst && next < items; i++)
+		{
+			deque.push(next++);
+		}
+
+		int item;
+		if (deque.pop(item))
+		{
+			taken.take(item);
+		}
+	}
+
+	int item;
+	while (deque.pop(item))
+	{
+		taken.take(item);
+	}
+
+	done = true;
+	for (auto &thief : thieves)
+	{
+		thief.join();
+	}
+
+	EXPECT_EQ(taken.wrong(), 0u);
+}
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) Evan Stoddard.
+ */
+
+/**
+ * @file worker_hooks_test.cpp
+ * @author Evan Stoddard
+ * @brief Worker hook and worker context tests
+ */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <gtest/gtest.h>
+#include "threadpool.hpp"
+#include "testutils.hpp"
+
+using ThreadUtils::SchedulingMode;
+using ThreadUtils::Task;
+using ThreadUtils::Threadpool;
+using ThreadUtils::WorkerHooks;
+using namespace ThreadUtilsTest;
+
+/**
+ * @brief Records workers started and exited, checking each exit follows a start
+ *
+ */
+class HookLog
+{
+public:
+	HookLog() :
+		_starts(0),
+		_exits(0),
+		_unpaired(0)
+	{
+	}
+
+	WorkerHooks hooks()
+	{
+		WorkerHooks hooks;
+		hooks.onStart = [this](uint32_t index) {
+			std::unique_lock<std::mutex> l(_mutex);
+			_unpaired += _live.insert(index).second ? 0 : 1;
+			_starts++;
+		};
+		hooks.onExit = [this](uint32_t index) {
+			std::unique_lock<std::mutex> l(_mutex);
+			_unpaired += _live.erase(index) == 1 ? 0 : 1;
+			_exits++;
+		};
+		return hooks;
+	}
+
+	int starts() { std::unique_lock<std::mutex> l(_mutex); return _starts; }
+
+	int exits() { std::unique_lock<std::mutex> l(_mutex); return _exits; }
+
+	int unpaired() { std::unique_lock<std::mutex> l(_mutex); return _unpaired; }
+
+	std::set<uint32_t> live() { std::unique_lock<std::mutex> l(_mutex); return _live; }
+
+private:
+	std::mutex _mutex;
+	std::set<uint32_t> _live;
+	int _starts;
+	int _exits;
+	int _unpaired;
+};
+
+/**
+ * @brief Worker context counting its uses, checking they're all on its own thread
+ *
+ */
+struct CountingContext
+{
+	CountingContext(uint32_t index, std::atomic<int> &totalUses) :
+		index(index),
+		owner(std::this_thread::get_id()),
+		uses(0),
+		totalUses(totalUses)
+	{
+	}
+
+	~CountingContext() { totalUses += uses; }
+
+	uint32_t index;
+	std::thread::id owner;
+	int uses;
+	std::atomic<int> &totalUses;
+};
+
+/// @brief Context type no pool is given
+struct OtherContext
+{
+};
+
+/**
+ * @brief Worker hook and context tests, run against each scheduling mode
+ *
+ */
+class WorkerHooksTest : public ::testing::TestWithParam<SchedulingMode>
+{
+};
+
+TEST_P(WorkerHooksTest, StartAndExitPairUpAcrossResizeDrainAndDestruction)
+{
+	HookLog log;
+	{
+		Threadpool pool(2, GetParam());
+		pool.setWorkerHooks(log.hooks());
+		pool.start();
+		EXPECT_TRUE(eventually([&]() { return log.starts() == 2; }));
+
+		pool.resize(4);
+		EXPECT_TRUE(eventually([&]() { return log.starts() == 4; }));
+
+		// Surplus workers leave, running their onExit
+		pool.resize(1);
+		EXPECT_TRUE(eventually([&]() { return log.exits() == 3; }));
+		EXPECT_EQ(log.live(), std::set<uint32_t>({ 0 }));
+
+		pool.drain();
+		EXPECT_EQ(log.exits(), 4);
+		EXPECT_TRUE(log.live().empty());
+
+		pool.resize(3);
+		pool.start();
+		EXPECT_TRUE(eventually([&]() { return log.starts() == 7; }));
+	}
+
+	EXPECT_EQ(log.exits(), 7);
+	EXPECT_TRUE(log.live().empty());
+	EXPECT_EQ(log.unpaired(), 0);
+}
+
+TEST_P(WorkerHooksTest, EachWorkerBuildsOneContextReusedByItsTasks)
+{
+	const int tasks = 3000;
+	std::atomic<int> built(0);
+	std::atomic<int> totalUses(0);
+	std::atomic<int> missing(0);
+	std::atomic<int> runs(0);
+	std::atomic<int> foreign(0);
+	{
+		Threadpool pool(3, GetParam());
+		pool.setWorkerContext<CountingContext>([&](uint32_t index) {
+			built++;
+			return std::unique_ptr<CountingContext>(new CountingContext(index, totalUses));
+		});
+		pool.start();
+
+		for (int i = 0; i < tasks; i++)
+		{
+			pool.enqueue(Task([&]() {
+				CountingContext *context = Threadpool::tryWorkerContext<CountingContext>();
+				if (context == nullptr)
+				{
+					missing++;
+				}
+				else if (context->owner != std::this_thread::get_id())
+				{
+					foreign++;
+				}
+				else
+				{
+					context->uses++;
+				}
+				runs++;
+			}));
+		}
+		EXPECT_TRUE(eventually([&]() { return runs.load() == tasks; }));
+	}
+
+	// Contexts are destroyed as their workers leave
+	EXPECT_EQ(built.load(), 3);
+	EXPECT_EQ(missing.load(), 0);
+	EXPECT_EQ(foreign.load(), 0);
+	EXPECT_EQ(totalUses.load(), tasks);
+}
+
+TEST_P(WorkerHooksTest, EnqueueWithContextPassesRunningWorkersContext)
+{
+	const int tasks = 3000;
+	std::atomic<int> totalUses(0);
+	std::atomic<int> foreign(0);
+	std::atomic<int> runs(0);
+	{
+		Threadpool pool(3, GetParam());
+		pool.setWorkerContext<CountingContext>([&](uint32_t index) {
+			return std::unique_ptr<CountingContext>(new CountingContext(index, totalUses));
+		});
+		pool.start();
+
+		for (int i = 0; i < tasks; i++)
+		{
+			pool.enqueueWithContext<CountingContext>([&](CountingContext &context) {
+				if (context.owner != std::this_thread::get_id())
+				{
+					foreign++;
+				}
+				context.uses++;
+				runs++;
+			});
+		}
+		EXPECT_TRUE(eventually([&]() { return runs.load() == tasks; }));
+	}
+
+	EXPECT_EQ(foreign.load(), 0);
+	EXPECT_EQ(totalUses.load(), tasks);
+}
+
+TEST_P(WorkerHooksTest, EnqueueWithContextMakesContextForHelperWithoutOne)
+{
+	// Never started, so the task is left for this thread to run
+	std::atomic<int> totalUses(0);
+	Threadpool pool(1, GetParam());
+	pool.setWorkerContext<CountingContext>([&](uint32_t index) {
+		return std::unique_ptr<CountingContext>(new CountingContext(index, totalUses));
+	});
+
+	uint32_t index = 0;
+	pool.enqueueWithContext<CountingContext>([&](CountingContext &context) {
+		index = context.index;
+		context.uses++;
+	});
+	EXPECT_TRUE(pool.runPendingTask());
+	EXPECT_EQ(index, uint32_t(Threadpool::HelperContextIndex));
+	EXPECT_EQ(totalUses.load(), 1);
+}
+
+TEST_P(WorkerHooksTest, EnqueueWithContextThrowsWithoutContextOfType)
+{
+	std::atomic<int> totalUses(0);
+	Threadpool pool(1, GetParam());
+	EXPECT_THROW(pool.enqueueWithContext<CountingContext>([](CountingContext &) {}), std::logic_error);
+
+	// Checked as it's enqueued, nothing is queued to fail later
+	pool.setWorkerContext<CountingContext>([&](uint32_t index) {
+		return std::unique_ptr<CountingContext>(new CountingContext(index, totalUses));
+	});
+	EXPECT_THROW(pool.enqueueWithContext<OtherContext>([](OtherContext &) {}), std::logic_error);
+	EXPECT_FALSE(pool.runPendingTask());
+}
+
+TEST_P(WorkerHooksTest, TryWorkerContextIsNullOffWorkersAndForOtherTypes)
+{
+	std::atomic<int> totalUses(0);
+	Threadpool pool(1, GetParam());
+	pool.setWorkerContext<CountingContext>([&](uint32_t index) {
+		return std::unique_ptr<CountingContext>(new CountingContext(index, totalUses));
+	});
+	pool.start();
+
+	EXPECT_EQ(Threadpool::tryWorkerContext<CountingContext>(), nullptr);
+	EXPECT_THROW(Threadpool::workerContext<CountingContext>(), std::logic_error);
+
+	std::atomic<bool> own(false);
+	std::atomic<bool> other(true);
+	std::atomic<bool> done(false);
+	pool.enqueue(Task([&]() {
+		own = Threadpool::tryWorkerContext<CountingContext>() != nullptr;
+		other = Threadpool::tryWorkerContext<OtherContext>() != nullptr;
+		done = true;
+	}));
+	EXPECT_TRUE(eventually([&]() { return done.load(); }));
+
+	EXPECT_TRUE(own.load());
+	EXPECT_FALSE(other.load());
+}
+
+TEST_P(WorkerHooksTest, PoolWithoutContextGivesTasksNone)
+{
+	Threadpool pool(1, GetParam());
+	pool.start();
+
+	std::atomic<bool> found(true);
+	std::atomic<bool> done(false);
+	pool.enqueue(Task([&]() {
+		found = Threadpool::tryWorkerContext<CountingContext>() != nullptr;
+		done = true;
+	}));
+	EXPECT_TRUE(eventually([&]() { return done.load(); }));
+
+	EXPECT_FALSE(found.load());
+}
+
+INSTANTIATE_TEST_SUITE_P(
+	SchedulingModes,
+	WorkerHooksTest,
+	::testing::ValuesIn(AllSchedulingModes),
+	schedulingModeName
+);